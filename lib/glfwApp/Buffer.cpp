@@ -11,6 +11,7 @@ namespace glfw {
         mApp = app;
         mSize = 0;
         mBuffer = VK_NULL_HANDLE;
+        mMapped = nullptr;
     }
 
     VkDeviceSize Buffer::size() {
@@ -21,7 +22,11 @@ namespace glfw {
         return mBuffer;
     }
 
-    VkResult Buffer::create(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties) {
+    const Allocation &Buffer::getAllocation() const {
+        return mAllocation;
+    }
+
+    VkResult Buffer::create(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties, bool persistentMapped) {
         if (mBuffer != VK_NULL_HANDLE) {
             throw std::runtime_error("Buffer can only be created once.");
         }
@@ -44,92 +49,91 @@ namespace glfw {
             VkMemoryRequirements memoryRequirements;
             vkGetBufferMemoryRequirements(mApp->device, mBuffer, &memoryRequirements);
 
-            VkMemoryAllocateInfo memoryAllocateInfo;
-            memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            memoryAllocateInfo.pNext = nullptr;
-            memoryAllocateInfo.allocationSize = memoryRequirements.size;
-            memoryAllocateInfo.memoryTypeIndex = getMemoryType(memoryRequirements, memoryProperties);
-
-            VkMemoryAllocateFlagsInfo allocationFlags = {};
-            allocationFlags.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
-            allocationFlags.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+            VkMemoryAllocateFlags allocateFlags = 0;
             if ((usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) == VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
-                memoryAllocateInfo.pNext = &allocationFlags;
+                allocateFlags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
             }
 
-            result = vkAllocateMemory(mApp->device, &memoryAllocateInfo, nullptr, &mDeviceMemory);
+            result = mApp->memoryAllocator->allocate(memoryRequirements, memoryProperties, AllocationKind::Buffer,
+                                                     mAllocation, allocateFlags);
             if (VK_SUCCESS != result) {
                 vkDestroyBuffer(mApp->device, mBuffer, nullptr);
                 mBuffer = VK_NULL_HANDLE;
-                mDeviceMemory = VK_NULL_HANDLE;
             } else {
-                result = vkBindBufferMemory(mApp->device, mBuffer, mDeviceMemory, 0);
+                result = vkBindBufferMemory(mApp->device, mBuffer, mAllocation.memory, mAllocation.offset);
                 if (VK_SUCCESS != result) {
                     vkDestroyBuffer(mApp->device, mBuffer, nullptr);
-                    vkFreeMemory(mApp->device, mDeviceMemory, nullptr);
+                    mApp->memoryAllocator->free(mAllocation);
                     mBuffer = VK_NULL_HANDLE;
-                    mDeviceMemory = VK_NULL_HANDLE;
                 }
             }
         }
 
-        return result;
-    }
-
-    uint32_t Buffer::getMemoryType(VkMemoryRequirements &memoryRequiriments, VkMemoryPropertyFlags memoryProperties) {
-        VkPhysicalDeviceMemoryProperties properties;
-        vkGetPhysicalDeviceMemoryProperties(mApp->physicalDevice, &properties);
-
-        uint32_t result = -1;
-        for (uint32_t memoryTypeIndex = 0; memoryTypeIndex < VK_MAX_MEMORY_TYPES; ++memoryTypeIndex) {
-            if (memoryRequiriments.memoryTypeBits & (1 << memoryTypeIndex)) {
-                if ((properties.memoryTypes[memoryTypeIndex].propertyFlags & memoryProperties) == memoryProperties) {
-                    result = memoryTypeIndex;
-                    break;
-                }
+        if (VK_SUCCESS == result && persistentMapped) {
+            if (!(memoryProperties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+                throw std::runtime_error("Buffer: Only host visible buffers can be persistent mapped.");
+            mMapped = mApp->memoryAllocator->map(mAllocation);
+            if (!mMapped) {
+                this->destroy();
+                result = VK_ERROR_MEMORY_MAP_FAILED;
             }
         }
 
-        if (result == -1)
-            throw std::runtime_error("Buffer: Failed to find correct memory type");
-
         return result;
     }
 
     void Buffer::destroy() {
+        if (mMapped) {
+            mApp->memoryAllocator->unmap(mAllocation);
+            mMapped = nullptr;
+        }
         if (mBuffer) {
             vkDestroyBuffer(mApp->device, mBuffer, nullptr);
             mBuffer = VK_NULL_HANDLE;
         }
-        if (mDeviceMemory) {
-            vkFreeMemory(mApp->device, mDeviceMemory, nullptr);
-            mDeviceMemory = VK_NULL_HANDLE;
+        if (mAllocation.block) {
+            mApp->memoryAllocator->free(mAllocation);
         }
     }
 
     void *Buffer::map(VkDeviceSize size, VkDeviceSize offset) const {
-        if (!mDeviceMemory)
+        if (!mAllocation.block)
             throw std::runtime_error("Buffer: Device Memory is not created.");
 
-        void *mem = nullptr;
         if (offset >= mSize)
             return nullptr;
-        if (offset + size > mSize)
-            size = mSize - offset;
-        VkResult result = vkMapMemory(mApp->device, mDeviceMemory, offset, size, 0, &mem);
-        if (result != VK_SUCCESS)
-            mem = nullptr;
+        void *mem = mApp->memoryAllocator->map(mAllocation);
+        if (mem)
+            mem = static_cast<char*>(mem) + offset;
         return mem;
     }
 
     void Buffer::unmap() const {
-        vkUnmapMemory(mApp->device, mDeviceMemory);
+        mApp->memoryAllocator->unmap(mAllocation);
+    }
+
+    void *Buffer::getMappedData() const {
+        return mMapped;
+    }
+
+    VkResult Buffer::flush(VkDeviceSize size, VkDeviceSize offset) const {
+        return mApp->memoryAllocator->flush(mAllocation, offset, size);
+    }
+
+    VkResult Buffer::invalidate(VkDeviceSize size, VkDeviceSize offset) const {
+        return mApp->memoryAllocator->invalidate(mAllocation, offset, size);
     }
 
     VkResult Buffer::uploadData(const void *data, VkDeviceSize size, VkDeviceSize offset) const {
+        if (mMapped) {
+            // Persistent mapped: a plain copy, the flush is skipped on coherent memory.
+            std::memcpy(static_cast<char*>(mMapped) + offset, data, size);
+            return this->flush(size, offset);
+        }
         void *mem = this->map(size, offset);
         if (mem) {
             std::memcpy(mem, data, size);
+            this->flush(size, offset);
             this->unmap();
         } else
             return VK_ERROR_UNKNOWN;
@@ -6,6 +6,7 @@
 #define TRIANGLE_BUFFER_H
 
 #include <common.h>
+#include <MemoryAllocator.h>
 
 namespace glfw {
     class glfwApp;
@@ -18,7 +19,7 @@ namespace glfw {
 
         virtual ~Buffer();
 
-        VkResult create(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties);
+        VkResult create(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties, bool persistentMapped = false);
 
         void destroy();
 
@@ -28,19 +29,29 @@ namespace glfw {
 
         VkResult uploadData(const void *data, VkDeviceSize size, VkDeviceSize offset = 0) const;
 
+        // Only valid for persistent mapped buffers, stays the same for the lifetime of the buffer.
+        void *getMappedData() const;
+
+        // Make host writes visible to the device, no-op on coherent memory.
+        VkResult flush(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0) const;
+
+        // Make device writes visible to the host, no-op on coherent memory.
+        VkResult invalidate(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0) const;
+
         VkBuffer getBuffer();
 
         VkDeviceSize size();
 
+        const Allocation &getAllocation() const;
+
         void copyTo(Buffer &dst, VkCommandPool commandPool, VkQueue graphicsQueue, VkDeviceSize size);
 
     protected:
         glfw::glfwApp *mApp;
         VkBuffer mBuffer;
-        VkDeviceMemory mDeviceMemory;
+        Allocation mAllocation;
         VkDeviceSize mSize;
-
-        uint32_t getMemoryType(VkMemoryRequirements &memoryRequiriments, VkMemoryPropertyFlags memoryProperties);
+        void *mMapped;
     };
 }
 
@@ -0,0 +1,256 @@
+#include "DepthPyramid.h"
+#include "glfwApp.h"
+#include "MipGenerator.h"
+
+namespace glfw {
+    namespace {
+        const uint32_t kMaxLevels = 16;
+
+        // Matches the push_constant block of hiz.comp.
+        struct HiZParams {
+            int32_t srcSize[2];
+            int32_t dstSize[2];
+        };
+    }
+
+    DepthPyramid::DepthPyramid(glfwApp *app): mPyramid(app) {
+        mApp = app;
+        mExtent = {0, 0};
+        mDepthExtent = {0, 0};
+        mInitialized = false;
+        mDescriptorSetLayout = VK_NULL_HANDLE;
+        mDescriptorPool = VK_NULL_HANDLE;
+        mPipelineLayout = VK_NULL_HANDLE;
+        mPipeline = VK_NULL_HANDLE;
+        this->initComputePipeline();
+    }
+
+    DepthPyramid::~DepthPyramid() {
+        this->destroy();
+    }
+
+    void DepthPyramid::destroy() {
+        this->releaseLevels();
+        if (mPipeline) {
+            vkDestroyPipeline(mApp->device, mPipeline, nullptr);
+            mPipeline = VK_NULL_HANDLE;
+        }
+        if (mPipelineLayout) {
+            vkDestroyPipelineLayout(mApp->device, mPipelineLayout, nullptr);
+            mPipelineLayout = VK_NULL_HANDLE;
+        }
+        if (mDescriptorPool) {
+            vkDestroyDescriptorPool(mApp->device, mDescriptorPool, nullptr);
+            mDescriptorPool = VK_NULL_HANDLE;
+        }
+        if (mDescriptorSetLayout) {
+            vkDestroyDescriptorSetLayout(mApp->device, mDescriptorSetLayout, nullptr);
+            mDescriptorSetLayout = VK_NULL_HANDLE;
+        }
+    }
+
+    void DepthPyramid::releaseLevels() {
+        for (VkImageView view : mLevelViews)
+            vkDestroyImageView(mApp->device, view, nullptr);
+        mLevelViews.clear();
+        if (!mDescriptorSets.empty())
+            vkResetDescriptorPool(mApp->device, mDescriptorPool, 0);
+        mDescriptorSets.clear();
+        if (mPyramid.getImage())
+            mPyramid.destroy();
+        mInitialized = false;
+    }
+
+    void DepthPyramid::initComputePipeline() {
+        {
+            /**
+             * Descriptor Set Layout: level above (or the depth attachment) and the level written
+             */
+            VkDescriptorSetLayoutBinding bindings[2]{};
+            bindings[0].binding = 0;
+            bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            bindings[0].descriptorCount = 1;
+            bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            bindings[1].binding = 1;
+            bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            bindings[1].descriptorCount = 1;
+            bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            VkDescriptorSetLayoutCreateInfo layoutInfo{};
+            layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            layoutInfo.bindingCount = 2;
+            layoutInfo.pBindings = bindings;
+            if (vkCreateDescriptorSetLayout(mApp->device, &layoutInfo, nullptr, &mDescriptorSetLayout) != VK_SUCCESS)
+                throw std::runtime_error("DepthPyramid: failed to create descriptor set layout!");
+        }
+
+        {
+            /**
+             * Descriptor Pool, reset whenever the chain is recreated
+             */
+            VkDescriptorPoolSize poolSizes[2]{};
+            poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            poolSizes[0].descriptorCount = kMaxLevels;
+            poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            poolSizes[1].descriptorCount = kMaxLevels;
+            VkDescriptorPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.maxSets = kMaxLevels;
+            poolInfo.poolSizeCount = 2;
+            poolInfo.pPoolSizes = poolSizes;
+            if (vkCreateDescriptorPool(mApp->device, &poolInfo, nullptr, &mDescriptorPool) != VK_SUCCESS)
+                throw std::runtime_error("DepthPyramid: failed to create descriptor pool!");
+        }
+
+        {
+            /**
+             * Pipeline
+             */
+            VkPushConstantRange pushConstantRange{};
+            pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            pushConstantRange.offset = 0;
+            pushConstantRange.size = sizeof(HiZParams);
+            VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutInfo.setLayoutCount = 1;
+            pipelineLayoutInfo.pSetLayouts = &mDescriptorSetLayout;
+            pipelineLayoutInfo.pushConstantRangeCount = 1;
+            pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+            if (vkCreatePipelineLayout(mApp->device, &pipelineLayoutInfo, nullptr, &mPipelineLayout) != VK_SUCCESS)
+                throw std::runtime_error("DepthPyramid: failed to create pipeline layout!");
+
+            VkShaderModule shaderModule = createShaderModule(mApp->device, readFile("hiz.comp.spv"));
+            VkComputePipelineCreateInfo pipelineInfo{};
+            pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+            pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+            pipelineInfo.stage.module = shaderModule;
+            pipelineInfo.stage.pName = "main";
+            pipelineInfo.layout = mPipelineLayout;
+            VkResult result = vkCreateComputePipelines(mApp->device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mPipeline);
+            vkDestroyShaderModule(mApp->device, shaderModule, nullptr);
+            if (result != VK_SUCCESS)
+                throw std::runtime_error("DepthPyramid: failed to create compute pipeline!");
+        }
+    }
+
+    void DepthPyramid::create(VkImageView depthView, VkExtent2D extent) {
+        this->releaseLevels();
+        mDepthExtent = extent;
+        mExtent = {std::max(extent.width / 2, 1u), std::max(extent.height / 2, 1u)};
+        const uint32_t levels = std::min(MipGenerator::getMipLevels({mExtent.width, mExtent.height, 1}), kMaxLevels);
+
+        if (mPyramid.create(VK_IMAGE_TYPE_2D, VK_FORMAT_R32_SFLOAT, {mExtent.width, mExtent.height, 1}, VK_IMAGE_TILING_OPTIMAL,
+                            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                            levels) != VK_SUCCESS)
+            throw std::runtime_error("DepthPyramid: failed to create image!");
+        if (mPyramid.createImageView(VK_IMAGE_VIEW_TYPE_2D, VK_FORMAT_R32_SFLOAT, {VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1}) != VK_SUCCESS)
+            throw std::runtime_error("DepthPyramid: failed to create image view!");
+        if (mPyramid.createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST,
+                                   VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE) != VK_SUCCESS)
+            throw std::runtime_error("DepthPyramid: failed to create sampler!");
+
+        for (uint32_t level = 0; level < levels; level ++) {
+            VkImageViewCreateInfo viewInfo{};
+            viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewInfo.image = mPyramid.getImage();
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = VK_FORMAT_R32_SFLOAT;
+            viewInfo.components = {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A};
+            viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1};
+            VkImageView view;
+            if (vkCreateImageView(mApp->device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+                throw std::runtime_error("DepthPyramid: failed to create level view!");
+            mLevelViews.push_back(view);
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(levels, mDescriptorSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = mDescriptorPool;
+        allocInfo.descriptorSetCount = levels;
+        allocInfo.pSetLayouts = layouts.data();
+        mDescriptorSets.resize(levels);
+        if (vkAllocateDescriptorSets(mApp->device, &allocInfo, mDescriptorSets.data()) != VK_SUCCESS)
+            throw std::runtime_error("DepthPyramid: failed to allocate descriptor sets!");
+
+        std::vector<VkDescriptorImageInfo> imageInfos(levels * 2);
+        std::vector<VkWriteDescriptorSet> writes(levels * 2);
+        for (uint32_t i = 0; i < writes.size(); i ++) {
+            uint32_t level = i / 2;
+            uint32_t binding = i % 2;
+            if (binding == 0) {
+                imageInfos[i].sampler = mPyramid.getSampler();
+                imageInfos[i].imageView = level == 0 ? depthView : mLevelViews[level - 1];
+                imageInfos[i].imageLayout = level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+            } else {
+                imageInfos[i].imageView = mLevelViews[level];
+                imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            }
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = mDescriptorSets[level];
+            writes[i].dstBinding = binding;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            writes[i].pImageInfo = &imageInfos[i];
+        }
+        vkUpdateDescriptorSets(mApp->device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    }
+
+    void DepthPyramid::build(VkCommandBuffer cb) {
+        const uint32_t levels = static_cast<uint32_t>(mLevelViews.size());
+        if (!levels)
+            return;
+
+        /**
+         * The previous build was only read by compute, so apart from the first layout change an
+         * execution dependency is all the rewrite needs.
+         */
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = mPyramid.getImage();
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1};
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.oldLayout = mInitialized ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        vkCmdPipelineBarrier(cb, mInitialized ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        mInitialized = true;
+
+        vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, mPipeline);
+        HiZParams params{};
+        params.srcSize[0] = static_cast<int32_t>(mDepthExtent.width);
+        params.srcSize[1] = static_cast<int32_t>(mDepthExtent.height);
+        for (uint32_t level = 0; level < levels; level ++) {
+            params.dstSize[0] = static_cast<int32_t>(std::max(mExtent.width >> level, 1u));
+            params.dstSize[1] = static_cast<int32_t>(std::max(mExtent.height >> level, 1u));
+            vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, mPipelineLayout, 0, 1, &mDescriptorSets[level], 0, nullptr);
+            vkCmdPushConstants(cb, mPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(HiZParams), &params);
+            vkCmdDispatch(cb, (params.dstSize[0] + 7) / 8, (params.dstSize[1] + 7) / 8, 1);
+
+            barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1};
+            barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                                 0, nullptr, 0, nullptr, 1, &barrier);
+            params.srcSize[0] = params.dstSize[0];
+            params.srcSize[1] = params.dstSize[1];
+        }
+    }
+
+    VkImageView DepthPyramid::getImageView() const {
+        return mPyramid.getImageView();
+    }
+
+    VkSampler DepthPyramid::getSampler() const {
+        return mPyramid.getSampler();
+    }
+
+    VkExtent2D DepthPyramid::getExtent() const {
+        return mExtent;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef TRIANGLE_DEPTHPYRAMID_H
+#define TRIANGLE_DEPTHPYRAMID_H
+
+#include "common.h"
+#include <Texture.h>
+
+namespace glfw {
+    class glfwApp;
+
+    /**
+     * Hierarchical Z of a depth attachment: an R32_SFLOAT chain whose level 0 is half the attachment
+     * and every texel holds the farthest depth of the texels it covers, reduced level by level by
+     * hiz.comp. A sphere whose nearest depth is behind the four texels around its screen rectangle,
+     * at the level where that rectangle is one texel wide, is hidden (see cull.comp).
+     *
+     * The chain stays in GENERAL; sample it with getSampler() (nearest, clamped) through getImageView().
+     */
+    class DepthPyramid {
+    public:
+        DepthPyramid(glfwApp* app);
+        virtual ~DepthPyramid();
+        DepthPyramid(const DepthPyramid&) = delete;
+
+        /**
+         * (Re)creates the chain for a depth attachment of extent, read through depthView (depth aspect
+         * only) in DEPTH_STENCIL_READ_ONLY_OPTIMAL. Call with the swap chain, nothing may be in flight.
+         */
+        void create(VkImageView depthView, VkExtent2D extent);
+
+        // Outside a render pass, once the depth writes are visible to compute. Leaves the chain readable by compute.
+        void build(VkCommandBuffer cb);
+
+        VkImageView getImageView() const;
+        VkSampler getSampler() const;
+        // Of level 0.
+        VkExtent2D getExtent() const;
+
+        void destroy();
+    private:
+        void initComputePipeline();
+        void releaseLevels();
+
+        glfwApp* mApp;
+        Texture mPyramid;
+        VkExtent2D mExtent;
+        // Of the attachment level 0 is reduced from.
+        VkExtent2D mDepthExtent;
+        // Per level storage view and the set reading the level (or depth) above it.
+        std::vector<VkImageView> mLevelViews;
+        std::vector<VkDescriptorSet> mDescriptorSets;
+        // The first build moves the chain out of UNDEFINED.
+        bool mInitialized;
+
+        VkDescriptorSetLayout mDescriptorSetLayout;
+        VkDescriptorPool mDescriptorPool;
+        VkPipelineLayout mPipelineLayout;
+        VkPipeline mPipeline;
+    };
+}
+
+
+#endif //TRIANGLE_DEPTHPYRAMID_H
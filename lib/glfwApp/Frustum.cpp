@@ -0,0 +1,175 @@
+#include "Frustum.h"
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define TRIANGLE_FRUSTUM_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace glfw {
+    bool Bounds::isEmpty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    void Bounds::merge(const Bounds &other) {
+        if (other.isEmpty())
+            return;
+        if (this->isEmpty()) {
+            *this = other;
+            return;
+        }
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+
+        /**
+         * Smallest sphere around both spheres.
+         */
+        glm::vec3 delta = other.center - center;
+        float distance = glm::length(delta);
+        if (distance + other.radius <= radius)
+            return;
+        if (distance + radius <= other.radius) {
+            center = other.center;
+            radius = other.radius;
+            return;
+        }
+        float merged = (distance + radius + other.radius) * 0.5f;
+        center += delta * ((merged - radius) / distance);
+        radius = merged;
+    }
+
+    Bounds Bounds::transform(const glm::mat4 &transform) const {
+        if (this->isEmpty())
+            return *this;
+        Bounds result;
+        glm::vec3 boxCenter = (min + max) * 0.5f;
+        glm::vec3 extent = (max - min) * 0.5f;
+        glm::vec3 newCenter = glm::vec3(transform * glm::vec4(boxCenter, 1.0f));
+        glm::vec3 newExtent(0.0f);
+        for (int row = 0; row < 3; row ++)
+            for (int column = 0; column < 3; column ++)
+                newExtent[row] += std::fabs(transform[column][row]) * extent[column];
+        result.min = newCenter - newExtent;
+        result.max = newCenter + newExtent;
+
+        float scale = 0.0f;
+        for (int column = 0; column < 3; column ++)
+            scale = std::max(scale, glm::length(glm::vec3(transform[column])));
+        result.center = glm::vec3(transform * glm::vec4(center, 1.0f));
+        result.radius = radius * scale;
+        return result;
+    }
+
+    LodView::LodView(const glm::vec3 &eye, float fovY, uint32_t viewportHeight): eye(eye) {
+        scale = static_cast<float>(viewportHeight) / (2.0f * std::tan(glm::radians(fovY) * 0.5f));
+    }
+
+    float LodView::getPixelsPerUnit(const Bounds &bounds) const {
+        float distance = glm::length(bounds.center - eye) - bounds.radius;
+        if (bounds.isEmpty() || !(distance > 0.0f))
+            return std::numeric_limits<float>::infinity();
+        return scale / distance;
+    }
+
+    Frustum::Frustum(const glm::mat4 &viewProjection): mViewProjection(viewProjection) {
+        auto row = [&viewProjection](int r) {
+            return glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+        };
+        const glm::vec4 planes[6] = {
+                row(3) + row(0), row(3) - row(0), // left, right
+                row(3) + row(1), row(3) - row(1), // bottom, top (either way round after a Y flip)
+                row(2), row(3) - row(2)           // near (0..1 depth), far
+        };
+        for (int i = 0; i < kPlaneCount; i ++) {
+            // Padding: every point is infinitely far inside, so no radius or box ever reaches it.
+            glm::vec4 plane(0.0f, 0.0f, 0.0f, std::numeric_limits<float>::max());
+            if (i < 6) {
+                float length = glm::length(glm::vec3(planes[i]));
+                plane = length > 0.0f ? planes[i] / length : planes[i];
+            }
+            mX[i] = plane.x;
+            mY[i] = plane.y;
+            mZ[i] = plane.z;
+            mW[i] = plane.w;
+        }
+    }
+
+    Frustum Frustum::transformed(const glm::mat4 &transform) const {
+        return Frustum(mViewProjection * transform);
+    }
+
+    void Frustum::getPlanes(glm::vec4 planes[6]) const {
+        for (int i = 0; i < 6; i ++)
+            planes[i] = glm::vec4(mX[i], mY[i], mZ[i], mW[i]);
+    }
+
+    Frustum::Result Frustum::test(const Bounds &bounds) const {
+        if (bounds.isEmpty())
+            return Outside;
+        Result sphere = this->testSphere(bounds.center, bounds.radius);
+        if (sphere != Intersecting)
+            return sphere;
+        return this->testBox((bounds.min + bounds.max) * 0.5f, (bounds.max - bounds.min) * 0.5f);
+    }
+
+#ifdef TRIANGLE_FRUSTUM_SSE
+    Frustum::Result Frustum::testSphere(const glm::vec3 &center, float radius) const {
+        const __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+        const __m128 r = _mm_set1_ps(radius), negR = _mm_set1_ps(-radius);
+        __m128 outside = _mm_setzero_ps(), intersecting = _mm_setzero_ps();
+        for (int i = 0; i < kPlaneCount; i += 4) {
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(mX + i), cx), _mm_mul_ps(_mm_load_ps(mY + i), cy)),
+                                  _mm_add_ps(_mm_mul_ps(_mm_load_ps(mZ + i), cz), _mm_load_ps(mW + i)));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(d, negR));
+            intersecting = _mm_or_ps(intersecting, _mm_cmplt_ps(d, r));
+        }
+        if (_mm_movemask_ps(outside))
+            return Outside;
+        return _mm_movemask_ps(intersecting) ? Intersecting : Inside;
+    }
+
+    Frustum::Result Frustum::testBox(const glm::vec3 &center, const glm::vec3 &extent) const {
+        const __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+        const __m128 ex = _mm_set1_ps(extent.x), ey = _mm_set1_ps(extent.y), ez = _mm_set1_ps(extent.z);
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        __m128 outside = _mm_setzero_ps(), intersecting = _mm_setzero_ps();
+        for (int i = 0; i < kPlaneCount; i += 4) {
+            __m128 x = _mm_load_ps(mX + i), y = _mm_load_ps(mY + i), z = _mm_load_ps(mZ + i);
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, cx), _mm_mul_ps(y, cy)), _mm_add_ps(_mm_mul_ps(z, cz), _mm_load_ps(mW + i)));
+            // Projected half size of the box onto the normal.
+            __m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, x), ex), _mm_mul_ps(_mm_andnot_ps(sign, y), ey)),
+                                  _mm_mul_ps(_mm_andnot_ps(sign, z), ez));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, e), _mm_setzero_ps()));
+            intersecting = _mm_or_ps(intersecting, _mm_cmplt_ps(_mm_sub_ps(d, e), _mm_setzero_ps()));
+        }
+        if (_mm_movemask_ps(outside))
+            return Outside;
+        return _mm_movemask_ps(intersecting) ? Intersecting : Inside;
+    }
+#else
+    Frustum::Result Frustum::testSphere(const glm::vec3 &center, float radius) const {
+        Result result = Inside;
+        for (int i = 0; i < kPlaneCount; i ++) {
+            float d = mX[i] * center.x + mY[i] * center.y + mZ[i] * center.z + mW[i];
+            if (d < -radius)
+                return Outside;
+            if (d < radius)
+                result = Intersecting;
+        }
+        return result;
+    }
+
+    Frustum::Result Frustum::testBox(const glm::vec3 &center, const glm::vec3 &extent) const {
+        Result result = Inside;
+        for (int i = 0; i < kPlaneCount; i ++) {
+            float d = mX[i] * center.x + mY[i] * center.y + mZ[i] * center.z + mW[i];
+            float e = std::fabs(mX[i]) * extent.x + std::fabs(mY[i]) * extent.y + std::fabs(mZ[i]) * extent.z;
+            if (d + e < 0.0f)
+                return Outside;
+            if (d - e < 0.0f)
+                result = Intersecting;
+        }
+        return result;
+    }
+#endif
+}
@@ -0,0 +1,84 @@
+#ifndef TRIANGLE_FRUSTUM_H
+#define TRIANGLE_FRUSTUM_H
+
+#include "common.h"
+
+#include <glm/glm.hpp>
+
+namespace glfw {
+    /**
+     * Axis aligned box and a sphere around the same geometry, in the space of whatever it bounds.
+     * Empty (min > max) until something is added.
+     */
+    struct Bounds {
+        glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+        glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+        glm::vec3 center = glm::vec3(0.0f);
+        float radius = 0.0f;
+
+        bool isEmpty() const;
+        // Grows the box and refits the sphere around it.
+        void merge(const Bounds& other);
+        // Box around the transformed box (Arvo), sphere scaled by the largest axis scale of transform.
+        Bounds transform(const glm::mat4& transform) const;
+    };
+
+    /**
+     * What level of detail selection needs of the camera: an error of e world units at distance d from
+     * eye covers e * scale / d pixels of the viewport.
+     */
+    struct LodView {
+        glm::vec3 eye;
+        // viewportHeight / (2 tan(fovY / 2)).
+        float scale;
+
+        // fovY in degrees, as Camera::GetFovY.
+        LodView(const glm::vec3& eye, float fovY, uint32_t viewportHeight);
+        // Pixels a world unit covers on the near side of bounds (world space). Infinite once eye is inside.
+        float getPixelsPerUnit(const Bounds& bounds) const;
+    };
+
+    // Submesh draws considered and skipped in one frame, summed over every InstanceGroup.
+    struct CullingStats {
+        uint32_t tested = 0;
+        uint32_t culled = 0;
+    };
+
+    /**
+     * The six planes of a view projection matrix (Gribb/Hartmann, 0..1 depth as Camera builds it),
+     * normals pointing inwards. Bounds are tested against four planes at once with SSE where the
+     * compiler has it, against one at a time otherwise.
+     */
+    class Frustum {
+    public:
+        enum Result {
+            Outside,
+            Intersecting,
+            Inside
+        };
+
+        explicit Frustum(const glm::mat4& viewProjection);
+
+        // Sphere first, the box only when the sphere straddles a plane.
+        Result test(const Bounds& bounds) const;
+
+        // The frustum seen from the space transform maps into world, e.g. a group transform.
+        Frustum transformed(const glm::mat4& transform) const;
+        // Normalized, xyz inwards, for shaders that test on their own (see cull.comp).
+        void getPlanes(glm::vec4 planes[6]) const;
+    private:
+        Result testSphere(const glm::vec3& center, float radius) const;
+        Result testBox(const glm::vec3& center, const glm::vec3& extent) const;
+
+        // Planes as structure of arrays, padded to 8 with planes everything is far in front of.
+        static const int kPlaneCount = 8;
+        alignas(16) float mX[kPlaneCount];
+        alignas(16) float mY[kPlaneCount];
+        alignas(16) float mZ[kPlaneCount];
+        alignas(16) float mW[kPlaneCount];
+        glm::mat4 mViewProjection;
+    };
+}
+
+
+#endif //TRIANGLE_FRUSTUM_H
@@ -0,0 +1,282 @@
+#include "GeometryPool.h"
+#include <Buffer.h>
+#include <glfwApp.h>
+#include <UploadContext.h>
+
+namespace glfw {
+    GeometryPool::GeometryPool(glfwApp *app, uint32_t vertexSize, uint32_t vertexCapacity, uint32_t indexCapacity,
+                               uint32_t shortIndexCapacity) {
+        mApp = app;
+        mGeneration = 0;
+        // Storage too, object.mesh fetches vertices itself.
+        this->createHeap(mVertices, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, vertexSize, vertexCapacity);
+        this->createHeap(mIndices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, sizeof(uint32_t), indexCapacity);
+        this->createHeap(mShortIndices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, sizeof(uint16_t), shortIndexCapacity);
+    }
+
+    GeometryPool::~GeometryPool() {
+        this->destroy();
+    }
+
+    void GeometryPool::destroy() {
+        delete mVertices.buffer;
+        mVertices.buffer = nullptr;
+        delete mIndices.buffer;
+        mIndices.buffer = nullptr;
+        delete mShortIndices.buffer;
+        mShortIndices.buffer = nullptr;
+        mEntries.clear();
+        mFreeHandles.clear();
+    }
+
+    void GeometryPool::createHeap(Heap &heap, VkBufferUsageFlags usage, uint32_t elementSize, uint32_t capacity) {
+        heap.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        heap.elementSize = elementSize;
+        heap.capacity = capacity;
+        heap.used = 0;
+        heap.buffer = new Buffer(mApp);
+        if (heap.buffer->create(VkDeviceSize(elementSize) * capacity, heap.usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != VK_SUCCESS)
+            throw std::runtime_error("GeometryPool: failed to create pool buffer!");
+        heap.freeRanges.clear();
+        heap.freeRanges[0] = capacity;
+    }
+
+    bool GeometryPool::allocateRange(Heap &heap, uint32_t count, uint32_t &offset) {
+        auto best = heap.freeRanges.end();
+        for (auto it = heap.freeRanges.begin(); it != heap.freeRanges.end(); it ++) {
+            if (it->second >= count && (best == heap.freeRanges.end() || it->second < best->second))
+                best = it;
+        }
+        if (best == heap.freeRanges.end())
+            return false;
+        offset = best->first;
+        uint32_t remaining = best->second - count;
+        heap.freeRanges.erase(best);
+        if (remaining)
+            heap.freeRanges[offset + count] = remaining;
+        heap.used += count;
+        return true;
+    }
+
+    void GeometryPool::freeRange(Heap &heap, uint32_t offset, uint32_t count) {
+        heap.used -= count;
+        auto next = heap.freeRanges.lower_bound(offset);
+        if (next != heap.freeRanges.end() && offset + count == next->first) {
+            count += next->second;
+            next = heap.freeRanges.erase(next);
+        }
+        if (next != heap.freeRanges.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == offset) {
+                prev->second += count;
+                return;
+            }
+        }
+        heap.freeRanges[offset] = count;
+    }
+
+    uint32_t GeometryPool::allocateOrGrow(Heap &heap, uint32_t count) {
+        uint32_t offset;
+        if (this->allocateRange(heap, count, offset))
+            return offset;
+        this->grow(heap, heap.capacity + count);
+        if (!this->allocateRange(heap, count, offset))
+            throw std::runtime_error("GeometryPool: out of space after growing!");
+        return offset;
+    }
+
+    GeometryPool::Heap &GeometryPool::getIndexHeap(VkIndexType indexType) {
+        return indexType == VK_INDEX_TYPE_UINT16 ? mShortIndices : mIndices;
+    }
+
+    uint32_t GeometryPool::allocate(const void *vertices, uint32_t vertexCount, const void *indices, uint32_t indexCount,
+                                    VkIndexType indexType) {
+        uint32_t handle = this->reserve(vertexCount, indexCount, indexType);
+        this->uploadVertices(handle, vertices, 0, vertexCount);
+        this->uploadIndices(handle, indices, 0, indexCount);
+        return handle;
+    }
+
+    uint32_t GeometryPool::reserve(uint32_t vertexCount, uint32_t indexCount, VkIndexType indexType) {
+        Entry entry{};
+        entry.vertexCount = vertexCount;
+        entry.indexCount = indexCount;
+        entry.indexType = indexType;
+        entry.live = true;
+        Heap& indexHeap = this->getIndexHeap(indexType);
+        if (vertexCount)
+            entry.firstVertex = this->allocateOrGrow(mVertices, vertexCount);
+        if (indexCount)
+            entry.firstIndex = this->allocateOrGrow(indexHeap, indexCount);
+
+        uint32_t handle;
+        if (!mFreeHandles.empty()) {
+            handle = mFreeHandles.back();
+            mFreeHandles.pop_back();
+            mEntries[handle] = entry;
+        } else {
+            handle = static_cast<uint32_t>(mEntries.size());
+            mEntries.push_back(entry);
+        }
+        return handle;
+    }
+
+    void GeometryPool::uploadVertices(uint32_t handle, const void *vertices, uint32_t first, uint32_t count) {
+        const Entry& entry = mEntries[handle];
+        assert(first + count <= entry.vertexCount);
+        if (count)
+            mApp->uploadContext->uploadBuffer(*mVertices.buffer, vertices, VkDeviceSize(count) * mVertices.elementSize,
+                                              VkDeviceSize(entry.firstVertex + first) * mVertices.elementSize);
+    }
+
+    void GeometryPool::uploadIndices(uint32_t handle, const void *indices, uint32_t first, uint32_t count) {
+        const Entry& entry = mEntries[handle];
+        assert(first + count <= entry.indexCount);
+        Heap& indexHeap = this->getIndexHeap(entry.indexType);
+        if (count)
+            mApp->uploadContext->uploadBuffer(*indexHeap.buffer, indices, VkDeviceSize(count) * indexHeap.elementSize,
+                                              VkDeviceSize(entry.firstIndex + first) * indexHeap.elementSize);
+    }
+
+    void GeometryPool::free(uint32_t handle) {
+        Entry& entry = mEntries[handle];
+        if (!entry.live)
+            return;
+        if (entry.vertexCount)
+            this->freeRange(mVertices, entry.firstVertex, entry.vertexCount);
+        if (entry.indexCount)
+            this->freeRange(this->getIndexHeap(entry.indexType), entry.firstIndex, entry.indexCount);
+        entry = Entry{};
+        mFreeHandles.push_back(handle);
+    }
+
+    int32_t GeometryPool::getVertexOffset(uint32_t handle) const {
+        return static_cast<int32_t>(mEntries[handle].firstVertex);
+    }
+
+    uint32_t GeometryPool::getFirstIndex(uint32_t handle) const {
+        return mEntries[handle].firstIndex;
+    }
+
+    VkIndexType GeometryPool::getIndexType(uint32_t handle) const {
+        return mEntries[handle].indexType;
+    }
+
+    void GeometryPool::bind(VkCommandBuffer cb) {
+        VkBuffer vertexBuffers[] = {mVertices.buffer->getBuffer()};
+        VkDeviceSize offsets[] = {0};
+        vkCmdBindVertexBuffers(cb, 0, 1, vertexBuffers, offsets);
+        this->bindIndices(cb, VK_INDEX_TYPE_UINT32);
+    }
+
+    Buffer *GeometryPool::getVertexBuffer() const {
+        return mVertices.buffer;
+    }
+
+    void GeometryPool::bindIndices(VkCommandBuffer cb, VkIndexType indexType) {
+        vkCmdBindIndexBuffer(cb, this->getIndexHeap(indexType).buffer->getBuffer(), 0, indexType);
+    }
+
+    float GeometryPool::getFragmentation() const {
+        /**
+         * Free space before the last live range of a pool is a hole, the tail is not.
+         */
+        auto holes = [](const Heap& heap) {
+            uint32_t free = heap.capacity - heap.used;
+            auto last = heap.freeRanges.rbegin();
+            if (last != heap.freeRanges.rend() && last->first + last->second == heap.capacity)
+                free -= last->second;
+            return std::make_pair(free, free + heap.used);
+        };
+        uint64_t span = 0, wasted = 0;
+        for (const Heap* heap : {&mVertices, &mIndices, &mShortIndices}) {
+            auto heapHoles = holes(*heap);
+            wasted += uint64_t(heapHoles.first) * heap->elementSize;
+            span += uint64_t(heapHoles.second) * heap->elementSize;
+        }
+        if (span == 0)
+            return 0.0f;
+        return static_cast<float>(double(wasted) / double(span));
+    }
+
+    void GeometryPool::grow(Heap &heap, uint32_t minCapacity) {
+        uint32_t oldCapacity = heap.capacity;
+        uint32_t newCapacity = std::max(oldCapacity * 2, minCapacity);
+        fprintf(stdout, "GeometryPool: growing pool to %u elements\n", newCapacity);
+
+        Buffer* oldBuffer = heap.buffer;
+        heap.buffer = new Buffer(mApp);
+        if (heap.buffer->create(VkDeviceSize(heap.elementSize) * newCapacity, heap.usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != VK_SUCCESS)
+            throw std::runtime_error("GeometryPool: failed to grow pool buffer!");
+        heap.capacity = newCapacity;
+        // The new tail joins the free list, freeRange takes it off `used` so count it in first.
+        heap.used += newCapacity - oldCapacity;
+        this->freeRange(heap, oldCapacity, newCapacity - oldCapacity);
+
+        VkCommandBuffer cb = mApp->uploadContext->getCommandBuffer();
+        VkBufferCopy region{};
+        region.size = VkDeviceSize(heap.elementSize) * oldCapacity;
+        vkCmdCopyBuffer(cb, oldBuffer->getBuffer(), heap.buffer->getBuffer(), 1, &region);
+        std::vector<Buffer*> oldBuffers = {oldBuffer};
+        this->finishMove(cb, oldBuffers);
+    }
+
+    void GeometryPool::compact() {
+        /**
+         * Live ranges are packed in handle order into fresh buffers of the same size.
+         */
+        Heap* heaps[] = {&mVertices, &mIndices, &mShortIndices};
+        std::vector<Buffer*> oldBuffers;
+        for (Heap* heap : heaps) {
+            oldBuffers.push_back(heap->buffer);
+            this->createHeap(*heap, heap->usage, heap->elementSize, heap->capacity);
+        }
+
+        std::vector<VkBufferCopy> regions[3];
+        auto move = [this](Heap& heap, std::vector<VkBufferCopy>& heapRegions, uint32_t& first, uint32_t count) {
+            if (!count)
+                return;
+            uint32_t offset = 0;
+            this->allocateRange(heap, count, offset);
+            heapRegions.push_back({VkDeviceSize(first) * heap.elementSize, VkDeviceSize(offset) * heap.elementSize,
+                                   VkDeviceSize(count) * heap.elementSize});
+            first = offset;
+        };
+        for (auto& entry : mEntries) {
+            if (!entry.live)
+                continue;
+            move(mVertices, regions[0], entry.firstVertex, entry.vertexCount);
+            int indexHeap = entry.indexType == VK_INDEX_TYPE_UINT16 ? 2 : 1;
+            move(*heaps[indexHeap], regions[indexHeap], entry.firstIndex, entry.indexCount);
+        }
+
+        VkCommandBuffer cb = mApp->uploadContext->getCommandBuffer();
+        for (int i = 0; i < 3; i ++) {
+            if (!regions[i].empty())
+                vkCmdCopyBuffer(cb, oldBuffers[i]->getBuffer(), heaps[i]->buffer->getBuffer(),
+                                static_cast<uint32_t>(regions[i].size()), regions[i].data());
+        }
+        this->finishMove(cb, oldBuffers);
+    }
+
+    void GeometryPool::finishMove(VkCommandBuffer cb, std::vector<Buffer*>& oldBuffers) {
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+        /**
+         * Frames already submitted still read the old buffers, and the graphics queue reaches the copy
+         * only after them, so once it is done nothing references them anymore.
+         */
+        mApp->uploadContext->finish();
+        for (auto& buffer : oldBuffers)
+            delete buffer;
+        mGeneration ++;
+    }
+
+    uint64_t GeometryPool::getGeneration() const {
+        return mGeneration;
+    }
+}
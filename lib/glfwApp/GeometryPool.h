@@ -0,0 +1,102 @@
+#ifndef TRIANGLE_GEOMETRYPOOL_H
+#define TRIANGLE_GEOMETRYPOOL_H
+
+#include "common.h"
+#include <map>
+
+namespace glfw {
+    class glfwApp;
+    class Buffer;
+
+    /**
+     * Vertices and indices of every loaded mesh, sub-allocated out of one device local vertex buffer
+     * and one index buffer per index type, so a frame binds vertices once and draws with
+     * firstIndex/vertexOffset, rebinding only the index buffer when the index type changes.
+     *
+     * Ranges are handed out best fit from a free list. Growing a pool and compact() move data on the
+     * GPU and wait for it, so size the pools for the scene rather than relying on growth. Offsets of a
+     * handle are only stable until the next growth or compaction, look them up when recording; whoever
+     * keeps them longer compares getGeneration() against the one they were read at.
+     *
+     * free() makes the ranges reusable at once, only call it when no frame in flight draws the handle
+     * any more (MeshManager::unloadMesh defers it).
+     */
+    class GeometryPool {
+    public:
+        GeometryPool(glfwApp* app, uint32_t vertexSize, uint32_t vertexCapacity, uint32_t indexCapacity,
+                     uint32_t shortIndexCapacity);
+        virtual ~GeometryPool();
+        GeometryPool(const GeometryPool&) = delete;
+
+        /**
+         * Reserves and uploads a mesh worth of geometry, indices are relative to its first vertex and
+         * are uint16_t for VK_INDEX_TYPE_UINT16, uint32_t otherwise.
+         */
+        uint32_t allocate(const void* vertices, uint32_t vertexCount, const void* indices, uint32_t indexCount,
+                          VkIndexType indexType = VK_INDEX_TYPE_UINT32);
+        // Reserves without uploading, for loaders that fill a mesh in pieces through uploadVertices/uploadIndices.
+        uint32_t reserve(uint32_t vertexCount, uint32_t indexCount, VkIndexType indexType = VK_INDEX_TYPE_UINT32);
+        // count elements at element first of the handle's range.
+        void uploadVertices(uint32_t handle, const void* vertices, uint32_t first, uint32_t count);
+        void uploadIndices(uint32_t handle, const void* indices, uint32_t first, uint32_t count);
+        void free(uint32_t handle);
+
+        int32_t getVertexOffset(uint32_t handle) const;
+        // In elements of the index buffer of the handle's index type.
+        uint32_t getFirstIndex(uint32_t handle) const;
+        VkIndexType getIndexType(uint32_t handle) const;
+
+        // Binds the vertex buffer and the 32 bit index buffer.
+        void bind(VkCommandBuffer cb);
+        void bindIndices(VkCommandBuffer cb, VkIndexType indexType);
+        // For shaders that fetch vertices themselves. Replaced when the pool grows.
+        Buffer* getVertexBuffer() const;
+
+        // Share of the used span of all pools lying in holes left by freed meshes.
+        float getFragmentation() const;
+        // Moves every live range to the front of its pool.
+        void compact();
+        // Bumped whenever offsets move: by growth and compact().
+        uint64_t getGeneration() const;
+
+        void destroy();
+    private:
+        struct Heap {
+            Buffer* buffer = nullptr;
+            VkBufferUsageFlags usage = 0;
+            uint32_t elementSize = 0;
+            uint32_t capacity = 0;
+            uint32_t used = 0;
+            // offset -> count, neighbouring free ranges are always merged.
+            std::map<uint32_t, uint32_t> freeRanges;
+        };
+
+        struct Entry {
+            uint32_t firstVertex = 0;
+            uint32_t vertexCount = 0;
+            uint32_t firstIndex = 0;
+            uint32_t indexCount = 0;
+            VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+            bool live = false;
+        };
+
+        void createHeap(Heap& heap, VkBufferUsageFlags usage, uint32_t elementSize, uint32_t capacity);
+        bool allocateRange(Heap& heap, uint32_t count, uint32_t& offset);
+        void freeRange(Heap& heap, uint32_t offset, uint32_t count);
+        uint32_t allocateOrGrow(Heap& heap, uint32_t count);
+        void grow(Heap& heap, uint32_t minCapacity);
+        Heap& getIndexHeap(VkIndexType indexType);
+        void finishMove(VkCommandBuffer cb, std::vector<Buffer*>& oldBuffers);
+
+        glfwApp* mApp;
+        Heap mVertices;
+        Heap mIndices;
+        Heap mShortIndices;
+        std::vector<Entry> mEntries;
+        std::vector<uint32_t> mFreeHandles;
+        uint64_t mGeneration;
+    };
+}
+
+
+#endif //TRIANGLE_GEOMETRYPOOL_H
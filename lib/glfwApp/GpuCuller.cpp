@@ -0,0 +1,752 @@
+#include "GpuCuller.h"
+#include "glfwApp.h"
+#include "Buffer.h"
+#include "Mesh.h"
+#include "SubMesh.h"
+#include "Instance.h"
+#include "InstanceGroup.h"
+#include "MeshManager.h"
+#include "GeometryPool.h"
+#include "UploadContext.h"
+#include "DepthPyramid.h"
+#include "MipGenerator.h"
+
+namespace glfw {
+    namespace {
+        const uint32_t kBindingCount = 16;
+        const uint32_t kParamsBinding = 6;
+        const uint32_t kPyramidBinding = 7;
+        const uint32_t kVisibilityBinding = 8;
+        const uint32_t kWorkBinding = 10;
+        const uint32_t kDispatchBinding = 11;
+        const uint32_t kLodBinding = 15;
+        const uint32_t kWorkgroupSize = 64;
+        const uint32_t kMinInstances = 64;
+        // Buckets of commands and counts: per phase (frustum only or previously visible, occluded), per index type.
+        const uint32_t kBucketCount = 4;
+
+        // The phase of cull.comp.
+        const uint32_t kPhaseFrustum = 0;
+        const uint32_t kPhaseVisible = 1;
+        const uint32_t kPhaseOccluded = 2;
+
+        // Matches the push_constant block of cull.comp.
+        struct CullConstants {
+            uint32_t instanceCount;
+            // Command slots per bucket.
+            uint32_t maxDraws;
+            uint32_t phase;
+            // Work slots per bucket.
+            uint32_t maxWork;
+            // Emit mesh task commands rather than work for cluster.comp.
+            uint32_t meshShading;
+        };
+
+        // Matches the push_constant block of cluster.comp.
+        struct ClusterConstants {
+            uint32_t bucket;
+            uint32_t maxWork;
+            uint32_t maxDraws;
+        };
+
+        // Matches the Params uniform block of cull.comp (std140).
+        struct CullParams {
+            glm::vec4 planes[6];
+            glm::mat4 viewProjection;
+            // Level 0 of the depth pyramid.
+            glm::vec2 pyramidSize;
+            uint32_t pyramidLevels;
+            uint32_t padding;
+            // Eye, and LodView::scale in w.
+            glm::vec4 cameraPosition;
+        };
+
+        // Graphics stages that read what GpuCuller writes: the task and mesh stages too with mesh shaders.
+        VkPipelineStageFlags getGraphicsStages(bool meshShading) {
+            VkPipelineStageFlags stages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+#ifdef VK_EXT_mesh_shader
+            if (meshShading)
+                stages |= VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT | VK_PIPELINE_STAGE_MESH_SHADER_BIT_EXT;
+#endif
+            return stages;
+        }
+
+        // Doubles capacity, at least kMinInstances, until count fits.
+        uint32_t growCapacity(uint32_t capacity, uint32_t count) {
+            capacity = std::max(capacity, kMinInstances);
+            while (capacity < count)
+                capacity *= 2;
+            return capacity;
+        }
+    }
+
+    GpuCuller::GpuCuller(glfwApp *app, int frameCount) {
+        mApp = app;
+        mSubmeshes = nullptr;
+        mMatIDs = nullptr;
+        mMeshlets = nullptr;
+        mMeshletVertices = nullptr;
+        mMeshletTriangles = nullptr;
+        mGeneration = 0;
+        mMeshShading = app->meshShaderSupported;
+        mVisibility = nullptr;
+        mVisibilityCapacity = 0;
+        mVisibilityCleared = false;
+        mLods = nullptr;
+        mLodCapacity = 0;
+        mDepthPyramid = nullptr;
+        mDescriptorSetLayout = VK_NULL_HANDLE;
+        mDescriptorPool = VK_NULL_HANDLE;
+        mPipelineLayout = VK_NULL_HANDLE;
+        mPipeline = VK_NULL_HANDLE;
+        mClusterPipelineLayout = VK_NULL_HANDLE;
+        mClusterPipeline = VK_NULL_HANDLE;
+        mFrames.resize(frameCount);
+        this->initPipeline();
+    }
+
+    GpuCuller::~GpuCuller() {
+        this->destroy();
+    }
+
+    void GpuCuller::destroy() {
+        // Descriptor sets go back with their pool.
+        for (auto& frame : mFrames) {
+            delete frame.instances;
+            delete frame.draws;
+            delete frame.commands;
+            delete frame.counts;
+            delete frame.params;
+            delete frame.work;
+            delete frame.dispatches;
+        }
+        mFrames.clear();
+        delete mSubmeshes;
+        mSubmeshes = nullptr;
+        delete mMatIDs;
+        mMatIDs = nullptr;
+        delete mMeshlets;
+        mMeshlets = nullptr;
+        delete mMeshletVertices;
+        mMeshletVertices = nullptr;
+        delete mMeshletTriangles;
+        mMeshletTriangles = nullptr;
+        delete mVisibility;
+        mVisibility = nullptr;
+        mVisibilityCapacity = 0;
+        delete mLods;
+        mLods = nullptr;
+        mLodCapacity = 0;
+        mMeshes.clear();
+        mFirstSubmesh.clear();
+        mMaxMeshlets.clear();
+        if (mClusterPipeline) {
+            vkDestroyPipeline(mApp->device, mClusterPipeline, nullptr);
+            mClusterPipeline = VK_NULL_HANDLE;
+        }
+        if (mClusterPipelineLayout) {
+            vkDestroyPipelineLayout(mApp->device, mClusterPipelineLayout, nullptr);
+            mClusterPipelineLayout = VK_NULL_HANDLE;
+        }
+        if (mPipeline) {
+            vkDestroyPipeline(mApp->device, mPipeline, nullptr);
+            mPipeline = VK_NULL_HANDLE;
+        }
+        if (mPipelineLayout) {
+            vkDestroyPipelineLayout(mApp->device, mPipelineLayout, nullptr);
+            mPipelineLayout = VK_NULL_HANDLE;
+        }
+        if (mDescriptorPool) {
+            vkDestroyDescriptorPool(mApp->device, mDescriptorPool, nullptr);
+            mDescriptorPool = VK_NULL_HANDLE;
+        }
+        if (mDescriptorSetLayout) {
+            vkDestroyDescriptorSetLayout(mApp->device, mDescriptorSetLayout, nullptr);
+            mDescriptorSetLayout = VK_NULL_HANDLE;
+        }
+    }
+
+    void GpuCuller::initPipeline() {
+        {
+            /**
+             * Descriptor Set Layout: see the class comment. Everything but the depth pyramid, visibility,
+             * the levels of detail and the cluster.comp work is shared with the graphics pipelines that draw what was culled.
+             */
+            VkShaderStageFlags graphicsStages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+#ifdef VK_EXT_mesh_shader
+            if (mMeshShading)
+                graphicsStages |= VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+#endif
+            VkDescriptorSetLayoutBinding bindings[kBindingCount]{};
+            for (uint32_t i = 0; i < kBindingCount; i ++) {
+                const bool computeOnly = i == kPyramidBinding || i == kVisibilityBinding || i == kWorkBinding || i == kDispatchBinding ||
+                                         i == kLodBinding;
+                bindings[i].binding = i;
+                bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[i].descriptorCount = 1;
+                bindings[i].stageFlags = computeOnly ? VK_SHADER_STAGE_COMPUTE_BIT : graphicsStages | VK_SHADER_STAGE_COMPUTE_BIT;
+            }
+            bindings[kParamsBinding].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            bindings[kPyramidBinding].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            VkDescriptorSetLayoutCreateInfo layoutInfo{};
+            layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            layoutInfo.bindingCount = kBindingCount;
+            layoutInfo.pBindings = bindings;
+            if (vkCreateDescriptorSetLayout(mApp->device, &layoutInfo, nullptr, &mDescriptorSetLayout) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create descriptor set layout!");
+        }
+
+        {
+            /**
+             * Descriptor Pool, one set per frame in flight
+             */
+            const uint32_t frameCount = static_cast<uint32_t>(mFrames.size());
+            VkDescriptorPoolSize poolSizes[3]{};
+            poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            poolSizes[0].descriptorCount = frameCount * (kBindingCount - 2);
+            poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            poolSizes[1].descriptorCount = frameCount;
+            poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            poolSizes[2].descriptorCount = frameCount;
+            VkDescriptorPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.maxSets = frameCount;
+            poolInfo.poolSizeCount = 3;
+            poolInfo.pPoolSizes = poolSizes;
+            if (vkCreateDescriptorPool(mApp->device, &poolInfo, nullptr, &mDescriptorPool) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create descriptor pool!");
+
+            std::vector<VkDescriptorSetLayout> layouts(frameCount, mDescriptorSetLayout);
+            std::vector<VkDescriptorSet> sets(frameCount);
+            VkDescriptorSetAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.descriptorPool = mDescriptorPool;
+            allocInfo.descriptorSetCount = frameCount;
+            allocInfo.pSetLayouts = layouts.data();
+            if (vkAllocateDescriptorSets(mApp->device, &allocInfo, sets.data()) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to allocate descriptor sets!");
+            for (uint32_t i = 0; i < frameCount; i ++)
+                mFrames[i].descriptorSet = sets[i];
+        }
+
+        {
+            /**
+             * Pipeline
+             */
+            VkPushConstantRange pushConstantRange{};
+            pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            pushConstantRange.offset = 0;
+            pushConstantRange.size = sizeof(CullConstants);
+            VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutInfo.setLayoutCount = 1;
+            pipelineLayoutInfo.pSetLayouts = &mDescriptorSetLayout;
+            pipelineLayoutInfo.pushConstantRangeCount = 1;
+            pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+            if (vkCreatePipelineLayout(mApp->device, &pipelineLayoutInfo, nullptr, &mPipelineLayout) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create pipeline layout!");
+
+            pushConstantRange.size = sizeof(ClusterConstants);
+            if (vkCreatePipelineLayout(mApp->device, &pipelineLayoutInfo, nullptr, &mClusterPipelineLayout) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create pipeline layout!");
+
+            const char* shaders[2] = {"cull.comp.spv", "cluster.comp.spv"};
+            VkPipelineLayout layouts[2] = {mPipelineLayout, mClusterPipelineLayout};
+            VkPipeline* pipelines[2] = {&mPipeline, &mClusterPipeline};
+            for (int i = 0; i < 2; i ++) {
+                VkShaderModule shaderModule = createShaderModule(mApp->device, readFile(shaders[i]));
+                VkComputePipelineCreateInfo pipelineInfo{};
+                pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+                pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+                pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+                pipelineInfo.stage.module = shaderModule;
+                pipelineInfo.stage.pName = "main";
+                pipelineInfo.layout = layouts[i];
+                VkResult result = vkCreateComputePipelines(mApp->device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, pipelines[i]);
+                vkDestroyShaderModule(mApp->device, shaderModule, nullptr);
+                if (result != VK_SUCCESS)
+                    throw std::runtime_error("GpuCuller: failed to create compute pipeline!");
+            }
+        }
+    }
+
+    void GpuCuller::build(const std::vector<Mesh *> &meshes) {
+        static_assert(sizeof(GpuInstance) == 112 && sizeof(GpuSubmesh) == 96 && sizeof(Meshlet) == 48,
+                      "GpuCuller: std430 strides of cull.comp");
+        static_assert(Mesh::kMaxLods <= 4, "GpuCuller: GpuInstance::lodErrors holds 4 levels");
+        if (mSubmeshes)
+            vkDeviceWaitIdle(mApp->device);
+        delete mSubmeshes;
+        delete mMatIDs;
+        delete mMeshlets;
+        delete mMeshletVertices;
+        delete mMeshletTriangles;
+        mMeshletVertices = nullptr;
+        mMeshletTriangles = nullptr;
+        mMeshes = meshes;
+        mFirstSubmesh.clear();
+        mMaxMeshlets.clear();
+
+        /**
+         * Submeshes of every mesh back to back with their absolute draw ranges, level by level, and the
+         * material ids, meshlets and meshlet lists of every mesh gathered into one buffer each, rebased onto it.
+         */
+        std::vector<GpuSubmesh> submeshes;
+        VkDeviceSize matIDSize = 0, meshletSize = 0, meshletVertexSize = 0, meshletTriangleSize = 0;
+        for (auto& mesh : mMeshes) {
+            mFirstSubmesh.push_back(static_cast<uint32_t>(submeshes.size()));
+            const uint32_t faceBase = static_cast<uint32_t>(matIDSize / sizeof(uint32_t));
+            const uint32_t meshletBase = static_cast<uint32_t>(meshletSize / sizeof(Meshlet));
+            const uint32_t vertexBase = static_cast<uint32_t>(meshletVertexSize / sizeof(uint32_t));
+            const uint32_t triangleBase = static_cast<uint32_t>(meshletTriangleSize / sizeof(uint32_t));
+            uint32_t maxMeshlets = 0;
+            for (uint32_t level = 0; level < mesh->getLodCount(); level ++) {
+                uint32_t levelMeshlets = 0;
+                for (auto& submesh : mesh->submesh) {
+                    // A level only uses vertices of level 0, the sphere holds for all.
+                    SubMesh::Lod lod = submesh->getLod(level);
+                    GpuSubmesh gpu{};
+                    gpu.sphere = submesh->bounds.isEmpty() ? glm::vec4(0.0f, 0.0f, 0.0f, -1.0f)
+                                                           : glm::vec4(submesh->bounds.center, submesh->bounds.radius);
+                    gpu.positionScale = glm::vec4(mesh->getPositionScale(), 0.0f);
+                    gpu.positionOffset = glm::vec4(mesh->getPositionOffset(), 0.0f);
+                    gpu.indexCount = lod.indexCount;
+                    gpu.firstIndex = mesh->getFirstIndex() + lod.firstIndex;
+                    gpu.vertexOffset = mesh->getVertexOffset() + submesh->vertexOffset;
+                    gpu.materialID = submesh->materialID;
+                    gpu.firstFace = faceBase + lod.firstFace;
+                    gpu.indexType = mesh->getIndexType() == VK_INDEX_TYPE_UINT16 ? 1 : 0;
+                    gpu.firstMeshlet = meshletBase + lod.firstMeshlet;
+                    gpu.meshletCount = lod.meshletCount;
+                    gpu.meshletVertexBase = vertexBase;
+                    gpu.meshletTriangleBase = triangleBase + lod.firstIndex / 3;
+                    gpu.meshVertexOffset = mesh->getVertexOffset();
+                    submeshes.push_back(gpu);
+                    levelMeshlets += lod.meshletCount;
+                }
+                maxMeshlets = std::max(maxMeshlets, levelMeshlets);
+            }
+            mMaxMeshlets.push_back(maxMeshlets);
+            matIDSize += mesh->matIDBuffer->size();
+            meshletSize += mesh->meshletBuffer->size();
+            if (mMeshShading) {
+                meshletVertexSize += mesh->meshletVertexBuffer->size();
+                meshletTriangleSize += mesh->meshletTriangleBuffer->size();
+            }
+        }
+
+        mSubmeshes = new Buffer(mApp);
+        VkDeviceSize submeshSize = sizeof(GpuSubmesh) * std::max<size_t>(submeshes.size(), 1);
+        if (mSubmeshes->create(submeshSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != VK_SUCCESS)
+            throw std::runtime_error("GpuCuller: failed to create submesh buffer!");
+        mMatIDs = new Buffer(mApp);
+        if (mMatIDs->create(std::max<VkDeviceSize>(matIDSize, sizeof(uint32_t)),
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != VK_SUCCESS)
+            throw std::runtime_error("GpuCuller: failed to create material id buffer!");
+        mMeshlets = new Buffer(mApp);
+        if (mMeshlets->create(std::max<VkDeviceSize>(meshletSize, sizeof(Meshlet)),
+                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != VK_SUCCESS)
+            throw std::runtime_error("GpuCuller: failed to create meshlet buffer!");
+        if (mMeshShading) {
+            mMeshletVertices = new Buffer(mApp);
+            if (mMeshletVertices->create(std::max<VkDeviceSize>(meshletVertexSize, sizeof(uint32_t)),
+                                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create meshlet vertex buffer!");
+            mMeshletTriangles = new Buffer(mApp);
+            if (mMeshletTriangles->create(std::max<VkDeviceSize>(meshletTriangleSize, sizeof(uint32_t)),
+                                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create meshlet triangle buffer!");
+        }
+
+        if (!submeshes.empty())
+            mApp->uploadContext->uploadBuffer(*mSubmeshes, submeshes.data(), sizeof(GpuSubmesh) * submeshes.size());
+        VkCommandBuffer cb = mApp->uploadContext->getCommandBuffer();
+        VkDeviceSize offset = 0, meshletOffset = 0, vertexOffset = 0, triangleOffset = 0;
+        for (auto& mesh : mMeshes) {
+            VkBufferCopy region{};
+            region.dstOffset = offset;
+            region.size = mesh->matIDBuffer->size();
+            vkCmdCopyBuffer(cb, mesh->matIDBuffer->getBuffer(), mMatIDs->getBuffer(), 1, &region);
+            offset += region.size;
+            region.dstOffset = meshletOffset;
+            region.size = mesh->meshletBuffer->size();
+            vkCmdCopyBuffer(cb, mesh->meshletBuffer->getBuffer(), mMeshlets->getBuffer(), 1, &region);
+            meshletOffset += region.size;
+            if (mMeshShading) {
+                region.dstOffset = vertexOffset;
+                region.size = mesh->meshletVertexBuffer->size();
+                vkCmdCopyBuffer(cb, mesh->meshletVertexBuffer->getBuffer(), mMeshletVertices->getBuffer(), 1, &region);
+                vertexOffset += region.size;
+                region.dstOffset = triangleOffset;
+                region.size = mesh->meshletTriangleBuffer->size();
+                vkCmdCopyBuffer(cb, mesh->meshletTriangleBuffer->getBuffer(), mMeshletTriangles->getBuffer(), 1, &region);
+                triangleOffset += region.size;
+            }
+        }
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | getGraphicsStages(mMeshShading),
+                             0, 1, &barrier, 0, nullptr, 0, nullptr);
+        mApp->uploadContext->finish();
+        mGeneration = mApp->meshManager->getGeometryPool()->getGeneration();
+
+        // Instance records point into the old submesh table.
+        for (auto& frame : mFrames) {
+            frame.version = 0;
+            if (frame.instances)
+                this->writeDescriptorSet(frame);
+        }
+        fprintf(stdout, "GpuCuller: %zu submeshes, %zu meshlets of %zu meshes\n", submeshes.size(), static_cast<size_t>(meshletSize / sizeof(Meshlet)), mMeshes.size());
+    }
+
+    void GpuCuller::createFrameBuffers(Frame &frame, uint32_t instanceCapacity, uint32_t workCapacity, uint32_t drawCapacity) {
+        if (instanceCapacity != frame.instanceCapacity) {
+            delete frame.instances;
+            frame.instances = new Buffer(mApp);
+            if (frame.instances->create(sizeof(GpuInstance) * instanceCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, true) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create instance buffer!");
+            frame.instanceCapacity = instanceCapacity;
+            frame.version = 0;
+        }
+        if (workCapacity != frame.workCapacity) {
+            delete frame.work;
+            frame.work = new Buffer(mApp);
+            if (frame.work->create(sizeof(uint32_t) * 2 * kBucketCount * workCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create work buffer!");
+            frame.workCapacity = workCapacity;
+        }
+        if (drawCapacity != frame.drawCapacity) {
+            delete frame.draws;
+            delete frame.commands;
+            frame.draws = new Buffer(mApp);
+            if (frame.draws->create(sizeof(uint32_t) * 4 * kBucketCount * drawCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create draw buffer!");
+            frame.commands = new Buffer(mApp);
+            if (frame.commands->create(sizeof(VkDrawIndexedIndirectCommand) * kBucketCount * drawCapacity,
+                                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create command buffer!");
+            frame.drawCapacity = drawCapacity;
+        }
+        if (!frame.counts) {
+            // Host visible so getStats() can read the visible counts back.
+            frame.counts = new Buffer(mApp);
+            if (frame.counts->create(sizeof(uint32_t) * kBucketCount,
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, true) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create count buffer!");
+            std::memset(frame.counts->getMappedData(), 0, sizeof(uint32_t) * kBucketCount);
+            frame.params = new Buffer(mApp);
+            if (frame.params->create(sizeof(CullParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, true) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create parameter buffer!");
+            frame.dispatches = new Buffer(mApp);
+            if (frame.dispatches->create(sizeof(VkDispatchIndirectCommand) * kBucketCount,
+                                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create dispatch buffer!");
+        }
+        this->writeDescriptorSet(frame);
+    }
+
+    void GpuCuller::writeDescriptorSet(Frame &frame) {
+        Buffer* vertices = mMeshShading ? mApp->meshManager->getGeometryPool()->getVertexBuffer() : nullptr;
+        Buffer* buffers[kBindingCount] = {frame.instances, mMatIDs, mSubmeshes, frame.draws, frame.commands, frame.counts,
+                                          frame.params, nullptr, mVisibility, mMeshlets, frame.work, frame.dispatches,
+                                          mMeshletVertices, mMeshletTriangles, vertices, mLods};
+        VkDescriptorBufferInfo bufferInfos[kBindingCount]{};
+        VkDescriptorImageInfo imageInfo{};
+        VkWriteDescriptorSet writes[kBindingCount]{};
+        uint32_t writeCount = 0;
+        for (uint32_t i = 0; i < kBindingCount; i ++) {
+            VkWriteDescriptorSet& write = writes[writeCount];
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstSet = frame.descriptorSet;
+            write.dstBinding = i;
+            write.descriptorCount = 1;
+            if (i == kPyramidBinding) {
+                // Left unwritten until there is a pyramid, cull.comp only samples it in the occlusion phase.
+                if (!mDepthPyramid)
+                    continue;
+                imageInfo.sampler = mDepthPyramid->getSampler();
+                imageInfo.imageView = mDepthPyramid->getImageView();
+                imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+                write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                write.pImageInfo = &imageInfo;
+            } else {
+                // The object.mesh inputs, only there with mesh shaders.
+                if (!buffers[i])
+                    continue;
+                bufferInfos[i].buffer = buffers[i]->getBuffer();
+                bufferInfos[i].offset = 0;
+                bufferInfos[i].range = VK_WHOLE_SIZE;
+                write.descriptorType = i == kParamsBinding ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                write.pBufferInfo = &bufferInfos[i];
+            }
+            writeCount ++;
+        }
+        vkUpdateDescriptorSets(mApp->device, writeCount, writes, 0, nullptr);
+    }
+
+    void GpuCuller::setDepthPyramid(const DepthPyramid *pyramid) {
+        mDepthPyramid = pyramid;
+        for (auto& frame : mFrames)
+            if (frame.counts)
+                this->writeDescriptorSet(frame);
+    }
+
+    bool GpuCuller::isStale() const {
+        return mSubmeshes && mGeneration != mApp->meshManager->getGeometryPool()->getGeneration();
+    }
+
+    void GpuCuller::update(int frame_index) {
+        if (!mSubmeshes)
+            return;
+        if (this->isStale())
+            throw std::runtime_error("GpuCuller: geometry moved since build, rebuild first!");
+        Frame& frame = mFrames[frame_index];
+
+        /**
+         * O(meshes): versions only grow, so their sum changes whenever any group does.
+         */
+        uint64_t version = 0;
+        uint32_t instanceCount = 0, drawCount = 0, clusterCount = 0;
+        for (size_t m = 0; m < mMeshes.size(); m ++) {
+            InstanceGroup* group = mMeshes[m]->getInstanceGroup();
+            version += group->getVersion();
+            instanceCount += group->getInstanceCount();
+            drawCount += group->getInstanceCount() * static_cast<uint32_t>(mMeshes[m]->submesh.size());
+            clusterCount += group->getInstanceCount() * mMaxMeshlets[m];
+        }
+        frame.instanceCount = instanceCount;
+        frame.drawCount = drawCount;
+        frame.clusterCount = clusterCount;
+
+        uint32_t instanceCapacity = growCapacity(frame.instanceCapacity, instanceCount);
+        uint32_t workCapacity = growCapacity(frame.workCapacity, drawCount);
+        // A command per meshlet out of cluster.comp, per submesh draw with mesh shaders.
+        uint32_t drawCapacity = growCapacity(frame.drawCapacity, mMeshShading ? drawCount : clusterCount);
+        if (workCapacity > mVisibilityCapacity) {
+            /**
+             * Shared by the frames in flight, so growing it has to wait for them. Rare, it only grows.
+             */
+            if (mVisibility)
+                vkDeviceWaitIdle(mApp->device);
+            delete mVisibility;
+            mVisibility = new Buffer(mApp);
+            if (mVisibility->create(sizeof(uint32_t) * workCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create visibility buffer!");
+            mVisibilityCapacity = workCapacity;
+            mVisibilityCleared = false;
+            for (auto& other : mFrames)
+                if (other.counts && &other != &frame)
+                    this->writeDescriptorSet(other);
+        }
+        if (instanceCapacity > mLodCapacity) {
+            // Like visibility. Levels start at 0, the hysteresis settles them within a frame or two.
+            if (mLods)
+                vkDeviceWaitIdle(mApp->device);
+            delete mLods;
+            mLods = new Buffer(mApp);
+            if (mLods->create(sizeof(uint32_t) * instanceCapacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != VK_SUCCESS)
+                throw std::runtime_error("GpuCuller: failed to create level of detail buffer!");
+            mLodCapacity = instanceCapacity;
+            mVisibilityCleared = false;
+            for (auto& other : mFrames)
+                if (other.counts && &other != &frame)
+                    this->writeDescriptorSet(other);
+        }
+        if (instanceCapacity != frame.instanceCapacity || workCapacity != frame.workCapacity || drawCapacity != frame.drawCapacity)
+            this->createFrameBuffers(frame, instanceCapacity, workCapacity, drawCapacity);
+        if (frame.version == version)
+            return;
+
+        auto* instances = static_cast<GpuInstance*>(frame.instances->getMappedData());
+        uint32_t index = 0, firstDraw = 0;
+        for (size_t m = 0; m < mMeshes.size(); m ++) {
+            Mesh* mesh = mMeshes[m];
+            InstanceGroup* group = mesh->getInstanceGroup();
+            const glm::mat4& transform = group->getTransform();
+            for (uint32_t i = 0; i < group->getInstanceCount(); i ++, index ++) {
+                Instance* instance = group->getInstance(i);
+                Bounds bounds = instance->mWorldBounds.transform(transform);
+                GpuInstance& gpu = instances[index];
+                gpu.model = transform * instance->mModel;
+                gpu.sphere = bounds.isEmpty() ? glm::vec4(0.0f, 0.0f, 0.0f, -1.0f) : glm::vec4(bounds.center, bounds.radius);
+                gpu.firstSubmesh = mFirstSubmesh[m];
+                gpu.submeshCount = static_cast<uint32_t>(mesh->submesh.size());
+                gpu.firstDraw = firstDraw;
+                gpu.lodCount = mesh->getLodCount();
+                for (uint32_t level = 0; level < gpu.lodCount; level ++)
+                    gpu.lodErrors[level] = mesh->getLodError(level);
+                firstDraw += gpu.submeshCount;
+            }
+        }
+        if (instanceCount)
+            frame.instances->flush(sizeof(GpuInstance) * instanceCount);
+        frame.version = version;
+    }
+
+    void GpuCuller::cull(VkCommandBuffer cb, int frame_index, const Frustum &frustum, const glm::mat4 &viewProjection,
+                         const LodView &view) {
+        Frame& frame = mFrames[frame_index];
+        if (!frame.counts)
+            return;
+
+        CullParams params{};
+        frustum.getPlanes(params.planes);
+        params.viewProjection = viewProjection;
+        if (mDepthPyramid) {
+            VkExtent2D extent = mDepthPyramid->getExtent();
+            params.pyramidSize = glm::vec2(extent.width, extent.height);
+            params.pyramidLevels = MipGenerator::getMipLevels({extent.width, extent.height, 1});
+        }
+        params.cameraPosition = glm::vec4(view.eye, view.scale);
+        std::memcpy(frame.params->getMappedData(), &params, sizeof(CullParams));
+        frame.params->flush(sizeof(CullParams));
+
+        vkCmdFillBuffer(cb, frame.counts->getBuffer(), 0, VK_WHOLE_SIZE, 0);
+        if (!mMeshShading) {
+            // cull.comp counts the workgroups of cluster.comp in x.
+            VkDispatchIndirectCommand dispatches[kBucketCount];
+            for (auto& dispatch : dispatches)
+                dispatch = {0, 1, 1};
+            vkCmdUpdateBuffer(cb, frame.dispatches->getBuffer(), 0, sizeof(dispatches), dispatches);
+        }
+        if (!mVisibilityCleared) {
+            // Nothing counts as visible yet, the occlusion phase draws it all, and everything starts at level 0.
+            vkCmdFillBuffer(cb, mVisibility->getBuffer(), 0, VK_WHOLE_SIZE, 0);
+            vkCmdFillBuffer(cb, mLods->getBuffer(), 0, VK_WHOLE_SIZE, 0);
+            mVisibilityCleared = true;
+        }
+        // Also orders the visibility written by the previous frame before it is read.
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        this->dispatch(cb, frame, mDepthPyramid ? kPhaseVisible : kPhaseFrustum);
+    }
+
+    void GpuCuller::cullOccluded(VkCommandBuffer cb, int frame_index) {
+        Frame& frame = mFrames[frame_index];
+        if (!frame.counts || !mDepthPyramid)
+            return;
+        this->dispatch(cb, frame, kPhaseOccluded);
+    }
+
+    void GpuCuller::dispatch(VkCommandBuffer cb, Frame &frame, uint32_t phase) {
+        if (frame.instanceCount) {
+            CullConstants constants{};
+            constants.instanceCount = frame.instanceCount;
+            constants.maxDraws = frame.drawCapacity;
+            constants.phase = phase;
+            constants.maxWork = frame.workCapacity;
+            constants.meshShading = mMeshShading ? 1 : 0;
+            vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, mPipeline);
+            vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, mPipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+            vkCmdPushConstants(cb, mPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullConstants), &constants);
+            vkCmdDispatch(cb, (frame.instanceCount + kWorkgroupSize - 1) / kWorkgroupSize, 1, 1);
+        }
+
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        if (!mMeshShading) {
+            /**
+             * One cluster.comp workgroup per submesh draw cull.comp let through, for the two buckets of
+             * the phase; an empty one dispatches nothing.
+             */
+            barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0, 1, &barrier, 0, nullptr, 0, nullptr);
+            vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, mClusterPipeline);
+            vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, mClusterPipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+            const uint32_t first = phase == kPhaseOccluded ? 2 : 0;
+            for (uint32_t bucket = first; bucket < first + 2; bucket ++) {
+                ClusterConstants constants{};
+                constants.bucket = bucket;
+                constants.maxWork = frame.workCapacity;
+                constants.maxDraws = frame.drawCapacity;
+                vkCmdPushConstants(cb, mClusterPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ClusterConstants), &constants);
+                vkCmdDispatchIndirect(cb, frame.dispatches->getBuffer(), sizeof(VkDispatchIndirectCommand) * bucket);
+            }
+        }
+
+        barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | getGraphicsStages(mMeshShading) | VK_PIPELINE_STAGE_HOST_BIT,
+                             0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    void GpuCuller::draw(VkCommandBuffer cb, VkPipelineLayout layout, uint32_t set, int frame_index, bool occluded) {
+        Frame& frame = mFrames[frame_index];
+        if (!frame.instanceCount)
+            return;
+
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, set, 1, &frame.descriptorSet, 0, nullptr);
+        const VkDeviceSize stride = sizeof(VkDrawIndexedIndirectCommand);
+        const uint32_t bucket = occluded ? 2 : 0;
+        if (mMeshShading) {
+#ifdef VK_EXT_mesh_shader
+            /**
+             * cull.comp writes the task counts into the same 20 byte slots, the rest of each is unused.
+             * object.mesh reads the triangles itself, the buckets only differ in where they start.
+             */
+            MeshDrawConstants constants{};
+            constants.compactVertices = mApp->meshManager->getVertexFormat() == VertexFormat::Compact ? 1 : 0;
+            for (uint32_t b = bucket; b < bucket + 2; b ++) {
+                constants.firstDraw = frame.drawCapacity * b;
+                vkCmdPushConstants(cb, layout, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT, 0, sizeof(MeshDrawConstants), &constants);
+                mApp->cmdDrawMeshTasksIndirectCount(cb, frame.commands->getBuffer(), stride * frame.drawCapacity * b,
+                                                    frame.counts->getBuffer(), sizeof(uint32_t) * b, frame.drawCapacity,
+                                                    static_cast<uint32_t>(stride));
+            }
+#endif
+            return;
+        }
+
+        /**
+         * The pool keeps 32 and 16 bit indices in separate buffers, so one draw per index type: of the
+         * two buckets of a phase the first is 32 bit, the second 16 bit, each with its own count.
+         */
+        GeometryPool* pool = mApp->meshManager->getGeometryPool();
+        pool->bind(cb);
+        vkCmdDrawIndexedIndirectCount(cb, frame.commands->getBuffer(), stride * frame.drawCapacity * bucket,
+                                      frame.counts->getBuffer(), sizeof(uint32_t) * bucket, frame.drawCapacity, stride);
+        pool->bindIndices(cb, VK_INDEX_TYPE_UINT16);
+        vkCmdDrawIndexedIndirectCount(cb, frame.commands->getBuffer(), stride * frame.drawCapacity * (bucket + 1),
+                                      frame.counts->getBuffer(), sizeof(uint32_t) * (bucket + 1), frame.drawCapacity, stride);
+    }
+
+    CullingStats GpuCuller::getStats(int frame_index) const {
+        const Frame& frame = mFrames[frame_index];
+        CullingStats stats;
+        if (!frame.counts)
+            return stats;
+        frame.counts->invalidate();
+        const auto* counts = static_cast<const uint32_t*>(frame.counts->getMappedData());
+        const uint32_t tested = mMeshShading ? frame.drawCount : frame.clusterCount;
+        stats.tested = tested;
+        stats.culled = tested - std::min(tested, counts[0] + counts[1] + counts[2] + counts[3]);
+        return stats;
+    }
+
+    VkDescriptorSetLayout GpuCuller::getDescriptorSetLayout() const {
+        return mDescriptorSetLayout;
+    }
+}
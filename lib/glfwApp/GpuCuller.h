@@ -0,0 +1,207 @@
+#ifndef TRIANGLE_GPUCULLER_H
+#define TRIANGLE_GPUCULLER_H
+
+#include "common.h"
+#include <Frustum.h>
+
+#include <glm/glm.hpp>
+
+namespace glfw {
+    class glfwApp;
+    class Buffer;
+    class Mesh;
+    class DepthPyramid;
+
+    /**
+     * GPU driven drawing of every instance of a set of meshes. build() flattens the meshes into a
+     * submesh table (mesh space bounds, draw range, material) and gathers their material ids into one
+     * buffer; every frame the instance table (transform, world space sphere, its submeshes) is read by
+     * cull.comp, which tests instances and then their submeshes against the frustum and appends one
+     * VkDrawIndexedIndirectCommand per visible submesh. draw() then issues one
+     * vkCmdDrawIndexedIndirectCount per index type of the GeometryPool, whatever the scene size.
+     *
+     * The CPU only rewrites the instance table when a group changed (see InstanceGroup::getVersion),
+     * so a static scene costs the same to record however large it is. Needs glfwApp::gpuDrivenSupported.
+     *
+     * With a DepthPyramid the frame is culled in two phases. cull() only lets through what was visible
+     * the frame before, which is drawn and becomes the depth the pyramid is built from; cullOccluded()
+     * then tests everything against the pyramid, draws what phase one missed and records what is
+     * visible for the next frame. Whatever the first phase gets wrong the second one draws, so
+     * occlusion never drops geometry, a stale visibility record only costs a few extra draws.
+     *
+     * Submeshes are culled further by Meshlet: cluster.comp takes what cull.comp let through, one
+     * workgroup per submesh through vkCmdDispatchIndirect, and turns it into one indexed draw per
+     * meshlet inside the frustum and not facing away from the eye. With glfwApp::meshShaderSupported
+     * cull.comp emits vkCmdDrawMeshTasksIndirectCountEXT commands instead, one task workgroup per 32
+     * meshlets, and object.task does the same tests before object.mesh emits what is left.
+     *
+     * Every instance is drawn at one level of detail (see Mesh::selectLod), picked by cull.comp from the
+     * projected error of the levels, which build() lays out one after the other in the submesh table.
+     * The level each instance was drawn at is kept for the next frame, for the hysteresis.
+     *
+     * Graphics pipelines bind getDescriptorSetLayout() as one of their sets (object_indirect.vert):
+     * binding 0 instances, 1 material ids (as object.frag expects), 2 submeshes, 3 draw records
+     * (instance, submesh and first triangle of every command slot, indexed with gl_InstanceIndex),
+     * 4 commands, 5 counts, 6 view parameters, 9 meshlets, and for object.mesh 12 meshlet vertices,
+     * 13 meshlet triangles and 14 the vertices of the GeometryPool. Only the culling passes use 7 the
+     * depth pyramid, 8 per submesh draw visibility, 10 the submesh draws for cluster.comp, 11 its
+     * dispatch arguments and 15 the level of detail of every instance.
+     */
+    class GpuCuller {
+    public:
+        // Push constants of object.task and object.mesh, pushed by draw() with mesh shaders.
+        struct MeshDrawConstants {
+            // Draw record of gl_DrawID 0.
+            uint32_t firstDraw;
+            // The GeometryPool holds CompactVertex rather than Vertex.
+            uint32_t compactVertices;
+        };
+
+        GpuCuller(glfwApp* app, int frameCount);
+        virtual ~GpuCuller();
+        GpuCuller(const GpuCuller&) = delete;
+
+        /**
+         * Takes the submeshes, meshlets and material ids of meshes and records the gather on the upload context.
+         * Call again when meshes are loaded or unloaded (before MeshManager::collect releases them) and
+         * whenever isStale(), waits for the device when it replaces tables in use. Instances added or
+         * removed later are picked up by update().
+         */
+        void build(const std::vector<Mesh*>& meshes);
+        // The GeometryPool grew or compacted since build(), the draw ranges it baked in are wrong.
+        bool isStale() const;
+
+        // Rewrites the instance table of frame_index if any group changed since. Only once its fence has signalled, throws when isStale().
+        void update(int frame_index);
+
+        /**
+         * Hi-Z the second phase tests against, rewritten into every frame's set. Set it again when the
+         * swap chain recreates the pyramid; without one cull() is the only phase.
+         */
+        void setDepthPyramid(const DepthPyramid* pyramid);
+
+        /**
+         * Outside a render pass, before draw(): clears the counts and culls into the commands of
+         * frame_index. viewProjection is the matrix frustum was built from, view the camera it belongs to.
+         */
+        void cull(VkCommandBuffer cb, int frame_index, const Frustum& frustum, const glm::mat4& viewProjection,
+                  const LodView& view);
+
+        // Outside a render pass, after the pyramid was built from the depth of the first draw().
+        void cullOccluded(VkCommandBuffer cb, int frame_index);
+
+        /**
+         * Inside the render pass, with a pipeline whose layout has getDescriptorSetLayout() at `set`
+         * (and MeshDrawConstants for the task and mesh stages with mesh shaders). Binds the GeometryPool
+         * itself. occluded draws what cullOccluded() found instead of cull().
+         */
+        void draw(VkCommandBuffer cb, VkPipelineLayout layout, uint32_t set, int frame_index, bool occluded = false);
+
+        // Of the frame last recorded at frame_index, read back; only once its fence has signalled.
+        // Meshlet draws, submesh draws with mesh shaders (object.task culls out of sight).
+        CullingStats getStats(int frame_index) const;
+
+        VkDescriptorSetLayout getDescriptorSetLayout() const;
+
+        void destroy();
+    private:
+        // std430 layouts of cull.comp and object_indirect.vert.
+        struct GpuInstance {
+            glm::mat4 model;
+            glm::vec4 sphere;
+            uint32_t firstSubmesh;
+            uint32_t submeshCount;
+            // Of its first submesh in the visibility buffer.
+            uint32_t firstDraw;
+            // Levels of detail, level k of submesh i at firstSubmesh + k * submeshCount + i.
+            uint32_t lodCount;
+            // Mesh::getLodError of every level.
+            glm::vec4 lodErrors;
+        };
+
+        struct GpuSubmesh {
+            glm::vec4 sphere;
+            glm::vec4 positionScale;
+            glm::vec4 positionOffset;
+            uint32_t indexCount;
+            uint32_t firstIndex;
+            int32_t vertexOffset;
+            uint32_t materialID;
+            uint32_t firstFace;
+            // 0 for VK_INDEX_TYPE_UINT32, 1 for UINT16: the half of the commands it goes to.
+            uint32_t indexType;
+            // Of the gathered meshlets.
+            uint32_t firstMeshlet;
+            uint32_t meshletCount;
+            // For object.mesh: the vertex list of the mesh and the triangle list of the submesh in the
+            // gathered lists, and the first vertex of the mesh in the GeometryPool.
+            uint32_t meshletVertexBase;
+            uint32_t meshletTriangleBase;
+            int32_t meshVertexOffset;
+            uint32_t padding;
+        };
+
+        struct Frame {
+            Buffer* instances = nullptr;
+            Buffer* draws = nullptr;
+            Buffer* commands = nullptr;
+            // uint[4]: per phase, per index type.
+            Buffer* counts = nullptr;
+            Buffer* params = nullptr;
+            // Submesh draws cull.comp hands to cluster.comp per bucket, and VkDispatchIndirectCommand[4] for them.
+            Buffer* work = nullptr;
+            Buffer* dispatches = nullptr;
+            VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+            uint32_t instanceCapacity = 0;
+            // Command slots per phase and index type.
+            uint32_t drawCapacity = 0;
+            // Submesh draw slots per bucket of work.
+            uint32_t workCapacity = 0;
+            uint32_t instanceCount = 0;
+            // Submesh draws, and meshlet draws, of every instance.
+            uint32_t drawCount = 0;
+            uint32_t clusterCount = 0;
+            // Sum of the group versions the instance table was written at, 0 to force a rewrite.
+            uint64_t version = 0;
+        };
+
+        void initPipeline();
+        void createFrameBuffers(Frame& frame, uint32_t instanceCapacity, uint32_t workCapacity, uint32_t drawCapacity);
+        void writeDescriptorSet(Frame& frame);
+        void dispatch(VkCommandBuffer cb, Frame& frame, uint32_t phase);
+
+        glfwApp* mApp;
+        std::vector<Mesh*> mMeshes;
+        std::vector<uint32_t> mFirstSubmesh;
+        // Meshlets of the level of detail with the most, per mesh.
+        std::vector<uint32_t> mMaxMeshlets;
+        Buffer* mSubmeshes;
+        Buffer* mMatIDs;
+        Buffer* mMeshlets;
+        // Only with mesh shaders, see Mesh::meshletVertexBuffer.
+        Buffer* mMeshletVertices;
+        Buffer* mMeshletTriangles;
+        // GeometryPool::getGeneration the draw ranges were read at.
+        uint64_t mGeneration;
+        bool mMeshShading;
+        // One uint per draw, shared by every frame: whether it passed the last occlusion test.
+        Buffer* mVisibility;
+        uint32_t mVisibilityCapacity;
+        bool mVisibilityCleared;
+        // One uint per instance, shared by every frame like visibility: the level it was drawn at.
+        Buffer* mLods;
+        uint32_t mLodCapacity;
+        const DepthPyramid* mDepthPyramid;
+        std::vector<Frame> mFrames;
+
+        VkDescriptorSetLayout mDescriptorSetLayout;
+        VkDescriptorPool mDescriptorPool;
+        VkPipelineLayout mPipelineLayout;
+        VkPipeline mPipeline;
+        VkPipelineLayout mClusterPipelineLayout;
+        VkPipeline mClusterPipeline;
+    };
+}
+
+
+#endif //TRIANGLE_GPUCULLER_H
@@ -3,75 +3,43 @@
 //
 
 #include "Instance.h"
+#include "InstanceGroup.h"
 #include "Mesh.h"
 #include "glfwApp.h"
-#include "Buffer.h"
 
 namespace glfw {
-    Instance::Instance(glfwApp* app, Mesh *mesh) {
+    Instance::Instance(glfwApp* app, Mesh *mesh, const glm::mat4& model) {
         mMesh = mesh;
-        mModel = glm::mat4(1.0f);
+        mModel = model;
+        mLod = 0;
+        mWorldBounds = mesh->getBounds().transform(model);
 
         mApp = app;
-    }
-
-    void Instance::initGPUMemory(VkDescriptorPool descPool, VkDescriptorSetLayout defaultLayout, VkCommandPool commandPool, VkQueue graphicsQueue, int num_frame) {
-        mDescPool = descPool;
-
-        std::vector<VkDescriptorSetLayout> layouts(num_frame, defaultLayout);
-        VkDescriptorSetAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool = descPool;
-        allocInfo.descriptorSetCount = static_cast<uint32_t>(num_frame);
-        allocInfo.pSetLayouts = layouts.data();
-        mModelDesc.resize(num_frame);
-        if (vkAllocateDescriptorSets(mApp->device, &allocInfo, mModelDesc.data()) != VK_SUCCESS)
-            throw std::runtime_error("failed to allocate descriptor sets!");
-
-        for (int i = 0; i < num_frame; i ++) {
-            mModelBuffer.push_back(new Buffer(mApp));
-            mModelBuffer[i]->create(sizeof(glm::mat4), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-            mModelBuffer[i]->uploadData(&this->mModel, sizeof(glm::mat4));
-
-            VkDescriptorBufferInfo bufferInfo{};
-            bufferInfo.buffer = mModelBuffer[i]->getBuffer();
-            bufferInfo.offset = 0;
-            bufferInfo.range = sizeof(glm::mat4);
-
-            VkWriteDescriptorSet descriptorWrite;
-            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrite.pNext = nullptr;
-            descriptorWrite.dstSet = mModelDesc[i];
-            descriptorWrite.dstBinding = 0;
-            descriptorWrite.dstArrayElement = 0;
-            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            descriptorWrite.descriptorCount = 1;
-            descriptorWrite.pBufferInfo = &bufferInfo;
-
-            vkUpdateDescriptorSets(mApp->device, 1, &descriptorWrite, 0, nullptr);
-        }
+        mGroup = mesh->getInstanceGroup();
+        mIndex = mGroup->add(this);
     }
 
     Instance::~Instance() {
         this->destroy(0);
     }
 
+    void Instance::setModel(const glm::mat4 &model) {
+        mModel = model;
+        mLod = 0;
+        if (mMesh)
+            mWorldBounds = mMesh->getBounds().transform(model);
+        if (mGroup)
+            mGroup->setModel(mIndex, model);
+    }
+
     void Instance::destroy(int destroy_mesh) {
+        if (mGroup) {
+            mGroup->remove(this);
+            mGroup = nullptr;
+        }
         if (destroy_mesh && mMesh) {
             mMesh->destroy();
             mMesh = nullptr;
         }
-        if (mDescPool) {
-            vkFreeDescriptorSets(mApp->device, mDescPool, mModelDesc.size(), mModelDesc.data());
-            mModelDesc.resize(0);
-            mDescPool = VK_NULL_HANDLE;
-            for (auto &buffer : mModelBuffer)
-                delete buffer;
-            mModelBuffer.resize(0);
-        }
-    }
-
-    VkDescriptorSet Instance::getModelDescriptorSet(int frame_index) {
-        return mModelDesc[frame_index];
     }
-}
\ No newline at end of file
+}
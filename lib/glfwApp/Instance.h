@@ -10,25 +10,33 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/hash.hpp>
+#include <Frustum.h>
 
 namespace glfw {
     class Mesh;
     class glfwApp;
-    class Buffer;
+    class InstanceGroup;
+
+    /**
+     * One placement of a Mesh. The transform lives in the InstanceGroup of the mesh, which all its
+     * instances share, so an instance owns no GPU memory of its own.
+     */
     struct Instance {
         glm::mat4 mModel;
-        std::vector<VkDescriptorSet> mModelDesc;
-        std::vector<Buffer*> mModelBuffer;
+        // Mesh::getBounds under mModel, in the space of the group transform. The mesh has to be loaded first.
+        Bounds mWorldBounds;
 
         Mesh* mMesh;
         glfwApp* mApp;
-        VkDescriptorPool mDescPool;
+        InstanceGroup* mGroup;
+        uint32_t mIndex;
+        // Level of detail InstanceGroup::draw drew it at last, see Mesh::selectLod.
+        uint32_t mLod;
 
-        Instance(glfwApp* app, Mesh* mesh);
+        Instance(glfwApp* app, Mesh* mesh, const glm::mat4& model = glm::mat4(1.0f));
         virtual ~Instance();
-        void initGPUMemory(VkDescriptorPool descPool, VkDescriptorSetLayout defaultLayout, VkCommandPool commandPool, VkQueue graphicsQueue, int num_frame);
+        void setModel(const glm::mat4& model);
         void destroy(int destroy_mesh = 0);
-        VkDescriptorSet getModelDescriptorSet(int frame_index);
     };
 }
 
@@ -0,0 +1,284 @@
+#include "InstanceGroup.h"
+#include "Instance.h"
+#include "Mesh.h"
+#include "SubMesh.h"
+#include "glfwApp.h"
+#include "Buffer.h"
+#include "MeshManager.h"
+#include "GeometryPool.h"
+#include "SoftwareOcclusion.h"
+
+namespace glfw {
+    namespace {
+        const uint32_t kMinCapacity = 64;
+    }
+
+    InstanceGroup::InstanceGroup(glfwApp *app, Mesh *mesh) {
+        mApp = app;
+        mMesh = mesh;
+        mVersion = 1;
+        mTransform = glm::mat4(1.0f);
+    }
+
+    InstanceGroup::~InstanceGroup() {
+        this->destroy();
+    }
+
+    void InstanceGroup::initGPUMemory(VkDescriptorPool descPool, VkDescriptorSetLayout layout, int num_frame) {
+        std::vector<VkDescriptorSetLayout> layouts(num_frame, layout);
+        std::vector<VkDescriptorSet> sets(num_frame);
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = descPool;
+        allocInfo.descriptorSetCount = static_cast<uint32_t>(num_frame);
+        allocInfo.pSetLayouts = layouts.data();
+        if (vkAllocateDescriptorSets(mApp->device, &allocInfo, sets.data()) != VK_SUCCESS)
+            throw std::runtime_error("InstanceGroup: failed to allocate descriptor sets!");
+
+        mFrames.resize(num_frame);
+        for (int i = 0; i < num_frame; i ++) {
+            mFrames[i].descriptorSet = sets[i];
+            this->createFrameBuffer(mFrames[i], std::max(kMinCapacity, static_cast<uint32_t>(mModels.size())));
+            this->createVisibleBuffer(mFrames[i], std::max(kMinCapacity, this->getVisibleNeed()));
+
+            VkDescriptorBufferInfo bufferInfo{};
+            bufferInfo.buffer = mMesh->matIDBuffer->getBuffer();
+            bufferInfo.offset = 0;
+            bufferInfo.range = VK_WHOLE_SIZE;
+
+            VkWriteDescriptorSet descriptorWrite{};
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = sets[i];
+            descriptorWrite.dstBinding = 1;
+            descriptorWrite.dstArrayElement = 0;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.pBufferInfo = &bufferInfo;
+            vkUpdateDescriptorSets(mApp->device, 1, &descriptorWrite, 0, nullptr);
+        }
+    }
+
+    void InstanceGroup::destroy() {
+        // Descriptor sets go back with their pool.
+        for (auto& frame : mFrames) {
+            delete frame.buffer;
+            delete frame.visible;
+        }
+        mFrames.clear();
+        for (auto& instance : mInstances)
+            instance->mGroup = nullptr;
+        mInstances.clear();
+        mModels.clear();
+    }
+
+    void InstanceGroup::createFrameBuffer(Frame &frame, uint32_t capacity) {
+        delete frame.buffer;
+        frame.buffer = new Buffer(mApp);
+        VkDeviceSize size = sizeof(glm::mat4) * capacity;
+        if (frame.buffer->create(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, true) != VK_SUCCESS)
+            throw std::runtime_error("InstanceGroup: failed to create transform buffer!");
+        frame.capacity = capacity;
+        frame.version = 0;
+
+        VkDescriptorBufferInfo bufferInfo{};
+        bufferInfo.buffer = frame.buffer->getBuffer();
+        bufferInfo.offset = 0;
+        bufferInfo.range = size;
+
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = frame.descriptorSet;
+        descriptorWrite.dstBinding = 0;
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pBufferInfo = &bufferInfo;
+        vkUpdateDescriptorSets(mApp->device, 1, &descriptorWrite, 0, nullptr);
+    }
+
+    void InstanceGroup::createVisibleBuffer(Frame &frame, uint32_t capacity) {
+        delete frame.visible;
+        frame.visible = new Buffer(mApp);
+        VkDeviceSize size = sizeof(uint32_t) * capacity;
+        if (frame.visible->create(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, true) != VK_SUCCESS)
+            throw std::runtime_error("InstanceGroup: failed to create visible list buffer!");
+        frame.visibleCapacity = capacity;
+
+        VkDescriptorBufferInfo bufferInfo{};
+        bufferInfo.buffer = frame.visible->getBuffer();
+        bufferInfo.offset = 0;
+        bufferInfo.range = size;
+
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = frame.descriptorSet;
+        descriptorWrite.dstBinding = 2;
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pBufferInfo = &bufferInfo;
+        vkUpdateDescriptorSets(mApp->device, 1, &descriptorWrite, 0, nullptr);
+    }
+
+    uint32_t InstanceGroup::getVisibleNeed() const {
+        // Every submesh of every instance kept, each in exactly one level's list.
+        return static_cast<uint32_t>(mModels.size() * mMesh->submesh.size());
+    }
+
+    uint32_t InstanceGroup::add(Instance *instance) {
+        mInstances.push_back(instance);
+        mModels.push_back(instance->mModel);
+        mVersion ++;
+        return static_cast<uint32_t>(mModels.size() - 1);
+    }
+
+    void InstanceGroup::remove(Instance *instance) {
+        uint32_t index = instance->mIndex;
+        assert(index < mInstances.size() && mInstances[index] == instance);
+        /**
+         * The last instance takes over the freed slot.
+         */
+        mInstances[index] = mInstances.back();
+        mModels[index] = mModels.back();
+        mInstances[index]->mIndex = index;
+        mInstances.pop_back();
+        mModels.pop_back();
+        mVersion ++;
+    }
+
+    void InstanceGroup::setModel(uint32_t index, const glm::mat4 &model) {
+        mModels[index] = model;
+        mVersion ++;
+    }
+
+    void InstanceGroup::setTransform(const glm::mat4 &transform) {
+        mTransform = transform;
+        // Pushed per draw here, but baked into the transforms GpuCuller uploads.
+        mVersion ++;
+    }
+
+    void InstanceGroup::update(int frame_index) {
+        Frame& frame = mFrames[frame_index];
+        // Grown here rather than in draw(), the descriptor set must not change once it is recorded.
+        const uint32_t visibleNeed = this->getVisibleNeed();
+        if (visibleNeed > frame.visibleCapacity)
+            this->createVisibleBuffer(frame, std::max(frame.visibleCapacity * 2, visibleNeed));
+        if (frame.version == mVersion)
+            return;
+        if (mModels.size() > frame.capacity)
+            this->createFrameBuffer(frame, std::max(frame.capacity * 2, static_cast<uint32_t>(mModels.size())));
+        VkDeviceSize size = sizeof(glm::mat4) * mModels.size();
+        if (size) {
+            std::memcpy(frame.buffer->getMappedData(), mModels.data(), size);
+            frame.buffer->flush(size);
+        }
+        frame.version = mVersion;
+    }
+
+    void InstanceGroup::draw(VkCommandBuffer cb, VkPipelineLayout layout, uint32_t set, int frame_index,
+                             const Frustum *frustum, CullingStats *stats, SoftwareOcclusion *occlusion,
+                             const LodView *lodView) {
+        if (mModels.empty())
+            return;
+
+        // Instance bounds are in group space, so is the frustum they are tested against.
+        std::optional<Frustum> groupFrustum;
+        if (frustum)
+            groupFrustum.emplace(frustum->transformed(mTransform));
+        const uint32_t instanceCount = static_cast<uint32_t>(mModels.size());
+        mVisibility.resize(instanceCount);
+        bool anyVisible = false;
+        for (uint32_t i = 0; i < instanceCount; i ++) {
+            mVisibility[i] = groupFrustum ? groupFrustum->test(mInstances[i]->mWorldBounds) : Frustum::Inside;
+            // The occlusion buffer is in world space.
+            if (occlusion && mVisibility[i] != Frustum::Outside &&
+                occlusion->isOccluded(mInstances[i]->mWorldBounds.transform(mTransform)))
+                mVisibility[i] = Frustum::Outside;
+            anyVisible = anyVisible || mVisibility[i] != Frustum::Outside;
+        }
+        if (stats)
+            stats->tested += instanceCount * static_cast<uint32_t>(mMesh->submesh.size());
+        if (!anyVisible) {
+            if (stats)
+                stats->culled += instanceCount * static_cast<uint32_t>(mMesh->submesh.size());
+            return;
+        }
+        if (lodView) {
+            // Mesh units per world unit, the radius scales as the transforms do.
+            const float meshRadius = mMesh->getBounds().radius;
+            for (uint32_t i = 0; i < instanceCount; i ++) {
+                if (mVisibility[i] == Frustum::Outside)
+                    continue;
+                Bounds world = mInstances[i]->mWorldBounds.transform(mTransform);
+                float pixels = lodView->getPixelsPerUnit(world) * (meshRadius > 0.0f ? world.radius / meshRadius : 1.0f);
+                mInstances[i]->mLod = mMesh->selectLod(pixels, mInstances[i]->mLod);
+            }
+        }
+
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, set, 1, &mFrames[frame_index].descriptorSet, 0, nullptr);
+        // Index buffers of both types live in the pool, only the one of this mesh is bound.
+        mApp->meshManager->getGeometryPool()->bindIndices(cb, mMesh->getIndexType());
+        const uint32_t firstIndex = mMesh->getFirstIndex();
+        const int32_t vertexOffset = mMesh->getVertexOffset();
+        DrawConstants constants{};
+        constants.model = mTransform;
+        constants.positionScale = glm::vec4(mMesh->getPositionScale(), 0.0f);
+        constants.positionOffset = glm::vec4(mMesh->getPositionOffset(), 0.0f);
+        Frame& frame = mFrames[frame_index];
+        assert(this->getVisibleNeed() <= frame.visibleCapacity);
+        auto* slots = static_cast<uint32_t*>(frame.visible->getMappedData());
+        uint32_t offset = 0;
+        mLodSlots.resize(Mesh::kMaxLods);
+        for (auto &submesh : mMesh->submesh) {
+            constants.materialID = submesh->materialID;
+            for (auto& list : mLodSlots)
+                list.clear();
+            for (uint32_t i = 0; i < instanceCount; i ++) {
+                bool visible = mVisibility[i] == Frustum::Inside ||
+                               (mVisibility[i] == Frustum::Intersecting &&
+                                groupFrustum->test(submesh->bounds.transform(mModels[i])) != Frustum::Outside);
+                if (visible)
+                    mLodSlots[lodView ? mInstances[i]->mLod : 0].push_back(i);
+                else if (stats)
+                    stats->culled ++;
+            }
+            for (uint32_t level = 0; level < Mesh::kMaxLods; level ++) {
+                const auto& list = mLodSlots[level];
+                if (list.empty())
+                    continue;
+                std::memcpy(slots + offset, list.data(), sizeof(uint32_t) * list.size());
+                // Levels differ in their ranges, and in where their faces start in the material ids.
+                SubMesh::Lod lod = submesh->getLod(level);
+                constants.firstFace = lod.firstFace;
+                vkCmdPushConstants(cb, layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(DrawConstants), &constants);
+                vkCmdDrawIndexed(cb, lod.indexCount, static_cast<uint32_t>(list.size()), firstIndex + lod.firstIndex,
+                                 vertexOffset + submesh->vertexOffset, offset);
+                offset += static_cast<uint32_t>(list.size());
+            }
+        }
+        if (offset)
+            frame.visible->flush(sizeof(uint32_t) * offset);
+    }
+
+    uint32_t InstanceGroup::getInstanceCount() const {
+        return static_cast<uint32_t>(mModels.size());
+    }
+
+    Instance *InstanceGroup::getInstance(uint32_t index) const {
+        return mInstances[index];
+    }
+
+    const glm::mat4 &InstanceGroup::getTransform() const {
+        return mTransform;
+    }
+
+    uint64_t InstanceGroup::getVersion() const {
+        return mVersion;
+    }
+
+    VkDescriptorSet InstanceGroup::getDescriptorSet(int frame_index) {
+        return mFrames[frame_index].descriptorSet;
+    }
+}
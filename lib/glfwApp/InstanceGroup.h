@@ -0,0 +1,117 @@
+#ifndef TRIANGLE_INSTANCEGROUP_H
+#define TRIANGLE_INSTANCEGROUP_H
+
+#include <common.h>
+
+#include <glm/glm.hpp>
+#include <Frustum.h>
+
+namespace glfw {
+    class glfwApp;
+    class Buffer;
+    class Mesh;
+    struct Instance;
+    class SoftwareOcclusion;
+
+    /**
+     * Per-draw data, pushed once per submesh. Matches the push_constant block of object.vert/frag.
+     */
+    struct DrawConstants {
+        // Transform of the whole group, the per-instance transforms apply on top of it.
+        glm::mat4 model;
+        // Mesh::getPositionScale/getPositionOffset, w unused.
+        glm::vec4 positionScale;
+        glm::vec4 positionOffset;
+        // SubMesh::materialID, or kNoMaterial to read the material of each face from Mesh::matIDBuffer.
+        uint32_t materialID;
+        // SubMesh::firstFace, offset of the submesh in Mesh::matIDBuffer.
+        uint32_t firstFace;
+    };
+
+    /**
+     * Transforms of every Instance of one Mesh, stored back to back in a storage buffer per frame in
+     * flight. draw() writes the slots of the instances it keeps into a second per-frame buffer and the
+     * vertex shader reads the transform through it with gl_InstanceIndex, so the whole group is drawn
+     * with one instanced vkCmdDrawIndexed per submesh and level of detail, however many instances there
+     * are and whichever of them are culled.
+     */
+    class InstanceGroup {
+    public:
+        InstanceGroup(glfwApp* app, Mesh* mesh);
+        virtual ~InstanceGroup();
+        InstanceGroup(const InstanceGroup&) = delete;
+
+        void initGPUMemory(VkDescriptorPool descPool, VkDescriptorSetLayout layout, int num_frame);
+        void destroy();
+
+        // Returns the slot of instance, slots are kept dense so they move on remove.
+        uint32_t add(Instance* instance);
+        void remove(Instance* instance);
+        void setModel(uint32_t index, const glm::mat4& model);
+        // Pushed with every draw of the group, identity by default.
+        void setTransform(const glm::mat4& transform);
+
+        /**
+         * Copies the transforms into the buffer of frame_index if they changed since that buffer was
+         * last written, growing it and the visible list buffer when needed. Only call once the fence
+         * of that frame has signalled, and before draw() for that frame.
+         */
+        void update(int frame_index);
+
+        /**
+         * Binds the transforms (binding 0), material ids (binding 1) and visible lists (binding 2) as set
+         * `set` of layout once, then per submesh pushes DrawConstants to the vertex and fragment stages
+         * and draws the instances it keeps. Vertices come from the GeometryPool, which the caller binds
+         * once for the frame, the index buffer of the mesh's index type is bound here.
+         *
+         * With a frustum (world space, the group transform is applied here) instances whose bounds are
+         * outside are skipped, and so are submeshes outside of instances that straddle it. stats, when
+         * given, is added to. Instances the frustum keeps are then tested against occlusion, when given,
+         * which has to be waited for. With lodView every instance is drawn at the level of detail
+         * Mesh::selectLod picks for it, level 0 without. The slots kept for a submesh are listed per
+         * level in the visible buffer and each list is one draw, its offset passed as firstInstance.
+         */
+        void draw(VkCommandBuffer cb, VkPipelineLayout layout, uint32_t set, int frame_index,
+                  const Frustum* frustum = nullptr, CullingStats* stats = nullptr,
+                  SoftwareOcclusion* occlusion = nullptr, const LodView* lodView = nullptr);
+
+        uint32_t getInstanceCount() const;
+        Instance* getInstance(uint32_t index) const;
+        const glm::mat4& getTransform() const;
+        // Changes with every add, remove, setModel and setTransform.
+        uint64_t getVersion() const;
+        VkDescriptorSet getDescriptorSet(int frame_index);
+    private:
+        struct Frame {
+            Buffer* buffer = nullptr;
+            VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+            uint32_t capacity = 0;
+            uint64_t version = 0;
+            // Instance slots draw() keeps, one list per submesh and level, rewritten every frame.
+            Buffer* visible = nullptr;
+            uint32_t visibleCapacity = 0;
+        };
+
+        void createFrameBuffer(Frame& frame, uint32_t capacity);
+        void createVisibleBuffer(Frame& frame, uint32_t capacity);
+        // Longest the visible lists of one frame can get.
+        uint32_t getVisibleNeed() const;
+
+        std::vector<glm::mat4> mModels;
+        std::vector<Instance*> mInstances;
+        std::vector<Frame> mFrames;
+        // Per instance result of the frustum (and occlusion) test, scratch of draw().
+        std::vector<Frustum::Result> mVisibility;
+        // Slots kept for the submesh being drawn, per level of detail, scratch of draw().
+        std::vector<std::vector<uint32_t>> mLodSlots;
+        // Bumped on every change, a frame whose version differs has stale transforms.
+        uint64_t mVersion;
+        glm::mat4 mTransform;
+
+        Mesh* mMesh;
+        glfwApp* mApp;
+    };
+}
+
+
+#endif //TRIANGLE_INSTANCEGROUP_H
@@ -0,0 +1,99 @@
+#include "MappedFile.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace glfw {
+    MappedFile::MappedFile() {
+        mData = nullptr;
+        mSize = 0;
+#ifdef _WIN32
+        mFile = INVALID_HANDLE_VALUE;
+        mMapping = nullptr;
+#endif
+    }
+
+    MappedFile::~MappedFile() {
+        this->close();
+    }
+
+    bool MappedFile::open(const std::string &fileName) {
+        this->close();
+#ifdef _WIN32
+        mFile = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (mFile == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0) {
+            this->close();
+            return false;
+        }
+        mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mMapping) {
+            this->close();
+            return false;
+        }
+        mData = static_cast<const char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+        if (!mData) {
+            this->close();
+            return false;
+        }
+        mSize = static_cast<size_t>(size.QuadPart);
+#else
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping keeps its own reference to the file.
+        ::close(fd);
+        if (data == MAP_FAILED)
+            return false;
+        mData = static_cast<const char*>(data);
+        mSize = static_cast<size_t>(st.st_size);
+#endif
+        return true;
+    }
+
+    void MappedFile::close() {
+#ifdef _WIN32
+        if (mData)
+            UnmapViewOfFile(mData);
+        if (mMapping)
+            CloseHandle(mMapping);
+        if (mFile != INVALID_HANDLE_VALUE)
+            CloseHandle(mFile);
+        mMapping = nullptr;
+        mFile = INVALID_HANDLE_VALUE;
+#else
+        if (mData)
+            munmap(const_cast<char*>(mData), mSize);
+#endif
+        mData = nullptr;
+        mSize = 0;
+    }
+
+    bool MappedFile::isOpen() const {
+        return mData != nullptr;
+    }
+
+    const char *MappedFile::getData() const {
+        return mData;
+    }
+
+    size_t MappedFile::getSize() const {
+        return mSize;
+    }
+}
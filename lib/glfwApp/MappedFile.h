@@ -0,0 +1,35 @@
+#ifndef TRIANGLE_MAPPEDFILE_H
+#define TRIANGLE_MAPPEDFILE_H
+
+#include "common.h"
+
+namespace glfw {
+    /**
+     * Read only view of a whole file through the page cache. Nothing is copied at open, pages are
+     * faulted in on first access.
+     */
+    class MappedFile {
+    public:
+        MappedFile();
+        virtual ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool open(const std::string& fileName);
+        void close();
+
+        bool isOpen() const;
+        const char* getData() const;
+        size_t getSize() const;
+    private:
+        const char* mData;
+        size_t mSize;
+#ifdef _WIN32
+        void* mFile;
+        void* mMapping;
+#endif
+    };
+}
+
+
+#endif //TRIANGLE_MAPPEDFILE_H
@@ -0,0 +1,362 @@
+#include "MemoryAllocator.h"
+#include <glfwApp.h>
+
+namespace glfw {
+    static const VkDeviceSize kDefaultBlockSize = 64ull * 1024 * 1024;
+    static const VkDeviceSize kSmallHeapSize = 1024ull * 1024 * 1024;
+
+    struct MemoryBlock {
+        struct Chunk {
+            VkDeviceSize size;
+            AllocationKind kind;
+        };
+
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        VkDeviceSize used = 0;
+        uint32_t memoryType = 0;
+        uint32_t allocationCount = 0;
+        bool dedicated = false;
+
+        void* mapped = nullptr;
+        uint32_t mapCount = 0;
+
+        // offset -> chunk, covering the whole block. Neighbouring free chunks are always merged.
+        std::map<VkDeviceSize, Chunk> chunks;
+    };
+
+    static inline
+    VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static inline
+    bool onSamePage(VkDeviceSize endOfA, VkDeviceSize startOfB, VkDeviceSize pageSize) {
+        // endOfA is the last byte of the lower resource, startOfB the first byte of the upper one.
+        return (endOfA & ~(pageSize - 1)) == (startOfB & ~(pageSize - 1));
+    }
+
+    static inline
+    bool kindsConflict(AllocationKind a, AllocationKind b) {
+        if (a == AllocationKind::Free || b == AllocationKind::Free)
+            return false;
+        return (a == AllocationKind::ImageOptimal) != (b == AllocationKind::ImageOptimal);
+    }
+
+    MemoryAllocator::MemoryAllocator(glfwApp *app) {
+        mApp = app;
+
+        vkGetPhysicalDeviceMemoryProperties(mApp->physicalDevice, &mMemoryProperties);
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties(mApp->physicalDevice, &deviceProperties);
+        mBufferImageGranularity = std::max<VkDeviceSize>(deviceProperties.limits.bufferImageGranularity, 1);
+        mNonCoherentAtomSize = std::max<VkDeviceSize>(deviceProperties.limits.nonCoherentAtomSize, 1);
+
+        for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i ++) {
+            mPreferredBlockSize[i] = kDefaultBlockSize;
+            if (i < mMemoryProperties.memoryTypeCount) {
+                VkDeviceSize heapSize = mMemoryProperties.memoryHeaps[mMemoryProperties.memoryTypes[i].heapIndex].size;
+                if (heapSize <= kSmallHeapSize)
+                    mPreferredBlockSize[i] = alignUp(heapSize / 8, 32);
+            }
+        }
+    }
+
+    MemoryAllocator::~MemoryAllocator() {
+        this->destroy();
+    }
+
+    void MemoryAllocator::destroy() {
+        for (auto &blocks : mBlocks) {
+            for (MemoryBlock* block : blocks) {
+                if (block->mapped)
+                    vkUnmapMemory(mApp->device, block->memory);
+                vkFreeMemory(mApp->device, block->memory, nullptr);
+                delete block;
+            }
+            blocks.clear();
+        }
+    }
+
+    uint32_t MemoryAllocator::findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags memoryProperties) const {
+        for (uint32_t memoryTypeIndex = 0; memoryTypeIndex < mMemoryProperties.memoryTypeCount; ++memoryTypeIndex) {
+            if (memoryTypeBits & (1 << memoryTypeIndex)) {
+                if ((mMemoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & memoryProperties) == memoryProperties)
+                    return memoryTypeIndex;
+            }
+        }
+        throw std::runtime_error("MemoryAllocator: Failed to find correct memory type");
+    }
+
+    VkResult MemoryAllocator::createBlock(uint32_t memoryType, VkDeviceSize size, VkMemoryAllocateFlags allocateFlags,
+                                          bool dedicated, MemoryBlock *&block) {
+        VkMemoryAllocateInfo memoryAllocateInfo{};
+        memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memoryAllocateInfo.pNext = nullptr;
+        memoryAllocateInfo.allocationSize = size;
+        memoryAllocateInfo.memoryTypeIndex = memoryType;
+
+        VkMemoryAllocateFlagsInfo allocationFlags{};
+        allocationFlags.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+        allocationFlags.flags = allocateFlags;
+        if (allocateFlags)
+            memoryAllocateInfo.pNext = &allocationFlags;
+
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkResult result = vkAllocateMemory(mApp->device, &memoryAllocateInfo, nullptr, &memory);
+        if (result != VK_SUCCESS) {
+            block = nullptr;
+            return result;
+        }
+
+        block = new MemoryBlock();
+        block->memory = memory;
+        block->size = size;
+        block->memoryType = memoryType;
+        block->dedicated = dedicated;
+        block->chunks[0] = {size, AllocationKind::Free};
+        mBlocks[memoryType].push_back(block);
+        return VK_SUCCESS;
+    }
+
+    void MemoryAllocator::destroyBlock(MemoryBlock *block) {
+        auto &blocks = mBlocks[block->memoryType];
+        blocks.erase(std::find(blocks.begin(), blocks.end(), block));
+        if (block->mapped)
+            vkUnmapMemory(mApp->device, block->memory);
+        vkFreeMemory(mApp->device, block->memory, nullptr);
+        delete block;
+    }
+
+    bool MemoryAllocator::allocateFromBlock(MemoryBlock *block, VkDeviceSize size, VkDeviceSize alignment,
+                                            AllocationKind kind, Allocation &allocation) {
+        if (block->size - block->used < size)
+            return false;
+        alignment = std::max<VkDeviceSize>(alignment, 1);
+
+        // Best fit: the smallest free chunk that can hold the request once alignment and
+        // bufferImageGranularity padding are applied.
+        auto best = block->chunks.end();
+        VkDeviceSize bestOffset = 0;
+        for (auto it = block->chunks.begin(); it != block->chunks.end(); ++it) {
+            if (it->second.kind != AllocationKind::Free || it->second.size < size)
+                continue;
+            if (best != block->chunks.end() && it->second.size >= best->second.size)
+                continue;
+            const VkDeviceSize chunkBegin = it->first;
+            const VkDeviceSize chunkEnd = it->first + it->second.size;
+
+            VkDeviceSize offset = alignUp(chunkBegin, alignment);
+            if (it != block->chunks.begin()) {
+                auto prev = std::prev(it);
+                if (kindsConflict(prev->second.kind, kind) &&
+                    onSamePage(prev->first + prev->second.size - 1, offset, mBufferImageGranularity))
+                    offset = alignUp(offset, mBufferImageGranularity);
+            }
+            if (offset + size > chunkEnd)
+                continue;
+            auto next = std::next(it);
+            if (next != block->chunks.end() && kindsConflict(next->second.kind, kind) &&
+                onSamePage(offset + size - 1, next->first, mBufferImageGranularity))
+                continue;
+
+            best = it;
+            bestOffset = offset;
+        }
+        if (best == block->chunks.end())
+            return false;
+
+        const VkDeviceSize chunkBegin = best->first;
+        const VkDeviceSize chunkEnd = best->first + best->second.size;
+        if (bestOffset > chunkBegin)
+            best->second.size = bestOffset - chunkBegin;
+        else
+            block->chunks.erase(best);
+        block->chunks[bestOffset] = {size, kind};
+        if (bestOffset + size < chunkEnd)
+            block->chunks[bestOffset + size] = {chunkEnd - bestOffset - size, AllocationKind::Free};
+
+        block->used += size;
+        block->allocationCount ++;
+
+        allocation.block = block;
+        allocation.memory = block->memory;
+        allocation.offset = bestOffset;
+        allocation.size = size;
+        allocation.memoryType = block->memoryType;
+        return true;
+    }
+
+    VkResult MemoryAllocator::allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags memoryProperties,
+                                       AllocationKind kind, Allocation &allocation, VkMemoryAllocateFlags allocateFlags) {
+        if (allocation.block)
+            throw std::runtime_error("MemoryAllocator: Allocation is already in use.");
+        uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, memoryProperties);
+        VkDeviceSize blockSize = mPreferredBlockSize[memoryType];
+
+        VkMemoryRequirements padded = requirements;
+        if (!(mMemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) &&
+            (mMemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+            // Flushes work on whole atoms, keep neighbours from sharing one.
+            padded.alignment = std::max(padded.alignment, mNonCoherentAtomSize);
+            padded.size = alignUp(padded.size, mNonCoherentAtomSize);
+        }
+
+        MemoryBlock* block = nullptr;
+        VkResult result;
+
+        // Big resources and resources needing special allocation flags get a block of their own.
+        if (allocateFlags != 0 || padded.size > blockSize / 2) {
+            result = createBlock(memoryType, padded.size, allocateFlags, true, block);
+            if (result != VK_SUCCESS)
+                return result;
+            allocateFromBlock(block, padded.size, padded.alignment, kind, allocation);
+            return VK_SUCCESS;
+        }
+
+        for (MemoryBlock* candidate : mBlocks[memoryType]) {
+            if (!candidate->dedicated &&
+                allocateFromBlock(candidate, padded.size, padded.alignment, kind, allocation))
+                return VK_SUCCESS;
+        }
+
+        // Out of space: open a new block, shrinking it if the heap refuses the preferred size.
+        do {
+            result = createBlock(memoryType, blockSize, 0, false, block);
+            blockSize /= 2;
+        } while (result != VK_SUCCESS && blockSize >= padded.size);
+        if (result != VK_SUCCESS)
+            return result;
+        if (!allocateFromBlock(block, padded.size, padded.alignment, kind, allocation))
+            return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+        return VK_SUCCESS;
+    }
+
+    void MemoryAllocator::free(Allocation &allocation) {
+        MemoryBlock* block = allocation.block;
+        if (!block)
+            return;
+
+        auto it = block->chunks.find(allocation.offset);
+        if (it == block->chunks.end() || it->second.kind == AllocationKind::Free)
+            throw std::runtime_error("MemoryAllocator: Freeing an unknown allocation.");
+        it->second.kind = AllocationKind::Free;
+        block->used -= it->second.size;
+        block->allocationCount --;
+
+        auto next = std::next(it);
+        if (next != block->chunks.end() && next->second.kind == AllocationKind::Free) {
+            it->second.size += next->second.size;
+            block->chunks.erase(next);
+        }
+        if (it != block->chunks.begin()) {
+            auto prev = std::prev(it);
+            if (prev->second.kind == AllocationKind::Free) {
+                prev->second.size += it->second.size;
+                block->chunks.erase(it);
+            }
+        }
+        allocation = Allocation();
+
+        if (block->allocationCount == 0) {
+            // Keep one empty shared block around so that create/destroy cycles do not hit the driver.
+            bool lastSharedBlock = !block->dedicated;
+            for (MemoryBlock* other : mBlocks[block->memoryType])
+                if (other != block && !other->dedicated)
+                    lastSharedBlock = false;
+            if (!lastSharedBlock)
+                this->destroyBlock(block);
+        }
+    }
+
+    void *MemoryAllocator::map(const Allocation &allocation) {
+        MemoryBlock* block = allocation.block;
+        if (!block)
+            throw std::runtime_error("MemoryAllocator: Mapping an empty allocation.");
+        if (block->mapCount == 0) {
+            // The whole block is mapped once and shared by every allocation living in it,
+            // a VkDeviceMemory can not be mapped twice.
+            if (vkMapMemory(mApp->device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped) != VK_SUCCESS) {
+                block->mapped = nullptr;
+                return nullptr;
+            }
+        }
+        block->mapCount ++;
+        return static_cast<char*>(block->mapped) + allocation.offset;
+    }
+
+    void MemoryAllocator::unmap(const Allocation &allocation) {
+        MemoryBlock* block = allocation.block;
+        if (!block || block->mapCount == 0)
+            return;
+        block->mapCount --;
+        if (block->mapCount == 0) {
+            vkUnmapMemory(mApp->device, block->memory);
+            block->mapped = nullptr;
+        }
+    }
+
+    bool MemoryAllocator::isCoherent(const Allocation &allocation) const {
+        if (!allocation.block)
+            return true;
+        return (mMemoryProperties.memoryTypes[allocation.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    }
+
+    VkMappedMemoryRange MemoryAllocator::getMappedRange(const Allocation &allocation, VkDeviceSize offset, VkDeviceSize size) const {
+        MemoryBlock* block = allocation.block;
+        if (size == VK_WHOLE_SIZE || offset + size > allocation.size)
+            size = allocation.size - std::min(offset, allocation.size);
+
+        // Ranges must start and end on nonCoherentAtomSize inside the block (or end at the block end).
+        VkDeviceSize begin = (allocation.offset + offset) / mNonCoherentAtomSize * mNonCoherentAtomSize;
+        VkDeviceSize end = std::min(alignUp(allocation.offset + offset + size, mNonCoherentAtomSize), block->size);
+
+        VkMappedMemoryRange range{};
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory = block->memory;
+        range.offset = begin;
+        range.size = end - begin;
+        return range;
+    }
+
+    VkResult MemoryAllocator::flush(const Allocation &allocation, VkDeviceSize offset, VkDeviceSize size) const {
+        if (this->isCoherent(allocation))
+            return VK_SUCCESS;
+        VkMappedMemoryRange range = this->getMappedRange(allocation, offset, size);
+        return vkFlushMappedMemoryRanges(mApp->device, 1, &range);
+    }
+
+    VkResult MemoryAllocator::invalidate(const Allocation &allocation, VkDeviceSize offset, VkDeviceSize size) const {
+        if (this->isCoherent(allocation))
+            return VK_SUCCESS;
+        VkMappedMemoryRange range = this->getMappedRange(allocation, offset, size);
+        return vkInvalidateMappedMemoryRanges(mApp->device, 1, &range);
+    }
+
+    MemoryStatistics MemoryAllocator::getStatistics() const {
+        MemoryStatistics stats;
+        for (auto &blocks : mBlocks) {
+            for (MemoryBlock* block : blocks) {
+                stats.blockCount ++;
+                stats.allocationCount += block->allocationCount;
+                stats.blockBytes += block->size;
+                stats.usedBytes += block->used;
+            }
+        }
+        return stats;
+    }
+
+    void MemoryAllocator::printStatistics() const {
+        MemoryStatistics stats = this->getStatistics();
+        std::cout << "MemoryAllocator: " << stats.allocationCount << " allocations in " << stats.blockCount
+                  << " blocks, " << stats.usedBytes / 1024 << " KiB used of " << stats.blockBytes / 1024 << " KiB" << std::endl;
+        for (uint32_t type = 0; type < mMemoryProperties.memoryTypeCount; type ++) {
+            for (MemoryBlock* block : mBlocks[type]) {
+                std::cout << "\tType " << type << (block->dedicated ? " dedicated" : "") << " block: "
+                          << block->allocationCount << " allocations, " << block->used / 1024 << "/" << block->size / 1024
+                          << " KiB (" << (100.0 * static_cast<double>(block->used) / static_cast<double>(block->size)) << "%), "
+                          << block->chunks.size() << " chunks" << std::endl;
+            }
+        }
+    }
+}
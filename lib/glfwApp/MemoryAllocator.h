@@ -0,0 +1,79 @@
+#ifndef TRIANGLE_MEMORYALLOCATOR_H
+#define TRIANGLE_MEMORYALLOCATOR_H
+
+#include "common.h"
+#include <map>
+
+namespace glfw {
+    class glfwApp;
+    struct MemoryBlock;
+
+    /**
+     * What lives in a range of a block. Linear resources (buffers, linear images) and optimal images
+     * must not share a bufferImageGranularity page, so the allocator keeps track of both.
+     */
+    enum class AllocationKind : uint8_t {
+        Free = 0,
+        Buffer,
+        ImageLinear,
+        ImageOptimal
+    };
+
+    struct Allocation {
+        MemoryBlock* block = nullptr;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        uint32_t memoryType = 0;
+    };
+
+    struct MemoryStatistics {
+        uint32_t blockCount = 0;
+        uint32_t allocationCount = 0;
+        VkDeviceSize blockBytes = 0;
+        VkDeviceSize usedBytes = 0;
+    };
+
+    /**
+     * Sub-allocates device memory out of large per-memory-type blocks, so that every Buffer and
+     * Texture does not need its own vkAllocateMemory.
+     */
+    class MemoryAllocator {
+    public:
+        MemoryAllocator(glfwApp* app);
+        virtual ~MemoryAllocator();
+        MemoryAllocator(const MemoryAllocator&) = delete;
+
+        VkResult allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags memoryProperties,
+                          AllocationKind kind, Allocation& allocation, VkMemoryAllocateFlags allocateFlags = 0);
+        void free(Allocation& allocation);
+
+        void* map(const Allocation& allocation);
+        void unmap(const Allocation& allocation);
+        bool isCoherent(const Allocation& allocation) const;
+        VkResult flush(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size) const;
+        VkResult invalidate(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size) const;
+
+        uint32_t findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags memoryProperties) const;
+
+        MemoryStatistics getStatistics() const;
+        void printStatistics() const;
+
+        void destroy();
+    private:
+        VkResult createBlock(uint32_t memoryType, VkDeviceSize size, VkMemoryAllocateFlags allocateFlags, bool dedicated, MemoryBlock*& block);
+        void destroyBlock(MemoryBlock* block);
+        bool allocateFromBlock(MemoryBlock* block, VkDeviceSize size, VkDeviceSize alignment, AllocationKind kind, Allocation& allocation);
+        VkMappedMemoryRange getMappedRange(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size) const;
+
+        glfwApp* mApp;
+        VkPhysicalDeviceMemoryProperties mMemoryProperties;
+        VkDeviceSize mBufferImageGranularity;
+        VkDeviceSize mNonCoherentAtomSize;
+        VkDeviceSize mPreferredBlockSize[VK_MAX_MEMORY_TYPES];
+        std::vector<MemoryBlock*> mBlocks[VK_MAX_MEMORY_TYPES];
+    };
+}
+
+
+#endif //TRIANGLE_MEMORYALLOCATOR_H
@@ -6,10 +6,36 @@
 #include "SubMesh.h"
 #include "glfwApp.h"
 #include "TextureManager.h"
+#include "UploadContext.h"
+#include "InstanceGroup.h"
+#include "MeshManager.h"
+#include "GeometryPool.h"
+#include "ThreadPool.h"
+#include <filesystem>
 
 namespace glfw {
+    namespace {
+        // Elements converted and uploaded at a time by loadMeshFile.
+        const uint32_t kUploadWindow = 1 << 16;
+        // Triangles kept in the Occluder of every mesh.
+        const uint32_t kOccluderTriangles = 512;
+        // Projected error (pixels) a level may have to be selected, and the share of it a coarser one needs.
+        const float kLodPixelError = 1.0f;
+        const float kLodHysteresis = 0.75f;
+    }
+
     Mesh::Mesh(glfwApp *app) {
         mApp = app;
+        matIDBuffer = NULL;
+        meshletBuffer = nullptr;
+        mMeshletCount = 0;
+        meshletVertexBuffer = nullptr;
+        meshletTriangleBuffer = nullptr;
+        mInstanceGroup = nullptr;
+        mGeometry = 0;
+        mHasGeometry = false;
+        mPositionScale = glm::vec3(1.0f);
+        mPositionOffset = glm::vec3(0.0f);
     }
 
     Mesh::~Mesh() {
@@ -17,53 +43,255 @@ namespace glfw {
     }
 
     void Mesh::destroy() {
-        if (this->vertexBuffer) {
-            delete this->vertexBuffer;
-            this->vertexBuffer = NULL;
+        if (this->mInstanceGroup) {
+            delete this->mInstanceGroup;
+            this->mInstanceGroup = nullptr;
+        }
+        if (this->mHasGeometry) {
+            mApp->meshManager->getGeometryPool()->free(this->mGeometry);
+            this->mHasGeometry = false;
         }
+        if (this->matIDBuffer) {
+            delete this->matIDBuffer;
+            this->matIDBuffer = NULL;
+        }
+        delete this->meshletBuffer;
+        this->meshletBuffer = nullptr;
+        delete this->meshletVertexBuffer;
+        this->meshletVertexBuffer = nullptr;
+        delete this->meshletTriangleBuffer;
+        this->meshletTriangleBuffer = nullptr;
         for (SubMesh* &smesh : submesh) {
             delete smesh;
         }
         submesh.resize(0);
+        mBounds = Bounds{};
+        mOccluder = Occluder{};
+        this->mMeshletCount = 0;
+        mLodErrors.clear();
+    }
+
+    int32_t Mesh::getVertexOffset() const {
+        return mApp->meshManager->getGeometryPool()->getVertexOffset(this->mGeometry);
+    }
+
+    uint32_t Mesh::getFirstIndex() const {
+        return mApp->meshManager->getGeometryPool()->getFirstIndex(this->mGeometry);
+    }
+
+    VkIndexType Mesh::getIndexType() const {
+        return mApp->meshManager->getGeometryPool()->getIndexType(this->mGeometry);
+    }
+
+    glm::vec3 Mesh::getPositionScale() const {
+        return this->mPositionScale;
+    }
+
+    glm::vec3 Mesh::getPositionOffset() const {
+        return this->mPositionOffset;
+    }
+
+    const Bounds &Mesh::getBounds() const {
+        return this->mBounds;
+    }
+
+    const Occluder &Mesh::getOccluder() const {
+        return this->mOccluder;
+    }
+
+    uint32_t Mesh::getMeshletCount() const {
+        return this->mMeshletCount;
+    }
+
+    uint32_t Mesh::getLodCount() const {
+        return std::max<uint32_t>(static_cast<uint32_t>(this->mLodErrors.size()), 1u);
+    }
+
+    float Mesh::getLodError(uint32_t level) const {
+        return level < this->mLodErrors.size() ? this->mLodErrors[level] : 0.0f;
     }
 
-    void Mesh::loadObject(const char *filename, VkCommandPool commandPool, VkQueue graphicsQueue) {
-        this->vertexBuffer = new glfw::Buffer(mApp);
-        tinyobj::attrib_t attrib;
-        std::vector<tinyobj::shape_t> shapes;
-        std::vector<tinyobj::material_t> materials;
-        std::string err;
-        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filename))
-            throw std::runtime_error(err);
+    uint32_t Mesh::selectLod(float pixelsPerUnit, uint32_t current) const {
+        // The eye is inside, as cull.comp.
+        if (std::isinf(pixelsPerUnit))
+            return 0;
+        const uint32_t count = this->getLodCount();
+        current = std::min(current, count - 1);
+        while (current > 0 && this->mLodErrors[current] * pixelsPerUnit > kLodPixelError)
+            current --;
+        while (current + 1 < count && this->mLodErrors[current + 1] * pixelsPerUnit <= kLodPixelError * kLodHysteresis)
+            current ++;
+        return current;
+    }
 
-        std::unordered_map<Vertex, uint32_t> tmp_vert_pool;
-        std::vector<Vertex> tmp_vert;
+    InstanceGroup *Mesh::getInstanceGroup() {
+        if (!this->mInstanceGroup)
+            this->mInstanceGroup = new InstanceGroup(mApp, this);
+        return this->mInstanceGroup;
+    }
 
-        fprintf(stdout, "Decoding Mesh\n");
+    void Mesh::loadObject(const char *filename) {
+        MeshFile file;
+        std::string cookedName = MeshFile::getCookedPath(filename);
+        std::error_code error;
+        uint64_t sourceSize = std::filesystem::file_size(filename, error);
+        if (MeshFile::isUpToDate(cookedName, filename) && file.read(cookedName)) {
+            fprintf(stdout, "Loading cooked Mesh %s\n", cookedName.c_str());
+        } else if (!error && sourceSize >= MeshFile::kStreamingImportSize) {
+            // Too big to import in memory, stream it into the cache and map that.
+            fprintf(stdout, "Streaming Mesh\n");
+            MeshFile::OptimizeStats stats{};
+            if (!MeshFile::streamObj(filename, cookedName, *mApp->threadPool, &stats) || !file.read(cookedName))
+                throw std::runtime_error("Mesh: failed to stream " + std::string(filename) + " into " + cookedName + "!");
+            fprintf(stdout, "Mesh: ACMR %.3f -> %.3f\n", stats.acmrBefore, stats.acmrAfter);
+        } else {
+            fprintf(stdout, "Decoding Mesh\n");
+            file.importObj(filename, *mApp->threadPool);
+            MeshFile::OptimizeStats stats = file.optimize();
+            fprintf(stdout, "Mesh: ACMR %.3f -> %.3f\n", stats.acmrBefore, stats.acmrAfter);
+            file.generateLods(mApp->threadPool);
+            file.buildMeshlets();
+            // Next start maps this instead of parsing the OBJ again.
+            if (!file.write(cookedName, filename))
+                fprintf(stdout, "Mesh: failed to write cache %s\n", cookedName.c_str());
+        }
+        this->loadMeshFile(file);
+    }
 
-        mMats.resize(materials.size());
-        for (auto& mat : materials) {
-            std::cout << "TEX:" << mat.diffuse_texname << std::endl;
-            mMats.push_back(mApp->textureManager->getTexture(mat.diffuse_texname.c_str(), commandPool, graphicsQueue));
+    void Mesh::loadMeshFile(const MeshFile &file) {
+        mMats.reserve(file.materials.size());
+        for (auto& mat : file.materials) {
+            std::cout << "TEX:" << mat << std::endl;
+            mMats.push_back(mApp->textureManager->requestTexture(mat.c_str()));
         }
+        // All materials decode in parallel, uploads go out in one batch.
+        mApp->textureManager->flush();
 
-        for (auto& shape : shapes) {
+        for (uint32_t i = 0; i < file.submeshes.size(); i ++) {
             SubMesh* smesh = new SubMesh(mApp);
-            smesh->loadSubMesh(shape, attrib, tmp_vert_pool, tmp_vert, this->vertexBuffer, commandPool, graphicsQueue);
+            smesh->loadSubMesh(file, i);
+            this->mBounds.merge(smesh->bounds);
             this->submesh.push_back(smesh);
         }
+        // While the file is still around, the pool only gets the GPU copy.
+        this->mOccluder = Occluder::build(file, kOccluderTriangles);
+
+        /**
+         * Levels of detail come cooked with the file, their indices and material ids after those of
+         * level 0 in the same streams, so a level is only another set of ranges.
+         */
+        this->mLodErrors = file.lodErrors;
+        for (uint32_t level = 1; level < file.getLodCount(); level ++) {
+            for (uint32_t i = 0; i < this->submesh.size(); i ++) {
+                const MeshFile::Range& range = file.getLod(level, i);
+                SubMesh::Lod lod{};
+                lod.firstIndex = range.firstIndex;
+                lod.indexCount = range.indexCount;
+                lod.firstFace = range.firstFace;
+                lod.firstMeshlet = range.firstMeshlet;
+                lod.meshletCount = range.meshletCount;
+                this->submesh[i]->lods.push_back(lod);
+            }
+        }
+        const uint32_t indexCount = file.getIndexCount() + file.getLodIndexCount();
+        fprintf(stdout, "Mesh: %u levels of detail\n", this->getLodCount());
+
+        /**
+         * Meshlets of every submesh and level come cooked too. They, and with mesh shaders their vertex
+         * and triangle lists, go from the file to the GPU as they are. GpuCuller gathers them into one
+         * buffer of each, like the material ids.
+         */
+        const VkBufferUsageFlags meshletUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        this->mMeshletCount = file.getMeshletCount();
+        this->meshletBuffer = new glfw::Buffer(mApp);
+        this->meshletBuffer->create(sizeof(Meshlet) * std::max(this->mMeshletCount, 1u), meshletUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        if (this->mMeshletCount)
+            mApp->uploadContext->uploadBuffer(*this->meshletBuffer, file.getMeshlets(), sizeof(Meshlet) * this->mMeshletCount);
+        if (mApp->meshShaderSupported) {
+            const uint32_t triangleCount = file.getFaceCount() + file.getLodFaceCount();
+            this->meshletVertexBuffer = new glfw::Buffer(mApp);
+            this->meshletTriangleBuffer = new glfw::Buffer(mApp);
+            this->meshletVertexBuffer->create(sizeof(uint32_t) * std::max(file.getMeshletVertexCount(), 1u), meshletUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            this->meshletTriangleBuffer->create(sizeof(uint32_t) * std::max(triangleCount, 1u), meshletUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            if (file.getMeshletVertexCount())
+                mApp->uploadContext->uploadBuffer(*this->meshletVertexBuffer, file.getMeshletVertices(), sizeof(uint32_t) * file.getMeshletVertexCount());
+            if (triangleCount)
+                mApp->uploadContext->uploadBuffer(*this->meshletTriangleBuffer, file.getMeshletTriangles(), sizeof(uint32_t) * triangleCount);
+        }
+
+        /**
+         * Indices are stored as uint16_t when every submesh references a span of at most 65536 vertices,
+         * each submesh rebased to the lowest vertex it uses through its vertexOffset. Its levels of detail
+         * only use vertices of level 0, the same offset holds for them.
+         */
+        const uint32_t* indices = file.getIndices();
+        bool shortIndices = true;
+        for (uint32_t i = 0; i < file.submeshes.size() && shortIndices; i ++) {
+            const MeshFile::Range& range = file.submeshes[i];
+            if (!range.indexCount)
+                continue;
+            auto span = std::minmax_element(indices + range.firstIndex, indices + range.firstIndex + range.indexCount);
+            this->submesh[i]->vertexOffset = static_cast<int32_t>(*span.first);
+            shortIndices = *span.second - *span.first <= 0xFFFF;
+        }
+        if (!shortIndices) {
+            for (SubMesh* smesh : this->submesh)
+                smesh->vertexOffset = 0;
+        }
+        VkIndexType indexType = shortIndices ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+
+        /**
+         * Vertices and indices go into the shared pool, submeshes draw from it by range. A compact pool
+         * gets the vertices quantized against the bounds of the whole mesh, submeshes share them.
+         * Whatever is converted on the way is converted and uploaded kUploadWindow elements at a time,
+         * so a mapped cache of any size loads without a full copy in host memory.
+         */
+        GeometryPool* pool = mApp->meshManager->getGeometryPool();
+        this->mGeometry = pool->reserve(file.getVertexCount(), indexCount, indexType);
+        this->mHasGeometry = true;
+        const Vertex* vertices = file.getVertices();
+        if (mApp->meshManager->getVertexFormat() == VertexFormat::Compact) {
+            CompactVertex::getQuantization(vertices, file.getVertexCount(), this->mPositionScale, this->mPositionOffset);
+            std::vector<CompactVertex> window(std::min(kUploadWindow, file.getVertexCount()));
+            for (uint32_t first = 0; first < file.getVertexCount(); first += kUploadWindow) {
+                uint32_t count = std::min(kUploadWindow, file.getVertexCount() - first);
+                for (uint32_t i = 0; i < count; i ++)
+                    window[i] = CompactVertex::quantize(vertices[first + i], this->mPositionScale, this->mPositionOffset);
+                pool->uploadVertices(this->mGeometry, window.data(), first, count);
+            }
+        } else {
+            pool->uploadVertices(this->mGeometry, vertices, 0, file.getVertexCount());
+        }
+        if (shortIndices) {
+            std::vector<uint16_t> window(std::min(kUploadWindow, indexCount));
+            for (uint32_t level = 0; level < this->getLodCount(); level ++) {
+                for (SubMesh* smesh : this->submesh) {
+                    SubMesh::Lod lod = smesh->getLod(level);
+                    const uint32_t* source = indices + lod.firstIndex;
+                    for (uint32_t first = 0; first < lod.indexCount; first += kUploadWindow) {
+                        uint32_t count = std::min(kUploadWindow, lod.indexCount - first);
+                        for (uint32_t j = 0; j < count; j ++)
+                            window[j] = static_cast<uint16_t>(source[first + j] - smesh->vertexOffset);
+                        pool->uploadIndices(this->mGeometry, window.data(), lod.firstIndex + first, count);
+                    }
+                }
+            }
+        } else {
+            pool->uploadIndices(this->mGeometry, indices, 0, indexCount);
+        }
 
         {
             /**
-             * Create Vertex Buffer
+             * Create Material ID Buffer, at least one element so the descriptor is always valid.
              */
-            glfw::Buffer stagingBuffer(mApp);
-            VkDeviceSize bufferSize = sizeof(tmp_vert[0]) * tmp_vert.size();
-            stagingBuffer.create(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-            stagingBuffer.uploadData(tmp_vert.data(), bufferSize, 0);
-            this->vertexBuffer->create(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-            stagingBuffer.copyTo(*this->vertexBuffer, commandPool, graphicsQueue, bufferSize);
-            stagingBuffer.destroy();
+            this->matIDBuffer = new glfw::Buffer(mApp);
+            const uint32_t faceCount = file.getFaceCount() + file.getLodFaceCount();
+            VkDeviceSize bufferSize = sizeof(uint32_t) * std::max(faceCount, 1u);
+            // Transfer source too, GpuCuller gathers the ids of all meshes into one buffer.
+            this->matIDBuffer->create(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            if (faceCount)
+                mApp->uploadContext->uploadBuffer(*this->matIDBuffer, file.getMatIDs(), sizeof(uint32_t) * faceCount);
         }
     }
 }
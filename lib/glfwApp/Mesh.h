@@ -16,26 +16,83 @@
 #include <tiny_obj_loader.h>
 #include <unordered_map>
 #include <Vertex.h>
+#include <MeshFile.h>
+#include <Frustum.h>
+#include <SoftwareOcclusion.h>
+#include <MeshletBuilder.h>
 
 namespace glfw {
     class glfwApp;
     class Buffer;
     class SubMesh;
     class Texture;
+    class InstanceGroup;
     class Mesh {
     public:
         Mesh(glfwApp* app);
         virtual ~Mesh();
 
+        // Releases the geometry and buffers at once, only when no frame in flight draws the mesh (see MeshManager::unloadMesh).
         void destroy();
 
-        void loadObject(const char* filename, VkCommandPool commandPool, VkQueue graphicsQueue);
+        // Maps the .mesh cache next to filename when it is up to date, otherwise imports the OBJ and writes the cache.
+        void loadObject(const char* filename);
+        void loadMeshFile(const MeshFile& file);
 
-        Buffer* vertexBuffer;
+        // Where the geometry of this mesh starts in the GeometryPool of MeshManager.
+        int32_t getVertexOffset() const;
+        uint32_t getFirstIndex() const;
+        VkIndexType getIndexType() const;
+        // Decodes positions of a VertexFormat::Compact pool, identity for float vertices.
+        glm::vec3 getPositionScale() const;
+        glm::vec3 getPositionOffset() const;
+        // Of every submesh, in mesh space.
+        const Bounds& getBounds() const;
+        // Largest triangles of the mesh, for SoftwareOcclusion. Kept on the CPU, the rest of the geometry is not.
+        const Occluder& getOccluder() const;
+        // In meshletBuffer.
+        uint32_t getMeshletCount() const;
+
+        // Levels of detail of every submesh, at most kMaxLods, 1 when the mesh is too small to simplify.
+        uint32_t getLodCount() const;
+        // Farthest (mesh units) the surface of level moved from level 0, growing with the level.
+        float getLodError(uint32_t level) const;
+        /**
+         * Coarsest level whose error stays under a pixel at pixelsPerUnit (LodView::getPixelsPerUnit times
+         * the scale of the instance). current is the level it was drawn at last: a coarser one is only taken
+         * once its error is well under the pixel, so an instance near the threshold does not pop back and forth.
+         */
+        uint32_t selectLod(float pixelsPerUnit, uint32_t current) const;
+        static const uint32_t kMaxLods = MeshFile::kMaxLods;
+
+        // Shared by every Instance of this mesh, created on first use.
+        InstanceGroup* getInstanceGroup();
+
+        // Material id of every face of every submesh, read by object.frag. At least one element.
+        Buffer* matIDBuffer;
+        // Meshlets of every submesh and level back to back, see SubMesh::firstMeshlet and SubMesh::Lod. At least one element.
+        Buffer* meshletBuffer;
+        /**
+         * Only with glfwApp::meshShaderSupported, read by object.mesh: the vertices of every meshlet
+         * (relative to getVertexOffset()) and per triangle its packed corners in that list, at the
+         * same position as the triangle in the index buffer. Null otherwise.
+         */
+        Buffer* meshletVertexBuffer;
+        Buffer* meshletTriangleBuffer;
         std::vector<SubMesh*> submesh;
-        std::vector<Texture*> mMats;
+        std::vector<int> mMats;
     private:
         glfwApp* mApp;
+        InstanceGroup* mInstanceGroup;
+        // GeometryPool handle, vertices and the indices of every submesh back to back.
+        uint32_t mGeometry;
+        bool mHasGeometry;
+        glm::vec3 mPositionScale;
+        glm::vec3 mPositionOffset;
+        Bounds mBounds;
+        Occluder mOccluder;
+        uint32_t mMeshletCount;
+        std::vector<float> mLodErrors;
     };
 }
 
@@ -0,0 +1,1072 @@
+#include "MeshFile.h"
+#include "MeshOptimizer.h"
+#include "VertexWelder.h"
+#include "ObjParser.h"
+#include "ThreadPool.h"
+#include "MeshSimplifier.h"
+#include <filesystem>
+#include <sstream>
+#include <cstddef>
+
+namespace glfw {
+    namespace {
+        const uint32_t kMeshFileMagic = 0x48534D54; // "TMSH"
+        const uint32_t kMeshFileVersion = 6;
+        const uint64_t kMeshFileAlignment = 16;
+        // Triangles welded by one job of the parallel import.
+        const uint32_t kWeldBlockTriangles = 1 << 16;
+        // Read window and triangles per batch of the streaming import.
+        const size_t kStreamWindowSize = 1 << 20;
+        const uint32_t kStreamBatchTriangles = 1 << 16;
+        /**
+         * Level of detail generation: each level aims at half the triangles of the one before, and is
+         * dropped (with every level after it) when it keeps more than kLodMinReduction of them or the
+         * one before has less than kLodMinTriangles. No collapse moves the surface more than
+         * kLodMaxError of the radius of the mesh.
+         */
+        const float kLodMinReduction = 0.75f;
+        const uint32_t kLodMinTriangles = 256;
+        const float kLodMaxError = 0.05f;
+
+        struct MeshFileHeader {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t sourceSize;
+            int64_t sourceTime;
+            uint64_t sourceHash;
+            uint32_t vertexCount;
+            uint32_t indexCount;
+            uint32_t faceCount;
+            uint32_t submeshCount;
+            uint32_t materialCount;
+            uint32_t vertexSize;
+            uint64_t vertexOffset;
+            uint64_t indexOffset;
+            uint64_t matIDOffset;
+            uint64_t submeshOffset;
+            uint64_t materialOffset;
+            // Stamps of the mtllib files the material names came from.
+            uint32_t libraryCount;
+            uint32_t padding;
+            uint64_t libraryOffset;
+            // Levels of detail, with level 0. Their ranges are in the table at lodOffset, see MeshFile::lods.
+            uint32_t lodCount;
+            float lodErrors[MeshFile::kMaxLods];
+            uint32_t lodPadding;
+            uint64_t lodOffset;
+            // Meshlets of every range, see MeshFile::meshlets. There is a meshlet triangle per face.
+            uint32_t meshletCount;
+            uint32_t meshletVertexCount;
+            uint64_t meshletOffset;
+            uint64_t meshletVertexOffset;
+            uint64_t meshletTriangleOffset;
+        };
+
+        // Followed by the name of the library, relative to the working directory as the importers open it.
+        struct LibraryStamp {
+            uint64_t size;
+            int64_t time;
+            uint64_t hash;
+            uint32_t nameLength;
+            uint32_t padding;
+        };
+        // LibraryStamp::size of a library that did not exist when the cache was written.
+        const uint64_t kMissingLibrary = ~0ull;
+
+        bool getSourceStamp(const char* sourceName, uint64_t& size, int64_t& time) {
+            std::error_code error;
+            size = std::filesystem::file_size(sourceName, error);
+            if (error)
+                return false;
+            time = std::filesystem::last_write_time(sourceName, error).time_since_epoch().count();
+            return !error;
+        }
+
+        // Appends the names of an mtllib line (without the keyword) to libraries.
+        void parseLibraries(const std::string& line, std::vector<std::string>& libraries) {
+            std::istringstream names(line);
+            std::string name;
+            while (names >> name)
+                if (std::find(libraries.begin(), libraries.end(), name) == libraries.end())
+                    libraries.push_back(name);
+        }
+
+        /**
+         * FNV-1a over the whole source, read through a window so huge sources do not count against memory.
+         * With libraries, also collects the mtllib names on the way, so finding them costs no extra pass.
+         */
+        bool hashSource(const char* sourceName, uint64_t& hash, std::vector<std::string>* libraries = nullptr) {
+            std::ifstream source(sourceName, std::ios::binary);
+            if (!source.is_open())
+                return false;
+            hash = 0xcbf29ce484222325ull;
+            static const char kKeyword[] = "mtllib";
+            const size_t keywordLength = sizeof(kKeyword) - 1;
+            // Only lines that still start like an mtllib line are kept.
+            std::string line;
+            bool lineStart = true, collecting = false;
+            std::vector<unsigned char> window(1 << 20);
+            while (source) {
+                source.read(reinterpret_cast<char*>(window.data()), static_cast<std::streamsize>(window.size()));
+                for (std::streamsize i = 0; i < source.gcount(); i ++) {
+                    const unsigned char c = window[i];
+                    hash ^= c;
+                    hash *= 0x100000001b3ull;
+                    if (!libraries)
+                        continue;
+                    if (c == '\n' || c == '\r') {
+                        if (collecting && line.size() > keywordLength)
+                            parseLibraries(line.substr(keywordLength), *libraries);
+                        line.clear();
+                        lineStart = true;
+                        collecting = false;
+                        continue;
+                    }
+                    if (lineStart)
+                        collecting = true;
+                    lineStart = false;
+                    if (!collecting)
+                        continue;
+                    if (line.size() < keywordLength && c != static_cast<unsigned char>(kKeyword[line.size()])) {
+                        collecting = false;
+                        line.clear();
+                    } else if (line.size() == keywordLength && c != ' ' && c != '\t') {
+                        collecting = false;
+                        line.clear();
+                    } else {
+                        line.push_back(static_cast<char>(c));
+                    }
+                }
+            }
+            if (libraries && collecting && line.size() > keywordLength)
+                parseLibraries(line.substr(keywordLength), *libraries);
+            return true;
+        }
+
+        // The library table of the cache: a LibraryStamp and the name of every library.
+        std::vector<char> packLibraries(const std::vector<std::string>& libraries) {
+            std::vector<char> data;
+            for (auto& name : libraries) {
+                LibraryStamp stamp{};
+                stamp.nameLength = static_cast<uint32_t>(name.size());
+                if (!getSourceStamp(name.c_str(), stamp.size, stamp.time) || !hashSource(name.c_str(), stamp.hash)) {
+                    stamp.size = kMissingLibrary;
+                    stamp.time = 0;
+                    stamp.hash = 0;
+                }
+                data.insert(data.end(), reinterpret_cast<const char*>(&stamp), reinterpret_cast<const char*>(&stamp) + sizeof(stamp));
+                data.insert(data.end(), name.begin(), name.end());
+            }
+            return data;
+        }
+
+        uint64_t alignOffset(uint64_t offset) {
+            return (offset + kMeshFileAlignment - 1) / kMeshFileAlignment * kMeshFileAlignment;
+        }
+
+        void padTo(std::ostream& file, uint64_t offset) {
+            static const char zeros[kMeshFileAlignment] = {};
+            uint64_t position = static_cast<uint64_t>(file.tellp());
+            assert(offset >= position);
+            for (; position < offset; position += std::min<uint64_t>(offset - position, kMeshFileAlignment))
+                file.write(zeros, static_cast<std::streamsize>(std::min<uint64_t>(offset - position, kMeshFileAlignment)));
+        }
+
+        // Appends the whole of fileName to file in window sized pieces.
+        bool appendFile(std::ostream& file, const std::string& fileName) {
+            std::ifstream input(fileName, std::ios::binary);
+            if (!input.is_open())
+                return false;
+            std::vector<char> window(kStreamWindowSize);
+            while (input) {
+                input.read(window.data(), static_cast<std::streamsize>(window.size()));
+                file.write(window.data(), input.gcount());
+            }
+            return static_cast<bool>(file);
+        }
+    }
+
+    const Vertex *MeshFile::getVertices() const {
+        return mMapping.isOpen() ? mMappedVertices : vertices.data();
+    }
+
+    uint32_t MeshFile::getVertexCount() const {
+        return mMapping.isOpen() ? mMappedVertexCount : static_cast<uint32_t>(vertices.size());
+    }
+
+    const uint32_t *MeshFile::getIndices() const {
+        return mMapping.isOpen() ? mMappedIndices : indices.data();
+    }
+
+    uint32_t MeshFile::getIndexCount() const {
+        return (mMapping.isOpen() ? mMappedIndexCount : static_cast<uint32_t>(indices.size())) - mLodIndexCount;
+    }
+
+    const uint32_t *MeshFile::getMatIDs() const {
+        return mMapping.isOpen() ? mMappedMatIDs : matIDs.data();
+    }
+
+    uint32_t MeshFile::getFaceCount() const {
+        return (mMapping.isOpen() ? mMappedFaceCount : static_cast<uint32_t>(matIDs.size())) - mLodFaceCount;
+    }
+
+    uint32_t MeshFile::getLodIndexCount() const {
+        return mLodIndexCount;
+    }
+
+    uint32_t MeshFile::getLodFaceCount() const {
+        return mLodFaceCount;
+    }
+
+    uint32_t MeshFile::getLodCount() const {
+        return std::max<uint32_t>(static_cast<uint32_t>(lodErrors.size()), 1u);
+    }
+
+    const MeshFile::Range &MeshFile::getLod(uint32_t level, uint32_t submesh) const {
+        return level ? lods[(level - 1) * submeshes.size() + submesh] : submeshes[submesh];
+    }
+
+    const Meshlet *MeshFile::getMeshlets() const {
+        return mMapping.isOpen() ? mMappedMeshlets : meshlets.data();
+    }
+
+    uint32_t MeshFile::getMeshletCount() const {
+        return mMapping.isOpen() ? mMappedMeshletCount : static_cast<uint32_t>(meshlets.size());
+    }
+
+    const uint32_t *MeshFile::getMeshletVertices() const {
+        return mMapping.isOpen() ? mMappedMeshletVertices : meshletVertices.data();
+    }
+
+    uint32_t MeshFile::getMeshletVertexCount() const {
+        return mMapping.isOpen() ? mMappedMeshletVertexCount : static_cast<uint32_t>(meshletVertices.size());
+    }
+
+    const uint32_t *MeshFile::getMeshletTriangles() const {
+        return mMapping.isOpen() ? mMappedMeshletTriangles : meshletTriangles.data();
+    }
+
+    bool MeshFile::importObj(const char *fileName) {
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> objMaterials;
+        std::string err;
+        if (!tinyobj::LoadObj(&attrib, &shapes, &objMaterials, &err, fileName))
+            throw std::runtime_error(err);
+
+        mMapping.close();
+        vertices.clear();
+        indices.clear();
+        matIDs.clear();
+        submeshes.clear();
+        materials.clear();
+        lods.clear();
+        lodErrors.clear();
+        mLodIndexCount = 0;
+        mLodFaceCount = 0;
+        meshlets.clear();
+        meshletVertices.clear();
+        meshletTriangles.clear();
+        for (auto& mat : objMaterials)
+            materials.push_back(mat.diffuse_texname);
+
+        /**
+         * All shapes share one vertex stream and are welded across, so vertices on the seams between
+         * shapes are stored once.
+         */
+        size_t cornerCount = 0;
+        for (auto& shape : shapes)
+            cornerCount += shape.mesh.num_face_vertices.size() * 3;
+        VertexWelder welder(vertices, cornerCount);
+        indices.reserve(cornerCount);
+        matIDs.reserve(cornerCount / 3);
+
+        for (auto& shape : shapes) {
+            Range range{};
+            range.firstIndex = static_cast<uint32_t>(indices.size());
+            range.firstFace = static_cast<uint32_t>(matIDs.size());
+
+            int idx = 0;
+            assert(shape.mesh.material_ids.size() == shape.mesh.num_face_vertices.size());
+            for (int fidx = 0; fidx < shape.mesh.num_face_vertices.size(); fidx ++) {
+                for (int j = 0; j < 3; idx ++, j ++) {
+                    auto &index = shape.mesh.indices[idx];
+                    Vertex vertex{};
+
+                    vertex.pos = {
+                            attrib.vertices[3 * index.vertex_index + 0],
+                            attrib.vertices[3 * index.vertex_index + 2],
+                            attrib.vertices[3 * index.vertex_index + 1]
+                    };
+                    vertex.texCoord = {0.0f, 0.0f};
+                    if (index.texcoord_index >= 0) {
+                        vertex.texCoord = {
+                                attrib.texcoords[2 * index.texcoord_index + 0],
+                                1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+                        };
+                    }
+                    vertex.color = {1.0f, 1.0f, 1.0f};
+                    indices.push_back(welder.weld(vertex));
+                }
+                matIDs.push_back(static_cast<uint32_t>(shape.mesh.material_ids[fidx]));
+            }
+
+            range.indexCount = static_cast<uint32_t>(indices.size()) - range.firstIndex;
+            range.faceCount = static_cast<uint32_t>(matIDs.size()) - range.firstFace;
+            submeshes.push_back(range);
+        }
+        return true;
+    }
+
+    bool MeshFile::importObj(const char *fileName, ThreadPool &pool) {
+        ObjParser parser(pool);
+        parser.parse(fileName);
+
+        mMapping.close();
+        vertices.clear();
+        indices.clear();
+        matIDs.clear();
+        submeshes.clear();
+        materials.clear();
+        lods.clear();
+        lodErrors.clear();
+        mLodIndexCount = 0;
+        mLodFaceCount = 0;
+        meshlets.clear();
+        meshletVertices.clear();
+        meshletTriangles.clear();
+        for (auto& mat : parser.materials)
+            materials.push_back(mat.diffuse_texname);
+
+        /**
+         * Every shape is cut into blocks that are welded on their own. Merging the block local vertices
+         * in block order through one more welder gives the same first-use order as welding serially.
+         */
+        struct Block {
+            const ObjParser::Span* span;
+            uint32_t firstTriangle;
+            uint32_t triangleCount;
+            uint32_t firstFace;
+            std::vector<Vertex> vertices;
+            std::vector<uint32_t> indices;
+            std::vector<uint32_t> remap;
+        };
+        std::vector<Block> blocks;
+        uint32_t faceCount = 0;
+        for (auto& shape : parser.shapes) {
+            Range range{};
+            range.firstIndex = faceCount * 3;
+            range.firstFace = faceCount;
+            range.indexCount = shape.triangleCount * 3;
+            range.faceCount = shape.triangleCount;
+            submeshes.push_back(range);
+            for (auto& span : shape.spans) {
+                for (uint32_t first = 0; first < span.triangleCount; first += kWeldBlockTriangles) {
+                    Block block{};
+                    block.span = &span;
+                    block.firstTriangle = first;
+                    block.triangleCount = std::min(kWeldBlockTriangles, span.triangleCount - first);
+                    block.firstFace = faceCount;
+                    faceCount += block.triangleCount;
+                    blocks.push_back(std::move(block));
+                }
+            }
+        }
+
+        const float* positions = parser.positions.data();
+        const float* texCoords = parser.texCoords.data();
+        std::vector<std::future<void>> jobs;
+        for (auto& block : blocks) {
+            jobs.push_back(pool.submit([&block, positions, texCoords]() {
+                VertexWelder welder(block.vertices, size_t(block.triangleCount) * 3);
+                block.indices.reserve(size_t(block.triangleCount) * 3);
+                const ObjParser::Corner* corners = block.span->corners + size_t(block.firstTriangle) * 3;
+                for (uint32_t i = 0; i < block.triangleCount * 3; i ++) {
+                    const ObjParser::Corner& corner = corners[i];
+                    Vertex vertex{};
+                    vertex.pos = {
+                            positions[3 * corner.position + 0],
+                            positions[3 * corner.position + 2],
+                            positions[3 * corner.position + 1]
+                    };
+                    vertex.texCoord = {0.0f, 0.0f};
+                    if (corner.texCoord != ObjParser::kNoTexCoord)
+                        vertex.texCoord = {texCoords[2 * corner.texCoord + 0], 1.0f - texCoords[2 * corner.texCoord + 1]};
+                    vertex.color = {1.0f, 1.0f, 1.0f};
+                    block.indices.push_back(welder.weld(vertex));
+                }
+            }));
+        }
+        for (auto& job : jobs)
+            job.get();
+        jobs.clear();
+
+        size_t blockVertices = 0;
+        for (auto& block : blocks)
+            blockVertices += block.vertices.size();
+        VertexWelder welder(vertices, blockVertices);
+        for (auto& block : blocks) {
+            block.remap.resize(block.vertices.size());
+            for (size_t i = 0; i < block.vertices.size(); i ++)
+                block.remap[i] = welder.weld(block.vertices[i]);
+            std::vector<Vertex>().swap(block.vertices);
+        }
+
+        indices.resize(size_t(faceCount) * 3);
+        matIDs.resize(faceCount);
+        for (auto& block : blocks) {
+            jobs.push_back(pool.submit([this, &block]() {
+                uint32_t* blockIndices = indices.data() + size_t(block.firstFace) * 3;
+                for (size_t i = 0; i < block.indices.size(); i ++)
+                    blockIndices[i] = block.remap[block.indices[i]];
+                const int* blockMaterials = block.span->materialIDs + block.firstTriangle;
+                for (uint32_t i = 0; i < block.triangleCount; i ++)
+                    matIDs[block.firstFace + i] = static_cast<uint32_t>(blockMaterials[i]);
+            }));
+        }
+        for (auto& job : jobs)
+            job.get();
+        return true;
+    }
+
+    void MeshFile::optimizeVertexFetch() {
+        const uint32_t unused = std::numeric_limits<uint32_t>::max();
+        std::vector<uint32_t> remap(vertices.size(), unused);
+        std::vector<Vertex> ordered;
+        ordered.reserve(vertices.size());
+        for (uint32_t& index : indices) {
+            if (remap[index] == unused) {
+                remap[index] = static_cast<uint32_t>(ordered.size());
+                ordered.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+        vertices.swap(ordered);
+    }
+
+    MeshFile::OptimizeStats MeshFile::optimize() {
+        OptimizeStats stats{0.0f, 0.0f};
+        double missesBefore = 0.0, missesAfter = 0.0;
+        size_t faces = 0;
+        for (auto& range : submeshes) {
+            if (range.indexCount < 3)
+                continue;
+            /**
+             * Shapes are welded across, so a submesh may share vertices with any other and its indices
+             * can span the whole stream. Work on the vertices it uses only, numbered in the order they
+             * sit in the stream: the local indices keep the relative order of the global ones.
+             */
+            uint32_t* first = indices.data() + range.firstIndex;
+            std::vector<uint32_t> used(first, first + range.indexCount);
+            std::sort(used.begin(), used.end());
+            used.erase(std::unique(used.begin(), used.end()), used.end());
+            const uint32_t vertexCount = static_cast<uint32_t>(used.size());
+            std::vector<uint32_t> local(range.indexCount);
+            for (uint32_t i = 0; i < range.indexCount; i ++)
+                local[i] = static_cast<uint32_t>(std::lower_bound(used.begin(), used.end(), first[i]) - used.begin());
+            std::vector<Vertex> localVertices(vertexCount);
+            for (uint32_t i = 0; i < vertexCount; i ++)
+                localVertices[i] = vertices[used[i]];
+
+            const size_t rangeFaces = range.indexCount / 3;
+            // Material ids are per face, they have to follow their triangles.
+            uint32_t* faceData = range.faceCount == rangeFaces ? matIDs.data() + range.firstFace : nullptr;
+            missesBefore += MeshOptimizer::computeACMR(local.data(), local.size(), vertexCount) * rangeFaces;
+            auto clusters = MeshOptimizer::optimizeVertexCache(local.data(), local.size(), vertexCount, faceData);
+            MeshOptimizer::optimizeOverdraw(local.data(), local.size(), localVertices.data(), vertexCount, clusters, faceData);
+            missesAfter += MeshOptimizer::computeACMR(local.data(), local.size(), vertexCount) * rangeFaces;
+            faces += rangeFaces;
+
+            for (uint32_t i = 0; i < range.indexCount; i ++)
+                first[i] = used[local[i]];
+        }
+        if (faces) {
+            stats.acmrBefore = static_cast<float>(missesBefore / faces);
+            stats.acmrAfter = static_cast<float>(missesAfter / faces);
+        }
+        this->optimizeVertexFetch();
+        return stats;
+    }
+
+    void MeshFile::generateLods(ThreadPool *pool) {
+        assert(!mMapping.isOpen());
+        indices.resize(this->getIndexCount());
+        matIDs.resize(this->getFaceCount());
+        lods.clear();
+        mLodIndexCount = 0;
+        mLodFaceCount = 0;
+        lodErrors.assign(1, 0.0f);
+        meshlets.clear();
+        meshletVertices.clear();
+        meshletTriangles.clear();
+
+        glm::vec3 low(std::numeric_limits<float>::max()), high(-std::numeric_limits<float>::max());
+        for (const Vertex& vertex : vertices) {
+            low = glm::min(low, vertex.pos);
+            high = glm::max(high, vertex.pos);
+        }
+        const float maxError = vertices.empty() ? 0.0f : 0.5f * glm::length(high - low) * kLodMaxError;
+
+        /**
+         * Every level from level 0, so the errors do not pile up. The error of a level is the largest
+         * of its submeshes, and never less than that of the level before.
+         */
+        struct Simplified {
+            std::vector<uint32_t> indices;
+            std::vector<uint32_t> matIDs;
+            float error = 0.0f;
+        };
+        uint32_t previousCount = static_cast<uint32_t>(indices.size());
+        for (uint32_t level = 1; level < kMaxLods && previousCount / 3 >= kLodMinTriangles; level ++) {
+            auto simplify = [this, level, maxError](const Range& range) {
+                Simplified result;
+                result.indices.resize(range.indexCount);
+                result.matIDs.resize(range.indexCount / 3);
+                size_t count = MeshSimplifier::simplify(result.indices.data(), result.matIDs.data(), indices.data() + range.firstIndex,
+                                                        matIDs.data() + range.firstFace, range.indexCount, vertices.data(),
+                                                        (range.indexCount / 3 >> level) * 3, maxError, &result.error);
+                result.indices.resize(count);
+                result.matIDs.resize(count / 3);
+                return result;
+            };
+            std::vector<Simplified> results;
+            if (pool) {
+                std::vector<std::future<Simplified>> jobs;
+                for (const Range& range : submeshes)
+                    jobs.push_back(pool->submit([&simplify, range]() { return simplify(range); }));
+                for (auto& job : jobs)
+                    results.push_back(job.get());
+            } else {
+                for (const Range& range : submeshes)
+                    results.push_back(simplify(range));
+            }
+            uint32_t count = 0;
+            for (auto& result : results)
+                count += static_cast<uint32_t>(result.indices.size());
+            if (count > previousCount * kLodMinReduction)
+                break;
+
+            float error = lodErrors.back();
+            for (auto& result : results) {
+                Range range{};
+                range.firstIndex = static_cast<uint32_t>(indices.size());
+                range.indexCount = static_cast<uint32_t>(result.indices.size());
+                range.firstFace = static_cast<uint32_t>(matIDs.size());
+                range.faceCount = static_cast<uint32_t>(result.matIDs.size());
+                indices.insert(indices.end(), result.indices.begin(), result.indices.end());
+                matIDs.insert(matIDs.end(), result.matIDs.begin(), result.matIDs.end());
+                lods.push_back(range);
+                mLodIndexCount += range.indexCount;
+                mLodFaceCount += range.faceCount;
+                error = std::max(error, result.error);
+            }
+            lodErrors.push_back(error);
+            previousCount = count;
+        }
+    }
+
+    void MeshFile::buildMeshlets() {
+        assert(!mMapping.isOpen());
+        meshlets.clear();
+        meshletVertices.clear();
+        meshletTriangles.assign(matIDs.size(), 0);
+        // Laid out like the index buffer, a range finds its triangles at firstIndex / 3.
+        std::vector<uint32_t> triangles;
+        for (uint32_t level = 0; level < this->getLodCount(); level ++) {
+            for (uint32_t i = 0; i < submeshes.size(); i ++) {
+                Range& range = level ? lods[(level - 1) * submeshes.size() + i] : submeshes[i];
+                range.firstMeshlet = static_cast<uint32_t>(meshlets.size());
+                triangles.clear();
+                MeshletBuilder::build(indices.data() + range.firstIndex, range.indexCount, vertices.data(), meshlets,
+                                      &meshletVertices, &triangles);
+                range.meshletCount = static_cast<uint32_t>(meshlets.size()) - range.firstMeshlet;
+                std::copy(triangles.begin(), triangles.end(), meshletTriangles.begin() + range.firstIndex / 3);
+            }
+        }
+    }
+
+    std::string MeshFile::getCookedPath(const char *sourceName) {
+        return std::filesystem::path(sourceName).replace_extension(".mesh").string();
+    }
+
+    bool MeshFile::isUpToDate(const std::string &cookedName, const char *sourceName) {
+        std::ifstream file(cookedName, std::ios::binary);
+        if (!file.is_open())
+            return false;
+        MeshFileHeader header{};
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+            return false;
+        if (header.magic != kMeshFileMagic || header.version != kMeshFileVersion || header.vertexSize != sizeof(Vertex))
+            return false;
+
+        uint64_t size;
+        int64_t time;
+        if (!getSourceStamp(sourceName, size, time))
+            return true; // Shipped without sources, the cooked file is all there is.
+        if (header.sourceSize != size)
+            return false;
+        /**
+         * Whatever was hashed because only its mtime changed gets the new mtime written back, so the
+         * next start takes the fast path again instead of hashing a multi-GB source every time.
+         */
+        std::vector<std::pair<uint64_t, int64_t>> refreshed;
+        if (header.sourceTime != time) {
+            uint64_t hash;
+            if (!hashSource(sourceName, hash) || header.sourceHash != hash)
+                return false;
+            refreshed.emplace_back(offsetof(MeshFileHeader, sourceTime), time);
+        }
+
+        // The material names come from the mtllib files, a changed library invalidates the cache too.
+        uint64_t offset = header.libraryOffset;
+        for (uint32_t i = 0; i < header.libraryCount; i ++) {
+            LibraryStamp stamp{};
+            file.seekg(static_cast<std::streamoff>(offset));
+            if (!file.read(reinterpret_cast<char*>(&stamp), sizeof(stamp)))
+                return false;
+            std::string name(stamp.nameLength, '\0');
+            if (!file.read(&name[0], stamp.nameLength))
+                return false;
+            uint64_t librarySize;
+            int64_t libraryTime;
+            if (!getSourceStamp(name.c_str(), librarySize, libraryTime)) {
+                if (stamp.size != kMissingLibrary)
+                    return false;
+            } else {
+                if (stamp.size != librarySize)
+                    return false;
+                if (stamp.time != libraryTime) {
+                    uint64_t hash;
+                    if (!hashSource(name.c_str(), hash) || stamp.hash != hash)
+                        return false;
+                    refreshed.emplace_back(offset + offsetof(LibraryStamp, time), libraryTime);
+                }
+            }
+            offset += sizeof(stamp) + stamp.nameLength;
+        }
+
+        if (!refreshed.empty()) {
+            file.close();
+            // Best effort, a read-only cache stays valid and is only hashed again next time.
+            std::fstream update(cookedName, std::ios::binary | std::ios::in | std::ios::out);
+            for (auto& stamp : refreshed) {
+                update.seekp(static_cast<std::streamoff>(stamp.first));
+                update.write(reinterpret_cast<const char*>(&stamp.second), sizeof(stamp.second));
+            }
+        }
+        return true;
+    }
+
+    bool MeshFile::read(const std::string &fileName) {
+        if (!mMapping.open(fileName))
+            return false;
+        const char* data = mMapping.getData();
+        const uint64_t dataSize = mMapping.getSize();
+        MeshFileHeader header{};
+        if (dataSize < sizeof(header)) {
+            mMapping.close();
+            return false;
+        }
+        std::memcpy(&header, data, sizeof(header));
+        if (header.magic != kMeshFileMagic || header.version != kMeshFileVersion || header.vertexSize != sizeof(Vertex)) {
+            mMapping.close();
+            return false;
+        }
+
+        auto inBounds = [dataSize](uint64_t offset, uint64_t bytes) {
+            return offset <= dataSize && bytes <= dataSize - offset;
+        };
+        if (!inBounds(header.vertexOffset, uint64_t(header.vertexCount) * sizeof(Vertex)) ||
+            !inBounds(header.indexOffset, uint64_t(header.indexCount) * sizeof(uint32_t)) ||
+            !inBounds(header.matIDOffset, uint64_t(header.faceCount) * sizeof(uint32_t)) ||
+            !inBounds(header.submeshOffset, uint64_t(header.submeshCount) * sizeof(Range)) ||
+            header.lodCount < 1 || header.lodCount > kMaxLods ||
+            !inBounds(header.lodOffset, uint64_t(header.lodCount - 1) * header.submeshCount * sizeof(Range)) ||
+            !inBounds(header.meshletOffset, uint64_t(header.meshletCount) * sizeof(Meshlet)) ||
+            !inBounds(header.meshletVertexOffset, uint64_t(header.meshletVertexCount) * sizeof(uint32_t)) ||
+            !inBounds(header.meshletTriangleOffset, uint64_t(header.faceCount) * sizeof(uint32_t))) {
+            mMapping.close();
+            return false;
+        }
+
+        /**
+         * The big streams stay in the mapping (the writer aligned them), only the submesh and level of
+         * detail tables and the material names are copied out.
+         */
+        vertices.clear();
+        indices.clear();
+        matIDs.clear();
+        meshlets.clear();
+        meshletVertices.clear();
+        meshletTriangles.clear();
+        mMappedVertices = reinterpret_cast<const Vertex*>(data + header.vertexOffset);
+        mMappedIndices = reinterpret_cast<const uint32_t*>(data + header.indexOffset);
+        mMappedMatIDs = reinterpret_cast<const uint32_t*>(data + header.matIDOffset);
+        mMappedVertexCount = header.vertexCount;
+        mMappedIndexCount = header.indexCount;
+        mMappedFaceCount = header.faceCount;
+        mMappedMeshlets = reinterpret_cast<const Meshlet*>(data + header.meshletOffset);
+        mMappedMeshletVertices = reinterpret_cast<const uint32_t*>(data + header.meshletVertexOffset);
+        mMappedMeshletTriangles = reinterpret_cast<const uint32_t*>(data + header.meshletTriangleOffset);
+        mMappedMeshletCount = header.meshletCount;
+        mMappedMeshletVertexCount = header.meshletVertexCount;
+
+        submeshes.resize(header.submeshCount);
+        if (header.submeshCount)
+            std::memcpy(submeshes.data(), data + header.submeshOffset, header.submeshCount * sizeof(Range));
+        lods.resize(size_t(header.lodCount - 1) * header.submeshCount);
+        if (!lods.empty())
+            std::memcpy(lods.data(), data + header.lodOffset, lods.size() * sizeof(Range));
+        lodErrors.assign(header.lodErrors, header.lodErrors + header.lodCount);
+        mLodIndexCount = 0;
+        mLodFaceCount = 0;
+        for (const Range& range : lods) {
+            mLodIndexCount += range.indexCount;
+            mLodFaceCount += range.faceCount;
+        }
+        if (mLodIndexCount > header.indexCount || mLodFaceCount > header.faceCount) {
+            mMapping.close();
+            return false;
+        }
+
+        materials.resize(header.materialCount);
+        uint64_t offset = header.materialOffset;
+        for (auto& material : materials) {
+            uint32_t length;
+            if (!inBounds(offset, sizeof(length))) {
+                mMapping.close();
+                return false;
+            }
+            std::memcpy(&length, data + offset, sizeof(length));
+            if (!inBounds(offset + sizeof(length), length)) {
+                mMapping.close();
+                return false;
+            }
+            material.assign(data + offset + sizeof(length), length);
+            offset += sizeof(length) + length;
+        }
+        return true;
+    }
+
+    bool MeshFile::write(const std::string &fileName, const char *sourceName) const {
+        MeshFileHeader header{};
+        header.magic = kMeshFileMagic;
+        header.version = kMeshFileVersion;
+        std::vector<std::string> libraries;
+        if (!getSourceStamp(sourceName, header.sourceSize, header.sourceTime) ||
+            !hashSource(sourceName, header.sourceHash, &libraries))
+            return false;
+        header.vertexCount = this->getVertexCount();
+        header.indexCount = this->getIndexCount() + this->getLodIndexCount();
+        header.faceCount = this->getFaceCount() + this->getLodFaceCount();
+        header.submeshCount = static_cast<uint32_t>(submeshes.size());
+        header.materialCount = static_cast<uint32_t>(materials.size());
+        header.vertexSize = sizeof(Vertex);
+        header.lodCount = this->getLodCount();
+        for (uint32_t i = 0; i < lodErrors.size(); i ++)
+            header.lodErrors[i] = lodErrors[i];
+        header.meshletCount = this->getMeshletCount();
+        header.meshletVertexCount = this->getMeshletVertexCount();
+
+        /**
+         * Every stream starts aligned so a reader can hand it to the GPU without repacking.
+         */
+        header.vertexOffset = alignOffset(sizeof(header));
+        header.indexOffset = alignOffset(header.vertexOffset + uint64_t(header.vertexCount) * sizeof(Vertex));
+        header.matIDOffset = alignOffset(header.indexOffset + uint64_t(header.indexCount) * sizeof(uint32_t));
+        header.meshletTriangleOffset = alignOffset(header.matIDOffset + uint64_t(header.faceCount) * sizeof(uint32_t));
+        header.meshletOffset = alignOffset(header.meshletTriangleOffset + uint64_t(header.faceCount) * sizeof(uint32_t));
+        header.meshletVertexOffset = alignOffset(header.meshletOffset + uint64_t(header.meshletCount) * sizeof(Meshlet));
+        header.submeshOffset = alignOffset(header.meshletVertexOffset + uint64_t(header.meshletVertexCount) * sizeof(uint32_t));
+        header.lodOffset = alignOffset(header.submeshOffset + submeshes.size() * sizeof(Range));
+        header.materialOffset = alignOffset(header.lodOffset + lods.size() * sizeof(Range));
+
+        std::vector<char> data(header.materialOffset);
+        std::memcpy(data.data() + header.vertexOffset, this->getVertices(), header.vertexCount * sizeof(Vertex));
+        std::memcpy(data.data() + header.indexOffset, this->getIndices(), header.indexCount * sizeof(uint32_t));
+        std::memcpy(data.data() + header.matIDOffset, this->getMatIDs(), header.faceCount * sizeof(uint32_t));
+        // Without buildMeshlets no range has meshlets, the triangle lists are left zero.
+        if (mMapping.isOpen() || meshletTriangles.size() == header.faceCount)
+            std::memcpy(data.data() + header.meshletTriangleOffset, this->getMeshletTriangles(), header.faceCount * sizeof(uint32_t));
+        std::memcpy(data.data() + header.meshletOffset, this->getMeshlets(), header.meshletCount * sizeof(Meshlet));
+        std::memcpy(data.data() + header.meshletVertexOffset, this->getMeshletVertices(), header.meshletVertexCount * sizeof(uint32_t));
+        std::memcpy(data.data() + header.submeshOffset, submeshes.data(), submeshes.size() * sizeof(Range));
+        std::memcpy(data.data() + header.lodOffset, lods.data(), lods.size() * sizeof(Range));
+        for (auto& material : materials) {
+            uint32_t length = static_cast<uint32_t>(material.size());
+            data.insert(data.end(), reinterpret_cast<const char*>(&length), reinterpret_cast<const char*>(&length) + sizeof(length));
+            data.insert(data.end(), material.begin(), material.end());
+        }
+        std::vector<char> libraryTable = packLibraries(libraries);
+        header.libraryCount = static_cast<uint32_t>(libraries.size());
+        header.libraryOffset = data.size();
+        // Complete only now that the table offset is known.
+        std::memcpy(data.data(), &header, sizeof(header));
+        data.insert(data.end(), libraryTable.begin(), libraryTable.end());
+
+        std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+            return false;
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        return static_cast<bool>(file);
+    }
+
+    bool MeshFile::streamObj(const char *sourceName, const std::string &cookedName, ThreadPool &pool,
+                             OptimizeStats *stats) {
+        MeshFileHeader header{};
+        header.magic = kMeshFileMagic;
+        header.version = kMeshFileVersion;
+        std::vector<std::string> libraries;
+        if (!getSourceStamp(sourceName, header.sourceSize, header.sourceTime) ||
+            !hashSource(sourceName, header.sourceHash, &libraries))
+            return false;
+        header.vertexSize = sizeof(Vertex);
+        header.vertexOffset = alignOffset(sizeof(header));
+
+        /**
+         * Vertices go to the cache as they come, everything else to spill files (indices, material ids,
+         * meshlet triangles and meshlets once per level of detail) that are appended once the vertex
+         * count is known. The header is written last.
+         */
+        struct Spill {
+            std::vector<std::string> names;
+            ~Spill() {
+                for (auto& name : names)
+                    std::remove(name.c_str());
+            }
+        } spill;
+        std::ofstream file(cookedName, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+            return false;
+        enum SpillStream { Indices, MatIDs, MeshletTriangles, Meshlets, SpillStreamCount };
+        static const char* kSpillNames[SpillStreamCount] = {".idx", ".mat", ".tri", ".mlt"};
+        std::vector<std::ofstream> spillFiles(kMaxLods * SpillStreamCount);
+        auto spillIndex = [](uint32_t level, SpillStream stream) {
+            return level * SpillStreamCount + stream;
+        };
+        for (uint32_t level = 0; level < kMaxLods; level ++) {
+            for (uint32_t stream = 0; stream < SpillStreamCount; stream ++) {
+                spill.names.push_back(cookedName + kSpillNames[stream] + std::to_string(level) + ".tmp");
+                spillFiles[spill.names.size() - 1].open(spill.names.back(), std::ios::binary | std::ios::trunc);
+                if (!spillFiles[spill.names.size() - 1].is_open())
+                    return false;
+            }
+        }
+        // Shared by all levels, meshlets of a batch repeating its coarsest level point to the same lists.
+        spill.names.push_back(cookedName + ".vtx.tmp");
+        std::ofstream meshletVertexFile(spill.names.back(), std::ios::binary | std::ios::trunc);
+        if (!meshletVertexFile.is_open())
+            return false;
+        padTo(file, header.vertexOffset);
+
+        struct Result {
+            MeshFile mesh;
+            OptimizeStats stats;
+            bool firstOfShape;
+        };
+        // Per level, ranges relative to the start of its spill file and how much is in it.
+        std::vector<std::vector<Range>> levelRanges(kMaxLods);
+        std::vector<uint64_t> levelFaces(kMaxLods, 0), levelMeshlets(kMaxLods, 0);
+        float levelErrors[kMaxLods] = {};
+        uint64_t vertexCount = 0, meshletVertexCount = 0;
+        double missesBefore = 0.0, missesAfter = 0.0;
+        auto append = [&](Result& result) {
+            MeshFile& mesh = result.mesh;
+            if (vertexCount + mesh.vertices.size() > std::numeric_limits<uint32_t>::max() ||
+                (levelFaces[0] + mesh.getFaceCount()) * 3 > std::numeric_limits<uint32_t>::max() ||
+                meshletVertexCount + mesh.meshletVertices.size() > std::numeric_limits<uint32_t>::max())
+                throw std::runtime_error("MeshFile: mesh too large for the cache!");
+            for (uint32_t& index : mesh.indices)
+                index += static_cast<uint32_t>(vertexCount);
+            for (uint32_t& index : mesh.meshletVertices)
+                index += static_cast<uint32_t>(vertexCount);
+            for (Meshlet& meshlet : mesh.meshlets)
+                meshlet.firstVertex += static_cast<uint32_t>(meshletVertexCount);
+            file.write(reinterpret_cast<const char*>(mesh.vertices.data()),
+                       static_cast<std::streamsize>(mesh.vertices.size() * sizeof(Vertex)));
+            meshletVertexFile.write(reinterpret_cast<const char*>(mesh.meshletVertices.data()),
+                                    static_cast<std::streamsize>(mesh.meshletVertices.size() * sizeof(uint32_t)));
+            vertexCount += mesh.vertices.size();
+            meshletVertexCount += mesh.meshletVertices.size();
+            missesBefore += double(result.stats.acmrBefore) * mesh.getFaceCount();
+            missesAfter += double(result.stats.acmrAfter) * mesh.getFaceCount();
+
+            /**
+             * A batch that stopped simplifying early fills the levels it lacks with its coarsest one,
+             * so every level covers the whole mesh.
+             */
+            for (uint32_t level = 0; level < kMaxLods; level ++) {
+                const uint32_t batchLevel = std::min(level, mesh.getLodCount() - 1);
+                const Range& batch = mesh.getLod(batchLevel, 0);
+                std::vector<Range>& ranges = levelRanges[level];
+                if (result.firstOfShape || ranges.empty())
+                    ranges.push_back({static_cast<uint32_t>(levelFaces[level] * 3), 0, static_cast<uint32_t>(levelFaces[level]), 0,
+                                      static_cast<uint32_t>(levelMeshlets[level]), 0});
+                // Meshlet triangles count from the start of the submesh, which may be batches back.
+                for (uint32_t i = 0; i < batch.meshletCount; i ++) {
+                    Meshlet meshlet = mesh.meshlets[batch.firstMeshlet + i];
+                    meshlet.firstTriangle += ranges.back().faceCount;
+                    spillFiles[spillIndex(level, Meshlets)].write(reinterpret_cast<const char*>(&meshlet), sizeof(meshlet));
+                }
+                ranges.back().indexCount += batch.indexCount;
+                ranges.back().faceCount += batch.faceCount;
+                ranges.back().meshletCount += batch.meshletCount;
+                spillFiles[spillIndex(level, Indices)].write(reinterpret_cast<const char*>(mesh.indices.data() + batch.firstIndex),
+                                                             static_cast<std::streamsize>(batch.indexCount * sizeof(uint32_t)));
+                spillFiles[spillIndex(level, MatIDs)].write(reinterpret_cast<const char*>(mesh.matIDs.data() + batch.firstFace),
+                                                            static_cast<std::streamsize>(batch.faceCount * sizeof(uint32_t)));
+                spillFiles[spillIndex(level, MeshletTriangles)].write(reinterpret_cast<const char*>(mesh.meshletTriangles.data() + batch.firstFace),
+                                                                      static_cast<std::streamsize>(batch.faceCount * sizeof(uint32_t)));
+                levelFaces[level] += batch.faceCount;
+                levelMeshlets[level] += batch.meshletCount;
+                levelErrors[level] = std::max(levelErrors[level], mesh.lodErrors[batchLevel]);
+            }
+        };
+
+        /**
+         * Batches are processed on the pool while the parser reads on, and appended in file order. At
+         * most one batch per worker is in flight, which is what bounds memory.
+         */
+        std::deque<std::future<std::unique_ptr<Result>>> inFlight;
+        const size_t maxInFlight = std::max<size_t>(pool.getThreadCount(), 1);
+        ObjParser parser(pool);
+        parser.stream(sourceName, cookedName, kStreamWindowSize, kStreamBatchTriangles, [&](const ObjParser::Batch& batch) {
+            auto result = std::make_unique<Result>();
+            result->firstOfShape = batch.firstOfShape;
+            MeshFile& mesh = result->mesh;
+            mesh.matIDs.reserve(batch.triangleCount);
+            for (uint32_t i = 0; i < batch.triangleCount; i ++)
+                mesh.matIDs.push_back(static_cast<uint32_t>(batch.materialIDs[i]));
+            // The attributes are only mapped while the parser runs, the job gets its corners gathered.
+            std::vector<Vertex> corners(size_t(batch.triangleCount) * 3);
+            for (size_t i = 0; i < corners.size(); i ++) {
+                const ObjParser::Corner& corner = batch.corners[i];
+                Vertex& vertex = corners[i];
+                vertex.pos = {
+                        batch.positions[3 * size_t(corner.position) + 0],
+                        batch.positions[3 * size_t(corner.position) + 2],
+                        batch.positions[3 * size_t(corner.position) + 1]
+                };
+                vertex.texCoord = {0.0f, 0.0f};
+                if (corner.texCoord != ObjParser::kNoTexCoord)
+                    vertex.texCoord = {batch.texCoords[2 * size_t(corner.texCoord) + 0], 1.0f - batch.texCoords[2 * size_t(corner.texCoord) + 1]};
+                vertex.color = {1.0f, 1.0f, 1.0f};
+            }
+
+            inFlight.push_back(pool.submit([result = std::move(result), corners = std::move(corners)]() mutable {
+                MeshFile& mesh = result->mesh;
+                VertexWelder welder(mesh.vertices, corners.size());
+                mesh.indices.reserve(corners.size());
+                for (const Vertex& vertex : corners)
+                    mesh.indices.push_back(welder.weld(vertex));
+                mesh.submeshes.push_back({0, static_cast<uint32_t>(mesh.indices.size()), 0, static_cast<uint32_t>(mesh.matIDs.size())});
+                result->stats = mesh.optimize();
+                // Already on a worker. The error bound is of the batch, the mesh is not known yet.
+                mesh.generateLods();
+                mesh.buildMeshlets();
+                return std::move(result);
+            }));
+            while (inFlight.size() > maxInFlight) {
+                append(*inFlight.front().get());
+                inFlight.pop_front();
+            }
+        });
+        while (!inFlight.empty()) {
+            append(*inFlight.front().get());
+            inFlight.pop_front();
+        }
+        for (auto& spillFile : spillFiles) {
+            spillFile.close();
+            if (!spillFile)
+                return false;
+        }
+        meshletVertexFile.close();
+        if (!meshletVertexFile)
+            return false;
+
+        // The same cut as generateLods, on the totals, and only as many levels as the cache can index.
+        uint32_t lodCount = 1;
+        uint64_t faceCount = levelFaces[0];
+        while (lodCount < kMaxLods && levelFaces[lodCount - 1] >= kLodMinTriangles &&
+               levelFaces[lodCount] <= levelFaces[lodCount - 1] * kLodMinReduction &&
+               (faceCount + levelFaces[lodCount]) * 3 <= std::numeric_limits<uint32_t>::max())
+            faceCount += levelFaces[lodCount ++];
+        header.lodCount = lodCount;
+        for (uint32_t level = 1; level < lodCount; level ++)
+            header.lodErrors[level] = std::max(header.lodErrors[level - 1], levelErrors[level]);
+
+        // Levels follow each other in the streams, their ranges become absolute.
+        const std::vector<Range>& submeshes = levelRanges[0];
+        std::vector<Range> lods;
+        uint64_t levelFirstFace = levelFaces[0], levelFirstMeshlet = levelMeshlets[0];
+        for (uint32_t level = 1; level < lodCount; level ++) {
+            for (Range range : levelRanges[level]) {
+                range.firstIndex += static_cast<uint32_t>(levelFirstFace * 3);
+                range.firstFace += static_cast<uint32_t>(levelFirstFace);
+                range.firstMeshlet += static_cast<uint32_t>(levelFirstMeshlet);
+                lods.push_back(range);
+            }
+            levelFirstFace += levelFaces[level];
+            levelFirstMeshlet += levelMeshlets[level];
+        }
+
+        std::vector<std::string> materials;
+        for (auto& mat : parser.materials)
+            materials.push_back(mat.diffuse_texname);
+        header.vertexCount = static_cast<uint32_t>(vertexCount);
+        header.indexCount = static_cast<uint32_t>(faceCount * 3);
+        header.faceCount = static_cast<uint32_t>(faceCount);
+        header.submeshCount = static_cast<uint32_t>(submeshes.size());
+        header.materialCount = static_cast<uint32_t>(materials.size());
+        header.indexOffset = alignOffset(header.vertexOffset + uint64_t(header.vertexCount) * sizeof(Vertex));
+        header.matIDOffset = alignOffset(header.indexOffset + uint64_t(header.indexCount) * sizeof(uint32_t));
+        header.meshletCount = static_cast<uint32_t>(levelFirstMeshlet);
+        header.meshletVertexCount = static_cast<uint32_t>(meshletVertexCount);
+        header.meshletTriangleOffset = alignOffset(header.matIDOffset + uint64_t(header.faceCount) * sizeof(uint32_t));
+        header.meshletOffset = alignOffset(header.meshletTriangleOffset + uint64_t(header.faceCount) * sizeof(uint32_t));
+        header.meshletVertexOffset = alignOffset(header.meshletOffset + uint64_t(header.meshletCount) * sizeof(Meshlet));
+        header.submeshOffset = alignOffset(header.meshletVertexOffset + uint64_t(header.meshletVertexCount) * sizeof(uint32_t));
+        header.lodOffset = alignOffset(header.submeshOffset + submeshes.size() * sizeof(Range));
+        header.materialOffset = alignOffset(header.lodOffset + lods.size() * sizeof(Range));
+
+        // Level after level, the ones cut above are left out.
+        auto appendLevels = [&](uint64_t offset, SpillStream stream) {
+            padTo(file, offset);
+            for (uint32_t level = 0; level < lodCount; level ++)
+                if (!appendFile(file, spill.names[spillIndex(level, stream)]))
+                    return false;
+            return true;
+        };
+        if (!appendLevels(header.indexOffset, Indices) || !appendLevels(header.matIDOffset, MatIDs) ||
+            !appendLevels(header.meshletTriangleOffset, MeshletTriangles) || !appendLevels(header.meshletOffset, Meshlets))
+            return false;
+        padTo(file, header.meshletVertexOffset);
+        if (!appendFile(file, spill.names.back()))
+            return false;
+        padTo(file, header.submeshOffset);
+        file.write(reinterpret_cast<const char*>(submeshes.data()), static_cast<std::streamsize>(submeshes.size() * sizeof(Range)));
+        padTo(file, header.lodOffset);
+        file.write(reinterpret_cast<const char*>(lods.data()), static_cast<std::streamsize>(lods.size() * sizeof(Range)));
+        padTo(file, header.materialOffset);
+        for (auto& material : materials) {
+            uint32_t length = static_cast<uint32_t>(material.size());
+            file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            file.write(material.data(), static_cast<std::streamsize>(material.size()));
+        }
+        std::vector<char> libraryTable = packLibraries(libraries);
+        header.libraryCount = static_cast<uint32_t>(libraries.size());
+        header.libraryOffset = static_cast<uint64_t>(file.tellp());
+        file.write(libraryTable.data(), static_cast<std::streamsize>(libraryTable.size()));
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.close();
+        if (!file)
+            return false;
+
+        if (stats) {
+            stats->acmrBefore = levelFaces[0] ? static_cast<float>(missesBefore / levelFaces[0]) : 0.0f;
+            stats->acmrAfter = levelFaces[0] ? static_cast<float>(missesAfter / levelFaces[0]) : 0.0f;
+        }
+        return true;
+    }
+}
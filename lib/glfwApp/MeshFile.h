@@ -0,0 +1,153 @@
+#ifndef TRIANGLE_MESHFILE_H
+#define TRIANGLE_MESHFILE_H
+
+#include "common.h"
+#include <Vertex.h>
+#include <MappedFile.h>
+#include <MeshletBuilder.h>
+
+namespace glfw {
+    class ThreadPool;
+
+    /**
+     * CPU side of a mesh: the deduplicated vertex stream shared by all submeshes, one index range and
+     * one run of per-face material ids per submesh, and the diffuse texture of every material. The
+     * simplified levels of detail of every submesh, when generated, follow level 0 in the index and
+     * material id streams, and the meshlets of every level of every submesh are cooked with them.
+     *
+     * It is either imported from an OBJ or read from the binary cache next to it (written by
+     * tools/cooker, or by Mesh::loadObject the first time it imports the OBJ). read() maps the cache
+     * and the vertex, index, material id and meshlet streams are used in place, so the get*() accessors are
+     * what loaders should use; the vectors only hold imported data.
+     */
+    struct MeshFile {
+        struct Range {
+            uint32_t firstIndex;
+            uint32_t indexCount;
+            uint32_t firstFace;
+            uint32_t faceCount;
+            // Of meshlets, see buildMeshlets.
+            uint32_t firstMeshlet;
+            uint32_t meshletCount;
+        };
+
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        std::vector<uint32_t> matIDs;
+        std::vector<Range> submeshes;
+        std::vector<std::string> materials;
+        /**
+         * Ranges of levels 1 and up, level after level: lods[(level - 1) * submeshes.size() + i] is
+         * submesh i at level. Into the same streams as submeshes, so they are drawn the same way.
+         */
+        std::vector<Range> lods;
+        // Farthest (mesh units) the surface of each level moved from level 0, lodErrors[0] is 0.
+        std::vector<float> lodErrors;
+        static const uint32_t kMaxLods = 4;
+        /**
+         * Meshlets of every range, level after level, their vertex lists (into vertices) and per triangle
+         * its packed corners in that list, at the position of the triangle in the material id stream.
+         */
+        std::vector<Meshlet> meshlets;
+        std::vector<uint32_t> meshletVertices;
+        std::vector<uint32_t> meshletTriangles;
+
+        const Vertex* getVertices() const;
+        uint32_t getVertexCount() const;
+        // Both streams hold every level, the counts are of level 0.
+        const uint32_t* getIndices() const;
+        uint32_t getIndexCount() const;
+        const uint32_t* getMatIDs() const;
+        uint32_t getFaceCount() const;
+        // Of all levels but 0, after getIndexCount() indices and getFaceCount() ids in the streams.
+        uint32_t getLodIndexCount() const;
+        uint32_t getLodFaceCount() const;
+        // 1 when no levels of detail were generated.
+        uint32_t getLodCount() const;
+        // Level 0 is submeshes[submesh].
+        const Range& getLod(uint32_t level, uint32_t submesh) const;
+        const Meshlet* getMeshlets() const;
+        uint32_t getMeshletCount() const;
+        const uint32_t* getMeshletVertices() const;
+        uint32_t getMeshletVertexCount() const;
+        // getFaceCount() + getLodFaceCount() of them.
+        const uint32_t* getMeshletTriangles() const;
+
+        bool importObj(const char* fileName);
+        /**
+         * Same result as importObj, parsed and welded on pool. Shapes are welded in blocks in parallel
+         * and the blocks merged in file order, so the vertex order does not depend on scheduling.
+         */
+        bool importObj(const char* fileName, ThreadPool& pool);
+        // Renumbers vertices in order of first use so the vertex stream is fetched front to back.
+        void optimizeVertexFetch();
+
+        struct OptimizeStats {
+            float acmrBefore;
+            float acmrAfter;
+        };
+        /**
+         * Reorders the triangles of every submesh for the post-transform cache and overdraw, then the
+         * vertices for fetch. Only for imported data, the cache is written already optimized.
+         */
+        OptimizeStats optimize();
+        /**
+         * Simplifies every submesh into up to kMaxLods - 1 coarser levels (MeshSimplifier, each level
+         * from level 0 and with about half the triangles of the one before) and appends them to the
+         * streams. Levels that would not save enough are left out. Only for imported data, after
+         * optimize(): generated once here, the cache then keeps them. Submeshes are simplified on pool
+         * when given.
+         */
+        void generateLods(ThreadPool* pool = nullptr);
+        /**
+         * Splits every range of every level into meshlets (MeshletBuilder) and fills in their meshlet
+         * ranges. Last step of an import, after generateLods: anything that changes the ranges drops them.
+         */
+        void buildMeshlets();
+
+        bool read(const std::string& fileName);
+        bool write(const std::string& fileName, const char* sourceName) const;
+
+        // Sources at least this big are imported with streamObj instead of importObj.
+        static const uint64_t kStreamingImportSize = 256ull << 20;
+        /**
+         * Imports sourceName straight into the cache at cookedName without holding the mesh in memory:
+         * the OBJ is streamed through ObjParser::stream, every batch of triangles is welded, optimized
+         * and given its levels of detail and meshlets on pool and appended to the cache, so host memory stays bounded
+         * by a few batches. Welding does not cross batches, vertices on batch seams are stored once per
+         * batch (and, being on a border, never move in the levels of detail). read() the cache afterwards.
+         * Throws like importObj, returns false when the cache cannot be written.
+         */
+        static bool streamObj(const char* sourceName, const std::string& cookedName, ThreadPool& pool,
+                              OptimizeStats* stats = nullptr);
+
+        // models/foo.obj -> models/foo.mesh
+        static std::string getCookedPath(const char* sourceName);
+        /**
+         * The cache records size, mtime and content hash of the source it was built from, and of the
+         * mtllib files it names. Size and mtime matching is enough, otherwise the file is hashed so a
+         * touched but unchanged OBJ (e.g. after a checkout) keeps its cache; the new mtime is then
+         * written back into the cache so later starts do not hash it again.
+         */
+        static bool isUpToDate(const std::string& cookedName, const char* sourceName);
+    private:
+        MappedFile mMapping;
+        const Vertex* mMappedVertices = nullptr;
+        const uint32_t* mMappedIndices = nullptr;
+        const uint32_t* mMappedMatIDs = nullptr;
+        uint32_t mMappedVertexCount = 0;
+        uint32_t mMappedIndexCount = 0;
+        uint32_t mMappedFaceCount = 0;
+        const Meshlet* mMappedMeshlets = nullptr;
+        const uint32_t* mMappedMeshletVertices = nullptr;
+        const uint32_t* mMappedMeshletTriangles = nullptr;
+        uint32_t mMappedMeshletCount = 0;
+        uint32_t mMappedMeshletVertexCount = 0;
+        // Sums over lods, mapped or not.
+        uint32_t mLodIndexCount = 0;
+        uint32_t mLodFaceCount = 0;
+    };
+}
+
+
+#endif //TRIANGLE_MESHFILE_H
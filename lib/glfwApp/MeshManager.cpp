@@ -5,17 +5,68 @@
 #include "MeshManager.h"
 #include <Mesh.h>
 #include <glfwApp.h>
+#include <GeometryPool.h>
 
 namespace glfw {
-    MeshManager::MeshManager(glfwApp *app) {
+    namespace {
+        const uint32_t kVertexPoolCapacity = 1 << 20;
+        // Most meshes fit 16 bit indices, the 32 bit pool only takes the rest.
+        const uint32_t kIndexPoolCapacity = 1 << 20;
+        const uint32_t kShortIndexPoolCapacity = 4 << 20;
+        const float kCompactThreshold = 0.25f;
+    }
+
+    MeshManager::MeshManager(glfwApp *app, VertexFormat format) {
         mApp = app;
+        mVertexFormat = format;
+        mFrame = 0;
+        mGeometryPool = new GeometryPool(app, getVertexSize(format), kVertexPoolCapacity, kIndexPoolCapacity,
+                                         kShortIndexPoolCapacity);
+    }
+
+    GeometryPool *MeshManager::getGeometryPool() {
+        return mGeometryPool;
+    }
+
+    VertexFormat MeshManager::getVertexFormat() const {
+        return mVertexFormat;
+    }
+
+    bool MeshManager::unloadMesh(const char *name) {
+        auto it = this->mMeshes.find(std::string(name));
+        if (it == this->mMeshes.end())
+            return false;
+        mRetired.push_back({it->second, mFrame});
+        this->mMeshes.erase(it);
+        return true;
+    }
+
+    void MeshManager::collect(uint32_t framesInFlight) {
+        mFrame ++;
+        /**
+         * Unloaded while frame mFrame was recorded: the fence just waited for is the one of frame
+         * mFrame - framesInFlight, so once that reaches it no submitted frame draws the mesh anymore.
+         */
+        bool released = false;
+        for (size_t i = 0; i < mRetired.size(); ) {
+            if (mRetired[i].frame + framesInFlight > mFrame) {
+                i ++;
+                continue;
+            }
+            delete mRetired[i].mesh;
+            mRetired[i] = mRetired.back();
+            mRetired.pop_back();
+            released = true;
+        }
+        if (released && mGeometryPool->getFragmentation() > kCompactThreshold)
+            mGeometryPool->compact();
     }
 
-    Mesh *MeshManager::getMesh(const char *name, VkCommandPool commandPool, VkQueue graphicsQueue) {
+    Mesh *MeshManager::getMesh(const char *name) {
         if (this->mMeshes.count(std::string(name)))
             return this->mMeshes[std::string(name)];
         Mesh* ret = new Mesh(mApp);
-        ret->loadObject(name, commandPool, graphicsQueue);
+        ret->loadObject(name);
         this->mMeshes[std::string(name)] = ret;
         return ret;
     }
@@ -25,5 +76,10 @@ namespace glfw {
             delete mesh.second;
         }
         mMeshes.clear();
+        for (auto& retired : mRetired)
+            delete retired.mesh;
+        mRetired.clear();
+        delete mGeometryPool;
+        mGeometryPool = nullptr;
     }
 }
@@ -11,16 +11,48 @@
 namespace glfw {
     class Mesh;
     class glfwApp;
+    class GeometryPool;
+
+    /**
+     * Owns the meshes loaded by name and the GeometryPool every Mesh puts its vertices and indices in.
+     * Every mesh is stored in the one vertex format the pool was created for.
+     */
     class MeshManager {
     public:
-        MeshManager(glfwApp* app);
+        MeshManager(glfwApp* app, VertexFormat format = VertexFormat::Float);
         virtual ~MeshManager();
         MeshManager(const MeshManager&) = delete;
 
-        Mesh* getMesh(const char* name, VkCommandPool commandPool, VkQueue graphicsQueue);
+        Mesh* getMesh(const char* name);
+        /**
+         * Forgets the mesh, false if none was loaded under name. Frames in flight may still draw it, so
+         * its geometry and buffers are only released by collect(); take it out of a GpuCuller (build()
+         * with the meshes left) before then.
+         */
+        bool unloadMesh(const char* name);
+        /**
+         * Call once a frame, after waiting for the fence of the frame about to be recorded. Releases the
+         * meshes unloaded framesInFlight frames ago or earlier and compacts the pool once too much of it
+         * is holes, which bumps GeometryPool::getGeneration.
+         */
+        void collect(uint32_t framesInFlight);
+
+        GeometryPool* getGeometryPool();
+        VertexFormat getVertexFormat() const;
     private:
+        struct Retired {
+            Mesh* mesh;
+            // mFrame at unloadMesh().
+            uint64_t frame;
+        };
+
         glfwApp* mApp;
+        VertexFormat mVertexFormat;
+        GeometryPool* mGeometryPool;
         std::unordered_map<std::string, Mesh*> mMeshes;
+        std::vector<Retired> mRetired;
+        // Calls of collect() so far.
+        uint64_t mFrame;
     };
 }
 
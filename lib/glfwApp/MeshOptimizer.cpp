@@ -0,0 +1,225 @@
+#include "MeshOptimizer.h"
+
+namespace glfw {
+    namespace MeshOptimizer {
+        namespace {
+            /**
+             * FIFO cache by timestamps: a vertex is cached while fewer than cacheSize misses happened
+             * since it was loaded.
+             */
+            struct FifoCache {
+                std::vector<uint32_t> loadedAt;
+                uint32_t time;
+                uint32_t size;
+
+                FifoCache(uint32_t vertexCount, uint32_t cacheSize) : loadedAt(vertexCount, 0), time(cacheSize + 1), size(cacheSize) {}
+
+                void reset() {
+                    time += size + 1;
+                }
+
+                uint32_t touch(uint32_t vertex) {
+                    if (time - loadedAt[vertex] <= size)
+                        return 0;
+                    loadedAt[vertex] = time ++;
+                    return 1;
+                }
+            };
+        }
+
+        float computeACMR(const uint32_t *indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize) {
+            if (indexCount < 3)
+                return 0.0f;
+            FifoCache cache(vertexCount, cacheSize);
+            size_t misses = 0;
+            for (size_t i = 0; i < indexCount; i ++)
+                misses += cache.touch(indices[i]);
+            return static_cast<float>(misses) / static_cast<float>(indexCount / 3);
+        }
+
+        std::vector<uint32_t> optimizeVertexCache(uint32_t *indices, size_t indexCount, uint32_t vertexCount,
+                                                  uint32_t *faceData, uint32_t cacheSize) {
+            std::vector<uint32_t> clusters;
+            const size_t faceCount = indexCount / 3;
+            if (faceCount == 0)
+                return clusters;
+
+            /**
+             * Vertex -> triangle adjacency, as offsets into one flat list.
+             */
+            std::vector<uint32_t> live(vertexCount, 0);
+            for (size_t i = 0; i < faceCount * 3; i ++)
+                live[indices[i]] ++;
+            std::vector<uint32_t> adjacencyOffset(vertexCount + 1, 0);
+            for (uint32_t v = 0; v < vertexCount; v ++)
+                adjacencyOffset[v + 1] = adjacencyOffset[v] + live[v];
+            std::vector<uint32_t> adjacency(adjacencyOffset[vertexCount]);
+            {
+                std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+                for (size_t i = 0; i < faceCount * 3; i ++)
+                    adjacency[fill[indices[i]] ++] = static_cast<uint32_t>(i / 3);
+            }
+
+            std::vector<uint32_t> cacheTime(vertexCount, 0);
+            std::vector<bool> emitted(faceCount, false);
+            std::vector<uint32_t> deadEnd;
+            std::vector<uint32_t> candidates;
+            std::vector<uint32_t> result, resultFaceData;
+            result.reserve(faceCount * 3);
+            resultFaceData.reserve(faceData ? faceCount : 0);
+            uint32_t time = cacheSize + 1;
+            uint32_t cursor = 0;
+
+            int64_t fanning = indices[0];
+            clusters.push_back(0);
+            while (fanning >= 0) {
+                candidates.clear();
+                for (uint32_t a = adjacencyOffset[fanning]; a < adjacencyOffset[fanning + 1]; a ++) {
+                    uint32_t face = adjacency[a];
+                    if (emitted[face])
+                        continue;
+                    emitted[face] = true;
+                    if (faceData)
+                        resultFaceData.push_back(faceData[face]);
+                    for (int k = 0; k < 3; k ++) {
+                        uint32_t v = indices[face * 3 + k];
+                        result.push_back(v);
+                        deadEnd.push_back(v);
+                        candidates.push_back(v);
+                        live[v] --;
+                        if (time - cacheTime[v] > cacheSize)
+                            cacheTime[v] = time ++;
+                    }
+                }
+
+                /**
+                 * Next fan: the candidate that stays in cache longest once its remaining triangles
+                 * are emitted. Otherwise we are at a dead end and a new cluster starts.
+                 */
+                int64_t best = -1;
+                int64_t bestPriority = -1;
+                for (uint32_t v : candidates) {
+                    if (live[v] == 0)
+                        continue;
+                    int64_t priority = 0;
+                    if (int64_t(time) - cacheTime[v] + 2 * int64_t(live[v]) <= cacheSize)
+                        priority = int64_t(time) - cacheTime[v];
+                    if (priority > bestPriority) {
+                        bestPriority = priority;
+                        best = v;
+                    }
+                }
+                if (best < 0) {
+                    while (!deadEnd.empty() && best < 0) {
+                        uint32_t v = deadEnd.back();
+                        deadEnd.pop_back();
+                        if (live[v] > 0)
+                            best = v;
+                    }
+                    while (best < 0 && cursor < vertexCount) {
+                        if (live[cursor] > 0)
+                            best = cursor;
+                        cursor ++;
+                    }
+                    if (best >= 0)
+                        clusters.push_back(static_cast<uint32_t>(result.size() / 3));
+                }
+                fanning = best;
+            }
+            std::copy(result.begin(), result.end(), indices);
+            if (faceData)
+                std::copy(resultFaceData.begin(), resultFaceData.end(), faceData);
+            return clusters;
+        }
+
+        void optimizeOverdraw(uint32_t *indices, size_t indexCount, const Vertex *vertices, uint32_t vertexCount,
+                              const std::vector<uint32_t> &clusters, uint32_t *faceData, float threshold, uint32_t cacheSize) {
+            const uint32_t faceCount = static_cast<uint32_t>(indexCount / 3);
+            if (faceCount == 0 || clusters.empty())
+                return;
+
+            /**
+             * Soft boundaries: inside a cluster, cut wherever the ACMR of the run so far is already
+             * within threshold of the ACMR of the whole cluster. The cache restarts at each cut.
+             */
+            FifoCache cache(vertexCount, cacheSize);
+            std::vector<uint32_t> starts;
+            for (size_t c = 0; c < clusters.size(); c ++) {
+                uint32_t begin = clusters[c];
+                uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : faceCount;
+                if (begin >= end)
+                    continue;
+                cache.reset();
+                uint32_t clusterMisses = 0;
+                for (uint32_t f = begin; f < end; f ++)
+                    for (int k = 0; k < 3; k ++)
+                        clusterMisses += cache.touch(indices[f * 3 + k]);
+                const float targetACMR = threshold * float(clusterMisses) / float(end - begin);
+
+                cache.reset();
+                starts.push_back(begin);
+                uint32_t runMisses = 0, runFaces = 0;
+                for (uint32_t f = begin; f < end; f ++) {
+                    for (int k = 0; k < 3; k ++)
+                        runMisses += cache.touch(indices[f * 3 + k]);
+                    runFaces ++;
+                    if (f + 1 < end && float(runMisses) / float(runFaces) <= targetACMR) {
+                        starts.push_back(f + 1);
+                        cache.reset();
+                        runMisses = runFaces = 0;
+                    }
+                }
+            }
+
+            glm::vec3 meshCentroid(0.0f);
+            for (uint32_t i = 0; i < faceCount * 3; i ++)
+                meshCentroid += vertices[indices[i]].pos;
+            meshCentroid /= float(faceCount * 3);
+
+            /**
+             * Sort key: how far the cluster faces away from the centre of the mesh. Area weighted
+             * centroid and normal of the cluster.
+             */
+            struct Cluster {
+                uint32_t begin;
+                uint32_t end;
+                float key;
+            };
+            std::vector<Cluster> sorted;
+            sorted.reserve(starts.size());
+            for (size_t c = 0; c < starts.size(); c ++) {
+                Cluster cluster{starts[c], c + 1 < starts.size() ? starts[c + 1] : faceCount, 0.0f};
+                glm::vec3 centroid(0.0f), normal(0.0f);
+                float area = 0.0f;
+                for (uint32_t f = cluster.begin; f < cluster.end; f ++) {
+                    const glm::vec3& p0 = vertices[indices[f * 3 + 0]].pos;
+                    const glm::vec3& p1 = vertices[indices[f * 3 + 1]].pos;
+                    const glm::vec3& p2 = vertices[indices[f * 3 + 2]].pos;
+                    glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+                    float a = glm::length(n);
+                    centroid += (p0 + p1 + p2) * (a / 3.0f);
+                    normal += n;
+                    area += a;
+                }
+                float normalLength = glm::length(normal);
+                if (area > 0.0f && normalLength > 0.0f)
+                    cluster.key = glm::dot(centroid / area - meshCentroid, normal / normalLength);
+                sorted.push_back(cluster);
+            }
+            std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) {
+                return a.key > b.key;
+            });
+
+            std::vector<uint32_t> result, resultFaceData;
+            result.reserve(faceCount * 3);
+            for (auto& cluster : sorted) {
+                result.insert(result.end(), indices + cluster.begin * 3, indices + cluster.end * 3);
+                if (faceData)
+                    resultFaceData.insert(resultFaceData.end(), faceData + cluster.begin, faceData + cluster.end);
+            }
+            std::copy(result.begin(), result.end(), indices);
+            if (faceData)
+                std::copy(resultFaceData.begin(), resultFaceData.end(), faceData);
+        }
+    }
+}
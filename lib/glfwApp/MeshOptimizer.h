@@ -0,0 +1,38 @@
+#ifndef TRIANGLE_MESHOPTIMIZER_H
+#define TRIANGLE_MESHOPTIMIZER_H
+
+#include "common.h"
+#include <Vertex.h>
+
+namespace glfw {
+    /**
+     * Load/cook time reordering of triangle lists. Indices passed in are local, in [0, vertexCount).
+     * Triangles keep their corner order, faceData (one entry per triangle, may be null) is permuted
+     * along with them.
+     */
+    namespace MeshOptimizer {
+        // Post-transform cache the orderings are tuned for, and ACMR is measured with (FIFO).
+        const uint32_t kCacheSize = 16;
+
+        // Average cache misses per triangle, 0.5 is the floor for large regular meshes, 3 the worst.
+        float computeACMR(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize = kCacheSize);
+
+        /**
+         * Tipsify (Sander et al. 2007): fans around the most recently used vertex that stays in cache.
+         * Returns the first triangle of each cluster, a cluster starts where the walk hit a dead end.
+         */
+        std::vector<uint32_t> optimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount,
+                                                  uint32_t* faceData = nullptr, uint32_t cacheSize = kCacheSize);
+
+        /**
+         * Splits the clusters further wherever doing so keeps ACMR within threshold, then orders them
+         * outside in (view independent), so triangles that tend to occlude are drawn first.
+         */
+        void optimizeOverdraw(uint32_t* indices, size_t indexCount, const Vertex* vertices, uint32_t vertexCount,
+                              const std::vector<uint32_t>& clusters, uint32_t* faceData = nullptr,
+                              float threshold = 1.05f, uint32_t cacheSize = kCacheSize);
+    }
+}
+
+
+#endif //TRIANGLE_MESHOPTIMIZER_H
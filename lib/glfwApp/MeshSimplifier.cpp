@@ -0,0 +1,244 @@
+#include "MeshSimplifier.h"
+#include <cmath>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace glfw {
+    namespace MeshSimplifier {
+        namespace {
+            /**
+             * Sum of squared distances to a set of planes, p^T A p + 2 b.p + c with A symmetric. Doubles,
+             * a vertex collects the planes of a whole neighbourhood and the terms nearly cancel.
+             */
+            struct Quadric {
+                double a00 = 0.0, a01 = 0.0, a02 = 0.0, a11 = 0.0, a12 = 0.0, a22 = 0.0;
+                double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+                double c = 0.0;
+
+                // Plane n.p + d = 0, n unit length.
+                void addPlane(const glm::vec3& n, float d) {
+                    a00 += n.x * n.x; a01 += n.x * n.y; a02 += n.x * n.z;
+                    a11 += n.y * n.y; a12 += n.y * n.z; a22 += n.z * n.z;
+                    b0 += n.x * d; b1 += n.y * d; b2 += n.z * d;
+                    c += double(d) * d;
+                }
+
+                void add(const Quadric& other) {
+                    a00 += other.a00; a01 += other.a01; a02 += other.a02;
+                    a11 += other.a11; a12 += other.a12; a22 += other.a22;
+                    b0 += other.b0; b1 += other.b1; b2 += other.b2;
+                    c += other.c;
+                }
+
+                double evaluate(const glm::vec3& p) const {
+                    double x = p.x, y = p.y, z = p.z;
+                    double result = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                                    2.0 * (b0 * x + b1 * y + b2 * z) + c;
+                    return std::max(result, 0.0);
+                }
+            };
+
+            // Moves vertex `from` onto `to`, both local.
+            struct Collapse {
+                uint32_t from;
+                uint32_t to;
+                double error;
+            };
+
+            // Below this the normal turned more than about 75 degrees, the triangle folds over.
+            const float kMinNormalDot = 0.25f;
+
+            /**
+             * Whether moving `from` onto `to` turns any of the triangles around `from` over. Triangles
+             * with both go away with the collapse and are not checked.
+             */
+            bool flips(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& triangles,
+                       const uint32_t* around, uint32_t aroundCount, uint32_t from, uint32_t to) {
+                for (uint32_t i = 0; i < aroundCount; i ++) {
+                    const uint32_t* corners = &triangles[around[i] * 3];
+                    if (corners[0] == to || corners[1] == to || corners[2] == to)
+                        continue;
+                    glm::vec3 p[3], q[3];
+                    for (int k = 0; k < 3; k ++) {
+                        p[k] = positions[corners[k]];
+                        q[k] = corners[k] == from ? positions[to] : p[k];
+                    }
+                    glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                    glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                    // Degenerating counts too, it leaves a sliver when the corners line up.
+                    if (glm::dot(before, after) <= kMinNormalDot * glm::length(before) * glm::length(after))
+                        return true;
+                }
+                return false;
+            }
+        }
+
+        size_t simplify(uint32_t *destination, uint32_t *destinationFaceData, const uint32_t *indices,
+                        const uint32_t *faceData, size_t indexCount, const Vertex *vertices,
+                        size_t targetIndexCount, float maxError, float *error) {
+            /**
+             * Local vertices in order of first use, the triangles are rewritten in those.
+             */
+            std::unordered_map<uint32_t, uint32_t> localIDs;
+            std::vector<uint32_t> globalIDs;
+            std::vector<uint32_t> triangles(indexCount);
+            for (size_t i = 0; i < indexCount; i ++) {
+                auto inserted = localIDs.emplace(indices[i], static_cast<uint32_t>(globalIDs.size()));
+                if (inserted.second)
+                    globalIDs.push_back(indices[i]);
+                triangles[i] = inserted.first->second;
+            }
+            std::vector<uint32_t> faces;
+            if (faceData && destinationFaceData)
+                faces.assign(faceData, faceData + indexCount / 3);
+            const uint32_t vertexCount = static_cast<uint32_t>(globalIDs.size());
+            std::vector<glm::vec3> positions(vertexCount);
+            for (uint32_t v = 0; v < vertexCount; v ++)
+                positions[v] = vertices[globalIDs[v]].pos;
+
+            /**
+             * Vertices sharing a position are welded into the first of them to find the borders of the
+             * surface, and locked: moving one copy of a seam would tear it open.
+             */
+            std::vector<uint32_t> welded(vertexCount);
+            std::vector<char> locked(vertexCount, 0);
+            {
+                std::vector<uint32_t> order(vertexCount);
+                std::iota(order.begin(), order.end(), 0u);
+                auto less = [&positions](uint32_t a, uint32_t b) {
+                    const glm::vec3& p = positions[a];
+                    const glm::vec3& q = positions[b];
+                    return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+                };
+                std::sort(order.begin(), order.end(), less);
+                for (uint32_t i = 0; i < vertexCount; ) {
+                    uint32_t end = i + 1;
+                    while (end < vertexCount && positions[order[end]] == positions[order[i]])
+                        end ++;
+                    uint32_t first = *std::min_element(order.begin() + i, order.begin() + end);
+                    for (uint32_t j = i; j < end; j ++) {
+                        welded[order[j]] = first;
+                        locked[order[j]] = end - i > 1;
+                    }
+                    i = end;
+                }
+            }
+            {
+                // An edge of the welded surface without its twin is on a border.
+                std::unordered_set<uint64_t> edges;
+                edges.reserve(indexCount);
+                auto key = [](uint32_t a, uint32_t b) { return (uint64_t(a) << 32) | b; };
+                for (size_t t = 0; t < indexCount / 3; t ++)
+                    for (int k = 0; k < 3; k ++)
+                        edges.insert(key(welded[triangles[t * 3 + k]], welded[triangles[t * 3 + (k + 1) % 3]]));
+                for (size_t t = 0; t < indexCount / 3; t ++) {
+                    for (int k = 0; k < 3; k ++) {
+                        uint32_t a = triangles[t * 3 + k], b = triangles[t * 3 + (k + 1) % 3];
+                        if (!edges.count(key(welded[b], welded[a])))
+                            locked[a] = locked[b] = 1;
+                    }
+                }
+            }
+
+            std::vector<Quadric> quadrics(vertexCount);
+            for (size_t t = 0; t < indexCount / 3; t ++) {
+                const uint32_t* corners = &triangles[t * 3];
+                glm::vec3 normal = glm::cross(positions[corners[1]] - positions[corners[0]], positions[corners[2]] - positions[corners[0]]);
+                float length = glm::length(normal);
+                if (!(length > 0.0f))
+                    continue;
+                normal /= length;
+                float d = -glm::dot(normal, positions[corners[0]]);
+                for (int k = 0; k < 3; k ++)
+                    quadrics[corners[k]].addPlane(normal, d);
+            }
+
+            /**
+             * In passes: every edge collapse is priced, then the cheapest are applied as long as none of
+             * them touches a triangle another one changed, which keeps the prices and flip tests of a pass valid.
+             */
+            const double maxError2 = double(maxError) * maxError;
+            double worst = 0.0;
+            std::vector<uint32_t> remap(vertexCount);
+            std::vector<char> touched(vertexCount);
+            std::vector<uint32_t> aroundOffsets(vertexCount + 1), around;
+            std::vector<Collapse> collapses;
+            while (triangles.size() > targetIndexCount) {
+                const size_t triangleCount = triangles.size() / 3;
+                std::fill(aroundOffsets.begin(), aroundOffsets.end(), 0u);
+                for (uint32_t index : triangles)
+                    aroundOffsets[index + 1] ++;
+                std::partial_sum(aroundOffsets.begin(), aroundOffsets.end(), aroundOffsets.begin());
+                around.resize(triangles.size());
+                {
+                    std::vector<uint32_t> fill(aroundOffsets.begin(), aroundOffsets.end() - 1);
+                    for (size_t i = 0; i < triangles.size(); i ++)
+                        around[fill[triangles[i]] ++] = static_cast<uint32_t>(i / 3);
+                }
+
+                collapses.clear();
+                for (size_t i = 0; i < triangles.size(); i ++) {
+                    uint32_t a = triangles[i], b = triangles[i - i % 3 + (i % 3 + 1) % 3];
+                    if (!locked[a])
+                        collapses.push_back({a, b, quadrics[a].evaluate(positions[b]) + quadrics[b].evaluate(positions[b])});
+                    if (!locked[b])
+                        collapses.push_back({b, a, quadrics[a].evaluate(positions[a]) + quadrics[b].evaluate(positions[a])});
+                }
+                std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.error < y.error; });
+
+                std::iota(remap.begin(), remap.end(), 0u);
+                std::fill(touched.begin(), touched.end(), 0);
+                const size_t excess = triangleCount - targetIndexCount / 3;
+                size_t removed = 0, applied = 0;
+                for (const Collapse& collapse : collapses) {
+                    if (collapse.error > maxError2 || removed >= excess)
+                        break;
+                    if (touched[collapse.from] || touched[collapse.to])
+                        continue;
+                    const uint32_t* first = around.data() + aroundOffsets[collapse.from];
+                    const uint32_t count = aroundOffsets[collapse.from + 1] - aroundOffsets[collapse.from];
+                    if (flips(positions, triangles, first, count, collapse.from, collapse.to))
+                        continue;
+                    remap[collapse.from] = collapse.to;
+                    quadrics[collapse.to].add(quadrics[collapse.from]);
+                    worst = std::max(worst, collapse.error);
+                    for (uint32_t i = 0; i < count; i ++) {
+                        const uint32_t* corners = &triangles[first[i] * 3];
+                        // The triangles on the edge degenerate.
+                        if (corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to)
+                            removed ++;
+                        touched[corners[0]] = touched[corners[1]] = touched[corners[2]] = 1;
+                    }
+                    applied ++;
+                }
+                if (!applied)
+                    break;
+
+                size_t kept = 0;
+                for (size_t t = 0; t < triangleCount; t ++) {
+                    uint32_t a = remap[triangles[t * 3]], b = remap[triangles[t * 3 + 1]], c = remap[triangles[t * 3 + 2]];
+                    if (a == b || b == c || a == c)
+                        continue;
+                    triangles[kept * 3] = a;
+                    triangles[kept * 3 + 1] = b;
+                    triangles[kept * 3 + 2] = c;
+                    if (!faces.empty())
+                        faces[kept] = faces[t];
+                    kept ++;
+                }
+                triangles.resize(kept * 3);
+                if (!faces.empty())
+                    faces.resize(kept);
+            }
+
+            for (size_t i = 0; i < triangles.size(); i ++)
+                destination[i] = globalIDs[triangles[i]];
+            if (!faces.empty())
+                std::copy(faces.begin(), faces.end(), destinationFaceData);
+            if (error)
+                *error = static_cast<float>(std::sqrt(worst));
+            return triangles.size();
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef TRIANGLE_MESHSIMPLIFIER_H
+#define TRIANGLE_MESHSIMPLIFIER_H
+
+#include "common.h"
+#include <Vertex.h>
+
+namespace glfw {
+    /**
+     * Load/cook time level of detail generation. Quadric error metric (Garland and Heckbert 1997) by
+     * half edge collapse: a vertex is only ever moved onto a neighbour, so the result indexes a subset
+     * of the input vertices and every triangle left is an input triangle with some corners moved.
+     */
+    namespace MeshSimplifier {
+        /**
+         * Simplifies the triangles of indices (into vertices) into destination, at most indexCount
+         * indices, and returns how many. faceData (one entry per triangle, may be null) is carried into
+         * destinationFaceData along with the triangles that are left.
+         *
+         * Collapses cheapest first until targetIndexCount is reached or the next one would move the
+         * surface farther than maxError. Vertices on a border or a UV seam (another vertex at the same
+         * position) never move, so the outline and the texture layout are kept. error, when given,
+         * receives the largest distance (mesh units) a collapse moved the surface, as the quadrics estimate it.
+         */
+        size_t simplify(uint32_t* destination, uint32_t* destinationFaceData, const uint32_t* indices,
+                        const uint32_t* faceData, size_t indexCount, const Vertex* vertices,
+                        size_t targetIndexCount, float maxError, float* error = nullptr);
+    }
+}
+
+
+#endif //TRIANGLE_MESHSIMPLIFIER_H
@@ -0,0 +1,102 @@
+#include "MeshletBuilder.h"
+#include <cmath>
+
+namespace glfw {
+    namespace MeshletBuilder {
+        namespace {
+            // Below this the normals spread over more than about 84 degrees, the cone would never cull.
+            const float kMinConeDot = 0.1f;
+
+            // Sphere and normal cone of triangles [first, first + count) of indices.
+            void computeBounds(Meshlet& meshlet, const uint32_t* indices, uint32_t first, uint32_t count, const Vertex* vertices) {
+                glm::vec3 lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+                for (uint32_t i = first * 3; i < (first + count) * 3; i ++) {
+                    lo = glm::min(lo, vertices[indices[i]].pos);
+                    hi = glm::max(hi, vertices[indices[i]].pos);
+                }
+                glm::vec3 center = (lo + hi) * 0.5f;
+                float radius2 = 0.0f;
+                for (uint32_t i = first * 3; i < (first + count) * 3; i ++) {
+                    glm::vec3 delta = vertices[indices[i]].pos - center;
+                    radius2 = std::max(radius2, glm::dot(delta, delta));
+                }
+                meshlet.sphere = glm::vec4(center, std::sqrt(radius2));
+
+                /**
+                 * Normals as the pipeline sees them (counter clockwise in front), degenerate ones skipped.
+                 */
+                std::vector<glm::vec3> normals;
+                normals.reserve(count);
+                glm::vec3 sum(0.0f);
+                for (uint32_t t = first; t < first + count; t ++) {
+                    const glm::vec3& a = vertices[indices[t * 3]].pos;
+                    glm::vec3 normal = glm::cross(vertices[indices[t * 3 + 1]].pos - a, vertices[indices[t * 3 + 2]].pos - a);
+                    float length = glm::length(normal);
+                    if (!(length > 0.0f))
+                        continue;
+                    normals.push_back(normal / length);
+                    sum += normals.back();
+                }
+                meshlet.cone = glm::vec4(0.0f, 0.0f, 0.0f, 2.0f);
+                float sumLength = glm::length(sum);
+                if (normals.empty() || !(sumLength > 0.0f))
+                    return;
+                glm::vec3 axis = sum / sumLength;
+                float minDot = 1.0f;
+                for (const glm::vec3& normal : normals)
+                    minDot = std::min(minDot, glm::dot(normal, axis));
+                if (minDot <= kMinConeDot)
+                    return;
+                // Sine of the widest angle a normal makes with the axis.
+                meshlet.cone = glm::vec4(axis, std::sqrt(1.0f - minDot * minDot));
+            }
+        }
+
+        void build(const uint32_t *indices, size_t indexCount, const Vertex *vertices, std::vector<Meshlet> &meshlets,
+                   std::vector<uint32_t> *meshletVertices, std::vector<uint32_t> *meshletTriangles) {
+            const uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+            // Unique vertices of the meshlet being built, searched linearly, there are at most 64.
+            uint32_t local[kMaxVertices];
+            uint32_t localCount = 0;
+            Meshlet meshlet{};
+            auto flush = [&]() {
+                if (!meshlet.triangleCount)
+                    return;
+                computeBounds(meshlet, indices, meshlet.firstTriangle, meshlet.triangleCount, vertices);
+                meshlet.vertexCount = localCount;
+                if (meshletVertices)
+                    meshletVertices->insert(meshletVertices->end(), local, local + localCount);
+                meshlets.push_back(meshlet);
+                meshlet.firstVertex += localCount;
+                meshlet.firstTriangle += meshlet.triangleCount;
+                meshlet.triangleCount = 0;
+                localCount = 0;
+            };
+            meshlet.firstVertex = meshletVertices ? static_cast<uint32_t>(meshletVertices->size()) : 0;
+
+            for (uint32_t t = 0; t < triangleCount; t ++) {
+                const uint32_t* triangle = indices + t * 3;
+                // New vertices of the triangle, a corner repeating an earlier one counts once.
+                uint32_t added = 0;
+                for (uint32_t k = 0; k < 3; k ++)
+                    if (std::find(local, local + localCount, triangle[k]) == local + localCount &&
+                        std::find(triangle, triangle + k, triangle[k]) == triangle + k)
+                        added ++;
+                if (localCount + added > kMaxVertices || meshlet.triangleCount == kMaxTriangles)
+                    flush();
+
+                uint32_t packed = 0;
+                for (uint32_t k = 0; k < 3; k ++) {
+                    uint32_t position = static_cast<uint32_t>(std::find(local, local + localCount, triangle[k]) - local);
+                    if (position == localCount)
+                        local[localCount ++] = triangle[k];
+                    packed |= position << (k * 8);
+                }
+                if (meshletTriangles)
+                    meshletTriangles->push_back(packed);
+                meshlet.triangleCount ++;
+            }
+            flush();
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef TRIANGLE_MESHLETBUILDER_H
+#define TRIANGLE_MESHLETBUILDER_H
+
+#include "common.h"
+#include <Vertex.h>
+
+#include <glm/glm.hpp>
+
+namespace glfw {
+    /**
+     * A run of consecutive triangles of one submesh touching at most MeshletBuilder::kMaxVertices
+     * vertices, the unit GpuCuller culls below submeshes. std430 layout of cluster.comp and object.task.
+     */
+    struct Meshlet {
+        // Mesh space, around its vertices.
+        glm::vec4 sphere;
+        /**
+         * Average face normal and cutoff, mesh space: the meshlet faces away from eye, and is culled
+         * with back faces, when dot(center - eye, axis) >= cutoff * length(center - eye) + radius.
+         * cutoff > 1 when the normals spread too far for that to ever hold.
+         */
+        glm::vec4 cone;
+        // Of the submesh, so the draw range is firstIndex + 3 * firstTriangle.
+        uint32_t firstTriangle;
+        uint32_t triangleCount;
+        // Into the vertex list of the mesh, only built for mesh shaders.
+        uint32_t firstVertex;
+        uint32_t vertexCount;
+    };
+
+    /**
+     * Splits the triangles of a submesh into meshlets in index order (a scan, no reordering), so
+     * the cache and overdraw order MeshOptimizer gave them is kept and a meshlet stays an index range.
+     */
+    namespace MeshletBuilder {
+        // What one mesh shader workgroup outputs at most, the sizes most drivers are fastest with.
+        const uint32_t kMaxVertices = 64;
+        const uint32_t kMaxTriangles = 124;
+
+        /**
+         * Appends the meshlets of indices (triangles of one submesh, indices into vertices) to meshlets.
+         * With meshletVertices, also appends the unique vertices of every meshlet to it, and with
+         * meshletTriangles, per triangle its three corners as 8 bit positions in that list.
+         */
+        void build(const uint32_t* indices, size_t indexCount, const Vertex* vertices, std::vector<Meshlet>& meshlets,
+                   std::vector<uint32_t>* meshletVertices = nullptr, std::vector<uint32_t>* meshletTriangles = nullptr);
+    }
+}
+
+
+#endif //TRIANGLE_MESHLETBUILDER_H
@@ -0,0 +1,388 @@
+#include "MipGenerator.h"
+#include <glfwApp.h>
+#include <Texture.h>
+#include <UploadContext.h>
+#include <cmath>
+
+namespace glfw {
+    static const uint32_t kMaxMipDescriptorSets = 256;
+
+    struct MipGenParams {
+        int32_t srcSize[2];
+        int32_t dstSize[2];
+        uint32_t srgb;
+    };
+
+    static
+    bool isSrgb(VkFormat format) {
+        return format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_SRGB;
+    }
+
+    /**
+     * Format of the storage views mipgen.comp writes through, it is declared rgba8.
+     */
+    static
+    VkFormat getStorageFormat(VkFormat format) {
+        switch (format) {
+            case VK_FORMAT_R8G8B8A8_SRGB:
+            case VK_FORMAT_R8G8B8A8_UNORM:
+                return VK_FORMAT_R8G8B8A8_UNORM;
+            default:
+                return VK_FORMAT_UNDEFINED;
+        }
+    }
+
+    /**
+     * Whether mipgen.comp can write format through views of getStorageFormat. An sRGB image can only be
+     * created with storage usage when that usage is left to the views (EXTENDED_USAGE), and not every
+     * device allows even that.
+     */
+    static
+    bool canStore(VkPhysicalDevice physicalDevice, VkFormat format) {
+        VkFormat storageFormat = getStorageFormat(format);
+        if (storageFormat == VK_FORMAT_UNDEFINED)
+            return false;
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, storageFormat, &properties);
+        if (!(properties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT))
+            return false;
+        VkImageFormatProperties imageProperties;
+        return vkGetPhysicalDeviceImageFormatProperties(physicalDevice, format, VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_OPTIMAL,
+                                                        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+                                                        VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT | VK_IMAGE_CREATE_EXTENDED_USAGE_BIT,
+                                                        &imageProperties) == VK_SUCCESS;
+    }
+
+    MipGenerator::MipGenerator(glfwApp *app) {
+        mApp = app;
+        mDescriptorSetLayout = VK_NULL_HANDLE;
+        mPipelineLayout = VK_NULL_HANDLE;
+        mPipeline = VK_NULL_HANDLE;
+        mDescriptorPool = VK_NULL_HANDLE;
+    }
+
+    MipGenerator::~MipGenerator() {
+        this->destroy();
+    }
+
+    void MipGenerator::destroy() {
+        this->releaseCompleted(true);
+        if (mPipeline) {
+            vkDestroyPipeline(mApp->device, mPipeline, nullptr);
+            mPipeline = VK_NULL_HANDLE;
+        }
+        if (mPipelineLayout) {
+            vkDestroyPipelineLayout(mApp->device, mPipelineLayout, nullptr);
+            mPipelineLayout = VK_NULL_HANDLE;
+        }
+        if (mDescriptorPool) {
+            vkDestroyDescriptorPool(mApp->device, mDescriptorPool, nullptr);
+            mDescriptorPool = VK_NULL_HANDLE;
+        }
+        if (mDescriptorSetLayout) {
+            vkDestroyDescriptorSetLayout(mApp->device, mDescriptorSetLayout, nullptr);
+            mDescriptorSetLayout = VK_NULL_HANDLE;
+        }
+    }
+
+    uint32_t MipGenerator::getMipLevels(VkExtent3D extent) {
+        uint32_t largest = std::max(extent.width, extent.height);
+        return static_cast<uint32_t>(std::floor(std::log2(std::max(largest, 1u)))) + 1;
+    }
+
+    MipPath MipGenerator::choosePath(VkFormat format) const {
+        const bool compute = canStore(mApp->physicalDevice, format);
+        if (compute && isSrgb(format))
+            return MipPath::Compute;
+
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(mApp->physicalDevice, format, &properties);
+        const VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+        if ((properties.optimalTilingFeatures & blit) == blit)
+            return MipPath::Blit;
+
+        return compute ? MipPath::Compute : MipPath::None;
+    }
+
+    VkImageUsageFlags MipGenerator::getUsage(MipPath path) const {
+        switch (path) {
+            case MipPath::Blit:
+                return VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+            case MipPath::Compute:
+                return VK_IMAGE_USAGE_STORAGE_BIT;
+            default:
+                return 0;
+        }
+    }
+
+    VkImageCreateFlags MipGenerator::getCreateFlags(MipPath path) const {
+        // Storage usage only has to hold for the unorm views, see Texture::createImageView.
+        return path == MipPath::Compute ? VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT | VK_IMAGE_CREATE_EXTENDED_USAGE_BIT : 0;
+    }
+
+    VkImageLayout MipGenerator::getSourceLayout(MipPath path) const {
+        switch (path) {
+            case MipPath::Blit:
+                return VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            case MipPath::Compute:
+                return VK_IMAGE_LAYOUT_GENERAL;
+            default:
+                return VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        }
+    }
+
+    void MipGenerator::initComputePipeline() {
+        {
+            /**
+             * Descriptor Set Layout: source and destination level
+             */
+            VkDescriptorSetLayoutBinding bindings[2]{};
+            for (uint32_t i = 0; i < 2; i ++) {
+                bindings[i].binding = i;
+                bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                bindings[i].descriptorCount = 1;
+                bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            }
+            VkDescriptorSetLayoutCreateInfo layoutInfo{};
+            layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            layoutInfo.bindingCount = 2;
+            layoutInfo.pBindings = bindings;
+            if (vkCreateDescriptorSetLayout(mApp->device, &layoutInfo, nullptr, &mDescriptorSetLayout) != VK_SUCCESS)
+                throw std::runtime_error("MipGenerator: failed to create descriptor set layout!");
+        }
+
+        {
+            /**
+             * Descriptor Pool
+             */
+            VkDescriptorPoolSize poolSize{};
+            poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            poolSize.descriptorCount = kMaxMipDescriptorSets * 2;
+            VkDescriptorPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+            poolInfo.maxSets = kMaxMipDescriptorSets;
+            poolInfo.poolSizeCount = 1;
+            poolInfo.pPoolSizes = &poolSize;
+            if (vkCreateDescriptorPool(mApp->device, &poolInfo, nullptr, &mDescriptorPool) != VK_SUCCESS)
+                throw std::runtime_error("MipGenerator: failed to create descriptor pool!");
+        }
+
+        {
+            /**
+             * Pipeline
+             */
+            VkPushConstantRange pushConstantRange{};
+            pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+            pushConstantRange.offset = 0;
+            pushConstantRange.size = sizeof(MipGenParams);
+            VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+            pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutInfo.setLayoutCount = 1;
+            pipelineLayoutInfo.pSetLayouts = &mDescriptorSetLayout;
+            pipelineLayoutInfo.pushConstantRangeCount = 1;
+            pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+            if (vkCreatePipelineLayout(mApp->device, &pipelineLayoutInfo, nullptr, &mPipelineLayout) != VK_SUCCESS)
+                throw std::runtime_error("MipGenerator: failed to create pipeline layout!");
+
+            VkShaderModule shaderModule = createShaderModule(mApp->device, readFile("mipgen.comp.spv"));
+            VkComputePipelineCreateInfo pipelineInfo{};
+            pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+            pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+            pipelineInfo.stage.module = shaderModule;
+            pipelineInfo.stage.pName = "main";
+            pipelineInfo.layout = mPipelineLayout;
+            VkResult result = vkCreateComputePipelines(mApp->device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mPipeline);
+            vkDestroyShaderModule(mApp->device, shaderModule, nullptr);
+            if (result != VK_SUCCESS)
+                throw std::runtime_error("MipGenerator: failed to create compute pipeline!");
+        }
+    }
+
+    void MipGenerator::releaseCompleted(bool all) {
+        for (auto it = mPending.begin(); it != mPending.end();) {
+            if (!all && !mApp->uploadContext->isComplete(it->ticket)) {
+                ++it;
+                continue;
+            }
+            for (VkImageView view : it->views)
+                vkDestroyImageView(mApp->device, view, nullptr);
+            if (!it->descriptorSets.empty())
+                vkFreeDescriptorSets(mApp->device, mDescriptorPool, static_cast<uint32_t>(it->descriptorSets.size()), it->descriptorSets.data());
+            it = mPending.erase(it);
+        }
+    }
+
+    void MipGenerator::generate(Texture &texture, MipPath path) {
+        if (texture.getMipLevels() <= 1 || path == MipPath::None)
+            return;
+        if (path == MipPath::Compute) {
+            if (mPipeline == VK_NULL_HANDLE)
+                this->initComputePipeline();
+            this->releaseCompleted(false);
+            this->generateCompute(mApp->uploadContext->getCommandBuffer(), texture);
+        } else {
+            this->generateBlit(mApp->uploadContext->getCommandBuffer(), texture);
+        }
+    }
+
+    void MipGenerator::generateBlit(VkCommandBuffer commandBuffer, Texture &texture) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(mApp->physicalDevice, texture.getFormat(), &properties);
+        VkFilter filter = (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = texture.getImage();
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+        int32_t width = static_cast<int32_t>(texture.getExtent().width);
+        int32_t height = static_cast<int32_t>(texture.getExtent().height);
+        for (uint32_t level = 1; level < texture.getMipLevels(); level ++) {
+            int32_t nextWidth = std::max(width / 2, 1);
+            int32_t nextHeight = std::max(height / 2, 1);
+
+            barrier.subresourceRange.baseMipLevel = level;
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                 0, nullptr, 0, nullptr, 1, &barrier);
+
+            VkImageBlit blit{};
+            blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1};
+            blit.srcOffsets[1] = {width, height, 1};
+            blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+            blit.dstOffsets[1] = {nextWidth, nextHeight, 1};
+            vkCmdBlitImage(commandBuffer, texture.getImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           texture.getImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, filter);
+
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                 0, nullptr, 0, nullptr, 1, &barrier);
+
+            width = nextWidth;
+            height = nextHeight;
+        }
+
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, texture.getMipLevels(), 0, 1};
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
+    void MipGenerator::generateCompute(VkCommandBuffer commandBuffer, Texture &texture) {
+        const uint32_t levels = texture.getMipLevels();
+        PendingViews pending;
+        pending.ticket = mApp->uploadContext->getTicket();
+
+        /**
+         * One UNORM view per level, the image was created MUTABLE_FORMAT for this.
+         */
+        for (uint32_t level = 0; level < levels; level ++) {
+            VkImageViewCreateInfo viewInfo{};
+            viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewInfo.image = texture.getImage();
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = getStorageFormat(texture.getFormat());
+            viewInfo.components = {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A};
+            viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1};
+            VkImageView view;
+            if (vkCreateImageView(mApp->device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+                throw std::runtime_error("MipGenerator: failed to create storage view!");
+            pending.views.push_back(view);
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(levels - 1, mDescriptorSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = mDescriptorPool;
+        allocInfo.descriptorSetCount = levels - 1;
+        allocInfo.pSetLayouts = layouts.data();
+        pending.descriptorSets.resize(levels - 1);
+        if (vkAllocateDescriptorSets(mApp->device, &allocInfo, pending.descriptorSets.data()) != VK_SUCCESS) {
+            // Pool is full of sets of batches still in flight, wait for them and try once more.
+            mApp->uploadContext->finish();
+            this->releaseCompleted(false);
+            commandBuffer = mApp->uploadContext->getCommandBuffer();
+            pending.ticket = mApp->uploadContext->getTicket();
+            if (vkAllocateDescriptorSets(mApp->device, &allocInfo, pending.descriptorSets.data()) != VK_SUCCESS)
+                throw std::runtime_error("MipGenerator: failed to allocate descriptor sets!");
+        }
+
+        std::vector<VkDescriptorImageInfo> imageInfos((levels - 1) * 2);
+        std::vector<VkWriteDescriptorSet> writes((levels - 1) * 2);
+        for (uint32_t i = 0; i < writes.size(); i ++) {
+            uint32_t level = i / 2 + 1;
+            uint32_t binding = i % 2;
+            imageInfos[i].imageView = pending.views[binding == 0 ? level - 1 : level];
+            imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = pending.descriptorSets[level - 1];
+            writes[i].dstBinding = binding;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            writes[i].pImageInfo = &imageInfos[i];
+        }
+        vkUpdateDescriptorSets(mApp->device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = texture.getImage();
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 1, levels - 1, 0, 1};
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mPipeline);
+        MipGenParams params{};
+        params.srcSize[0] = static_cast<int32_t>(texture.getExtent().width);
+        params.srcSize[1] = static_cast<int32_t>(texture.getExtent().height);
+        params.srgb = isSrgb(texture.getFormat()) ? 1 : 0;
+        for (uint32_t level = 1; level < levels; level ++) {
+            params.dstSize[0] = std::max(params.srcSize[0] / 2, 1);
+            params.dstSize[1] = std::max(params.srcSize[1] / 2, 1);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mPipelineLayout, 0, 1,
+                                    &pending.descriptorSets[level - 1], 0, nullptr);
+            vkCmdPushConstants(commandBuffer, mPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+            vkCmdDispatch(commandBuffer, (params.dstSize[0] + 7) / 8, (params.dstSize[1] + 7) / 8, 1);
+
+            // Level just written is the source of the next dispatch.
+            barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1};
+            barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                                 0, nullptr, 0, nullptr, 1, &barrier);
+
+            params.srcSize[0] = params.dstSize[0];
+            params.srcSize[1] = params.dstSize[1];
+        }
+
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1};
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+
+        mPending.push_back(std::move(pending));
+    }
+}
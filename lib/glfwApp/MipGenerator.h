@@ -0,0 +1,63 @@
+#ifndef TRIANGLE_MIPGENERATOR_H
+#define TRIANGLE_MIPGENERATOR_H
+
+#include "common.h"
+
+namespace glfw {
+    class glfwApp;
+    class Texture;
+
+    enum class MipPath : uint8_t {
+        None = 0,
+        // vkCmdBlitImage level by level, level 0 has to be in TRANSFER_SRC_OPTIMAL.
+        Blit,
+        // mipgen.comp through UNORM storage views, level 0 has to be in GENERAL.
+        Compute
+    };
+
+    /**
+     * Fills levels 1..n of a texture from level 0 on the upload context's graphics command buffer and
+     * leaves the whole chain in SHADER_READ_ONLY_OPTIMAL. sRGB textures take the compute path so that
+     * the averaging happens in linear space; the blit path is used for everything else that can be
+     * blitted.
+     */
+    class MipGenerator {
+    public:
+        MipGenerator(glfwApp* app);
+        virtual ~MipGenerator();
+        MipGenerator(const MipGenerator&) = delete;
+
+        static uint32_t getMipLevels(VkExtent3D extent);
+
+        MipPath choosePath(VkFormat format) const;
+        VkImageUsageFlags getUsage(MipPath path) const;
+        VkImageCreateFlags getCreateFlags(MipPath path) const;
+        VkImageLayout getSourceLayout(MipPath path) const;
+
+        void generate(Texture& texture, MipPath path);
+
+        void destroy();
+    private:
+        struct PendingViews {
+            uint64_t ticket;
+            std::vector<VkImageView> views;
+            std::vector<VkDescriptorSet> descriptorSets;
+        };
+
+        void initComputePipeline();
+        void releaseCompleted(bool all);
+        void generateBlit(VkCommandBuffer commandBuffer, Texture& texture);
+        void generateCompute(VkCommandBuffer commandBuffer, Texture& texture);
+
+        glfwApp* mApp;
+        VkDescriptorSetLayout mDescriptorSetLayout;
+        VkPipelineLayout mPipelineLayout;
+        VkPipeline mPipeline;
+        VkDescriptorPool mDescriptorPool;
+        // Per-level views and sets stay alive until the batch that uses them has run.
+        std::vector<PendingViews> mPending;
+    };
+}
+
+
+#endif //TRIANGLE_MIPGENERATOR_H
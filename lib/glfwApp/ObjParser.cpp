@@ -0,0 +1,546 @@
+#include "ObjParser.h"
+#include <ThreadPool.h>
+#include <cmath>
+#include <map>
+
+namespace glfw {
+    namespace {
+        // Below this a chunk is not worth a job.
+        const size_t kMinChunkSize = 256 << 10;
+
+        bool isSpace(char c) {
+            return c == ' ' || c == '\t';
+        }
+
+        void skipSpace(const char*& p, const char* end) {
+            while (p < end && isSpace(*p))
+                p ++;
+        }
+
+        // Rest of the current token, up to whitespace or the end of the line.
+        std::string parseName(const char*& p, const char* end) {
+            skipSpace(p, end);
+            const char* begin = p;
+            while (p < end && !isSpace(*p) && *p != '\r')
+                p ++;
+            return std::string(begin, p);
+        }
+
+        int parseInt(const char*& p, const char* end) {
+            bool negative = false;
+            if (p < end && (*p == '-' || *p == '+'))
+                negative = *p ++ == '-';
+            int value = 0;
+            while (p < end && *p >= '0' && *p <= '9')
+                value = value * 10 + (*p ++ - '0');
+            return negative ? -value : value;
+        }
+
+        /**
+         * Decimal digits are accumulated as an integer and scaled once in double precision, which
+         * rounds to the nearest float for everything an exporter writes. Anything unusual (inf, nan,
+         * more than 18 significant digits) goes through strtod.
+         */
+        float parseFloat(const char*& p, const char* end) {
+            skipSpace(p, end);
+            const char* start = p;
+            bool negative = false;
+            if (p < end && (*p == '-' || *p == '+'))
+                negative = *p ++ == '-';
+            uint64_t mantissa = 0;
+            int digits = 0, exponent = 0;
+            bool any = false;
+            while (p < end && *p >= '0' && *p <= '9') {
+                if (digits < 18) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    digits += mantissa != 0;
+                } else {
+                    exponent ++;
+                }
+                any = true;
+                p ++;
+            }
+            if (p < end && *p == '.') {
+                p ++;
+                while (p < end && *p >= '0' && *p <= '9') {
+                    if (digits < 18) {
+                        mantissa = mantissa * 10 + (*p - '0');
+                        digits += mantissa != 0;
+                        exponent --;
+                    }
+                    any = true;
+                    p ++;
+                }
+            }
+            if (any && p < end && (*p == 'e' || *p == 'E')) {
+                p ++;
+                exponent += parseInt(p, end);
+            }
+            if (!any || (p < end && !isSpace(*p) && *p != '\r' && *p != '\n')) {
+                std::string token(start, std::find_if(start, end, [](char c) { return isSpace(c) || c == '\r' || c == '\n'; }));
+                p = start + token.size();
+                return static_cast<float>(std::strtod(token.c_str(), nullptr));
+            }
+            double value = static_cast<double>(mantissa);
+            if (exponent < 0)
+                value /= std::pow(10.0, -exponent);
+            else if (exponent > 0)
+                value *= std::pow(10.0, exponent);
+            return static_cast<float>(negative ? -value : value);
+        }
+
+        bool startsWith(const char* p, const char* end, const char* keyword) {
+            size_t length = std::strlen(keyword);
+            return size_t(end - p) > length && std::memcmp(p, keyword, length) == 0 && isSpace(p[length]);
+        }
+
+        // Indices of one corner of an f line as written in the file.
+        struct FaceCorner {
+            int position;
+            int texCoord;
+            bool hasTexCoord;
+        };
+
+        void parseFace(const char*& p, const char* lineEnd, std::vector<FaceCorner>& face) {
+            face.clear();
+            while (true) {
+                skipSpace(p, lineEnd);
+                if (p >= lineEnd || *p == '\r')
+                    break;
+                FaceCorner corner{0, 0, false};
+                const char* token = p;
+                corner.position = parseInt(p, lineEnd);
+                if (p == token) {
+                    // Not a number, skip the token rather than looping on it.
+                    while (p < lineEnd && !isSpace(*p))
+                        p ++;
+                    continue;
+                }
+                if (p < lineEnd && *p == '/') {
+                    p ++;
+                    if (p < lineEnd && *p != '/') {
+                        corner.texCoord = parseInt(p, lineEnd);
+                        corner.hasTexCoord = true;
+                    }
+                    // Normals are not used.
+                    while (p < lineEnd && !isSpace(*p) && *p != '\r')
+                        p ++;
+                }
+                face.push_back(corner);
+            }
+        }
+
+        // Same rules as tinyobj: 1 based, negative counts back from the last of count, 0 is 0.
+        int64_t toIndex(int index, int64_t count) {
+            return index > 0 ? index - 1 : index == 0 ? 0 : count + index;
+        }
+
+        /**
+         * Lines of a file read through a fixed window. The window only grows for a line longer than it.
+         */
+        class LineReader {
+        public:
+            LineReader(const char* fileName, size_t windowSize): mFile(fileName, std::ios::binary), mBuffer(windowSize) {
+            }
+
+            bool isOpen() const {
+                return mFile.is_open();
+            }
+
+            // [line, lineEnd) without the newline.
+            bool next(const char*& line, const char*& lineEnd) {
+                while (true) {
+                    const char* begin = mBuffer.data() + mBegin;
+                    const char* newline = static_cast<const char*>(std::memchr(begin, '\n', mEnd - mBegin));
+                    if (newline || (mEof && mBegin < mEnd)) {
+                        line = begin;
+                        lineEnd = newline ? newline : mBuffer.data() + mEnd;
+                        mBegin = newline ? size_t(newline + 1 - mBuffer.data()) : mEnd;
+                        return true;
+                    }
+                    if (mEof)
+                        return false;
+                    std::memmove(mBuffer.data(), begin, mEnd - mBegin);
+                    mEnd -= mBegin;
+                    mBegin = 0;
+                    if (mEnd == mBuffer.size())
+                        mBuffer.resize(mBuffer.size() * 2);
+                    mFile.read(mBuffer.data() + mEnd, static_cast<std::streamsize>(mBuffer.size() - mEnd));
+                    mEnd += static_cast<size_t>(mFile.gcount());
+                    mEof = !mFile;
+                }
+            }
+        private:
+            std::ifstream mFile;
+            std::vector<char> mBuffer;
+            size_t mBegin = 0;
+            size_t mEnd = 0;
+            bool mEof = false;
+        };
+
+        void loadMaterials(const std::vector<std::string>& mtllib, std::vector<tinyobj::material_t>& materials,
+                           std::map<std::string, int>& materialMap) {
+            tinyobj::MaterialFileReader reader("");
+            bool loaded = false;
+            for (auto& name : mtllib) {
+                if (name.empty()) {
+                    loaded = false;
+                    continue;
+                }
+                std::string warning;
+                if (!loaded)
+                    loaded = reader(name, &materials, &materialMap, &warning);
+            }
+        }
+
+        void parseMtllib(const char*& p, const char* lineEnd, std::vector<std::string>& mtllib) {
+            while (true) {
+                std::string name = parseName(p, lineEnd);
+                if (name.empty())
+                    break;
+                mtllib.push_back(name);
+            }
+            // Only the first file that loads counts, an empty entry separates lines.
+            mtllib.emplace_back();
+        }
+    }
+
+    ObjParser::ObjParser(ThreadPool &pool): mPool(pool) {
+    }
+
+    void ObjParser::parseChunk(Chunk &chunk) {
+        std::vector<FaceCorner> face;
+        int material = -1;
+        const char* p = chunk.begin;
+        while (p < chunk.end) {
+            const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', chunk.end - p));
+            if (!lineEnd)
+                lineEnd = chunk.end;
+            skipSpace(p, lineEnd);
+
+            if (startsWith(p, lineEnd, "v")) {
+                p += 2;
+                for (int c = 0; c < 3; c ++)
+                    chunk.positions.push_back(parseFloat(p, lineEnd));
+            } else if (startsWith(p, lineEnd, "vt")) {
+                p += 3;
+                for (int c = 0; c < 2; c ++)
+                    chunk.texCoords.push_back(parseFloat(p, lineEnd));
+            } else if (startsWith(p, lineEnd, "f")) {
+                p += 2;
+                parseFace(p, lineEnd, face);
+                int positionCount = static_cast<int>(chunk.positions.size() / 3);
+                int texCoordCount = static_cast<int>(chunk.texCoords.size() / 2);
+                for (size_t k = 2; k < face.size(); k ++) {
+                    for (const FaceCorner* corner : {&face[0], &face[k - 1], &face[k]}) {
+                        // Negative indices are relative to the chunk until its offset is known.
+                        Corner resolved{};
+                        resolved.position = static_cast<uint32_t>(toIndex(corner->position, positionCount));
+                        resolved.texCoord = corner->hasTexCoord ?
+                                            static_cast<uint32_t>(toIndex(corner->texCoord, texCoordCount)) : kNoTexCoord;
+                        chunk.corners.push_back(resolved);
+                        chunk.relative.push_back(static_cast<uint8_t>((corner->position < 0 ? 1 : 0) |
+                                                                      (corner->hasTexCoord && corner->texCoord < 0 ? 2 : 0)));
+                    }
+                    chunk.materialIDs.push_back(material);
+                }
+            } else if (startsWith(p, lineEnd, "usemtl")) {
+                p += 7;
+                material = static_cast<int>(chunk.usemtl.size());
+                chunk.usemtl.push_back(parseName(p, lineEnd));
+            } else if (startsWith(p, lineEnd, "mtllib")) {
+                p += 7;
+                parseMtllib(p, lineEnd, chunk.mtllib);
+            } else if (startsWith(p, lineEnd, "g") || startsWith(p, lineEnd, "o")) {
+                p += 2;
+                uint32_t triangle = static_cast<uint32_t>(chunk.materialIDs.size());
+                chunk.shapeStarts.emplace_back(triangle, parseName(p, lineEnd));
+            }
+            p = lineEnd + 1;
+        }
+    }
+
+    void ObjParser::resolveChunk(Chunk &chunk, uint32_t firstPosition, uint32_t firstTexCoord,
+                                 int startMaterial, const std::vector<int> &usemtlIDs, std::string &error) {
+        const uint32_t positionCount = static_cast<uint32_t>(positions.size() / 3);
+        const uint32_t texCoordCount = static_cast<uint32_t>(texCoords.size() / 2);
+        for (size_t i = 0; i < chunk.corners.size(); i ++) {
+            Corner& corner = chunk.corners[i];
+            if (chunk.relative[i] & 1)
+                corner.position += firstPosition;
+            if (chunk.relative[i] & 2)
+                corner.texCoord += firstTexCoord;
+            if (corner.position >= positionCount || (corner.texCoord != kNoTexCoord && corner.texCoord >= texCoordCount)) {
+                error = "ObjParser: face references a missing vertex!";
+                return;
+            }
+        }
+        for (int& material : chunk.materialIDs)
+            material = material < 0 ? startMaterial : usemtlIDs[material];
+        chunk.relative.clear();
+        chunk.relative.shrink_to_fit();
+    }
+
+    void ObjParser::parse(const char *fileName) {
+        positions.clear();
+        texCoords.clear();
+        shapes.clear();
+        materials.clear();
+        mChunks.clear();
+        if (!mFile.open(fileName))
+            throw std::runtime_error(std::string("ObjParser: cannot open ") + fileName + "!");
+
+        /**
+         * Chunks start right after a newline, so no line is split between two jobs.
+         */
+        const char* data = mFile.getData();
+        const char* dataEnd = data + mFile.getSize();
+        size_t chunkCount = std::max<size_t>(1, std::min<size_t>(mPool.getThreadCount() * 4, mFile.getSize() / kMinChunkSize));
+        const char* begin = data;
+        for (size_t i = 1; i <= chunkCount && begin < dataEnd; i ++) {
+            const char* end = i == chunkCount ? dataEnd : data + mFile.getSize() * i / chunkCount;
+            if (end < begin)
+                end = begin;
+            const char* newline = static_cast<const char*>(std::memchr(end, '\n', dataEnd - end));
+            end = i == chunkCount || !newline ? dataEnd : newline + 1;
+            Chunk chunk;
+            chunk.begin = begin;
+            chunk.end = end;
+            mChunks.push_back(std::move(chunk));
+            begin = end;
+        }
+
+        std::vector<std::future<void>> jobs;
+        for (auto& chunk : mChunks)
+            jobs.push_back(mPool.submit([&chunk]() { parseChunk(chunk); }));
+        for (auto& job : jobs)
+            job.get();
+        jobs.clear();
+
+        /**
+         * Materials. All mtllib lines are loaded before usemtl names are looked up.
+         */
+        std::map<std::string, int> materialMap;
+        for (auto& chunk : mChunks)
+            loadMaterials(chunk.mtllib, materials, materialMap);
+
+        /**
+         * Attributes of all chunks back to back, then every chunk resolves its relative indices and
+         * the materials of its triangles in parallel. A chunk starts with the material the chunks
+         * before it left active.
+         */
+        std::vector<uint32_t> firstPositions, firstTexCoords;
+        std::vector<int> startMaterials;
+        std::vector<std::vector<int>> usemtlIDs;
+        int material = -1;
+        size_t positionSize = 0, texCoordSize = 0;
+        for (auto& chunk : mChunks) {
+            firstPositions.push_back(static_cast<uint32_t>(positionSize / 3));
+            firstTexCoords.push_back(static_cast<uint32_t>(texCoordSize / 2));
+            positionSize += chunk.positions.size();
+            texCoordSize += chunk.texCoords.size();
+            startMaterials.push_back(material);
+            std::vector<int> ids;
+            for (auto& name : chunk.usemtl) {
+                auto it = materialMap.find(name);
+                ids.push_back(it == materialMap.end() ? -1 : it->second);
+            }
+            if (!ids.empty())
+                material = ids.back();
+            usemtlIDs.push_back(std::move(ids));
+        }
+        positions.resize(positionSize);
+        texCoords.resize(texCoordSize);
+
+        std::vector<std::string> errors(mChunks.size());
+        for (size_t i = 0; i < mChunks.size(); i ++) {
+            jobs.push_back(mPool.submit([&, i]() {
+                Chunk& chunk = mChunks[i];
+                std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + size_t(firstPositions[i]) * 3);
+                std::copy(chunk.texCoords.begin(), chunk.texCoords.end(), texCoords.begin() + size_t(firstTexCoords[i]) * 2);
+            }));
+        }
+        for (auto& job : jobs)
+            job.get();
+        jobs.clear();
+        for (size_t i = 0; i < mChunks.size(); i ++) {
+            jobs.push_back(mPool.submit([&, i]() {
+                resolveChunk(mChunks[i], firstPositions[i], firstTexCoords[i], startMaterials[i], usemtlIDs[i], errors[i]);
+                std::vector<float>().swap(mChunks[i].positions);
+                std::vector<float>().swap(mChunks[i].texCoords);
+            }));
+        }
+        for (auto& job : jobs)
+            job.get();
+        for (auto& error : errors) {
+            if (!error.empty())
+                throw std::runtime_error(error);
+        }
+
+        /**
+         * Shapes: the triangles between two g/o lines, which may cover any number of chunks.
+         */
+        Shape shape;
+        auto finishShape = [this, &shape](const std::string& nextName) {
+            if (shape.triangleCount)
+                shapes.push_back(std::move(shape));
+            shape = Shape();
+            shape.name = nextName;
+        };
+        auto addSpan = [&shape](const Chunk& chunk, uint32_t first, uint32_t last) {
+            if (first == last)
+                return;
+            shape.spans.push_back({chunk.corners.data() + size_t(first) * 3, chunk.materialIDs.data() + first, last - first});
+            shape.triangleCount += last - first;
+        };
+        for (auto& chunk : mChunks) {
+            uint32_t first = 0;
+            for (auto& start : chunk.shapeStarts) {
+                addSpan(chunk, first, start.first);
+                finishShape(start.second);
+                first = start.first;
+            }
+            addSpan(chunk, first, static_cast<uint32_t>(chunk.materialIDs.size()));
+        }
+        finishShape("");
+        mFile.close();
+    }
+
+    void ObjParser::stream(const char *fileName, const std::string &spillPrefix, size_t windowSize,
+                           uint32_t batchTriangles, const std::function<void(const Batch &)> &sink) {
+        positions.clear();
+        texCoords.clear();
+        shapes.clear();
+        materials.clear();
+        const std::string positionSpill = spillPrefix + ".pos", texCoordSpill = spillPrefix + ".uv";
+        // Spill files go away however stream() is left.
+        struct Spill {
+            MappedFile positions;
+            MappedFile texCoords;
+            std::string positionName;
+            std::string texCoordName;
+            ~Spill() {
+                positions.close();
+                texCoords.close();
+                std::remove(positionName.c_str());
+                std::remove(texCoordName.c_str());
+            }
+        } spill;
+        spill.positionName = positionSpill;
+        spill.texCoordName = texCoordSpill;
+
+        /**
+         * Pass 1: attributes to the spill files, materials.
+         */
+        std::map<std::string, int> materialMap;
+        uint64_t positionCount = 0, texCoordCount = 0;
+        {
+            LineReader reader(fileName, windowSize);
+            if (!reader.isOpen())
+                throw std::runtime_error(std::string("ObjParser: cannot open ") + fileName + "!");
+            std::ofstream positionFile(positionSpill, std::ios::binary | std::ios::trunc);
+            std::ofstream texCoordFile(texCoordSpill, std::ios::binary | std::ios::trunc);
+            if (!positionFile.is_open() || !texCoordFile.is_open())
+                throw std::runtime_error("ObjParser: cannot create spill files!");
+            std::vector<std::string> mtllib;
+            const char* p;
+            const char* lineEnd;
+            while (reader.next(p, lineEnd)) {
+                skipSpace(p, lineEnd);
+                if (startsWith(p, lineEnd, "v")) {
+                    p += 2;
+                    float value[3];
+                    for (float& c : value)
+                        c = parseFloat(p, lineEnd);
+                    positionFile.write(reinterpret_cast<const char*>(value), sizeof(value));
+                    positionCount ++;
+                } else if (startsWith(p, lineEnd, "vt")) {
+                    p += 3;
+                    float value[2];
+                    for (float& c : value)
+                        c = parseFloat(p, lineEnd);
+                    texCoordFile.write(reinterpret_cast<const char*>(value), sizeof(value));
+                    texCoordCount ++;
+                } else if (startsWith(p, lineEnd, "mtllib")) {
+                    p += 7;
+                    parseMtllib(p, lineEnd, mtllib);
+                }
+            }
+            if (!positionFile || !texCoordFile)
+                throw std::runtime_error("ObjParser: failed to write spill files!");
+            loadMaterials(mtllib, materials, materialMap);
+        }
+        if (positionCount > std::numeric_limits<uint32_t>::max() || texCoordCount > std::numeric_limits<uint32_t>::max())
+            throw std::runtime_error("ObjParser: too many vertices!");
+        if ((positionCount && !spill.positions.open(positionSpill)) || (texCoordCount && !spill.texCoords.open(texCoordSpill)))
+            throw std::runtime_error("ObjParser: cannot map spill files!");
+
+        /**
+         * Pass 2: faces, in batches.
+         */
+        Batch batch{};
+        batch.positions = reinterpret_cast<const float*>(spill.positions.getData());
+        batch.texCoords = reinterpret_cast<const float*>(spill.texCoords.getData());
+        batch.firstOfShape = true;
+        std::vector<Corner> corners;
+        std::vector<int> materialIDs;
+        corners.reserve(size_t(batchTriangles) * 3);
+        materialIDs.reserve(batchTriangles);
+        auto flush = [&]() {
+            if (materialIDs.empty())
+                return;
+            batch.corners = corners.data();
+            batch.materialIDs = materialIDs.data();
+            batch.triangleCount = static_cast<uint32_t>(materialIDs.size());
+            sink(batch);
+            batch.firstOfShape = false;
+            corners.clear();
+            materialIDs.clear();
+        };
+
+        LineReader reader(fileName, windowSize);
+        if (!reader.isOpen())
+            throw std::runtime_error(std::string("ObjParser: cannot open ") + fileName + "!");
+        std::vector<FaceCorner> face;
+        int64_t positionsSeen = 0, texCoordsSeen = 0;
+        int material = -1;
+        bool shapeHasFaces = false;
+        const char* p;
+        const char* lineEnd;
+        while (reader.next(p, lineEnd)) {
+            skipSpace(p, lineEnd);
+            if (startsWith(p, lineEnd, "v")) {
+                positionsSeen ++;
+            } else if (startsWith(p, lineEnd, "vt")) {
+                texCoordsSeen ++;
+            } else if (startsWith(p, lineEnd, "f")) {
+                p += 2;
+                parseFace(p, lineEnd, face);
+                for (size_t k = 2; k < face.size(); k ++) {
+                    for (const FaceCorner* corner : {&face[0], &face[k - 1], &face[k]}) {
+                        int64_t position = toIndex(corner->position, positionsSeen);
+                        int64_t texCoord = corner->hasTexCoord ? toIndex(corner->texCoord, texCoordsSeen) : -1;
+                        if (position < 0 || position >= int64_t(positionCount) || texCoord >= int64_t(texCoordCount) ||
+                            (corner->hasTexCoord && texCoord < 0))
+                            throw std::runtime_error("ObjParser: face references a missing vertex!");
+                        corners.push_back({static_cast<uint32_t>(position),
+                                           texCoord < 0 ? kNoTexCoord : static_cast<uint32_t>(texCoord)});
+                    }
+                    materialIDs.push_back(material);
+                    shapeHasFaces = true;
+                    if (materialIDs.size() == batchTriangles)
+                        flush();
+                }
+            } else if (startsWith(p, lineEnd, "usemtl")) {
+                p += 7;
+                auto it = materialMap.find(parseName(p, lineEnd));
+                material = it == materialMap.end() ? -1 : it->second;
+            } else if ((startsWith(p, lineEnd, "g") || startsWith(p, lineEnd, "o")) && shapeHasFaces) {
+                flush();
+                batch.firstOfShape = true;
+                shapeHasFaces = false;
+            }
+        }
+        flush();
+    }
+}
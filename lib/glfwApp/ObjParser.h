@@ -0,0 +1,109 @@
+#ifndef TRIANGLE_OBJPARSER_H
+#define TRIANGLE_OBJPARSER_H
+
+#include "common.h"
+#include <MappedFile.h>
+#include <functional>
+
+namespace glfw {
+    class ThreadPool;
+
+    /**
+     * Reads an OBJ on a ThreadPool. The mapped file is cut into chunks at line boundaries and every
+     * chunk is parsed by its own job; relative indices, the active material and the shape a chunk
+     * starts in are stitched up afterwards in file order, so the result does not depend on timing.
+     *
+     * Understands v, vt, f (fan triangulated), usemtl, mtllib, g and o, which is all MeshFile uses.
+     * Like tinyobj a g or o line starts a new shape and the active material carries over into it.
+     *
+     * stream() is the bounded memory alternative for files that should not be held in memory at once.
+     */
+    class ObjParser {
+    public:
+        static const uint32_t kNoTexCoord = 0xFFFFFFFF;
+
+        // Zero based attribute indices of one triangle corner.
+        struct Corner {
+            uint32_t position;
+            uint32_t texCoord;
+        };
+
+        // Consecutive triangles of one shape, all parsed by the same chunk.
+        struct Span {
+            const Corner* corners;
+            const int* materialIDs;
+            uint32_t triangleCount;
+        };
+
+        struct Shape {
+            std::string name;
+            std::vector<Span> spans;
+            uint32_t triangleCount = 0;
+        };
+
+        // Triangles handed to the sink of stream(), only valid during the call.
+        struct Batch {
+            const Corner* corners;
+            const int* materialIDs;
+            uint32_t triangleCount;
+            // Attributes the corners index, mapped from the spill files.
+            const float* positions;
+            const float* texCoords;
+            // Set on the first batch of every shape.
+            bool firstOfShape;
+        };
+
+        explicit ObjParser(ThreadPool& pool);
+        ObjParser(const ObjParser&) = delete;
+
+        // Throws std::runtime_error when the file cannot be read or a face references a missing vertex.
+        void parse(const char* fileName);
+
+        /**
+         * Reads the file twice through a window of windowSize bytes. The first pass writes positions and
+         * texture coordinates to spillPrefix + ".pos"/".uv" and loads the materials, the second maps
+         * the spill files and hands the faces to sink in batches of at most batchTriangles triangles,
+         * never spanning two shapes. Host memory is the window plus one batch whatever the file size;
+         * positions, texCoords and shapes stay empty. Throws like parse().
+         */
+        void stream(const char* fileName, const std::string& spillPrefix, size_t windowSize, uint32_t batchTriangles,
+                    const std::function<void(const Batch&)>& sink);
+
+        std::vector<float> positions;
+        std::vector<float> texCoords;
+        // Only shapes with at least one triangle.
+        std::vector<Shape> shapes;
+        std::vector<tinyobj::material_t> materials;
+    private:
+        /**
+         * What one job found in its part of the file. Indices that are relative in the file are kept
+         * relative to the chunk until the attribute counts of the chunks before it are known.
+         */
+        struct Chunk {
+            const char* begin;
+            const char* end;
+            std::vector<float> positions;
+            std::vector<float> texCoords;
+            std::vector<Corner> corners;
+            // Per corner, bit 0: position is chunk relative, bit 1: texCoord is.
+            std::vector<uint8_t> relative;
+            // Per triangle, index into usemtl or -1 for the material active when the chunk starts.
+            std::vector<int> materialIDs;
+            std::vector<std::string> usemtl;
+            std::vector<std::string> mtllib;
+            // Triangle index of every g/o line and the name it gives the next shape.
+            std::vector<std::pair<uint32_t, std::string>> shapeStarts;
+        };
+
+        static void parseChunk(Chunk& chunk);
+        void resolveChunk(Chunk& chunk, uint32_t firstPosition, uint32_t firstTexCoord,
+                          int startMaterial, const std::vector<int>& usemtlIDs, std::string& error);
+
+        ThreadPool& mPool;
+        MappedFile mFile;
+        std::vector<Chunk> mChunks;
+    };
+}
+
+
+#endif //TRIANGLE_OBJPARSER_H
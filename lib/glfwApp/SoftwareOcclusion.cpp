@@ -0,0 +1,282 @@
+#include "SoftwareOcclusion.h"
+#include "Instance.h"
+#include "InstanceGroup.h"
+#include "Mesh.h"
+#include "MeshFile.h"
+#include "ThreadPool.h"
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define TRIANGLE_OCCLUSION_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace glfw {
+    namespace {
+        // Clip w at or below which a point counts as behind the eye.
+        const float kNearW = 1e-5f;
+
+        // Pixel of a window coordinate, clamped to one past either side so any float converts.
+        int toPixel(float coordinate, uint32_t size) {
+            return static_cast<int>(std::floor(std::min(std::max(coordinate, -1.0f), static_cast<float>(size))));
+        }
+
+        // Window x, y and depth of a clip position in front of the eye.
+        glm::vec3 toWindow(const glm::vec4& clip) {
+            float invW = 1.0f / clip.w;
+            return glm::vec3((clip.x * invW * 0.5f + 0.5f) * SoftwareOcclusion::kWidth,
+                             (clip.y * invW * 0.5f + 0.5f) * SoftwareOcclusion::kHeight,
+                             clip.z * invW);
+        }
+    }
+
+    Occluder Occluder::build(const MeshFile &file, uint32_t maxTriangles) {
+        Occluder occluder;
+        if (!maxTriangles)
+            return occluder;
+        const Vertex* vertices = file.getVertices();
+        const uint32_t* indices = file.getIndices();
+        const uint32_t triangleCount = file.getIndexCount() / 3;
+
+        /**
+         * Min-heap on (twice the) area: the smallest triangle kept is the first to make room.
+         */
+        using Candidate = std::pair<float, uint32_t>;
+        std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> kept;
+        for (uint32_t t = 0; t < triangleCount; t ++) {
+            const glm::vec3& a = vertices[indices[t * 3]].pos;
+            const glm::vec3& b = vertices[indices[t * 3 + 1]].pos;
+            const glm::vec3& c = vertices[indices[t * 3 + 2]].pos;
+            float area = glm::length(glm::cross(b - a, c - a));
+            if (!(area > 0.0f))
+                continue;
+            if (kept.size() < maxTriangles) {
+                kept.push({area, t});
+            } else if (area > kept.top().first) {
+                kept.pop();
+                kept.push({area, t});
+            }
+        }
+
+        // Back in file order, neighbours share vertices.
+        std::vector<uint32_t> triangles;
+        triangles.reserve(kept.size());
+        for (; !kept.empty(); kept.pop())
+            triangles.push_back(kept.top().second);
+        std::sort(triangles.begin(), triangles.end());
+
+        std::unordered_map<uint32_t, uint32_t> remap;
+        occluder.indices.reserve(triangles.size() * 3);
+        for (uint32_t t : triangles) {
+            for (uint32_t k = 0; k < 3; k ++) {
+                uint32_t index = indices[t * 3 + k];
+                auto inserted = remap.emplace(index, static_cast<uint32_t>(occluder.positions.size()));
+                if (inserted.second)
+                    occluder.positions.push_back(vertices[index].pos);
+                occluder.indices.push_back(inserted.first->second);
+            }
+        }
+        return occluder;
+    }
+
+    bool Occluder::isEmpty() const {
+        return indices.empty();
+    }
+
+    SoftwareOcclusion::SoftwareOcclusion(ThreadPool &pool): mPool(pool) {
+        mViewProjection = glm::mat4(1.0f);
+        mDepth.resize(kWidth * kHeight, 1.0f);
+        mReady = false;
+    }
+
+    SoftwareOcclusion::~SoftwareOcclusion() {
+        // The raster reads this, it must not outlive it.
+        if (mRaster.valid())
+            mRaster.wait();
+    }
+
+    void SoftwareOcclusion::addOccluder(Instance *instance) {
+        mOccluders.push_back(instance);
+    }
+
+    void SoftwareOcclusion::removeOccluder(Instance *instance) {
+        // A running raster may still read its mesh.
+        this->wait();
+        auto it = std::find(mOccluders.begin(), mOccluders.end(), instance);
+        if (it != mOccluders.end())
+            mOccluders.erase(it);
+    }
+
+    void SoftwareOcclusion::begin(const glm::mat4 &viewProjection) {
+        this->wait();
+        mReady = false;
+        mViewProjection = viewProjection;
+        mJobs.clear();
+        for (Instance* instance : mOccluders) {
+            const Occluder& occluder = instance->mMesh->getOccluder();
+            if (occluder.isEmpty())
+                continue;
+            glm::mat4 group = instance->mGroup ? instance->mGroup->getTransform() : glm::mat4(1.0f);
+            mJobs.push_back({&occluder, viewProjection * group * instance->mModel});
+        }
+        if (mJobs.empty())
+            return;
+        mRaster = mPool.submit([this]() { this->rasterize(); });
+    }
+
+    void SoftwareOcclusion::wait() {
+        if (!mRaster.valid())
+            return;
+        mRaster.get();
+        mReady = true;
+    }
+
+    bool SoftwareOcclusion::isOccluded(const Bounds &bounds) {
+        if (!mReady || bounds.isEmpty())
+            return false;
+        mStats.tested ++;
+
+        /**
+         * Screen rectangle and nearest depth of the eight corners. A box reaching in front of the
+         * near plane is treated as visible, so is one entirely off screen (the frustum's call).
+         */
+        glm::vec2 low(std::numeric_limits<float>::max()), high(-std::numeric_limits<float>::max());
+        float nearest = std::numeric_limits<float>::max();
+        for (int corner = 0; corner < 8; corner ++) {
+            glm::vec3 position((corner & 1) ? bounds.max.x : bounds.min.x,
+                               (corner & 2) ? bounds.max.y : bounds.min.y,
+                               (corner & 4) ? bounds.max.z : bounds.min.z);
+            glm::vec4 clip = mViewProjection * glm::vec4(position, 1.0f);
+            if (clip.w <= kNearW || clip.z < 0.0f)
+                return false;
+            glm::vec3 window = toWindow(clip);
+            low = glm::min(low, glm::vec2(window.x, window.y));
+            high = glm::max(high, glm::vec2(window.x, window.y));
+            nearest = std::min(nearest, window.z);
+        }
+        const int x0 = std::max(0, toPixel(low.x, kWidth)), x1 = std::min(static_cast<int>(kWidth) - 1, toPixel(high.x, kWidth));
+        const int y0 = std::max(0, toPixel(low.y, kHeight)), y1 = std::min(static_cast<int>(kHeight) - 1, toPixel(high.y, kHeight));
+        if (x0 > x1 || y0 > y1)
+            return false;
+        for (int y = y0; y <= y1; y ++) {
+            const float* row = mDepth.data() + y * kWidth;
+            for (int x = x0; x <= x1; x ++)
+                if (row[x] >= nearest)
+                    return false;
+        }
+        mStats.culled ++;
+        return true;
+    }
+
+    SoftwareOcclusion::Stats SoftwareOcclusion::getStats() {
+        // The raster writes its own numbers.
+        this->wait();
+        Stats stats = mStats;
+        mStats.tested = 0;
+        mStats.culled = 0;
+        return stats;
+    }
+
+    void SoftwareOcclusion::rasterize() {
+        auto start = std::chrono::high_resolution_clock::now();
+        std::fill(mDepth.begin(), mDepth.end(), 1.0f);
+        uint32_t triangles = 0;
+        std::vector<glm::vec4> clip;
+        for (const Job& job : mJobs) {
+            const Occluder& occluder = *job.occluder;
+            clip.resize(occluder.positions.size());
+            for (size_t i = 0; i < clip.size(); i ++)
+                clip[i] = job.transform * glm::vec4(occluder.positions[i], 1.0f);
+            for (size_t i = 0; i + 2 < occluder.indices.size(); i += 3)
+                this->rasterizeTriangle(clip[occluder.indices[i]], clip[occluder.indices[i + 1]], clip[occluder.indices[i + 2]]);
+            triangles += static_cast<uint32_t>(occluder.indices.size() / 3);
+        }
+        std::chrono::duration<float, std::milli> duration = std::chrono::high_resolution_clock::now() - start;
+        mStats.rasterMilliseconds = duration.count();
+        mStats.triangles = triangles;
+    }
+
+    void SoftwareOcclusion::rasterizeTriangle(const glm::vec4 &c0, const glm::vec4 &c1, const glm::vec4 &c2) {
+        /**
+         * Triangles crossing the near plane are dropped rather than clipped, losing an occluder only
+         * hides less.
+         */
+        if (c0.w <= kNearW || c1.w <= kNearW || c2.w <= kNearW || c0.z < 0.0f || c1.z < 0.0f || c2.z < 0.0f)
+            return;
+        glm::vec3 v[3] = {toWindow(c0), toWindow(c1), toWindow(c2)};
+        float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+        if (std::fabs(area) < 1e-6f)
+            return;
+        // Either facing occludes, wind them all the same way.
+        if (area < 0.0f) {
+            std::swap(v[1], v[2]);
+            area = -area;
+        }
+        const int x0 = std::max(0, toPixel(std::min({v[0].x, v[1].x, v[2].x}), kWidth));
+        const int x1 = std::min(static_cast<int>(kWidth) - 1, toPixel(std::max({v[0].x, v[1].x, v[2].x}), kWidth));
+        const int y0 = std::max(0, toPixel(std::min({v[0].y, v[1].y, v[2].y}), kHeight));
+        const int y1 = std::min(static_cast<int>(kHeight) - 1, toPixel(std::max({v[0].y, v[1].y, v[2].y}), kHeight));
+        if (x0 > x1 || y0 > y1)
+            return;
+
+        /**
+         * Edge i, opposite vertex i, is a*x + b*y + c, positive inside. Tested at pixel centers against
+         * half the pixel's extent along its normal, so only pixels covered entirely pass. Depth is
+         * linear in window space too; the farthest it gets inside a pixel is what that pixel gets.
+         */
+        float a[3], b[3], c[3];
+        for (int i = 0; i < 3; i ++) {
+            const glm::vec3& p = v[(i + 1) % 3];
+            const glm::vec3& q = v[(i + 2) % 3];
+            a[i] = p.y - q.y;
+            b[i] = q.x - p.x;
+            c[i] = (q.y - p.y) * p.x - (q.x - p.x) * p.y;
+            c[i] -= 0.5f * (std::fabs(a[i]) + std::fabs(b[i]));
+        }
+        const float invArea = 1.0f / area;
+        const float zA = (a[0] * v[0].z + a[1] * v[1].z + a[2] * v[2].z) * invArea;
+        const float zB = (b[0] * v[0].z + b[1] * v[1].z + b[2] * v[2].z) * invArea;
+        float zC = 0.5f * (std::fabs(zA) + std::fabs(zB));
+        for (int i = 0; i < 3; i ++)
+            zC += (c[i] + 0.5f * (std::fabs(a[i]) + std::fabs(b[i]))) * v[i].z * invArea;
+
+#ifdef TRIANGLE_OCCLUSION_SSE
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 a0 = _mm_set1_ps(a[0]), a1 = _mm_set1_ps(a[1]), a2 = _mm_set1_ps(a[2]), az = _mm_set1_ps(zA);
+        // Four pixels at a time from a multiple of four, kWidth is one so rows never overrun.
+        const int first = x0 & ~3;
+        for (int y = y0; y <= y1; y ++) {
+            const float py = y + 0.5f;
+            const __m128 r0 = _mm_set1_ps(b[0] * py + c[0]), r1 = _mm_set1_ps(b[1] * py + c[1]), r2 = _mm_set1_ps(b[2] * py + c[2]);
+            const __m128 rz = _mm_set1_ps(zB * py + zC);
+            float* row = mDepth.data() + y * kWidth;
+            __m128 px = _mm_add_ps(_mm_set1_ps(first + 0.5f), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+            for (int x = first; x <= x1; x += 4, px = _mm_add_ps(px, _mm_set1_ps(4.0f))) {
+                __m128 inside = _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), r0), zero),
+                                           _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), r1), zero),
+                                                      _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), r2), zero)));
+                if (!_mm_movemask_ps(inside))
+                    continue;
+                __m128 depth = _mm_loadu_ps(row + x);
+                __m128 z = _mm_min_ps(depth, _mm_add_ps(_mm_mul_ps(az, px), rz));
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, depth)));
+            }
+        }
+#else
+        for (int y = y0; y <= y1; y ++) {
+            const float py = y + 0.5f;
+            float* row = mDepth.data() + y * kWidth;
+            for (int x = x0; x <= x1; x ++) {
+                const float px = x + 0.5f;
+                if (a[0] * px + b[0] * py + c[0] < 0.0f || a[1] * px + b[1] * py + c[1] < 0.0f ||
+                    a[2] * px + b[2] * py + c[2] < 0.0f)
+                    continue;
+                row[x] = std::min(row[x], zA * px + zB * py + zC);
+            }
+        }
+#endif
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef TRIANGLE_SOFTWAREOCCLUSION_H
+#define TRIANGLE_SOFTWAREOCCLUSION_H
+
+#include "common.h"
+#include <Frustum.h>
+
+#include <future>
+#include <glm/glm.hpp>
+
+namespace glfw {
+    class ThreadPool;
+    struct MeshFile;
+    struct Instance;
+
+    /**
+     * What a mesh hides of the scene: its largest triangles, in mesh space. Any subset of the real
+     * surface hides at most what the whole mesh does, so however few are kept the test stays conservative.
+     */
+    struct Occluder {
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> indices;
+
+        // At most maxTriangles of file, by area. Only ever holds maxTriangles candidates while it scans.
+        static Occluder build(const MeshFile& file, uint32_t maxTriangles);
+        bool isEmpty() const;
+    };
+
+    /**
+     * Occlusion culling without the GPU: the Occluder of a few instances is rasterized into a small
+     * depth buffer (nearest depth, 0..1 as Camera projects) on the ThreadPool, four pixels at a time
+     * with SSE where the compiler has it, then the box of every instance is tested against it before
+     * it is drawn. Occluders only write the pixels they cover entirely, at the farthest depth they
+     * reach inside them, so the low resolution never hides more than the full one would. An instance
+     * is hidden when the nearest corner of its box is behind the buffer on every pixel the box touches.
+     *
+     * begin() snapshots the occluders and starts the raster, so it can run while the GPU still works
+     * on the previous frame; wait() before the first isOccluded() of that frame.
+     */
+    class SoftwareOcclusion {
+    public:
+        static const uint32_t kWidth = 256;
+        static const uint32_t kHeight = 128;
+
+        struct Stats {
+            // Of the last raster, on the worker.
+            float rasterMilliseconds = 0.0f;
+            uint32_t triangles = 0;
+            // Instances tested and found hidden since the last getStats().
+            uint32_t tested = 0;
+            uint32_t culled = 0;
+        };
+
+        explicit SoftwareOcclusion(ThreadPool& pool);
+        virtual ~SoftwareOcclusion();
+        SoftwareOcclusion(const SoftwareOcclusion&) = delete;
+
+        // The instance's mesh has to stay loaded and the instance registered until removeOccluder.
+        void addOccluder(Instance* instance);
+        void removeOccluder(Instance* instance);
+
+        // viewProjection is the matrix the frame is drawn with. Waits for a raster still running.
+        void begin(const glm::mat4& viewProjection);
+        void wait();
+
+        // bounds in world space. Never true without a finished raster.
+        bool isOccluded(const Bounds& bounds);
+
+        // Resets tested and culled.
+        Stats getStats();
+    private:
+        struct Job {
+            const Occluder* occluder;
+            glm::mat4 transform;
+        };
+
+        void rasterize();
+        void rasterizeTriangle(const glm::vec4& c0, const glm::vec4& c1, const glm::vec4& c2);
+
+        ThreadPool& mPool;
+        std::vector<Instance*> mOccluders;
+        // Read by the worker only, written by begin() once the last raster is done.
+        std::vector<Job> mJobs;
+        glm::mat4 mViewProjection;
+        std::vector<float> mDepth;
+        std::future<void> mRaster;
+        // The depth buffer holds the raster of mViewProjection.
+        bool mReady;
+        Stats mStats;
+    };
+}
+
+
+#endif //TRIANGLE_SOFTWAREOCCLUSION_H
@@ -4,15 +4,17 @@
 
 #include "SubMesh.h"
 
-#include <Buffer.h>
+#include <glfwApp.h>
 
 namespace glfw {
     SubMesh::SubMesh(glfwApp *app): mApp(app) {
-        numIndices = 0;
-        needDestroyVertex = false;
-
-        vertex = NULL;
-        indice = NULL;
+        firstIndex = 0;
+        indexCount = 0;
+        vertexOffset = 0;
+        firstFace = 0;
+        materialID = kNoMaterial;
+        firstMeshlet = 0;
+        meshletCount = 0;
 
         mat_name = NULL;
         material = NULL;
@@ -22,79 +24,51 @@ namespace glfw {
         this->destroy();
     }
 
-    void SubMesh::loadSubMesh(tinyobj::shape_t &shape, tinyobj::attrib_t &attrib, VkCommandPool commandPool, VkQueue& graphicsQueue) {
-        throw std::runtime_error("SubMesh: Dont call this function for standalone creation");
-        std::unordered_map<Vertex, uint32_t> tmp_vert_pool;
-        std::vector<Vertex> tmp_vert;
-        this->vertex = new glfw::Buffer(mApp);
-        this->needDestroyVertex = true;
-        this->loadSubMesh(shape, attrib, tmp_vert_pool, tmp_vert, this->vertex, commandPool, graphicsQueue);
-        {
-            /**
-             * Create Vertex Buffer
-             */
-            glfw::Buffer stagingBuffer(mApp);
-            VkDeviceSize bufferSize = sizeof(tmp_vert[0]) * tmp_vert.size();
-            stagingBuffer.create(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-            stagingBuffer.uploadData(tmp_vert.data(), bufferSize, 0);
-            this->vertex->create(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-            stagingBuffer.copyTo(*this->vertex, commandPool, graphicsQueue, bufferSize);
-            stagingBuffer.destroy();
-        }
-    }
+    void SubMesh::loadSubMesh(const MeshFile &file, uint32_t index) {
+        const MeshFile::Range& range = file.submeshes[index];
+        // Scanned in place, a mapped cache is not copied.
+        const uint32_t* matIDs = file.getMatIDs() + range.firstFace;
+        this->firstFace = range.firstFace;
+        this->materialID = kNoMaterial;
+        if (range.faceCount && std::all_of(matIDs, matIDs + range.faceCount, [matIDs](uint32_t id) { return id == matIDs[0]; }))
+            this->materialID = matIDs[0];
 
-    void SubMesh::loadSubMesh(tinyobj::shape_t &shape, tinyobj::attrib_t &attrib, std::unordered_map<Vertex, uint32_t> &vert_pool, std::vector<Vertex> &vertices, glfw::Buffer* vert_buffer, VkCommandPool commandPool, VkQueue& graphicsQueue) {
-        this->vertex = vert_buffer;
-        std::unordered_map<Vertex, uint32_t> uniqueVertices;
-        std::vector<uint32_t> indices;
+        // Indices of all submeshes address the one vertex stream of the mesh, Mesh rebases them for 16 bit indices.
+        this->firstIndex = range.firstIndex;
+        this->indexCount = range.indexCount;
+        this->vertexOffset = 0;
+        this->firstMeshlet = range.firstMeshlet;
+        this->meshletCount = range.meshletCount;
 
-        int idx = 0;
-        assert(shape.mesh.material_ids.size() == shape.mesh.num_face_vertices.size());
-        matIDs.resize(shape.mesh.material_ids.size());
-        for (int fidx = 0; fidx < shape.mesh.num_face_vertices.size(); fidx ++) {
-            for (int j = 0; j < 3; idx ++, j ++) {
-                auto &index = shape.mesh.indices[idx];
-                Vertex vertex{};
-
-                vertex.pos = {
-                        attrib.vertices[3 * index.vertex_index + 0],
-                        attrib.vertices[3 * index.vertex_index + 2],
-                        attrib.vertices[3 * index.vertex_index + 1]
-                };
-                vertex.texCoord = {
-                        attrib.texcoords[2 * index.texcoord_index + 0],
-                        1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-                };
-                vertex.color = {1.0f, 1.0f, 1.0f};
-                if (uniqueVertices.count(vertex) == 0) {
-                    uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-                    vertices.push_back(vertex);
-                }
-                indices.push_back(uniqueVertices[vertex]);
-            }
-            matIDs[fidx] = static_cast<uint32_t>(shape.mesh.material_ids[fidx]);
+        /**
+         * Box over the referenced vertices, then the sphere around its center through the farthest vertex,
+         * which is tighter than the half diagonal.
+         */
+        const uint32_t* indices = file.getIndices() + range.firstIndex;
+        const Vertex* vertices = file.getVertices();
+        this->bounds = Bounds{};
+        for (uint32_t i = 0; i < range.indexCount; i ++) {
+            this->bounds.min = glm::min(this->bounds.min, vertices[indices[i]].pos);
+            this->bounds.max = glm::max(this->bounds.max, vertices[indices[i]].pos);
         }
-        this->indice = new glfw::Buffer(mApp);
-        {
-            /**
-             * Create Indices Buffer
-             */
-            VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-            glfw::Buffer stagingBuffer(mApp);
-            stagingBuffer.create(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-            stagingBuffer.uploadData(indices.data(), bufferSize);
-            this->indice->create(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-            stagingBuffer.copyTo(*this->indice, commandPool, graphicsQueue, bufferSize);
-            stagingBuffer.destroy();
+        if (range.indexCount) {
+            this->bounds.center = (this->bounds.min + this->bounds.max) * 0.5f;
+            float radius2 = 0.0f;
+            for (uint32_t i = 0; i < range.indexCount; i ++) {
+                glm::vec3 delta = vertices[indices[i]].pos - this->bounds.center;
+                radius2 = std::max(radius2, glm::dot(delta, delta));
+            }
+            this->bounds.radius = std::sqrt(radius2);
         }
-        this->numIndices = static_cast<uint32_t>(indices.size());
+    }
+
+    SubMesh::Lod SubMesh::getLod(uint32_t level) const {
+        if (level)
+            return this->lods[level - 1];
+        return Lod{this->firstIndex, this->indexCount, this->firstFace, this->firstMeshlet, this->meshletCount};
     }
 
     void SubMesh::destroy() {
-        if (this->indice) {
-            this->indice->destroy();
-            delete this->indice;
-            this->indice = NULL;
-        }
+        this->lods.clear();
     }
 }
\ No newline at end of file
@@ -16,31 +16,53 @@
 #include <tiny_obj_loader.h>
 #include <unordered_map>
 #include <Vertex.h>
+#include <MeshFile.h>
+#include <Frustum.h>
 
 namespace glfw {
     class glfwApp;
-    class Buffer;
     class Material;
     struct SubMesh {
-        uint32_t numIndices;
+        static const uint32_t kNoMaterial = 0xFFFFFFFF;
 
-        Buffer *vertex;
-        Buffer *indice;
+        // Ranges of one level of detail, in the same buffers as those of level 0 below.
+        struct Lod {
+            uint32_t firstIndex;
+            uint32_t indexCount;
+            uint32_t firstFace;
+            uint32_t firstMeshlet;
+            uint32_t meshletCount;
+        };
+
+        // Draw range relative to where the mesh starts in the GeometryPool. vertexOffset rebases 16 bit indices.
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        int32_t vertexOffset;
+        // First face in Mesh::matIDBuffer.
+        uint32_t firstFace;
+        // Material shared by every face, kNoMaterial when faces differ and have to be looked up.
+        uint32_t materialID;
+        // Of the vertices the submesh references, in mesh space.
+        Bounds bounds;
+        // Range of Mesh::meshletBuffer.
+        uint32_t firstMeshlet;
+        uint32_t meshletCount;
+        // Simplified levels, lods[0] is level 1. Every submesh of a mesh has Mesh::getLodCount() - 1.
+        std::vector<Lod> lods;
 
         Material* material;
         char* mat_name;
 
         glfwApp* mApp;
-        std::vector<uint32_t> matIDs;
 
         SubMesh(glfwApp* app);
         virtual ~SubMesh();
-        void loadSubMesh(tinyobj::shape_t &shape, tinyobj::attrib_t &attrib, VkCommandPool commandPool, VkQueue& graphicsQueue);
-        void loadSubMesh(tinyobj::shape_t &shape, tinyobj::attrib_t &attrib, std::unordered_map<Vertex, uint32_t> &vert_pool, std::vector<Vertex> &vertices, glfw::Buffer* vert_buffer, VkCommandPool commandPool, VkQueue& graphicsQueue);
+        // Index range `index` of file, drawn from the vertex and index buffers shared by the whole mesh.
+        void loadSubMesh(const MeshFile &file, uint32_t index);
+        // Level 0 is the full resolution ranges above. vertexOffset, materialID and bounds hold for all.
+        Lod getLod(uint32_t level) const;
 
         void destroy();
-    private:
-        bool needDestroyVertex;
     };
 }
 
@@ -7,6 +7,9 @@
 #include <common.h>
 #include <stb_image.h>
 #include <glfwApp.h>
+#include <UploadContext.h>
+#include <MipGenerator.h>
+#include <TextureFile.h>
 
 namespace glfw {
     Texture::Texture(glfw::glfwApp *app) {
@@ -14,8 +17,10 @@ namespace glfw {
 
         mSampler = VK_NULL_HANDLE;
         mImage = VK_NULL_HANDLE;
-        mMemory = VK_NULL_HANDLE;
         mImageView = VK_NULL_HANDLE;
+        mMipLevels = 1;
+        mExtent = {0, 0, 0};
+        mUsage = 0;
     }
 
     VkResult Texture::create(VkImageType imageType,
@@ -23,15 +28,21 @@ namespace glfw {
                              VkExtent3D extent,
                              VkImageTiling tiling,
                              VkImageUsageFlags usage,
-                             VkMemoryPropertyFlags memoryProperties) {
+                             VkMemoryPropertyFlags memoryProperties,
+                             uint32_t mipLevels,
+                             VkImageCreateFlags flags) {
         VkResult result = VK_SUCCESS;
         mFormat = format;
+        mUsage = usage;
+        mExtent = extent;
+        mMipLevels = mipLevels;
         VkImageCreateInfo imageCreateInfo = {};
         imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageCreateInfo.flags = flags;
         imageCreateInfo.imageType = imageType;
         imageCreateInfo.format = format;
         imageCreateInfo.extent = extent;
-        imageCreateInfo.mipLevels = 1;
+        imageCreateInfo.mipLevels = mipLevels;
         imageCreateInfo.arrayLayers = 1;
         imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
         imageCreateInfo.tiling = tiling;
@@ -44,49 +55,23 @@ namespace glfw {
             VkMemoryRequirements memoryRequirements = {};
             vkGetImageMemoryRequirements(mApp->device, mImage, &memoryRequirements);
 
-            VkMemoryAllocateInfo memoryAllocateInfo = {};
-            memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            memoryAllocateInfo.allocationSize = memoryRequirements.size;
-            memoryAllocateInfo.memoryTypeIndex = getMemoryType(memoryRequirements, memoryProperties);
-
-            result = vkAllocateMemory(mApp->device, &memoryAllocateInfo, nullptr, &mMemory);
+            AllocationKind kind = tiling == VK_IMAGE_TILING_OPTIMAL ? AllocationKind::ImageOptimal : AllocationKind::ImageLinear;
+            result = mApp->memoryAllocator->allocate(memoryRequirements, memoryProperties, kind, mAllocation);
             if (VK_SUCCESS != result) {
                 vkDestroyImage(mApp->device, mImage, nullptr);
                 mImage = VK_NULL_HANDLE;
-                mMemory = VK_NULL_HANDLE;
             } else {
-                result = vkBindImageMemory(mApp->device, mImage, mMemory, 0);
+                result = vkBindImageMemory(mApp->device, mImage, mAllocation.memory, mAllocation.offset);
                 if (VK_SUCCESS != result) {
                     vkDestroyImage(mApp->device, mImage, nullptr);
-                    vkFreeMemory(mApp->device, mMemory, nullptr);
+                    mApp->memoryAllocator->free(mAllocation);
                     mImage = VK_NULL_HANDLE;
-                    mMemory = VK_NULL_HANDLE;
                 }
             }
         }
         return result;
     }
 
-    uint32_t Texture::getMemoryType(VkMemoryRequirements &memoryRequirements, VkMemoryPropertyFlags memoryProperties) {
-        VkPhysicalDeviceMemoryProperties properties;
-        vkGetPhysicalDeviceMemoryProperties(mApp->physicalDevice, &properties);
-
-        uint32_t result = -1;
-        for (uint32_t memoryTypeIndex = 0; memoryTypeIndex < VK_MAX_MEMORY_TYPES; ++memoryTypeIndex) {
-            if (memoryRequirements.memoryTypeBits & (1 << memoryTypeIndex)) {
-                if ((properties.memoryTypes[memoryTypeIndex].propertyFlags & memoryProperties) == memoryProperties) {
-                    result = memoryTypeIndex;
-                    break;
-                }
-            }
-        }
-
-        if (result == -1)
-            throw std::runtime_error("Buffer: Failed to find correct memory type");
-
-        return result;
-    }
-
     void Texture::destroy() {
         if (mSampler) {
             vkDestroySampler(mApp->device, mSampler, nullptr);
@@ -96,96 +81,115 @@ namespace glfw {
             vkDestroyImageView(mApp->device, mImageView, nullptr);
             mImageView = VK_NULL_HANDLE;
         }
-        if (mMemory) {
-            vkFreeMemory(mApp->device, mMemory, nullptr);
-            mMemory = VK_NULL_HANDLE;
-        }
         if (mImage) {
             vkDestroyImage(mApp->device, mImage, nullptr);
             mImage = VK_NULL_HANDLE;
         }
+        if (mAllocation.block) {
+            mApp->memoryAllocator->free(mAllocation);
+        }
+    }
+
+    std::set<VkFormat> Texture::getSampleableFormats(glfwApp *app) {
+        std::set<VkFormat> formats;
+        for (VkFormat format : TextureFile::getFormats()) {
+            VkFormatProperties properties;
+            vkGetPhysicalDeviceFormatProperties(app->physicalDevice, format, &properties);
+            if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)
+                formats.insert(format);
+        }
+        return formats;
     }
 
-    bool Texture::load(const char *fileName, VkCommandPool commandPool, VkQueue graphicsQueue) {
+    TextureSource Texture::decode(const char *fileName, const std::set<VkFormat> &sampleable) const {
+        TextureSource source;
+        source.fileName = fileName;
+        if (TextureFile::isContainer(fileName)) {
+            source.isContainer = true;
+            if (!source.container.load(fileName))
+                return source;
+            if (!sampleable.count(source.container.format)) {
+                fprintf(stdout, "Texture: format of %s is not supported by the device\n", fileName);
+                return source;
+            }
+            source.format = source.container.format;
+            source.extent = source.container.extent;
+            source.valid = true;
+            return source;
+        }
+
         int width, height, channels;
         bool textureHDR = false;
-        stbi_uc *imageData = nullptr;
 
         std::string fileNameString(fileName);
         const std::string extension = fileNameString.substr(fileNameString.length() - 3);
 
         if (extension == "hdr") {
             textureHDR = true;
-            imageData = reinterpret_cast<stbi_uc *>(stbi_loadf(fileName, &width, &height, &channels, STBI_rgb_alpha));
+            source.pixels.reset(reinterpret_cast<stbi_uc *>(stbi_loadf(fileName, &width, &height, &channels, STBI_rgb_alpha)));
         } else {
-            imageData = stbi_load(fileName, &width, &height, &channels, STBI_rgb_alpha);
+            source.pixels.reset(stbi_load(fileName, &width, &height, &channels, STBI_rgb_alpha));
         }
-
-        VkResult result = VK_SUCCESS;
-
-        if (!imageData)
-            return false;
+        if (!source.pixels)
+            return source;
 
         const int bpp = textureHDR ? sizeof(float[4]) : sizeof(uint8_t[4]);
-        VkDeviceSize imageSize = static_cast<VkDeviceSize>(width * height * bpp);
-
-        glfw::Buffer stagingBuffer(mApp);
-        result = stagingBuffer.create(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-        if (result != VK_SUCCESS) {
-            stbi_image_free(imageData);
-            return false;
-        }
-        result = stagingBuffer.uploadData(imageData, imageSize);
-        stbi_image_free(imageData);
-        if (result != VK_SUCCESS)
-            return false;
-
-        VkExtent3D imageExtent{
+        source.size = static_cast<VkDeviceSize>(width) * height * bpp;
+        source.extent = {
                 static_cast<uint32_t>(width),
                 static_cast<uint32_t>(height),
                 1
         };
-        const VkFormat fmt = textureHDR ? VK_FORMAT_R32G32B32A32_SFLOAT : VK_FORMAT_R8G8B8A8_SRGB;
-        result = this->create(VK_IMAGE_TYPE_2D, fmt, imageExtent, VK_IMAGE_TILING_OPTIMAL,
-                              VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-        if (result != VK_SUCCESS)
+        source.format = textureHDR ? VK_FORMAT_R32G32B32A32_SFLOAT : VK_FORMAT_R8G8B8A8_SRGB;
+        source.valid = true;
+        return source;
+    }
+
+    bool Texture::upload(const TextureSource &source) {
+        if (!source.valid)
             return false;
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands(mApp->device, commandPool);
 
-        VkImageMemoryBarrier barrier = {};
-        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.image = mImage;
-        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        if (source.isContainer) {
+            /**
+             * The chain comes from the file, compressed formats can not be blitted or stored to anyway.
+             */
+            const TextureFile& file = source.container;
+            VkResult result = this->create(VK_IMAGE_TYPE_2D, file.format, file.extent, VK_IMAGE_TILING_OPTIMAL,
+                                           VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, file.mipLevels);
+            if (result != VK_SUCCESS)
+                return false;
+            mApp->uploadContext->uploadImage(*this, file.getData(), file.getDataSize(), file.regions,
+                                             {VK_IMAGE_ASPECT_COLOR_BIT, 0, file.mipLevels, 0, 1});
+            return true;
+        }
 
-        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
-                             0, nullptr, 0, nullptr, 1, &barrier);
+        const MipPath mipPath = mApp->mipGenerator->choosePath(source.format);
+        const uint32_t mipLevels = mipPath == MipPath::None ? 1 : MipGenerator::getMipLevels(source.extent);
+        VkResult result = this->create(VK_IMAGE_TYPE_2D, source.format, source.extent, VK_IMAGE_TILING_OPTIMAL,
+                                       VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | mApp->mipGenerator->getUsage(mipPath),
+                                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mipLevels, mApp->mipGenerator->getCreateFlags(mipPath));
+        if (result != VK_SUCCESS)
+            return false;
 
+        /**
+         * Staged into the upload ring, the copy runs with the rest of the batch. Only level 0 comes from
+         * the file, the rest of the chain is generated on the graphics queue right after.
+         */
         VkBufferImageCopy region = {};
         region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
-        region.imageExtent = imageExtent;
-
-        vkCmdCopyBufferToImage(commandBuffer, stagingBuffer.getBuffer(), mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                               1, &region);
-
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
-                             0, nullptr, 0, nullptr, 1, &barrier);
-
-        endSingleTimeCommands(mApp->device, commandPool, graphicsQueue, commandBuffer);
+        region.imageExtent = source.extent;
+        mApp->uploadContext->uploadImage(*this, source.pixels.get(), source.size, {region},
+                                         {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+                                         mApp->mipGenerator->getSourceLayout(mipPath));
+        mApp->mipGenerator->generate(*this, mipPath);
         return true;
     }
 
+    bool Texture::load(const char *fileName) {
+        return this->upload(this->decode(fileName, getSampleableFormats(mApp)));
+    }
+
     VkResult
     Texture::createImageView(VkImageViewType viewType, VkFormat format, VkImageSubresourceRange subresourceRange) {
         VkImageViewCreateInfo imageViewCreateInfo;
@@ -198,6 +202,20 @@ namespace glfw {
         imageViewCreateInfo.flags = 0;
         imageViewCreateInfo.components = {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B,
                                           VK_COMPONENT_SWIZZLE_A};
+        /**
+         * A view inherits the usage of the image, storage included, which an sRGB view can not have.
+         * Images created with EXTENDED_USAGE for MipGenerator leave it out of views that can not store.
+         */
+        VkImageViewUsageCreateInfo usageInfo{};
+        if (mUsage & VK_IMAGE_USAGE_STORAGE_BIT) {
+            VkFormatProperties properties;
+            vkGetPhysicalDeviceFormatProperties(mApp->physicalDevice, format, &properties);
+            if (!(properties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)) {
+                usageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO;
+                usageInfo.usage = mUsage & ~VK_IMAGE_USAGE_STORAGE_BIT;
+                imageViewCreateInfo.pNext = &usageInfo;
+            }
+        }
         return vkCreateImageView(mApp->device, &imageViewCreateInfo, nullptr, &mImageView);
     }
 
@@ -219,7 +237,7 @@ namespace glfw {
         samplerCreateInfo.compareEnable = VK_FALSE;
         samplerCreateInfo.compareOp = VK_COMPARE_OP_ALWAYS;
         samplerCreateInfo.minLod = 0;
-        samplerCreateInfo.maxLod = 0;
+        samplerCreateInfo.maxLod = static_cast<float>(mMipLevels);
         samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
         samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
         return vkCreateSampler(mApp->device, &samplerCreateInfo, nullptr, &mSampler);
@@ -229,6 +247,14 @@ namespace glfw {
         return mFormat;
     }
 
+    VkExtent3D Texture::getExtent() const {
+        return mExtent;
+    }
+
+    uint32_t Texture::getMipLevels() const {
+        return mMipLevels;
+    }
+
     VkImage Texture::getImage() const {
         return mImage;
     }
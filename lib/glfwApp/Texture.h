@@ -6,10 +6,30 @@
 #define TRIANGLE_TEXTURE_H
 
 #include <common.h>
+#include <MemoryAllocator.h>
+#include <TextureFile.h>
+#include <memory>
 
 namespace glfw {
     class glfwApp;
 
+    /**
+     * CPU side of a texture load: the decoded pixels (or the container read from disk) waiting to be
+     * uploaded. Built by Texture::decode, which does not touch Vulkan and so can run on a worker thread.
+     */
+    struct TextureSource {
+        bool valid = false;
+        std::string fileName;
+
+        bool isContainer = false;
+        TextureFile container;
+
+        std::unique_ptr<stbi_uc, void (*)(void *)> pixels{nullptr, stbi_image_free};
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        VkExtent3D extent = {0, 0, 1};
+        VkDeviceSize size = 0;
+    };
+
     class Texture {
     public:
         Texture(glfw::glfwApp *app);
@@ -21,11 +41,22 @@ namespace glfw {
                         VkExtent3D extent,
                         VkImageTiling tiling,
                         VkImageUsageFlags usage,
-                        VkMemoryPropertyFlags memoryProperties);
+                        VkMemoryPropertyFlags memoryProperties,
+                        uint32_t mipLevels = 1,
+                        VkImageCreateFlags flags = 0);
 
         void destroy();
 
-        bool load(const char *fileName, VkCommandPool commandPool, VkQueue graphicsQueue);
+        // DDS/KTX2 containers are uploaded as stored (BC formats, full chain), anything else goes through stb.
+        bool load(const char *fileName);
+
+        /**
+         * load() in two halves, decode is thread safe, upload has to run on the main thread. Containers
+         * in a format outside sampleable (see getSampleableFormats) are rejected.
+         */
+        TextureSource decode(const char *fileName, const std::set<VkFormat> &sampleable) const;
+
+        bool upload(const TextureSource &source);
 
         VkResult createImageView(VkImageViewType viewType, VkFormat format, VkImageSubresourceRange subresourceRange);
 
@@ -38,21 +69,30 @@ namespace glfw {
         // getters
         VkFormat getFormat() const;
 
+        VkExtent3D getExtent() const;
+
+        uint32_t getMipLevels() const;
+
         VkImage getImage() const;
 
         VkImageView getImageView() const;
 
         VkSampler getSampler() const;
 
+        // Of TextureFile::getFormats, those the device samples with optimal tiling. Queries Vulkan, main thread only.
+        static std::set<VkFormat> getSampleableFormats(glfwApp *app);
+
     private:
+
         VkFormat mFormat;
+        VkImageUsageFlags mUsage;
+        VkExtent3D mExtent;
+        uint32_t mMipLevels;
         VkImage mImage;
-        VkDeviceMemory mMemory;
+        Allocation mAllocation;
         VkImageView mImageView;
         VkSampler mSampler;
         glfw::glfwApp *mApp;
-
-        uint32_t getMemoryType(VkMemoryRequirements &memoryRequirements, VkMemoryPropertyFlags memoryProperties);
     };
 }
 
@@ -0,0 +1,356 @@
+#include "TextureFile.h"
+#include <filesystem>
+
+namespace glfw {
+    namespace {
+        const uint32_t kDDSMagic = 0x20534444; // "DDS "
+        const uint32_t kDDSFourCCFlag = 0x4;
+
+        struct DDSPixelFormat {
+            uint32_t size;
+            uint32_t flags;
+            uint32_t fourCC;
+            uint32_t rgbBitCount;
+            uint32_t masks[4];
+        };
+
+        struct DDSHeader {
+            uint32_t size;
+            uint32_t flags;
+            uint32_t height;
+            uint32_t width;
+            uint32_t pitchOrLinearSize;
+            uint32_t depth;
+            uint32_t mipMapCount;
+            uint32_t reserved1[11];
+            DDSPixelFormat pixelFormat;
+            uint32_t caps[4];
+            uint32_t reserved2;
+        };
+
+        struct DDSHeaderDX10 {
+            uint32_t dxgiFormat;
+            uint32_t resourceDimension;
+            uint32_t miscFlag;
+            uint32_t arraySize;
+            uint32_t miscFlags2;
+        };
+
+        const uint8_t kKTX2Identifier[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+        struct KTX2Header {
+            uint8_t identifier[12];
+            uint32_t vkFormat;
+            uint32_t typeSize;
+            uint32_t pixelWidth;
+            uint32_t pixelHeight;
+            uint32_t pixelDepth;
+            uint32_t layerCount;
+            uint32_t faceCount;
+            uint32_t levelCount;
+            uint32_t supercompressionScheme;
+            uint32_t dfdByteOffset;
+            uint32_t dfdByteLength;
+            uint32_t kvdByteOffset;
+            uint32_t kvdByteLength;
+            uint64_t sgdByteOffset;
+            uint64_t sgdByteLength;
+        };
+
+        struct KTX2LevelIndex {
+            uint64_t byteOffset;
+            uint64_t byteLength;
+            uint64_t uncompressedByteLength;
+        };
+
+        constexpr uint32_t makeFourCC(char a, char b, char c, char d) {
+            return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+        }
+
+        VkFormat formatFromDXGI(uint32_t dxgiFormat) {
+            switch (dxgiFormat) {
+                case 28: return VK_FORMAT_R8G8B8A8_UNORM;
+                case 29: return VK_FORMAT_R8G8B8A8_SRGB;
+                case 71: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+                case 72: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+                case 77: return VK_FORMAT_BC3_UNORM_BLOCK;
+                case 78: return VK_FORMAT_BC3_SRGB_BLOCK;
+                case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+                case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+                case 95: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+                case 96: return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+                case 98: return VK_FORMAT_BC7_UNORM_BLOCK;
+                case 99: return VK_FORMAT_BC7_SRGB_BLOCK;
+                default: return VK_FORMAT_UNDEFINED;
+            }
+        }
+
+        uint32_t dxgiFromFormat(VkFormat format) {
+            for (uint32_t dxgiFormat = 0; dxgiFormat < 100; dxgiFormat ++) {
+                if (formatFromDXGI(dxgiFormat) == format)
+                    return dxgiFormat;
+            }
+            return 0;
+        }
+
+        VkFormat formatFromFourCC(uint32_t fourCC) {
+            // Legacy headers carry no colour space; DXT1/DXT5 are albedo maps here, so decode as sRGB like stb loads.
+            switch (fourCC) {
+                case makeFourCC('D', 'X', 'T', '1'): return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+                case makeFourCC('D', 'X', 'T', '5'): return VK_FORMAT_BC3_SRGB_BLOCK;
+                case makeFourCC('A', 'T', 'I', '2'):
+                case makeFourCC('B', 'C', '5', 'U'): return VK_FORMAT_BC5_UNORM_BLOCK;
+                default: return VK_FORMAT_UNDEFINED;
+            }
+        }
+
+        // Levels of a full mip chain down to 1x1, 0 for an empty extent.
+        uint32_t maxLevelCount(const VkExtent3D& extent) {
+            if (extent.width == 0 || extent.height == 0)
+                return 0;
+            uint32_t levels = 0;
+            for (uint32_t size = std::max(extent.width, extent.height); size; size >>= 1)
+                levels ++;
+            return levels;
+        }
+    }
+
+    const char *TextureFile::getData() const {
+        return mFile.data() + mDataOffset;
+    }
+
+    VkDeviceSize TextureFile::getDataSize() const {
+        return mDataSize;
+    }
+
+    bool TextureFile::isContainer(const std::string &fileName) {
+        size_t dot = fileName.rfind('.');
+        if (dot == std::string::npos)
+            return false;
+        std::string extension = fileName.substr(dot + 1);
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        return extension == "dds" || extension == "ktx2";
+    }
+
+    bool TextureFile::isUpToDate(const std::string &cookedName, const char *sourceName) {
+        std::error_code error;
+        auto cookedTime = std::filesystem::last_write_time(cookedName, error);
+        if (error)
+            return false;
+        auto sourceTime = std::filesystem::last_write_time(sourceName, error);
+        return error || cookedTime >= sourceTime;
+    }
+
+    uint32_t TextureFile::getBlockSize(VkFormat format) {
+        switch (format) {
+            case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+                return 8;
+            case VK_FORMAT_BC3_UNORM_BLOCK:
+            case VK_FORMAT_BC3_SRGB_BLOCK:
+            case VK_FORMAT_BC5_UNORM_BLOCK:
+            case VK_FORMAT_BC5_SNORM_BLOCK:
+            case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+            case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+            case VK_FORMAT_BC7_UNORM_BLOCK:
+            case VK_FORMAT_BC7_SRGB_BLOCK:
+                return 16;
+            case VK_FORMAT_R8G8B8A8_UNORM:
+            case VK_FORMAT_R8G8B8A8_SRGB:
+                return 4;
+            default:
+                return 0;
+        }
+    }
+
+    const std::vector<VkFormat> &TextureFile::getFormats() {
+        static const std::vector<VkFormat> formats = {
+                VK_FORMAT_BC1_RGBA_UNORM_BLOCK, VK_FORMAT_BC1_RGBA_SRGB_BLOCK, VK_FORMAT_BC3_UNORM_BLOCK,
+                VK_FORMAT_BC3_SRGB_BLOCK, VK_FORMAT_BC5_UNORM_BLOCK, VK_FORMAT_BC5_SNORM_BLOCK,
+                VK_FORMAT_BC6H_UFLOAT_BLOCK, VK_FORMAT_BC6H_SFLOAT_BLOCK, VK_FORMAT_BC7_UNORM_BLOCK,
+                VK_FORMAT_BC7_SRGB_BLOCK, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R8G8B8A8_SRGB
+        };
+        return formats;
+    }
+
+    bool TextureFile::isBlockCompressed(VkFormat format) {
+        return getBlockSize(format) != 0 && format != VK_FORMAT_R8G8B8A8_UNORM && format != VK_FORMAT_R8G8B8A8_SRGB;
+    }
+
+    bool TextureFile::load(const char *fileName) {
+        std::string name(fileName);
+        std::string extension = name.substr(name.rfind('.') + 1);
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if (extension == "dds")
+            return this->loadDDS(fileName);
+        if (extension == "ktx2")
+            return this->loadKTX2(fileName);
+        return false;
+    }
+
+    bool TextureFile::addLevels(const std::vector<VkDeviceSize> &offsets) {
+        const uint32_t blockSize = getBlockSize(format);
+        const uint32_t blockDim = isBlockCompressed(format) ? 4 : 1;
+        if (blockSize == 0 || offsets.empty())
+            return false;
+
+        VkDeviceSize begin = std::numeric_limits<VkDeviceSize>::max();
+        VkDeviceSize end = 0;
+        std::vector<VkDeviceSize> sizes(offsets.size());
+        for (uint32_t level = 0; level < offsets.size(); level ++) {
+            uint32_t width = std::max(extent.width >> level, 1u);
+            uint32_t height = std::max(extent.height >> level, 1u);
+            sizes[level] = VkDeviceSize((width + blockDim - 1) / blockDim) * ((height + blockDim - 1) / blockDim) * blockSize;
+            if (offsets[level] + sizes[level] > mFile.size())
+                return false;
+            begin = std::min(begin, offsets[level]);
+            end = std::max(end, offsets[level] + sizes[level]);
+        }
+
+        mDataOffset = static_cast<size_t>(begin);
+        mDataSize = end - begin;
+        mipLevels = static_cast<uint32_t>(offsets.size());
+        regions.resize(offsets.size());
+        for (uint32_t level = 0; level < offsets.size(); level ++) {
+            VkBufferImageCopy& region = regions[level];
+            region = {};
+            region.bufferOffset = offsets[level] - begin;
+            region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+            region.imageExtent = {std::max(extent.width >> level, 1u), std::max(extent.height >> level, 1u), 1};
+        }
+        return true;
+    }
+
+    bool TextureFile::writeDDS(const char *fileName, VkFormat format, VkExtent3D extent,
+                               const std::vector<std::vector<uint8_t>> &levels) {
+        const uint32_t dxgiFormat = dxgiFromFormat(format);
+        if (dxgiFormat == 0 || levels.empty())
+            return false;
+
+        DDSHeader header{};
+        header.size = sizeof(DDSHeader);
+        header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; // CAPS HEIGHT WIDTH PIXELFORMAT MIPMAPCOUNT LINEARSIZE
+        header.height = extent.height;
+        header.width = extent.width;
+        header.pitchOrLinearSize = static_cast<uint32_t>(levels[0].size());
+        header.depth = 1;
+        header.mipMapCount = static_cast<uint32_t>(levels.size());
+        header.pixelFormat.size = sizeof(DDSPixelFormat);
+        header.pixelFormat.flags = kDDSFourCCFlag;
+        header.pixelFormat.fourCC = makeFourCC('D', 'X', '1', '0');
+        header.caps[0] = 0x1000 | 0x400000 | 0x8; // TEXTURE MIPMAP COMPLEX
+
+        DDSHeaderDX10 dx10{};
+        dx10.dxgiFormat = dxgiFormat;
+        dx10.resourceDimension = 3;
+        dx10.arraySize = 1;
+
+        std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+            return false;
+        file.write(reinterpret_cast<const char*>(&kDDSMagic), sizeof(kDDSMagic));
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(&dx10), sizeof(dx10));
+        for (auto& level : levels)
+            file.write(reinterpret_cast<const char*>(level.data()), static_cast<std::streamsize>(level.size()));
+        return static_cast<bool>(file);
+    }
+
+    bool TextureFile::loadDDS(const char *fileName) {
+        try {
+            mFile = readFile(fileName);
+        } catch (...) {
+            return false;
+        }
+        if (mFile.size() < sizeof(uint32_t) + sizeof(DDSHeader))
+            return false;
+
+        uint32_t magic;
+        DDSHeader header;
+        std::memcpy(&magic, mFile.data(), sizeof(magic));
+        std::memcpy(&header, mFile.data() + sizeof(magic), sizeof(header));
+        if (magic != kDDSMagic || header.size != sizeof(DDSHeader))
+            return false;
+
+        size_t offset = sizeof(magic) + sizeof(header);
+        format = VK_FORMAT_UNDEFINED;
+        if ((header.pixelFormat.flags & kDDSFourCCFlag) && header.pixelFormat.fourCC == makeFourCC('D', 'X', '1', '0')) {
+            if (mFile.size() < offset + sizeof(DDSHeaderDX10))
+                return false;
+            DDSHeaderDX10 dx10;
+            std::memcpy(&dx10, mFile.data() + offset, sizeof(dx10));
+            offset += sizeof(dx10);
+            // Texture2D only, no arrays or cube maps.
+            if (dx10.resourceDimension != 3 || dx10.arraySize > 1 || (dx10.miscFlag & 0x4))
+                return false;
+            format = formatFromDXGI(dx10.dxgiFormat);
+        } else if (header.pixelFormat.flags & kDDSFourCCFlag) {
+            format = formatFromFourCC(header.pixelFormat.fourCC);
+        }
+        if (format == VK_FORMAT_UNDEFINED) {
+            fprintf(stdout, "TextureFile: unsupported DDS format in %s\n", fileName);
+            return false;
+        }
+
+        /**
+         * Header fields are untrusted: a level count past the full chain would shift the width by 32 or
+         * more and size the offsets off an unbounded count.
+         */
+        extent = {header.width, header.height, 1};
+        const uint32_t levelCount = std::max(header.mipMapCount, 1u);
+        if (levelCount > maxLevelCount(extent)) {
+            fprintf(stdout, "TextureFile: bad DDS extent or level count in %s\n", fileName);
+            return false;
+        }
+        const uint32_t blockDim = isBlockCompressed(format) ? 4 : 1;
+        std::vector<VkDeviceSize> offsets(levelCount);
+        for (uint32_t level = 0; level < offsets.size(); level ++) {
+            offsets[level] = offset;
+            uint32_t width = std::max(extent.width >> level, 1u);
+            uint32_t height = std::max(extent.height >> level, 1u);
+            offset += size_t((width + blockDim - 1) / blockDim) * ((height + blockDim - 1) / blockDim) * getBlockSize(format);
+        }
+        return this->addLevels(offsets);
+    }
+
+    bool TextureFile::loadKTX2(const char *fileName) {
+        try {
+            mFile = readFile(fileName);
+        } catch (...) {
+            return false;
+        }
+        KTX2Header header;
+        if (mFile.size() < sizeof(header))
+            return false;
+        std::memcpy(&header, mFile.data(), sizeof(header));
+        if (std::memcmp(header.identifier, kKTX2Identifier, sizeof(kKTX2Identifier)) != 0)
+            return false;
+
+        /**
+         * Basis/zstd supercompressed files would need a transcoder, only raw payloads are accepted.
+         */
+        format = static_cast<VkFormat>(header.vkFormat);
+        if (header.supercompressionScheme != 0 || getBlockSize(format) == 0 || header.pixelDepth > 1 ||
+            header.layerCount > 1 || header.faceCount != 1) {
+            fprintf(stdout, "TextureFile: unsupported KTX2 layout in %s\n", fileName);
+            return false;
+        }
+
+        extent = {header.pixelWidth, std::max(header.pixelHeight, 1u), 1};
+        // A pixelHeight of 0 is a 1D texture, a pixelWidth of 0 nothing.
+        const uint32_t levelCount = std::max(header.levelCount, 1u);
+        if (levelCount > maxLevelCount(extent)) {
+            fprintf(stdout, "TextureFile: bad KTX2 extent or level count in %s\n", fileName);
+            return false;
+        }
+        if (mFile.size() < sizeof(header) + levelCount * sizeof(KTX2LevelIndex))
+            return false;
+        std::vector<VkDeviceSize> offsets(levelCount);
+        for (uint32_t level = 0; level < levelCount; level ++) {
+            KTX2LevelIndex index;
+            std::memcpy(&index, mFile.data() + sizeof(header) + level * sizeof(KTX2LevelIndex), sizeof(index));
+            offsets[level] = index.byteOffset;
+        }
+        return this->addLevels(offsets);
+    }
+}
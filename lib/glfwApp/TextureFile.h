@@ -0,0 +1,47 @@
+#ifndef TRIANGLE_TEXTUREFILE_H
+#define TRIANGLE_TEXTUREFILE_H
+
+#include "common.h"
+
+namespace glfw {
+    /**
+     * A texture container that is already in its GPU format (BC1/3/5/6H/7 or RGBA8) with every mip
+     * level stored, read from a DDS or KTX2 file. Level data is not copied out of the file, regions
+     * point into it relative to getData().
+     */
+    struct TextureFile {
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        VkExtent3D extent = {0, 0, 1};
+        uint32_t mipLevels = 0;
+        std::vector<VkBufferImageCopy> regions;
+
+        const char* getData() const;
+        VkDeviceSize getDataSize() const;
+
+        bool load(const char* fileName);
+        bool loadDDS(const char* fileName);
+        bool loadKTX2(const char* fileName);
+
+        // levels[i] holds the tightly packed blocks of mip level i. Used by tools/cooker.
+        static bool writeDDS(const char* fileName, VkFormat format, VkExtent3D extent,
+                             const std::vector<std::vector<uint8_t>>& levels);
+
+        static bool isContainer(const std::string& fileName);
+        // A cooked texture is stale once its source has been written after it.
+        static bool isUpToDate(const std::string& cookedName, const char* sourceName);
+        // Bytes per 4x4 block for BC formats, per texel otherwise. 0 for formats we do not load.
+        static uint32_t getBlockSize(VkFormat format);
+        // Every format getBlockSize knows, for callers that check device support up front.
+        static const std::vector<VkFormat>& getFormats();
+        static bool isBlockCompressed(VkFormat format);
+    private:
+        bool addLevels(const std::vector<VkDeviceSize>& offsets);
+
+        std::vector<char> mFile;
+        size_t mDataOffset = 0;
+        VkDeviceSize mDataSize = 0;
+    };
+}
+
+
+#endif //TRIANGLE_TEXTUREFILE_H
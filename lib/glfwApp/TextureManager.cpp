@@ -5,10 +5,15 @@
 #include "TextureManager.h"
 #include <glfwApp.h>
 #include <Texture.h>
+#include <TextureFile.h>
+#include <ThreadPool.h>
+#include <UploadContext.h>
+#include <filesystem>
 
 namespace glfw {
     TextureManager::TextureManager(glfwApp *app) {
         mApp = app;
+        mSampleableFormats = Texture::getSampleableFormats(app);
     }
 
     TextureManager::~TextureManager() {
@@ -16,6 +21,10 @@ namespace glfw {
     }
 
     void TextureManager::destroy() {
+        // Decodes still in flight reference the textures below.
+        for (auto& pending : mPending)
+            pending.second.wait();
+        mPending.clear();
         for (auto& p : mTextures)
             p->destroy();
         mTextures.clear();
@@ -30,17 +39,67 @@ namespace glfw {
         return descriptorSets[frame];
     }
 
-    int TextureManager::getTexture(const char *name, VkCommandPool commandPool, VkQueue graphicsQueue) {
-        if (this->mTextureIds.count(std::string(name)))
-            return this->mTextureIds[std::string(name)];
+    /**
+     * Pre-compressed siblings of a raw source, e.g. wood.png -> wood.ktx2, wood.dds.
+     */
+    static
+    std::vector<std::string> getCompressedCandidates(const char *name) {
+        std::vector<std::string> candidates;
+        if (TextureFile::isContainer(name))
+            return candidates;
+        std::filesystem::path path(name);
+        for (const char* extension : {".ktx2", ".dds"})
+            candidates.push_back(std::filesystem::path(path).replace_extension(extension).string());
+        return candidates;
+    }
+
+    int TextureManager::getTexture(const char *name) {
+        int ret = this->requestTexture(name);
+        this->flush();
+        return ret;
+    }
+
+    int TextureManager::requestTexture(const char *name) {
+        auto it = this->mTextureIds.find(std::string(name));
+        if (it != this->mTextureIds.end())
+            return it->second;
+
         Texture* nTexture = new Texture(mApp);
-        nTexture->load(name, commandPool, graphicsQueue);
         int ret = this->mTextures.size();
         this->mTextureIds[std::string(name)] = ret;
         this->mTextures.push_back(nTexture);
 
+        std::string source(name);
+        const std::set<VkFormat>* sampleable = &this->mSampleableFormats;
+        this->mPending.emplace_back(ret, mApp->threadPool->submit([nTexture, source, sampleable]() {
+            for (const std::string& candidate : getCompressedCandidates(source.c_str())) {
+                if (!TextureFile::isUpToDate(candidate, source.c_str()))
+                    continue;
+                TextureSource decoded = nTexture->decode(candidate.c_str(), *sampleable);
+                if (decoded.valid)
+                    return decoded;
+            }
+            return nTexture->decode(source.c_str(), *sampleable);
+        }));
+
         // TODO: init sampler & Image View
 
         return ret;
     }
+
+    void TextureManager::flush() {
+        if (this->mPending.empty())
+            return;
+        /**
+         * Uploads are recorded in request order, each one as soon as its own decode is done, while the
+         * rest are still decoding on the pool.
+         */
+        for (auto& pending : this->mPending) {
+            TextureSource source = pending.second.get();
+            if (!this->mTextures[pending.first]->upload(source))
+                fprintf(stdout, "TextureManager: failed to load %s\n", source.fileName.c_str());
+        }
+        this->mPending.clear();
+        mApp->uploadContext->flush();
+    }
 }
\ No newline at end of file
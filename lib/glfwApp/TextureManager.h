@@ -7,16 +7,29 @@
 
 #include "common.h"
 #include <unordered_map>
+#include <future>
 
 namespace glfw {
     class glfwApp;
     class Texture;
+    struct TextureSource;
+
+    /**
+     * Textures are decoded on glfwApp::threadPool. requestTexture hands out the id right away and queues
+     * the decode, asking twice for the same path while it is in flight returns the same id. flush
+     * uploads every finished decode into one UploadContext batch, so a mesh with dozens of materials
+     * loads in about the time of its largest texture.
+     */
     class TextureManager {
     public:
         TextureManager(glfwApp* app);
         virtual ~TextureManager();
 
-        int getTexture(const char* name, VkCommandPool commandPool, VkQueue graphicsQueue);
+        // requestTexture + flush, for callers that need a single texture right away.
+        int getTexture(const char* name);
+        int requestTexture(const char* name);
+        // Waits for pending decodes and records their uploads, then submits the batch.
+        void flush();
 
         int getTexutreNum();
         void initDescriptorSet(); // TODO
@@ -26,6 +39,9 @@ namespace glfw {
     private:
         std::unordered_map<std::string, int> mTextureIds;
         std::vector<Texture*> mTextures;
+        std::vector<std::pair<int, std::future<TextureSource>>> mPending;
+        // Texture::getSampleableFormats, queried here once so decodes on the pool never touch Vulkan.
+        std::set<VkFormat> mSampleableFormats;
 
         std::vector<VkDescriptorSet> descriptorSets;
 
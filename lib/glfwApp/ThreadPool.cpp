@@ -0,0 +1,47 @@
+#include "ThreadPool.h"
+
+namespace glfw {
+    ThreadPool::ThreadPool(uint32_t threadCount) {
+        mStopping = false;
+        if (threadCount == 0)
+            threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+        mWorkers.reserve(threadCount);
+        for (uint32_t i = 0; i < threadCount; i ++)
+            mWorkers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+
+    ThreadPool::~ThreadPool() {
+        this->destroy();
+    }
+
+    void ThreadPool::destroy() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+        }
+        mCondition.notify_all();
+        for (auto& worker : mWorkers)
+            worker.join();
+        mWorkers.clear();
+    }
+
+    uint32_t ThreadPool::getThreadCount() const {
+        return static_cast<uint32_t>(mWorkers.size());
+    }
+
+    void ThreadPool::workerLoop() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mCondition.wait(lock, [this]() { return mStopping || !mJobs.empty(); });
+                // Queued jobs still run on shutdown, someone may be waiting on their future.
+                if (mJobs.empty())
+                    return;
+                job = std::move(mJobs.front());
+                mJobs.pop_front();
+            }
+            job();
+        }
+    }
+}
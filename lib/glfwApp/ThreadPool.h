@@ -0,0 +1,52 @@
+#ifndef TRIANGLE_THREADPOOL_H
+#define TRIANGLE_THREADPOOL_H
+
+#include "common.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+namespace glfw {
+    /**
+     * Fixed set of worker threads for CPU side loading work (decoding, parsing). Jobs must not touch
+     * Vulkan objects, results are handed back through the future and consumed on the main thread.
+     */
+    class ThreadPool {
+    public:
+        // 0 picks hardware_concurrency - 1, leaving the main thread its own core.
+        explicit ThreadPool(uint32_t threadCount = 0);
+        virtual ~ThreadPool();
+        ThreadPool(const ThreadPool&) = delete;
+
+        template<typename F>
+        auto submit(F&& job) -> std::future<decltype(job())> {
+            using Result = decltype(job());
+            auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+            std::future<Result> result = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mJobs.emplace_back([task]() { (*task)(); });
+            }
+            mCondition.notify_one();
+            return result;
+        }
+
+        uint32_t getThreadCount() const;
+
+        void destroy();
+    private:
+        void workerLoop();
+
+        std::vector<std::thread> mWorkers;
+        std::deque<std::function<void()>> mJobs;
+        std::mutex mMutex;
+        std::condition_variable mCondition;
+        bool mStopping;
+    };
+}
+
+
+#endif //TRIANGLE_THREADPOOL_H
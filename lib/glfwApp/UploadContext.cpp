@@ -0,0 +1,461 @@
+#include "UploadContext.h"
+#include <glfwApp.h>
+#include <Buffer.h>
+#include <Texture.h>
+
+namespace glfw {
+    // Satisfies bufferOffset rules of vkCmdCopyBufferToImage for every format we upload (texel size, 4, block size).
+    static const VkDeviceSize kStagingAlignment = 16;
+
+    static inline
+    VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    UploadContext::UploadContext(glfwApp *app, VkDeviceSize ringSize) {
+        mApp = app;
+        mGraphicsQueue = app->graphicsQueue;
+        mCommandPool = VK_NULL_HANDLE;
+        mGraphicsCommandPool = VK_NULL_HANDLE;
+        mRing = nullptr;
+        mRingSize = ringSize;
+        mRingHead = 0;
+        mRingTail = 0;
+        mRingUsed = 0;
+        mRecording = false;
+        mNextTicket = 1;
+        mCompletedTicket = 0;
+
+        auto queueFamilyIndices = glfwApp::findQueueFamilies(app->physicalDevice, app->surface);
+        mGraphicsFamily = queueFamilyIndices.graphicsFamily.value();
+        if (queueFamilyIndices.transferFamily.has_value()) {
+            mQueueFamily = queueFamilyIndices.transferFamily.value();
+            mQueue = app->transferQueue;
+        } else {
+            mQueueFamily = mGraphicsFamily;
+            mQueue = mGraphicsQueue;
+        }
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = mQueueFamily;
+        if (vkCreateCommandPool(app->device, &poolInfo, nullptr, &mCommandPool) != VK_SUCCESS)
+            throw std::runtime_error("UploadContext: failed to create command pool!");
+        if (this->hasDedicatedTransfer()) {
+            poolInfo.queueFamilyIndex = mGraphicsFamily;
+            if (vkCreateCommandPool(app->device, &poolInfo, nullptr, &mGraphicsCommandPool) != VK_SUCCESS)
+                throw std::runtime_error("UploadContext: failed to create command pool!");
+        } else {
+            mGraphicsCommandPool = mCommandPool;
+        }
+
+        mRing = new Buffer(app);
+        if (mRing->create(mRingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true) != VK_SUCCESS)
+            throw std::runtime_error("UploadContext: failed to create staging ring!");
+    }
+
+    UploadContext::~UploadContext() {
+        this->destroy();
+    }
+
+    void UploadContext::destroy() {
+        if (mCommandPool == VK_NULL_HANDLE)
+            return;
+        this->finish();
+        for (auto& batch : mFreeBatches) {
+            vkDestroyFence(mApp->device, batch.fence, nullptr);
+            if (batch.transferFence != VK_NULL_HANDLE)
+                vkDestroyFence(mApp->device, batch.transferFence, nullptr);
+            if (batch.transferDone != VK_NULL_HANDLE)
+                vkDestroySemaphore(mApp->device, batch.transferDone, nullptr);
+        }
+        mFreeBatches.clear();
+        if (mGraphicsCommandPool != mCommandPool)
+            vkDestroyCommandPool(mApp->device, mGraphicsCommandPool, nullptr);
+        mGraphicsCommandPool = VK_NULL_HANDLE;
+        vkDestroyCommandPool(mApp->device, mCommandPool, nullptr);
+        mCommandPool = VK_NULL_HANDLE;
+        delete mRing;
+        mRing = nullptr;
+    }
+
+    bool UploadContext::hasDedicatedTransfer() const {
+        return mQueueFamily != mGraphicsFamily;
+    }
+
+    VkCommandBuffer UploadContext::allocateCommandBuffer(VkCommandPool commandPool) {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = commandPool;
+        allocInfo.commandBufferCount = 1;
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(mApp->device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+            throw std::runtime_error("UploadContext: failed to allocate command buffer!");
+        return commandBuffer;
+    }
+
+    void UploadContext::begin() {
+        if (mRecording)
+            return;
+        if (!mFreeBatches.empty()) {
+            mCurrent = std::move(mFreeBatches.back());
+            mFreeBatches.pop_back();
+        } else {
+            mCurrent = Batch();
+            mCurrent.commandBuffer = this->allocateCommandBuffer(mCommandPool);
+
+            VkFenceCreateInfo fenceInfo{};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            if (vkCreateFence(mApp->device, &fenceInfo, nullptr, &mCurrent.fence) != VK_SUCCESS)
+                throw std::runtime_error("UploadContext: failed to create fence!");
+
+            if (this->hasDedicatedTransfer()) {
+                mCurrent.acquireCommandBuffer = this->allocateCommandBuffer(mGraphicsCommandPool);
+                if (vkCreateFence(mApp->device, &fenceInfo, nullptr, &mCurrent.transferFence) != VK_SUCCESS)
+                    throw std::runtime_error("UploadContext: failed to create fence!");
+                VkSemaphoreCreateInfo semaphoreInfo{};
+                semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+                if (vkCreateSemaphore(mApp->device, &semaphoreInfo, nullptr, &mCurrent.transferDone) != VK_SUCCESS)
+                    throw std::runtime_error("UploadContext: failed to create semaphore!");
+            }
+        }
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        if (vkBeginCommandBuffer(mCurrent.commandBuffer, &beginInfo) != VK_SUCCESS)
+            throw std::runtime_error("UploadContext: failed to begin command buffer!");
+        mCurrent.ticket = mNextTicket++;
+        mCurrent.ringBytes = 0;
+        mCurrent.ringEnd = mRingHead;
+        mRecording = true;
+    }
+
+    bool UploadContext::allocateRing(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset) {
+        if (mRingUsed == 0)
+            mRingHead = mRingTail = 0;
+        else if (mRingHead == mRingTail)
+            return false;
+
+        /**
+         * Live bytes are [tail, head) going forward, so the free space is [head, size) + [0, tail)
+         * when head is ahead of tail and [head, tail) otherwise. Skipped bytes at the end of the ring
+         * belong to the batch that wrapped.
+         */
+        VkDeviceSize aligned = alignUp(mRingHead, alignment);
+        VkDeviceSize consumed;
+        if (mRingHead >= mRingTail) {
+            if (aligned + size <= mRingSize) {
+                offset = aligned;
+                consumed = aligned + size - mRingHead;
+            } else if (size <= mRingTail) {
+                offset = 0;
+                consumed = mRingSize - mRingHead + size;
+            } else {
+                return false;
+            }
+        } else {
+            if (aligned + size > mRingTail)
+                return false;
+            offset = aligned;
+            consumed = aligned + size - mRingHead;
+        }
+
+        mRingHead = (offset + size) % mRingSize;
+        mRingUsed += consumed;
+        mCurrent.ringBytes += consumed;
+        mCurrent.ringEnd = mRingHead;
+        return true;
+    }
+
+    void UploadContext::stage(const void *data, VkDeviceSize size, VkDeviceSize alignment, VkBuffer &buffer,
+                              VkDeviceSize &offset) {
+        this->begin();
+        if (size <= mRingSize) {
+            this->poll();
+            while (!this->allocateRing(size, alignment, offset)) {
+                if (mInFlight.empty()) {
+                    // Only the batch being recorded holds the ring: submit it so its space can come back.
+                    this->flush();
+                    this->begin();
+                }
+                this->wait(mInFlight.front().ticket);
+            }
+            std::memcpy(static_cast<char*>(mRing->getMappedData()) + offset, data, size);
+            mRing->flush(size, offset);
+            buffer = mRing->getBuffer();
+            return;
+        }
+
+        /**
+         * Larger than the whole ring, give it a staging buffer of its own that lives until the batch retires.
+         */
+        Buffer* staging = new Buffer(mApp);
+        if (staging->create(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != VK_SUCCESS) {
+            delete staging;
+            throw std::runtime_error("UploadContext: failed to create staging buffer!");
+        }
+        staging->uploadData(data, size);
+        mCurrent.dedicatedStaging.push_back(staging);
+        buffer = staging->getBuffer();
+        offset = 0;
+    }
+
+    void UploadContext::uploadBuffer(Buffer &dst, const void *data, VkDeviceSize size, VkDeviceSize dstOffset) {
+        if (size == 0)
+            return;
+        /**
+         * Big buffers go through the ring in quarter ring pieces instead of a staging buffer of their own
+         * size, so staging memory stays bounded by the ring however large the source is.
+         */
+        const VkDeviceSize piece = mRingSize / 4;
+        if (size > piece) {
+            for (VkDeviceSize done = 0; done < size; done += piece)
+                this->uploadBuffer(dst, static_cast<const char*>(data) + done, std::min(piece, size - done), dstOffset + done);
+            return;
+        }
+        VkBuffer src;
+        VkBufferCopy copyRegion{};
+        this->stage(data, size, kStagingAlignment, src, copyRegion.srcOffset);
+        copyRegion.dstOffset = dstOffset;
+        copyRegion.size = size;
+        vkCmdCopyBuffer(mCurrent.commandBuffer, src, dst.getBuffer(), 1, &copyRegion);
+
+        if (this->hasDedicatedTransfer()) {
+            VkBufferMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = 0;
+            barrier.srcQueueFamilyIndex = mQueueFamily;
+            barrier.dstQueueFamilyIndex = mGraphicsFamily;
+            barrier.buffer = dst.getBuffer();
+            barrier.offset = dstOffset;
+            barrier.size = size;
+            mCurrent.bufferBarriers.push_back(barrier);
+        }
+    }
+
+    void UploadContext::uploadImage(Texture &dst, const void *data, VkDeviceSize size,
+                                    const std::vector<VkBufferImageCopy> &regions,
+                                    const VkImageSubresourceRange &range, VkImageLayout finalLayout) {
+        VkBuffer src;
+        VkDeviceSize srcOffset;
+        this->stage(data, size, kStagingAlignment, src, srcOffset);
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = dst.getImage();
+        barrier.subresourceRange = range;
+        vkCmdPipelineBarrier(mCurrent.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+
+        std::vector<VkBufferImageCopy> copies(regions);
+        for (auto& copy : copies)
+            copy.bufferOffset += srcOffset;
+        vkCmdCopyBufferToImage(mCurrent.commandBuffer, src, dst.getImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               static_cast<uint32_t>(copies.size()), copies.data());
+
+        /**
+         * The transition out of TRANSFER_DST is deferred to the end of the batch, where all of them go
+         * into one barrier. With a dedicated transfer queue it doubles as the ownership release.
+         */
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = finalLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL ? VK_ACCESS_SHADER_READ_BIT : VK_ACCESS_MEMORY_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = finalLayout;
+        if (this->hasDedicatedTransfer()) {
+            barrier.srcQueueFamilyIndex = mQueueFamily;
+            barrier.dstQueueFamilyIndex = mGraphicsFamily;
+        }
+        mCurrent.imageBarriers.push_back(barrier);
+    }
+
+    VkCommandBuffer UploadContext::getCommandBuffer() {
+        this->begin();
+        if (!mCurrent.graphicsRecording) {
+            if (mCurrent.graphicsCommandBuffer == VK_NULL_HANDLE)
+                mCurrent.graphicsCommandBuffer = this->allocateCommandBuffer(mGraphicsCommandPool);
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            if (vkBeginCommandBuffer(mCurrent.graphicsCommandBuffer, &beginInfo) != VK_SUCCESS)
+                throw std::runtime_error("UploadContext: failed to begin command buffer!");
+            mCurrent.graphicsRecording = true;
+        }
+        return mCurrent.graphicsCommandBuffer;
+    }
+
+    uint64_t UploadContext::getTicket() {
+        this->begin();
+        return mCurrent.ticket;
+    }
+
+    uint64_t UploadContext::flush() {
+        if (!mRecording)
+            return mNextTicket - 1;
+
+        if (this->hasDedicatedTransfer()) {
+            /**
+             * Release on the transfer queue. The acquire half is recorded now and submitted to the
+             * graphics queue by poll()/wait() once the copies are done.
+             */
+            if (!mCurrent.bufferBarriers.empty() || !mCurrent.imageBarriers.empty())
+                vkCmdPipelineBarrier(mCurrent.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                                     0, nullptr,
+                                     static_cast<uint32_t>(mCurrent.bufferBarriers.size()), mCurrent.bufferBarriers.data(),
+                                     static_cast<uint32_t>(mCurrent.imageBarriers.size()), mCurrent.imageBarriers.data());
+
+            for (auto& barrier : mCurrent.bufferBarriers) {
+                barrier.srcAccessMask = 0;
+                barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+            }
+            for (auto& barrier : mCurrent.imageBarriers)
+                barrier.srcAccessMask = 0;
+
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            if (vkBeginCommandBuffer(mCurrent.acquireCommandBuffer, &beginInfo) != VK_SUCCESS)
+                throw std::runtime_error("UploadContext: failed to begin command buffer!");
+            if (!mCurrent.bufferBarriers.empty() || !mCurrent.imageBarriers.empty())
+                vkCmdPipelineBarrier(mCurrent.acquireCommandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                                     0, nullptr,
+                                     static_cast<uint32_t>(mCurrent.bufferBarriers.size()), mCurrent.bufferBarriers.data(),
+                                     static_cast<uint32_t>(mCurrent.imageBarriers.size()), mCurrent.imageBarriers.data());
+            if (vkEndCommandBuffer(mCurrent.acquireCommandBuffer) != VK_SUCCESS)
+                throw std::runtime_error("UploadContext: failed to end command buffer!");
+        } else {
+            /**
+             * Make every copy of the batch visible to whatever reads it later on the queue.
+             */
+            VkMemoryBarrier memoryBarrier{};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+            vkCmdPipelineBarrier(mCurrent.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                                 1, &memoryBarrier, 0, nullptr,
+                                 static_cast<uint32_t>(mCurrent.imageBarriers.size()), mCurrent.imageBarriers.data());
+        }
+        mCurrent.bufferBarriers.clear();
+        mCurrent.imageBarriers.clear();
+
+        if (vkEndCommandBuffer(mCurrent.commandBuffer) != VK_SUCCESS)
+            throw std::runtime_error("UploadContext: failed to end command buffer!");
+        if (mCurrent.graphicsRecording && vkEndCommandBuffer(mCurrent.graphicsCommandBuffer) != VK_SUCCESS)
+            throw std::runtime_error("UploadContext: failed to end command buffer!");
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        if (this->hasDedicatedTransfer()) {
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &mCurrent.commandBuffer;
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores = &mCurrent.transferDone;
+            if (vkQueueSubmit(mQueue, 1, &submitInfo, mCurrent.transferFence) != VK_SUCCESS)
+                throw std::runtime_error("UploadContext: failed to submit uploads!");
+            mCurrent.acquired = false;
+        } else {
+            VkCommandBuffer commandBuffers[] = {mCurrent.commandBuffer, mCurrent.graphicsCommandBuffer};
+            submitInfo.commandBufferCount = mCurrent.graphicsRecording ? 2 : 1;
+            submitInfo.pCommandBuffers = commandBuffers;
+            if (vkQueueSubmit(mQueue, 1, &submitInfo, mCurrent.fence) != VK_SUCCESS)
+                throw std::runtime_error("UploadContext: failed to submit uploads!");
+            mCurrent.acquired = true;
+        }
+
+        uint64_t ticket = mCurrent.ticket;
+        mInFlight.push_back(std::move(mCurrent));
+        mCurrent = Batch();
+        mRecording = false;
+        return ticket;
+    }
+
+    void UploadContext::submitAcquire(Batch &batch) {
+        VkCommandBuffer commandBuffers[] = {batch.acquireCommandBuffer, batch.graphicsCommandBuffer};
+        VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &batch.transferDone;
+        submitInfo.pWaitDstStageMask = &waitStage;
+        submitInfo.commandBufferCount = batch.graphicsRecording ? 2 : 1;
+        submitInfo.pCommandBuffers = commandBuffers;
+        if (vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, batch.fence) != VK_SUCCESS)
+            throw std::runtime_error("UploadContext: failed to submit ownership acquire!");
+        batch.acquired = true;
+    }
+
+    void UploadContext::retire(Batch &batch) {
+        if (batch.ringBytes) {
+            mRingUsed -= batch.ringBytes;
+            mRingTail = batch.ringEnd;
+        }
+        for (Buffer* staging : batch.dedicatedStaging)
+            delete staging;
+        batch.dedicatedStaging.clear();
+        mCompletedTicket = batch.ticket;
+
+        vkResetFences(mApp->device, 1, &batch.fence);
+        vkResetCommandBuffer(batch.commandBuffer, 0);
+        if (batch.transferFence != VK_NULL_HANDLE) {
+            vkResetFences(mApp->device, 1, &batch.transferFence);
+            vkResetCommandBuffer(batch.acquireCommandBuffer, 0);
+        }
+        if (batch.graphicsRecording)
+            vkResetCommandBuffer(batch.graphicsCommandBuffer, 0);
+        batch.graphicsRecording = false;
+        batch.acquired = false;
+        mFreeBatches.push_back(std::move(batch));
+    }
+
+    void UploadContext::retireCompleted() {
+        while (!mInFlight.empty() && mInFlight.front().acquired &&
+               vkGetFenceStatus(mApp->device, mInFlight.front().fence) == VK_SUCCESS) {
+            this->retire(mInFlight.front());
+            mInFlight.pop_front();
+        }
+    }
+
+    void UploadContext::poll() {
+        for (auto& batch : mInFlight) {
+            if (batch.acquired)
+                continue;
+            if (vkGetFenceStatus(mApp->device, batch.transferFence) != VK_SUCCESS)
+                break;
+            this->submitAcquire(batch);
+        }
+        this->retireCompleted();
+    }
+
+    bool UploadContext::isComplete(uint64_t ticket) {
+        this->poll();
+        return ticket <= mCompletedTicket;
+    }
+
+    void UploadContext::wait(uint64_t ticket) {
+        while (ticket > mCompletedTicket && !mInFlight.empty()) {
+            Batch& batch = mInFlight.front();
+            if (!batch.acquired) {
+                vkWaitForFences(mApp->device, 1, &batch.transferFence, VK_TRUE, UINT64_MAX);
+                this->submitAcquire(batch);
+            }
+            vkWaitForFences(mApp->device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+            this->retire(batch);
+            mInFlight.pop_front();
+        }
+    }
+
+    void UploadContext::finish() {
+        this->wait(this->flush());
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef TRIANGLE_UPLOADCONTEXT_H
+#define TRIANGLE_UPLOADCONTEXT_H
+
+#include "common.h"
+#include <deque>
+
+namespace glfw {
+    class glfwApp;
+    class Buffer;
+    class Texture;
+
+    /**
+     * Batches buffer and image uploads into a single command buffer per submission. Source data is
+     * copied into a persistently mapped staging ring, and ring space is handed back when the fence of
+     * the batch that used it signals, so loading never waits on the queue unless the ring is full.
+     *
+     * When the device has a dedicated transfer family the copies run on glfwApp::transferQueue. The
+     * batch releases its resources to the graphics family and signals a semaphore; once the copies are
+     * done poll() submits the matching acquire on the graphics queue, so rendering never waits on a
+     * copy in flight. Resources of a batch may be used by rendering once its ticket is complete.
+     * Without a dedicated family everything runs on the graphics queue and they can be used as soon
+     * as the batch is flushed.
+     */
+    class UploadContext {
+    public:
+        UploadContext(glfwApp* app, VkDeviceSize ringSize = 32 * 1024 * 1024);
+        virtual ~UploadContext();
+        UploadContext(const UploadContext&) = delete;
+
+        void uploadBuffer(Buffer& dst, const void* data, VkDeviceSize size, VkDeviceSize dstOffset = 0);
+
+        /**
+         * data holds the texels of every region back to back, bufferOffset of each region is relative
+         * to data. The whole range goes UNDEFINED -> TRANSFER_DST -> finalLayout.
+         */
+        void uploadImage(Texture& dst, const void* data, VkDeviceSize size,
+                         const std::vector<VkBufferImageCopy>& regions, const VkImageSubresourceRange& range,
+                         VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+        /**
+         * Graphics queue command buffer of the batch being recorded, for work that has to run after the
+         * copies (and after the ownership acquire), e.g. blits. Images are already in their final layout.
+         */
+        VkCommandBuffer getCommandBuffer();
+
+        // Ticket the batch being recorded will be flushed under.
+        uint64_t getTicket();
+
+        // Submits the batch being recorded and returns a ticket for it.
+        uint64_t flush();
+        // Hands finished copies over to the graphics queue and retires completed batches, call once a frame.
+        void poll();
+        bool isComplete(uint64_t ticket);
+        void wait(uint64_t ticket);
+        // flush + wait for everything submitted so far.
+        void finish();
+
+        bool hasDedicatedTransfer() const;
+
+        void destroy();
+    private:
+        struct Batch {
+            // Recorded on the upload family.
+            VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+            // Recorded on the graphics family: ownership acquire (dedicated transfer only), then user work.
+            VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;
+            VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+            VkSemaphore transferDone = VK_NULL_HANDLE;
+            VkFence transferFence = VK_NULL_HANDLE;
+            VkFence fence = VK_NULL_HANDLE;
+            bool graphicsRecording = false;
+            bool acquired = false;
+            uint64_t ticket = 0;
+            VkDeviceSize ringBytes = 0;
+            VkDeviceSize ringEnd = 0;
+            std::vector<Buffer*> dedicatedStaging;
+            std::vector<VkBufferMemoryBarrier> bufferBarriers;
+            std::vector<VkImageMemoryBarrier> imageBarriers;
+        };
+
+        void begin();
+        void submitAcquire(Batch& batch);
+        VkCommandBuffer allocateCommandBuffer(VkCommandPool commandPool);
+        bool allocateRing(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+        void stage(const void* data, VkDeviceSize size, VkDeviceSize alignment, VkBuffer& buffer, VkDeviceSize& offset);
+        void retire(Batch& batch);
+        void retireCompleted();
+
+        glfwApp* mApp;
+        VkQueue mQueue;
+        VkQueue mGraphicsQueue;
+        uint32_t mQueueFamily;
+        uint32_t mGraphicsFamily;
+        VkCommandPool mCommandPool;
+        VkCommandPool mGraphicsCommandPool;
+
+        Buffer* mRing;
+        VkDeviceSize mRingSize;
+        VkDeviceSize mRingHead;
+        VkDeviceSize mRingTail;
+        VkDeviceSize mRingUsed;
+
+        bool mRecording;
+        Batch mCurrent;
+        std::deque<Batch> mInFlight;
+        std::vector<Batch> mFreeBatches;
+        uint64_t mNextTicket;
+        uint64_t mCompletedTicket;
+    };
+}
+
+
+#endif //TRIANGLE_UPLOADCONTEXT_H
@@ -8,6 +8,9 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/hash.hpp>
+#include <cmath>
+#include <cstring>
+#include <vector>
 
 struct Vertex {
     glm::vec3 pos;
@@ -46,6 +49,109 @@ struct Vertex {
     }
 };
 
+// 12 byte vertex of VertexFormat::Compact, see common.h.
+struct CompactVertex {
+    uint16_t pos[4];
+    uint16_t texCoord[2];
+
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription{};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(CompactVertex);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        return bindingDescription;
+    }
+
+    // Same locations as Vertex, object.vert does not read the color.
+    static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+        // Three component 16 bit formats are rarely supported for vertex input, w is padding.
+        attributeDescriptions[0].binding = 0;
+        attributeDescriptions[0].location = 0;
+        attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+        attributeDescriptions[0].offset = offsetof(CompactVertex, pos);
+
+        attributeDescriptions[1].binding = 0;
+        attributeDescriptions[1].location = 2;
+        attributeDescriptions[1].format = VK_FORMAT_R16G16_SFLOAT;
+        attributeDescriptions[1].offset = offsetof(CompactVertex, texCoord);
+        return attributeDescriptions;
+    }
+
+    // IEEE half, round to nearest. Overflow goes to infinity, tiny values to zero or denormals.
+    static uint16_t packHalf(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        uint32_t sign = (bits >> 16) & 0x8000;
+        uint32_t mantissa = bits & 0x7FFFFF;
+        int32_t exponent = int32_t((bits >> 23) & 0xFF) - 127 + 15;
+        if (((bits >> 23) & 0xFF) == 0xFF)
+            return static_cast<uint16_t>(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+        if (exponent >= 31)
+            return static_cast<uint16_t>(sign | 0x7C00);
+        if (exponent <= 0) {
+            if (exponent < -10)
+                return static_cast<uint16_t>(sign);
+            mantissa |= 0x800000;
+            uint32_t shift = 14 - exponent;
+            uint32_t half = (mantissa >> shift) + ((mantissa >> (shift - 1)) & 1);
+            return static_cast<uint16_t>(sign | half);
+        }
+        // A carry out of the mantissa correctly bumps the exponent.
+        uint32_t half = (uint32_t(exponent) << 10) + (mantissa >> 13) + ((mantissa >> 12) & 1);
+        return static_cast<uint16_t>(sign | std::min(half, 0x7C00u));
+    }
+
+    /**
+     * Bounding box of count vertices as the decode parameters of quantize(). A decoded position is
+     * unorm * positionScale + positionOffset.
+     */
+    static void getQuantization(const Vertex* vertices, uint32_t count, glm::vec3& positionScale, glm::vec3& positionOffset) {
+        glm::vec3 lo(0.0f), hi(0.0f);
+        if (count) {
+            lo = hi = vertices[0].pos;
+            for (uint32_t i = 1; i < count; i ++) {
+                for (int c = 0; c < 3; c ++) {
+                    lo[c] = std::min(lo[c], vertices[i].pos[c]);
+                    hi[c] = std::max(hi[c], vertices[i].pos[c]);
+                }
+            }
+        }
+        positionOffset = lo;
+        positionScale = hi - lo;
+    }
+
+    // One vertex at a time so loaders can convert in windows instead of copying the whole mesh.
+    static CompactVertex quantize(const Vertex& vertex, const glm::vec3& positionScale, const glm::vec3& positionOffset) {
+        CompactVertex result{};
+        for (int c = 0; c < 3; c ++) {
+            float t = positionScale[c] > 0.0f ? (vertex.pos[c] - positionOffset[c]) / positionScale[c] : 0.0f;
+            result.pos[c] = static_cast<uint16_t>(std::lround(std::min(std::max(t, 0.0f), 1.0f) * 65535.0f));
+        }
+        result.pos[3] = 0;
+        result.texCoord[0] = packHalf(vertex.texCoord.x);
+        result.texCoord[1] = packHalf(vertex.texCoord.y);
+        return result;
+    }
+};
+
+inline uint32_t getVertexSize(VertexFormat format) {
+    return format == VertexFormat::Compact ? sizeof(CompactVertex) : sizeof(Vertex);
+}
+
+inline VkVertexInputBindingDescription getVertexBindingDescription(VertexFormat format) {
+    return format == VertexFormat::Compact ? CompactVertex::getBindingDescription() : Vertex::getBindingDescription();
+}
+
+inline std::vector<VkVertexInputAttributeDescription> getVertexAttributeDescriptions(VertexFormat format) {
+    if (format == VertexFormat::Compact) {
+        auto attributes = CompactVertex::getAttributeDescriptions();
+        return {attributes.begin(), attributes.end()};
+    }
+    auto attributes = Vertex::getAttributeDescriptions();
+    return {attributes.begin(), attributes.end()};
+}
+
 namespace std {
     template<> struct hash<Vertex> {
         size_t operator()(Vertex const& vertex) const {
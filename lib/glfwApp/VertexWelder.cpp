@@ -0,0 +1,85 @@
+#include "VertexWelder.h"
+
+namespace glfw {
+    namespace {
+        static_assert(sizeof(Vertex) % sizeof(uint64_t) == 0, "Vertex is hashed as 64 bit words");
+
+        uint64_t mix(uint64_t h) {
+            // Murmur3 finalizer.
+            h ^= h >> 33;
+            h *= 0xFF51AFD7ED558CCDull;
+            h ^= h >> 33;
+            h *= 0xC4CEB9FE1A85EC53ull;
+            h ^= h >> 33;
+            return h;
+        }
+
+        Vertex canonical(const Vertex& vertex) {
+            // Adding +0 turns -0 into +0 and leaves everything else alone.
+            Vertex result = vertex;
+            for (int c = 0; c < 3; c ++) {
+                result.pos[c] += 0.0f;
+                result.color[c] += 0.0f;
+            }
+            result.texCoord.x += 0.0f;
+            result.texCoord.y += 0.0f;
+            return result;
+        }
+    }
+
+    VertexWelder::VertexWelder(std::vector<Vertex> &vertices, size_t expectedVertices): mVertices(vertices) {
+        mMask = 0;
+        mCount = 0;
+        // Load factor stays below 1/2 up to expectedVertices.
+        size_t capacity = 16;
+        while (capacity < expectedVertices * 2)
+            capacity *= 2;
+        this->rehash(capacity);
+    }
+
+    uint64_t VertexWelder::hashVertex(const Vertex &vertex) {
+        uint64_t words[sizeof(Vertex) / sizeof(uint64_t)];
+        std::memcpy(words, &vertex, sizeof(Vertex));
+        uint64_t h = 0x9E3779B97F4A7C15ull;
+        for (uint64_t word : words)
+            h = mix(h ^ word) + 0x9E3779B97F4A7C15ull;
+        return h;
+    }
+
+    void VertexWelder::rehash(size_t capacity) {
+        std::vector<Slot> old;
+        old.swap(mSlots);
+        mSlots.assign(capacity, Slot{0, kEmpty});
+        mMask = capacity - 1;
+        for (const Slot& entry : old) {
+            if (entry.index == kEmpty)
+                continue;
+            size_t slot = hashVertex(mVertices[entry.index]) & mMask;
+            while (mSlots[slot].index != kEmpty)
+                slot = (slot + 1) & mMask;
+            mSlots[slot] = entry;
+        }
+    }
+
+    uint32_t VertexWelder::weld(const Vertex &input) {
+        if ((mCount + 1) * 2 > mSlots.size())
+            this->rehash(mSlots.size() * 2);
+
+        Vertex vertex = canonical(input);
+        uint64_t h = hashVertex(vertex);
+        uint32_t tag = static_cast<uint32_t>(h >> 32);
+        size_t slot = h & mMask;
+        while (mSlots[slot].index != kEmpty) {
+            const Slot& entry = mSlots[slot];
+            if (entry.hash == tag && std::memcmp(&mVertices[entry.index], &vertex, sizeof(Vertex)) == 0)
+                return entry.index;
+            slot = (slot + 1) & mMask;
+        }
+
+        uint32_t index = static_cast<uint32_t>(mVertices.size());
+        mVertices.push_back(vertex);
+        mSlots[slot] = {tag, index};
+        mCount ++;
+        return index;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef TRIANGLE_VERTEXWELDER_H
+#define TRIANGLE_VERTEXWELDER_H
+
+#include "common.h"
+#include <Vertex.h>
+
+namespace glfw {
+    /**
+     * Deduplicates vertices while a mesh is imported: weld() returns the index of an identical vertex
+     * already in the stream, or appends it. Open addressing with linear probing over the raw bytes of
+     * the vertex, one probe sequence per corner; -0.0 is treated as 0.0 like Vertex::operator==.
+     *
+     * Vertices already in the stream are not welded against. Size it with the number of corners and
+     * the table never rehashes.
+     */
+    class VertexWelder {
+    public:
+        VertexWelder(std::vector<Vertex>& vertices, size_t expectedVertices);
+        VertexWelder(const VertexWelder&) = delete;
+
+        uint32_t weld(const Vertex& vertex);
+    private:
+        static const uint32_t kEmpty = 0xFFFFFFFF;
+
+        struct Slot {
+            uint32_t hash;
+            uint32_t index;
+        };
+
+        static uint64_t hashVertex(const Vertex& vertex);
+        void rehash(size_t capacity);
+
+        std::vector<Vertex>& mVertices;
+        std::vector<Slot> mSlots;
+        size_t mMask;
+        size_t mCount;
+    };
+}
+
+
+#endif //TRIANGLE_VERTEXWELDER_H
@@ -17,6 +17,8 @@
 #include <cstdint>
 #include <array>
 #include <chrono>
+#include <cstring>
+#include <cassert>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -24,6 +26,20 @@
 #include "stb_image.h"
 #include "tiny_obj_loader.h"
 
+/**
+ * Layout of the vertices in the GeometryPool, picked once per app (glfwApp::vertexFormat) because the
+ * pool and the object pipeline are shared by every mesh.
+ *
+ * Float:   Vertex, 32 bytes.
+ * Compact: CompactVertex, 12 bytes. Positions are unorm16 relative to the bounds of the mesh and decoded
+ *          in object.vert with the positionScale/positionOffset push constants, UVs are half floats so
+ *          tiling coordinates outside [0, 1] still work. The constant white color is dropped.
+ */
+enum class VertexFormat {
+    Float,
+    Compact
+};
+
 static
 void printException(const std::exception& e, int level =  0) {
     std::cout << std::string(level, '\t') << e.what() << '\n';
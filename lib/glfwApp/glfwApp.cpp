@@ -6,6 +6,10 @@
 #include <chrono>
 #include <TextureManager.h>
 #include <MeshManager.h>
+#include <MemoryAllocator.h>
+#include <UploadContext.h>
+#include <MipGenerator.h>
+#include <ThreadPool.h>
 using namespace glfw;
 
 const std::vector<const char*> validationLayers = {
@@ -31,10 +35,18 @@ void glfwApp::cleanup() {
     }
     vkDestroySwapchainKHR(device, swapChain, nullptr);
     vkDestroySurfaceKHR(instance, surface, nullptr);
+    delete this->uploadContext;
+    this->uploadContext = nullptr;
     delete this->textureManager;
     this->textureManager = nullptr;
     delete this->meshManager;
     this->meshManager = nullptr;
+    delete this->threadPool;
+    this->threadPool = nullptr;
+    delete this->mipGenerator;
+    this->mipGenerator = nullptr;
+    delete this->memoryAllocator;
+    this->memoryAllocator = nullptr;
     vkDestroyDevice(device, nullptr);
     vkDestroyInstance(instance, nullptr);
     glfwDestroyWindow(window);
@@ -50,6 +62,7 @@ void glfwApp::run() {
     std::cout << "Started to run" << std::endl;
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
+        this->uploadContext->poll();
 
         std::chrono::high_resolution_clock::time_point thisCallUpdate = std::chrono::high_resolution_clock::now();
         std::chrono::duration<float> dur = (thisCallUpdate - lastCallUpdate);
@@ -98,8 +111,12 @@ void glfwApp::initVulkan() {
         this->initVulkanDevice();
         this->initSwapChain();
 
+        this->threadPool = new ThreadPool();
+        this->memoryAllocator = new MemoryAllocator(this);
+        this->uploadContext = new UploadContext(this);
+        this->mipGenerator = new MipGenerator(this);
         this->textureManager = new TextureManager(this);
-        this->meshManager = new MeshManager(this);
+        this->meshManager = new MeshManager(this, this->vertexFormat);
     } catch (...) {
         std::throw_with_nested(std::runtime_error("Failed to initialize Vulkan"));
     }
@@ -177,6 +194,8 @@ void glfwApp::initVulkanDevice() {
 
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
         std::vector<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+        if (indices.transferFamily.has_value())
+            uniqueQueueFamilies.push_back(indices.transferFamily.value());
         std::sort(uniqueQueueFamilies.begin(), uniqueQueueFamilies.end());
         uniqueQueueFamilies.erase(std::unique(uniqueQueueFamilies.begin(), uniqueQueueFamilies.end()), uniqueQueueFamilies.end());
 
@@ -190,20 +209,90 @@ void glfwApp::initVulkanDevice() {
             queueCreateInfos.push_back(queueCreateInfo);
         }
 
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
         VkPhysicalDeviceFeatures deviceFeatures{};
         deviceFeatures.samplerAnisotropy = VK_TRUE;
+        // Desktop GPUs all have it; without it BC containers are skipped and the raw source is used.
+        deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+
+        /**
+         * GPU driven rendering (GpuCuller) needs indirect draws with a count buffer (core in 1.2), more than
+         * one draw per call and firstInstance to find its draw record. Enabled only when all three are there.
+         */
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        VkPhysicalDeviceVulkan12Features supported12{};
+        supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        if (properties.apiVersion >= VK_API_VERSION_1_2) {
+            VkPhysicalDeviceFeatures2 supported2{};
+            supported2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            supported2.pNext = &supported12;
+            vkGetPhysicalDeviceFeatures2(physicalDevice, &supported2);
+        }
+        this->gpuDrivenSupported = supported12.drawIndirectCount && supportedFeatures.multiDrawIndirect &&
+                                   supportedFeatures.drawIndirectFirstInstance;
+        deviceFeatures.multiDrawIndirect = this->gpuDrivenSupported;
+        deviceFeatures.drawIndirectFirstInstance = this->gpuDrivenSupported;
+        VkPhysicalDeviceVulkan12Features features12{};
+        features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        features12.drawIndirectCount = this->gpuDrivenSupported;
+
+        /**
+         * Mesh shading on top of that: the task shader culls meshlets of the submesh draw it finds
+         * through gl_DrawID, which takes shaderDrawParameters. Built without it against headers
+         * older than VK_EXT_mesh_shader.
+         */
+        std::vector<const char*> extensions = vkDeviceExtensions;
+        VkPhysicalDeviceVulkan11Features features11{};
+        features11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+#ifdef VK_EXT_mesh_shader
+        VkPhysicalDeviceMeshShaderFeaturesEXT meshFeatures{};
+        meshFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+        if (this->gpuDrivenSupported && this->meshShaderAllowed && hasDeviceExtension(physicalDevice, VK_EXT_MESH_SHADER_EXTENSION_NAME)) {
+            VkPhysicalDeviceMeshShaderFeaturesEXT supportedMesh{};
+            supportedMesh.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+            VkPhysicalDeviceVulkan11Features supported11{};
+            supported11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+            supported11.pNext = &supportedMesh;
+            VkPhysicalDeviceFeatures2 supported2{};
+            supported2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            supported2.pNext = &supported11;
+            vkGetPhysicalDeviceFeatures2(physicalDevice, &supported2);
+            this->meshShaderSupported = supportedMesh.taskShader && supportedMesh.meshShader && supported11.shaderDrawParameters;
+        }
+        if (this->meshShaderSupported) {
+            extensions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+            meshFeatures.taskShader = VK_TRUE;
+            meshFeatures.meshShader = VK_TRUE;
+            features11.shaderDrawParameters = VK_TRUE;
+            features11.pNext = &meshFeatures;
+            features12.pNext = &features11;
+        }
+#endif
 
         VkDeviceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
         createInfo.pQueueCreateInfos = queueCreateInfos.data();
         createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
         createInfo.pEnabledFeatures = &deviceFeatures;
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(vkDeviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = vkDeviceExtensions.data();
+        createInfo.pNext = properties.apiVersion >= VK_API_VERSION_1_2 ? &features12 : nullptr;
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+        createInfo.ppEnabledExtensionNames = extensions.data();
         createInfo.enabledLayerCount = 0;
         if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
             std::throw_with_nested(std::runtime_error("failed to create logical device!"));
         }
+#ifdef VK_EXT_mesh_shader
+        if (this->meshShaderSupported) {
+            this->cmdDrawMeshTasksIndirectCount = reinterpret_cast<PFN_vkCmdDrawMeshTasksIndirectCountEXT>(
+                    vkGetDeviceProcAddr(device, "vkCmdDrawMeshTasksIndirectCountEXT"));
+            this->meshShaderSupported = this->cmdDrawMeshTasksIndirectCount != nullptr;
+        }
+#endif
+        fprintf(stdout, "GPU driven: %s, mesh shaders: %s\n", this->gpuDrivenSupported ? "yes" : "no",
+                this->meshShaderSupported ? "yes" : "no");
     }
 
     {
@@ -213,6 +302,12 @@ void glfwApp::initVulkanDevice() {
         QueueFamilyIndices indices = findQueueFamilies(physicalDevice, surface);
         vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
         vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+        if (indices.transferFamily.has_value()) {
+            vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+            fprintf(stdout, "Using dedicated transfer queue family %u\n", indices.transferFamily.value());
+        } else {
+            transferQueue = graphicsQueue;
+        }
     }
 }
 
@@ -224,16 +319,23 @@ QueueFamilyIndices glfwApp::findQueueFamilies(VkPhysicalDevice device, VkSurface
     vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
     uint32_t i = 0;
     for (const auto& queueFamily : queueFamilies) {
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && !indices.graphicsFamily.has_value()) {
             indices.graphicsFamily = i;
         }
         VkBool32 presentSupport = false;
-        if (vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport) == VK_SUCCESS) {
+        if (!indices.presentFamily.has_value() && vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport) == VK_SUCCESS) {
             if (presentSupport)
                 indices.presentFamily = i;
         }
-        if (indices.isComplete())
-            break;
+        /**
+         * Transfer-only families are the DMA engines; prefer them over async compute families, which
+         * also advertise transfer.
+         */
+        if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+            if (!indices.transferFamily.has_value() ||
+                ((queueFamilies[indices.transferFamily.value()].queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)))
+                indices.transferFamily = i;
+        }
         i++;
     }
     return indices;
@@ -305,6 +407,17 @@ bool glfwApp::checkDeviceExtensionSupport(VkPhysicalDevice device) {
     return requiredExtensions.empty();
 }
 
+bool glfwApp::hasDeviceExtension(VkPhysicalDevice device, const char *name) {
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+    for (const auto& extension : availableExtensions)
+        if (std::strcmp(extension.extensionName, name) == 0)
+            return true;
+    return false;
+}
+
 SwapChainSupportDetails glfwApp::querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface) {
     SwapChainSupportDetails details;
     if (vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.capabilities) != VK_SUCCESS)
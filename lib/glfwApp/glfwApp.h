@@ -14,6 +14,10 @@
 namespace glfw {
     class TextureManager;
     class MeshManager;
+    class MemoryAllocator;
+    class UploadContext;
+    class MipGenerator;
+    class ThreadPool;
 
     static
     const std::vector<const char*> vkDeviceExtensions = {
@@ -23,6 +27,8 @@ namespace glfw {
     struct QueueFamilyIndices {
         std::optional<uint32_t> graphicsFamily;
         std::optional<uint32_t> presentFamily;
+        // A family that can transfer but not draw, usually backed by the copy engines. May be empty.
+        std::optional<uint32_t> transferFamily;
 
         bool isComplete() const;
     };
@@ -55,6 +61,14 @@ namespace glfw {
         friend class Instance;
         friend class Mesh;
         friend class SubMesh;
+        friend class MemoryAllocator;
+        friend class UploadContext;
+        friend class MipGenerator;
+        friend class TextureManager;
+        friend class InstanceGroup;
+        friend class GeometryPool;
+        friend class GpuCuller;
+        friend class DepthPyramid;
         void initWindow();
 
         void initVulkan();
@@ -72,6 +86,7 @@ namespace glfw {
         static int rateDeviceSuitability(VkPhysicalDevice device, VkSurfaceKHR surface);
         static QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface);
         static bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+        static bool hasDeviceExtension(VkPhysicalDevice device, const char* name);
         static SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface);
         static VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
         static VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes);
@@ -81,6 +96,17 @@ namespace glfw {
         int width = 800;
         int height = 600;
         VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+        // Layout meshes are loaded in, set before initialize(). Pipelines take it from getVertexAttributeDescriptions.
+        VertexFormat vertexFormat = VertexFormat::Float;
+        // drawIndirectCount, multiDrawIndirect and drawIndirectFirstInstance are enabled, GpuCuller can be used.
+        bool gpuDrivenSupported = false;
+        // Cleared before initialize() to leave VK_EXT_mesh_shader off on devices that have it.
+        bool meshShaderAllowed = true;
+        // VK_EXT_mesh_shader (task and mesh stages) and shaderDrawParameters are enabled, only with gpuDrivenSupported.
+        bool meshShaderSupported = false;
+#ifdef VK_EXT_mesh_shader
+        PFN_vkCmdDrawMeshTasksIndirectCountEXT cmdDrawMeshTasksIndirectCount = nullptr;
+#endif
 
         GLFWwindow* window;
 
@@ -90,6 +116,8 @@ namespace glfw {
 
         VkQueue graphicsQueue{};
         VkQueue presentQueue{};
+        // Same as graphicsQueue when the device has no dedicated transfer family.
+        VkQueue transferQueue{};
 
         VkSurfaceKHR surface{};
         VkSwapchainKHR swapChain{};
@@ -101,6 +129,10 @@ namespace glfw {
         float deltaTime;
         std::chrono::high_resolution_clock::time_point lastCallUpdate;
 
+        ThreadPool *threadPool;
+        MemoryAllocator *memoryAllocator;
+        UploadContext *uploadContext;
+        MipGenerator *mipGenerator;
         TextureManager *textureManager;
         MeshManager *meshManager;
     };
@@ -4,15 +4,19 @@
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+// SubMesh::materialID and firstFace of the draw, from object.vert or object_indirect.vert.
+layout(location = 2) flat in uint fragMaterialID;
+layout(location = 3) flat in uint fragFirstFace;
 
 layout(location = 0) out vec4 outColor;
 
-layout(set = 2, binding = 0) readonly buffer MaterialID{
+layout(set = 1, binding = 1) readonly buffer MaterialID{
     uint matIDs[];
 } matIDs;
 layout(set = 3, binding = 0) uniform sampler2D diffuses[];
 
 void main() {
-    uint matID = matIDs.matIDs[gl_PrimitiveID];
+    // Single material submeshes skip the per-face lookup.
+    uint matID = fragMaterialID != 0xFFFFFFFFu ? fragMaterialID : matIDs.matIDs[fragFirstFace + gl_PrimitiveID];
     outColor = texture(diffuses[matID], fragTexCoord);
 }
\ No newline at end of file
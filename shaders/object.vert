@@ -1,27 +1,46 @@
 #version 450
 // Set 0: Global Set
-// Set 1: Instance Set
-// Set 2: SubMesh Set
+// Set 1: Instance Set (transforms, per-face material ids, visible instance slots)
 // Set 3: Texture Set
 // Set 4: Material Set (Not used now)
+// Push constants: per-draw data, see glfw::DrawConstants
 
-layout(set = 1, binding = 0) uniform Model {
+// One transform per instance of the mesh being drawn.
+layout(set = 1, binding = 0) readonly buffer Models {
+    mat4 models[];
+} models;
+// Slots of the instances kept for this draw, gl_InstanceIndex starts at the draw's list.
+layout(set = 1, binding = 2) readonly buffer Visible {
+    uint slots[];
+} visible;
+layout(push_constant) uniform Draw {
     mat4 model;
-} model;
+    vec4 positionScale;
+    vec4 positionOffset;
+    uint materialID;
+    uint firstFace;
+} draw;
 layout(set = 0, binding = 0) uniform UniformBufferObject {
     mat4 view;
     mat4 proj;
 } ubo;
 
+// Float vertices, or unorm16 positions of a compact vertex, see VertexFormat. Location 1 (color) is unused.
 layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+// Passed on so object.frag reads them the same way after object_indirect.vert.
+layout(location = 2) flat out uint fragMaterialID;
+layout(location = 3) flat out uint fragFirstFace;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * model.model * vec4(inPosition, 1.0);
-    fragColor = inColor;
+    // Identity (scale 1, offset 0) for float vertices.
+    vec3 position = inPosition * draw.positionScale.xyz + draw.positionOffset.xyz;
+    gl_Position = ubo.proj * ubo.view * draw.model * models.models[visible.slots[gl_InstanceIndex]] * vec4(position, 1.0);
+    fragColor = vec3(1.0);
     fragTexCoord = inTexCoord;
+    fragMaterialID = draw.materialID;
+    fragFirstFace = draw.firstFace;
 }
\ No newline at end of file
@@ -0,0 +1,67 @@
+#version 450
+// object.vert for the draws of glfw::GpuCuller: everything per draw is looked up from the slot of
+// the command, which cull.comp put in firstInstance.
+// Set 0: Global Set
+// Set 1: GpuCuller Set (instances, per-face material ids, submeshes, draw records)
+// Set 3: Texture Set
+
+struct Instance {
+    mat4 model;
+    vec4 sphere;
+    uint firstSubmesh;
+    uint submeshCount;
+    uint firstDraw;
+    uint lodCount;
+    vec4 lodErrors;
+};
+
+struct Submesh {
+    vec4 sphere;
+    vec4 positionScale;
+    vec4 positionOffset;
+    uint indexCount;
+    uint firstIndex;
+    int vertexOffset;
+    uint materialID;
+    uint firstFace;
+    uint indexType;
+    uint firstMeshlet;
+    uint meshletCount;
+    uint meshletVertexBase;
+    uint meshletTriangleBase;
+    int meshVertexOffset;
+};
+
+layout(set = 1, binding = 0) readonly buffer Instances {
+    Instance instances[];
+} instances;
+layout(set = 1, binding = 2) readonly buffer Submeshes {
+    Submesh submeshes[];
+} submeshes;
+layout(set = 1, binding = 3) readonly buffer Draws {
+    uvec4 draws[];
+} draws;
+layout(set = 0, binding = 0) uniform UniformBufferObject {
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragMaterialID;
+layout(location = 3) flat out uint fragFirstFace;
+
+void main() {
+    uvec4 draw = draws.draws[gl_InstanceIndex];
+    Submesh submesh = submeshes.submeshes[draw.y];
+    vec3 position = inPosition * submesh.positionScale.xyz + submesh.positionOffset.xyz;
+    gl_Position = ubo.proj * ubo.view * instances.instances[draw.x].model * vec4(position, 1.0);
+    fragColor = vec3(1.0);
+    fragTexCoord = inTexCoord;
+    fragMaterialID = submesh.materialID;
+    // gl_PrimitiveID counts from the meshlet the draw starts at.
+    fragFirstFace = submesh.firstFace + draw.z;
+}
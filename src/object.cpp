@@ -13,10 +13,20 @@
 #include <SubMesh.h>
 #include <Mesh.h>
 #include <Instance.h>
+#include <InstanceGroup.h>
+#include <MeshManager.h>
+#include <GeometryPool.h>
+#include <Frustum.h>
+#include <GpuCuller.h>
+#include <DepthPyramid.h>
+#include <SoftwareOcclusion.h>
 
 #include <unordered_map>
+#include <cstring>
 #include <Shader.h>
 #include <Camera.h>
+#include <MemoryAllocator.h>
+#include <UploadContext.h>
 
 //const std::string MODEL_PATH = "../../San_Miguel/san-miguel-low-poly.obj";
 const std::string MODEL_PATH = "../models/viking_room.obj";
@@ -39,7 +49,9 @@ struct FrameVkInfo {
 
 class MyApp : public glfw::glfwApp {
 public:
-    MyApp();
+    // meshShaders false keeps GpuCuller on cluster.comp even where VK_EXT_mesh_shader is there, so
+    // does a build whose glslc could not compile the mesh shaders.
+    explicit MyApp(bool meshShaders = true);
 
     void initialize() override;
     void cleanup() override;
@@ -75,17 +87,29 @@ protected:
 
     VkPipelineLayout pipelineLayout;
     VkRenderPass renderPass;
+    // With gpuCuller renderPass keeps color and depth for this one, which loads them for the second phase.
+    VkRenderPass occlusionRenderPass;
     VkPipeline graphicsPipeline;
+    // Draws of gpuCuller: object_indirect.vert, its set instead of the instance set, no push constants.
+    // With mesh shaders object.task and object.mesh, and GpuCuller::MeshDrawConstants.
+    VkPipelineLayout indirectPipelineLayout;
+    VkPipeline indirectPipeline;
     std::vector<VkFramebuffer> swapChainFramebuffers;
     VkCommandPool commandPool;
 
 //    glfw::Mesh mesh;
+    std::vector<glfw::Mesh*> meshes;
     std::vector<glfw::Instance*> instances;
     std::vector<glfw::Buffer*> uniformBuffers;
+    // Culls and draws every instance when the device can, null means culling on the CPU per group.
+    glfw::GpuCuller* gpuCuller = nullptr;
+    // Built from the depth of the first phase of gpuCuller, for the second.
+    glfw::DepthPyramid* depthPyramid = nullptr;
+    // Occlusion culling of the CPU path, rasterized while the GPU works on the frame before.
+    glfw::SoftwareOcclusion* softwareOcclusion = nullptr;
 
     VkDescriptorSetLayout globalDescSetLayout;
     VkDescriptorSetLayout meshDescSetLayout;
-    VkDescriptorSetLayout subMeshDescSetLayout;
 
     std::vector<VkDescriptorSet> descriptorSets;
 
@@ -108,20 +132,37 @@ protected:
     glm::vec2 cursorDelta = {0.0, 0.0};
 
     glfw::Camera mainCamera;
+    // Of the last recorded frame, printed about once a second.
+    glfw::CullingStats cullingStats;
+    float cullingStatsTimer = 0.0f;
 };
 
-MyApp::MyApp():glfwApp(),
+MyApp::MyApp(bool meshShaders):glfwApp(),
     texture(this), depth(this) {
+    // Quantized positions and half UVs, 12 instead of 32 bytes per vertex.
+    vertexFormat = VertexFormat::Compact;
+#ifdef TRIANGLE_MESH_SHADERS
+    meshShaderAllowed = meshShaders;
+#else
+    // object.task and object.mesh were not compiled, see CMakeLists.txt.
+    meshShaderAllowed = false;
+#endif
 }
 
 MyApp::~MyApp() {
 }
 
 void MyApp::cleanup() {
+    // Its raster may still read the meshes.
+    delete softwareOcclusion;
+    softwareOcclusion = nullptr;
     {
         for (glfw::Instance* & inst : instances)
-            inst->destroy(1);
+            delete inst;
         instances.resize(0);
+        for (glfw::Mesh* & mesh : meshes)
+            delete mesh;
+        meshes.resize(0);
         texture.destroy();
     }
     vkDestroyDescriptorPool(device, descriptorPool, nullptr);
@@ -133,7 +174,6 @@ void MyApp::cleanup() {
 
     vkDestroyDescriptorSetLayout(device, globalDescSetLayout, nullptr);
     vkDestroyDescriptorSetLayout(device, meshDescSetLayout, nullptr);
-    vkDestroyDescriptorSetLayout(device, subMeshDescSetLayout, nullptr);
 
     vkDestroyCommandPool(device, commandPool, nullptr);
     depth.destroy();
@@ -142,12 +182,27 @@ void MyApp::cleanup() {
     }
     vkDestroyPipeline(device, graphicsPipeline, nullptr);
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    if (gpuCuller) {
+        vkDestroyPipeline(device, indirectPipeline, nullptr);
+        vkDestroyPipelineLayout(device, indirectPipelineLayout, nullptr);
+    }
     vkDestroyRenderPass(device, renderPass, nullptr);
+    if (gpuCuller)
+        vkDestroyRenderPass(device, occlusionRenderPass, nullptr);
+    delete gpuCuller;
+    gpuCuller = nullptr;
+    delete depthPyramid;
+    depthPyramid = nullptr;
     glfw::glfwApp::cleanup();
 }
 
 int main(int argc, char **argv) {
-    MyApp myApp;
+    // --no-mesh-shader runs the compute cluster culling path on devices (or lavapipe) that have mesh shaders too.
+    bool meshShaders = true;
+    for (int i = 1; i < argc; i ++)
+        if (std::strcmp(argv[i], "--no-mesh-shader") == 0)
+            meshShaders = false;
+    MyApp myApp(meshShaders);
     try {
         myApp.initialize();
         myApp.run();
@@ -162,6 +217,10 @@ int main(int argc, char **argv) {
 void MyApp::initialize() {
     glfw::glfwApp::initialize();
     try {
+        if (gpuDrivenSupported) {
+            gpuCuller = new glfw::GpuCuller(this, MAX_FRAMES_IN_FLIGHT);
+            depthPyramid = new glfw::DepthPyramid(this);
+        }
         this->initRenderPass();
         this->initDescriptorSetLayout();
         this->initGraphicsPipeline();
@@ -169,16 +228,28 @@ void MyApp::initialize() {
         this->initDepthBuffer();
         this->initFramebuffers();
         fprintf(stdout, "Loading Model\n");
-        instances.push_back(new glfw::Instance(this, new glfw::Mesh(this)));
-        instances[0]->mMesh->loadObject(MODEL_PATH.c_str(), commandPool, graphicsQueue);
+        meshes.push_back(new glfw::Mesh(this));
+        meshes[0]->loadObject(MODEL_PATH.c_str());
+        instances.push_back(new glfw::Instance(this, meshes[0]));
+        uploadContext->finish();
+        if (gpuCuller) {
+            gpuCuller->build(meshes);
+        } else {
+            // Few and large enough in this scene that every instance occludes.
+            softwareOcclusion = new glfw::SoftwareOcclusion(*threadPool);
+            for (glfw::Instance* inst : instances)
+                softwareOcclusion->addOccluder(inst);
+        }
         fprintf(stdout, "Model Loaded\n");
 //        this->initTexture();
         this->initBuffers();
         this->initDescriptorPool();
         this->initDescriptorSets();
-//        instances[0]->initGPUMemory(descriptorPool, meshDescSetLayout, commandPool, graphicsQueue, MAX_FRAMES_IN_FLIGHT); // TODO: add submesh desc
+        for (auto &mesh : meshes)
+            mesh->getInstanceGroup()->initGPUMemory(descriptorPool, meshDescSetLayout, MAX_FRAMES_IN_FLIGHT); // TODO: add submesh desc
         this->initSyncObjects();
         this->initCamera();
+        memoryAllocator->printStatistics();
     } catch(...) {
         std::throw_with_nested(std::runtime_error("failed to init myApp"));
     }
@@ -195,6 +266,14 @@ void MyApp::recordCommandBuffer(VkCommandBuffer cb, int currentFrame, int imageI
     if (vkBeginCommandBuffer(cb, &beginInfo) != VK_SUCCESS)
         throw std::runtime_error("failed to begin recording command buffer!");
 
+    glm::mat4 viewProjection = mainCamera.GetProjection() * mainCamera.GetTransform();
+    glfw::Frustum frustum(viewProjection);
+    // Both paths pick the level of detail of an instance by how many pixels its simplification error covers.
+    glfw::LodView lodView(mainCamera.GetPosition(), mainCamera.GetFovY(), swapChainExtent.height);
+    // Writes the indirect commands, so it has to run before the render pass.
+    if (gpuCuller)
+        gpuCuller->cull(cb, currentFrame, frustum, viewProjection, lodView);
+
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassInfo.renderPass = renderPass;
@@ -207,31 +286,64 @@ void MyApp::recordCommandBuffer(VkCommandBuffer cb, int currentFrame, int imageI
     renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
     renderPassInfo.pClearValues = clearValues.data();
     vkCmdBeginRenderPass(cb, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-
-    for (auto &inst : instances) {
-        std::array<VkDescriptorSet, 2> curDescriptorSets = {
-                inst->getModelDescriptorSet(currentFrame),
-                descriptorSet
-        };
-        for (auto &submesh: inst->mMesh->submesh) {
-            VkBuffer vertexBuffers[] = {submesh->vertex->getBuffer()};
-            VkDeviceSize offsets[] = {0};
-            vkCmdBindVertexBuffers(cb, 0, 1, vertexBuffers, offsets);
-            vkCmdBindIndexBuffer(cb, submesh->indice->getBuffer(), 0, VK_INDEX_TYPE_UINT32);
-            vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, curDescriptorSets.size(), curDescriptorSets.data(), 0,
-                                    nullptr);
-            vkCmdDrawIndexed(cb, submesh->numIndices, 1, 0, 0, 0);
-        }
+    if (gpuCuller) {
+        /**
+         * Whatever the scene size, one indirect draw per index type. First what was visible last frame.
+         */
+        vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipeline);
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        gpuCuller->draw(cb, indirectPipelineLayout, 1, currentFrame);
+    } else {
+        vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        // Geometry of every mesh lives in one pool, groups rebind the index buffer of their index type.
+        meshManager->getGeometryPool()->bind(cb);
+        /**
+         * All instances of a mesh go in one instanced draw per submesh, minus what is outside the view
+         * or behind the occluders rasterized since onDraw started.
+         */
+        cullingStats = glfw::CullingStats{};
+        softwareOcclusion->wait();
+        for (auto &mesh : meshes)
+            mesh->getInstanceGroup()->draw(cb, pipelineLayout, 1, currentFrame, &frustum, &cullingStats, softwareOcclusion, &lodView);
     }
-
     vkCmdEndRenderPass(cb);
+
+    if (gpuCuller) {
+        /**
+         * Then Hi-Z from that depth, and whatever it does not hide that was not drawn yet.
+         */
+        depthPyramid->build(cb);
+        gpuCuller->cullOccluded(cb, currentFrame);
+        renderPassInfo.renderPass = occlusionRenderPass;
+        vkCmdBeginRenderPass(cb, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipeline);
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        gpuCuller->draw(cb, indirectPipelineLayout, 1, currentFrame, true);
+        vkCmdEndRenderPass(cb);
+    }
     if (vkEndCommandBuffer(cb) != VK_SUCCESS)
         throw std::runtime_error("failed to record command buffer!");
 }
 
 void MyApp::onDraw() {
+    // Same matrix recordCommandBuffer draws with, rasterized while this waits for the frame before.
+    if (softwareOcclusion)
+        softwareOcclusion->begin(mainCamera.GetProjection() * mainCamera.GetTransform());
     vkWaitForFences(device, 1, &frameInfos[currentFrame].inFlightFence, VK_TRUE, UINT64_MAX);
+    // Unloaded meshes no frame draws anymore; a compaction moves the ranges gpuCuller baked in.
+    meshManager->collect(MAX_FRAMES_IN_FLIGHT);
+    if (gpuCuller && gpuCuller->isStale())
+        gpuCuller->build(meshes);
+    if (gpuCuller) {
+        // Counts of the last frame recorded into this slot, then this frame's instances.
+        cullingStats = gpuCuller->getStats(currentFrame);
+        gpuCuller->update(currentFrame);
+    } else {
+        for (auto &mesh : meshes)
+            mesh->getInstanceGroup()->update(currentFrame);
+    }
     uint32_t imageIndex;
     VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, frameInfos[currentFrame].imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
@@ -319,6 +431,19 @@ void MyApp::onUpdate() {
     ubo.view = mainCamera.GetTransform();
     ubo.proj = mainCamera.GetProjection();
     uniformBuffers[currentFrame]->uploadData(&ubo, sizeof(ubo));
+
+    cullingStatsTimer += deltaTime;
+    if (cullingStatsTimer >= 1.0f) {
+        cullingStatsTimer = 0.0f;
+        // cluster.comp splits the submesh draws of the GpuCuller per meshlet, object.task culls its own.
+        fprintf(stdout, "Culling: %u of %u %s draws culled\n", cullingStats.culled, cullingStats.tested,
+                gpuCuller && !meshShaderSupported ? "meshlet" : "submesh");
+        if (softwareOcclusion) {
+            glfw::SoftwareOcclusion::Stats stats = softwareOcclusion->getStats();
+            fprintf(stdout, "Occlusion: %.3f ms for %u triangles, %u of %u instances hidden\n",
+                    stats.rasterMilliseconds, stats.triangles, stats.culled, stats.tested);
+        }
+    }
 }
 
 void MyApp::initGraphicsPipeline() {
@@ -328,8 +453,8 @@ void MyApp::initGraphicsPipeline() {
     const char* fname = "main";
     VkPipelineShaderStageCreateInfo shaderStages[] = {shader.getVertStageInfo(fname), shader.getFragStageInfo(fname)};
 
-    auto bindingDescription = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+    auto bindingDescription = getVertexBindingDescription(vertexFormat);
+    auto attributeDescriptions = getVertexAttributeDescriptions(vertexFormat);
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -406,16 +531,20 @@ void MyApp::initGraphicsPipeline() {
     colorBlending.blendConstants[3] = 0.0f; // Optional
 
     VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-    std::array<VkDescriptorSetLayout, 3> setLayouts = {
+    std::array<VkDescriptorSetLayout, 2> setLayouts = {
             globalDescSetLayout,
-            meshDescSetLayout,
-            subMeshDescSetLayout
+            meshDescSetLayout
     };
+    // Per-draw data (model matrix, material and submesh face offset), see glfw::DrawConstants.
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(glfw::DrawConstants);
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = setLayouts.size(); // Optional
     pipelineLayoutInfo.pSetLayouts = setLayouts.data(); // Optional
-    pipelineLayoutInfo.pushConstantRangeCount = 0; // Optionala
-    pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
     if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
         throw std::runtime_error("failed to create pipeline layout!");
@@ -457,6 +586,69 @@ void MyApp::initGraphicsPipeline() {
         throw std::runtime_error("failed to create graphics pipeline!");
     }
     shader.destroy();
+
+    if (gpuCuller) {
+        /**
+         * Same state for the draws of the GpuCuller, everything per draw comes from its set.
+         */
+        glfw::Shader indirectShader(this);
+        indirectShader.loadShaderModule("object_indirect.vert.spv", "object.frag.spv");
+        VkPipelineShaderStageCreateInfo indirectStages[] = {indirectShader.getVertStageInfo(fname), indirectShader.getFragStageInfo(fname)};
+        std::array<VkDescriptorSetLayout, 2> indirectSetLayouts = {
+                globalDescSetLayout,
+                gpuCuller->getDescriptorSetLayout()
+        };
+        pipelineLayoutInfo.setLayoutCount = indirectSetLayouts.size();
+        pipelineLayoutInfo.pSetLayouts = indirectSetLayouts.data();
+        pipelineLayoutInfo.pushConstantRangeCount = 0;
+        pipelineLayoutInfo.pPushConstantRanges = nullptr;
+        pipelineInfo.stageCount = 2;
+        pipelineInfo.pStages = indirectStages;
+#ifdef VK_EXT_mesh_shader
+        /**
+         * With mesh shaders object.task and object.mesh replace the vertex stage and the vertex input,
+         * they fetch the vertices themselves. GpuCuller::draw pushes which draw records to read.
+         */
+        VkShaderModule taskModule = VK_NULL_HANDLE, meshModule = VK_NULL_HANDLE;
+        VkPipelineShaderStageCreateInfo meshStages[3]{};
+        if (meshShaderSupported) {
+            taskModule = createShaderModule(device, readFile("object.task.spv"));
+            meshModule = createShaderModule(device, readFile("object.mesh.spv"));
+            VkShaderModule modules[2] = {taskModule, meshModule};
+            VkShaderStageFlagBits stages[2] = {VK_SHADER_STAGE_TASK_BIT_EXT, VK_SHADER_STAGE_MESH_BIT_EXT};
+            for (int i = 0; i < 2; i ++) {
+                meshStages[i].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+                meshStages[i].stage = stages[i];
+                meshStages[i].module = modules[i];
+                meshStages[i].pName = fname;
+            }
+            meshStages[2] = indirectShader.getFragStageInfo(fname);
+            pushConstantRange.stageFlags = VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+            pushConstantRange.size = sizeof(glfw::GpuCuller::MeshDrawConstants);
+            pipelineLayoutInfo.pushConstantRangeCount = 1;
+            pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+            pipelineInfo.stageCount = 3;
+            pipelineInfo.pStages = meshStages;
+            pipelineInfo.pVertexInputState = nullptr;
+            pipelineInfo.pInputAssemblyState = nullptr;
+        }
+#endif
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &indirectPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create indirect pipeline layout!");
+        }
+        pipelineInfo.layout = indirectPipelineLayout;
+        VkResult result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &indirectPipeline);
+#ifdef VK_EXT_mesh_shader
+        if (meshShaderSupported) {
+            vkDestroyShaderModule(device, taskModule, nullptr);
+            vkDestroyShaderModule(device, meshModule, nullptr);
+        }
+#endif
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to create indirect graphics pipeline!");
+        }
+        indirectShader.destroy();
+    }
 }
 
 void MyApp::initRenderPass() {
@@ -468,17 +660,18 @@ void MyApp::initRenderPass() {
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    colorAttachment.finalLayout = gpuCuller ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     VkAttachmentDescription depthAttachment{};
     depthAttachment.format = findDepthFormat();
     depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
     depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    // The depth pyramid of gpuCuller is built from it between the two passes.
+    depthAttachment.storeOp = gpuCuller ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
     depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.finalLayout = gpuCuller ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference colorAttachmentRef{};
     colorAttachmentRef.attachment = 0;
@@ -502,20 +695,57 @@ void MyApp::initRenderPass() {
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
 
-    VkSubpassDependency dependency{};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT; // The previous Pass's test
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT; // Once we did, we will clear it
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    std::array<VkSubpassDependency, 2> dependencies{};
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT; // The previous Pass's test
+    dependencies[0].srcAccessMask = 0;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT; // Once we did, we will clear it
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    if (gpuCuller) {
+        // The previous frame's pyramid build still reads the depth we clear.
+        dependencies[0].srcStageMask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        // Depth is read by the pyramid build once we are done.
+        dependencies[1].srcSubpass = 0;
+        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    }
 
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = gpuCuller ? 2 : 1;
+    renderPassInfo.pDependencies = dependencies.data();
 
     if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
         throw std::runtime_error("failed to create render pass!");
     }
+
+    if (gpuCuller) {
+        /**
+         * Second phase: compatible with renderPass, so it shares its framebuffers, but draws on top.
+         */
+        attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+        attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        // Waits for the occlusion cull to be done with the pyramid, and so with the depth it was built from.
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[0].srcAccessMask = 0;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                                        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        renderPassInfo.dependencyCount = 1;
+        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &occlusionRenderPass) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create occlusion render pass!");
+        }
+    }
 }
 
 void MyApp::initFramebuffers() {
@@ -595,7 +825,13 @@ void MyApp::cleanupSwapChain() {
     }
     vkDestroyPipeline(device, graphicsPipeline, nullptr);
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    if (gpuCuller) {
+        vkDestroyPipeline(device, indirectPipeline, nullptr);
+        vkDestroyPipelineLayout(device, indirectPipelineLayout, nullptr);
+    }
     vkDestroyRenderPass(device, renderPass, nullptr);
+    if (gpuCuller)
+        vkDestroyRenderPass(device, occlusionRenderPass, nullptr);
     glfw::glfwApp::cleanupSwapChain();
 }
 
@@ -617,7 +853,7 @@ void MyApp::initBuffers() {
             uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
             for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
                 uniformBuffers[i] = new glfw::Buffer(this);
-                uniformBuffers[i]->create(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+                uniformBuffers[i]->create(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, true);
             }
         }
     } catch (...) {
@@ -633,6 +869,10 @@ void MyApp::initDescriptorSetLayout() {
         uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
         uboLayoutBinding.descriptorCount = 1;
         uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; // This binding is accessable from VERTEX stage
+#ifdef VK_EXT_mesh_shader
+        if (meshShaderSupported)
+            uboLayoutBinding.stageFlags |= VK_SHADER_STAGE_MESH_BIT_EXT;
+#endif
         uboLayoutBinding.pImmutableSamplers = nullptr; // Optional
 
         std::array<VkDescriptorSetLayoutBinding, 1> bindings = {uboLayoutBinding};
@@ -650,24 +890,26 @@ void MyApp::initDescriptorSetLayout() {
         // Instance / Mesh Set
         VkDescriptorSetLayoutBinding modelMatBinding{};
         modelMatBinding.binding = 0;
-        modelMatBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        modelMatBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
         modelMatBinding.descriptorCount = 1;
         modelMatBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; // This binding is accessable from VERTEX stage
         modelMatBinding.pImmutableSamplers = nullptr; // Optional
 
-        uint32_t numMaterials = 0;
-        for (auto &inst : instances) {
-//            if (inst->getNumMaterial() > numMaterials)
-//                numMaterials = inst->getNumMaterial(); // TODO
-        }
-        VkDescriptorSetLayoutBinding samplersBinding{};
-        samplersBinding.binding = 1;
-        samplersBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        samplersBinding.descriptorCount = numMaterials;
-        samplersBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-        samplersBinding.pImmutableSamplers = nullptr; // Optional
-
-        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {modelMatBinding, samplersBinding};
+        VkDescriptorSetLayoutBinding matIDBinding{};
+        matIDBinding.binding = 1;
+        matIDBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        matIDBinding.descriptorCount = 1;
+        matIDBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        matIDBinding.pImmutableSamplers = nullptr; // Optional
+
+        VkDescriptorSetLayoutBinding visibleBinding{};
+        visibleBinding.binding = 2;
+        visibleBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        visibleBinding.descriptorCount = 1;
+        visibleBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        visibleBinding.pImmutableSamplers = nullptr; // Optional
+
+        std::array<VkDescriptorSetLayoutBinding, 3> bindings = {modelMatBinding, matIDBinding, visibleBinding};
         VkDescriptorSetLayoutCreateInfo layoutInfo{};
         layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
         layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -677,29 +919,19 @@ void MyApp::initDescriptorSetLayout() {
             throw std::runtime_error("failed to create descriptor set layout!");
         }
     }
-
-    {
-        // Submesh Set
-        VkDescriptorSetLayoutBinding matIDBinding{};
-        matIDBinding.binding = 0;
-        matIDBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        matIDBinding.descriptorCount = 1;
-        matIDBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT; // This binding is accessable from VERTEX stage
-        matIDBinding.pImmutableSamplers = nullptr; // Optional
-    }
 }
 
 void MyApp::initDescriptorPool() {
-    int meshNeedUniform = 0;
-    for (auto &inst : instances) {
-        meshNeedUniform += 1 + inst->mMesh->submesh.size();
-    }
+    // Transform, material id and visible slot buffer of every mesh.
+    int meshNeed = 3 * meshes.size();
 
-    std::array<VkDescriptorPoolSize, 2> poolSizes{};
+    std::array<VkDescriptorPoolSize, 3> poolSizes{};
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT * (1 + meshNeed));
-    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT * meshNeed);
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[2].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -767,13 +999,14 @@ void MyApp::initDescriptorSets() {
 
 void MyApp::initTexture() {
     try {
-        texture.load(TEXTURE_PATH.c_str(), commandPool, graphicsQueue);
+        texture.load(TEXTURE_PATH.c_str());
+        uploadContext->finish();
 
         // ??
         VkImageSubresourceRange subresourceRange;
         subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         subresourceRange.baseMipLevel = 0;
-        subresourceRange.levelCount = 1;
+        subresourceRange.levelCount = texture.getMipLevels();
         subresourceRange.baseArrayLayer = 0;
         subresourceRange.layerCount = 1;
         texture.createImageView(VK_IMAGE_VIEW_TYPE_2D, texture.getFormat(), subresourceRange);
@@ -802,7 +1035,8 @@ VkFormat MyApp::findDepthFormat() {
     return findSupportedFormat(
             {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
             VK_IMAGE_TILING_OPTIMAL,
-            VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+            // Sampled by the depth pyramid on the GPU driven path.
+            VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | (gpuDrivenSupported ? VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT : 0)
     );
 }
 
@@ -815,15 +1049,21 @@ void MyApp::initDepthBuffer() {
                 1
         };
         depth.create(VK_IMAGE_TYPE_2D, depthFormat, extent, VK_IMAGE_TILING_OPTIMAL,
-                     VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+                     VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (depthPyramid ? VK_IMAGE_USAGE_SAMPLED_BIT : 0),
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
         VkImageSubresourceRange subresourceRange;
-        subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        // Depth only, which is also what the depth pyramid samples.
+        subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
         subresourceRange.baseMipLevel = 0;
         subresourceRange.levelCount = 1;
         subresourceRange.baseArrayLayer = 0;
         subresourceRange.layerCount = 1;
         depth.createImageView(VK_IMAGE_VIEW_TYPE_2D, depth.getFormat(), subresourceRange);
         depth.transition(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, graphicsQueue, commandPool);
+        if (depthPyramid) {
+            depthPyramid->create(depth.getImageView(), swapChainExtent);
+            gpuCuller->setDepthPyramid(depthPyramid);
+        }
     } catch (...) {
         std::throw_with_nested(std::runtime_error("failed to create depth texture"));
     }
@@ -0,0 +1,220 @@
+#include "BlockCompressor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace cooker {
+    namespace {
+        uint16_t packColor565(const float color[3]) {
+            auto quantize = [](float value, int bits) {
+                int maxValue = (1 << bits) - 1;
+                int q = static_cast<int>(std::lround(std::clamp(value, 0.0f, 255.0f) * maxValue / 255.0f));
+                return static_cast<uint16_t>(std::clamp(q, 0, maxValue));
+            };
+            return static_cast<uint16_t>((quantize(color[0], 5) << 11) | (quantize(color[1], 6) << 5) | quantize(color[2], 5));
+        }
+
+        void unpackColor565(uint16_t packed, int color[3]) {
+            int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+            color[0] = (r << 3) | (r >> 2);
+            color[1] = (g << 2) | (g >> 4);
+            color[2] = (b << 3) | (b >> 2);
+        }
+
+        void writeLE(uint8_t* dst, uint64_t value, int bytes) {
+            for (int i = 0; i < bytes; i ++)
+                dst[i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+
+        void encodeColorBlock(const uint8_t rgba[64], uint8_t block[8]) {
+            /**
+             * Principal axis of the 16 colours by power iteration on their covariance.
+             */
+            float mean[3] = {0, 0, 0};
+            for (int i = 0; i < 16; i ++)
+                for (int c = 0; c < 3; c ++)
+                    mean[c] += rgba[i * 4 + c] / 16.0f;
+            float cov[6] = {0, 0, 0, 0, 0, 0};
+            for (int i = 0; i < 16; i ++) {
+                float r = rgba[i * 4 + 0] - mean[0], g = rgba[i * 4 + 1] - mean[1], b = rgba[i * 4 + 2] - mean[2];
+                cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+                cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+            }
+            // Seeded with the covariance column of the widest channel, (1, 1, 1) misses anti-correlated axes.
+            int widest = cov[0] >= cov[3] ? (cov[0] >= cov[5] ? 0 : 2) : (cov[3] >= cov[5] ? 1 : 2);
+            const int column[3][3] = {{0, 1, 2}, {1, 3, 4}, {2, 4, 5}};
+            float axis[3] = {cov[column[widest][0]], cov[column[widest][1]], cov[column[widest][2]]};
+            for (int iter = 0; iter < 8; iter ++) {
+                float next[3] = {
+                        cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                        cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                        cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]
+                };
+                float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+                if (length < 1e-6f)
+                    break;
+                for (int c = 0; c < 3; c ++)
+                    axis[c] = next[c] / length;
+            }
+
+            float minT = 0, maxT = 0;
+            for (int i = 0; i < 16; i ++) {
+                float t = 0;
+                for (int c = 0; c < 3; c ++)
+                    t += (rgba[i * 4 + c] - mean[c]) * axis[c];
+                minT = std::min(minT, t);
+                maxT = std::max(maxT, t);
+            }
+            float end0[3], end1[3];
+            for (int c = 0; c < 3; c ++) {
+                end0[c] = mean[c] + axis[c] * maxT;
+                end1[c] = mean[c] + axis[c] * minT;
+            }
+
+            uint16_t c0 = packColor565(end0);
+            uint16_t c1 = packColor565(end1);
+            // c0 > c1 selects the four colour mode.
+            if (c0 < c1)
+                std::swap(c0, c1);
+
+            uint32_t indices = 0;
+            if (c0 != c1) {
+                int palette[4][3];
+                unpackColor565(c0, palette[0]);
+                unpackColor565(c1, palette[1]);
+                for (int c = 0; c < 3; c ++) {
+                    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+                }
+                for (int i = 0; i < 16; i ++) {
+                    int best = 0, bestError = std::numeric_limits<int>::max();
+                    for (int p = 0; p < 4; p ++) {
+                        int error = 0;
+                        for (int c = 0; c < 3; c ++) {
+                            int d = rgba[i * 4 + c] - palette[p][c];
+                            error += d * d;
+                        }
+                        if (error < bestError) {
+                            bestError = error;
+                            best = p;
+                        }
+                    }
+                    indices |= uint32_t(best) << (2 * i);
+                }
+            }
+            writeLE(block, c0, 2);
+            writeLE(block + 2, c1, 2);
+            writeLE(block + 4, indices, 4);
+        }
+
+        void encodeAlphaBlock(const uint8_t rgba[64], uint8_t block[8]) {
+            int a0 = 0, a1 = 255;
+            for (int i = 0; i < 16; i ++) {
+                a0 = std::max(a0, int(rgba[i * 4 + 3]));
+                a1 = std::min(a1, int(rgba[i * 4 + 3]));
+            }
+
+            uint64_t indices = 0;
+            if (a0 != a1) {
+                // a0 > a1: eight alpha mode.
+                int palette[8] = {a0, a1};
+                for (int p = 2; p < 8; p ++)
+                    palette[p] = ((8 - p) * a0 + (p - 1) * a1) / 7;
+                for (int i = 0; i < 16; i ++) {
+                    int best = 0, bestError = 256;
+                    for (int p = 0; p < 8; p ++) {
+                        int error = std::abs(int(rgba[i * 4 + 3]) - palette[p]);
+                        if (error < bestError) {
+                            bestError = error;
+                            best = p;
+                        }
+                    }
+                    indices |= uint64_t(best) << (3 * i);
+                }
+            }
+            block[0] = static_cast<uint8_t>(a0);
+            block[1] = static_cast<uint8_t>(a1);
+            writeLE(block + 2, indices, 6);
+        }
+
+        float srgbToLinear(float c) {
+            return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+
+        float linearToSrgb(float c) {
+            return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+        }
+    }
+
+    void encodeBC1(const uint8_t rgba[64], uint8_t block[8]) {
+        encodeColorBlock(rgba, block);
+    }
+
+    void encodeBC3(const uint8_t rgba[64], uint8_t block[16]) {
+        encodeAlphaBlock(rgba, block);
+        encodeColorBlock(rgba, block + 8);
+    }
+
+    std::vector<uint8_t> compressLevel(const uint8_t *rgba, uint32_t width, uint32_t height, bool alpha) {
+        const uint32_t blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        const uint32_t blockSize = alpha ? 16 : 8;
+        std::vector<uint8_t> blocks(size_t(blocksX) * blocksY * blockSize);
+        uint8_t texels[64];
+        for (uint32_t by = 0; by < blocksY; by ++) {
+            for (uint32_t bx = 0; bx < blocksX; bx ++) {
+                for (uint32_t y = 0; y < 4; y ++) {
+                    for (uint32_t x = 0; x < 4; x ++) {
+                        uint32_t sx = std::min(bx * 4 + x, width - 1), sy = std::min(by * 4 + y, height - 1);
+                        std::memcpy(texels + (y * 4 + x) * 4, rgba + (size_t(sy) * width + sx) * 4, 4);
+                    }
+                }
+                uint8_t* block = blocks.data() + (size_t(by) * blocksX + bx) * blockSize;
+                if (alpha)
+                    encodeBC3(texels, block);
+                else
+                    encodeBC1(texels, block);
+            }
+        }
+        return blocks;
+    }
+
+    std::vector<std::vector<uint8_t>> buildMipChain(const uint8_t *rgba, uint32_t width, uint32_t height, bool srgb) {
+        float decode[256];
+        for (int i = 0; i < 256; i ++)
+            decode[i] = srgb ? srgbToLinear(i / 255.0f) : i / 255.0f;
+
+        std::vector<std::vector<uint8_t>> levels;
+        levels.emplace_back(rgba, rgba + size_t(width) * height * 4);
+        while (width > 1 || height > 1) {
+            const std::vector<uint8_t>& src = levels.back();
+            uint32_t nextWidth = std::max(width / 2, 1u), nextHeight = std::max(height / 2, 1u);
+            std::vector<uint8_t> dst(size_t(nextWidth) * nextHeight * 4);
+            for (uint32_t y = 0; y < nextHeight; y ++) {
+                for (uint32_t x = 0; x < nextWidth; x ++) {
+                    float sum[4] = {0, 0, 0, 0};
+                    for (uint32_t dy = 0; dy < 2; dy ++) {
+                        for (uint32_t dx = 0; dx < 2; dx ++) {
+                            uint32_t sx = std::min(x * 2 + dx, width - 1), sy = std::min(y * 2 + dy, height - 1);
+                            const uint8_t* texel = src.data() + (size_t(sy) * width + sx) * 4;
+                            for (int c = 0; c < 3; c ++)
+                                sum[c] += decode[texel[c]];
+                            sum[3] += texel[3] / 255.0f;
+                        }
+                    }
+                    uint8_t* out = dst.data() + (size_t(y) * nextWidth + x) * 4;
+                    for (int c = 0; c < 4; c ++) {
+                        float value = sum[c] * 0.25f;
+                        if (srgb && c < 3)
+                            value = linearToSrgb(value);
+                        out[c] = static_cast<uint8_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+                    }
+                }
+            }
+            levels.push_back(std::move(dst));
+            width = nextWidth;
+            height = nextHeight;
+        }
+        return levels;
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef TRIANGLE_BLOCKCOMPRESSOR_H
+#define TRIANGLE_BLOCKCOMPRESSOR_H
+
+#include <cstdint>
+#include <vector>
+
+namespace cooker {
+    /**
+     * Range fit BC1/BC3 encoder: endpoints are the extremes of the block along its principal colour
+     * axis. Not as good as an exhaustive search, but fast enough to cook every texture on each build.
+     */
+    void encodeBC1(const uint8_t rgba[64], uint8_t block[8]);
+    void encodeBC3(const uint8_t rgba[64], uint8_t block[16]);
+
+    // Whole level, partial edge blocks repeat the last row/column.
+    std::vector<uint8_t> compressLevel(const uint8_t* rgba, uint32_t width, uint32_t height, bool alpha);
+
+    // Box filtered chain down to 1x1, level 0 included. sRGB data is filtered in linear space.
+    std::vector<std::vector<uint8_t>> buildMipChain(const uint8_t* rgba, uint32_t width, uint32_t height, bool srgb);
+}
+
+#endif //TRIANGLE_BLOCKCOMPRESSOR_H
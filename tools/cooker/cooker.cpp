@@ -0,0 +1,161 @@
+#include <MeshFile.h>
+#include <TextureFile.h>
+#include <ThreadPool.h>
+#include "BlockCompressor.h"
+#include <filesystem>
+
+/**
+ * Offline asset cooker.
+ *
+ *   cooker [--force] <file|directory>...
+ *
+ * .obj files are imported, reordered for the vertex cache, overdraw and vertex fetch, given their levels of detail and meshlets and written as .mesh next to the source
+ * (streamed through bounded memory from MeshFile::kStreamingImportSize on). Images are
+ * compressed to BC1 (opaque) or BC3 (with alpha) with a full mip chain and written as .dds next to
+ * the source. The runtime picks these up instead of the sources as long as they are up to date.
+ */
+
+namespace {
+    struct Stats {
+        int cooked = 0;
+        int skipped = 0;
+        int failed = 0;
+    };
+
+    std::string lowerExtension(const std::filesystem::path& path) {
+        std::string ext = path.extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+        return ext;
+    }
+
+    bool isImage(const std::string& ext) {
+        return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".tga" || ext == ".bmp";
+    }
+
+    bool cookMesh(const std::string& source, bool force, Stats& stats, glfw::ThreadPool& pool) {
+        std::string cooked = glfw::MeshFile::getCookedPath(source.c_str());
+        if (!force && glfw::MeshFile::isUpToDate(cooked, source.c_str())) {
+            stats.skipped ++;
+            return true;
+        }
+
+        glfw::MeshFile mesh;
+        glfw::MeshFile::OptimizeStats optimized{};
+        std::error_code error;
+        bool streaming = std::filesystem::file_size(source, error) >= glfw::MeshFile::kStreamingImportSize && !error;
+        try {
+            if (streaming) {
+                // Written straight to the cache, mapped back only for the report.
+                if (!glfw::MeshFile::streamObj(source.c_str(), cooked, pool, &optimized) || !mesh.read(cooked)) {
+                    fprintf(stderr, "cooker: failed to write %s\n", cooked.c_str());
+                    return false;
+                }
+            } else {
+                mesh.importObj(source.c_str(), pool);
+            }
+        } catch (std::exception& e) {
+            fprintf(stderr, "cooker: failed to import %s: %s\n", source.c_str(), e.what());
+            return false;
+        }
+        if (!streaming) {
+            optimized = mesh.optimize();
+            mesh.generateLods(&pool);
+            mesh.buildMeshlets();
+            if (!mesh.write(cooked, source.c_str())) {
+                fprintf(stderr, "cooker: failed to write %s\n", cooked.c_str());
+                return false;
+            }
+        }
+        fprintf(stdout, "cooker: %s -> %s (%u vertices, %u indices, %u levels of detail, ACMR %.3f -> %.3f%s)\n", source.c_str(), cooked.c_str(),
+                mesh.getVertexCount(), mesh.getIndexCount(), mesh.getLodCount(), optimized.acmrBefore, optimized.acmrAfter, streaming ? ", streamed" : "");
+        stats.cooked ++;
+        return true;
+    }
+
+    bool cookTexture(const std::string& source, bool force, Stats& stats) {
+        std::string cooked = std::filesystem::path(source).replace_extension(".dds").string();
+        if (!force && glfw::TextureFile::isUpToDate(cooked, source.c_str())) {
+            stats.skipped ++;
+            return true;
+        }
+
+        int width, height, channels;
+        stbi_uc* pixels = stbi_load(source.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+        if (!pixels) {
+            fprintf(stderr, "cooker: failed to decode %s\n", source.c_str());
+            return false;
+        }
+
+        bool alpha = false;
+        for (size_t i = 0; i < size_t(width) * height && !alpha; i ++)
+            alpha = pixels[i * 4 + 3] != 255;
+
+        // Color textures are sampled as sRGB at runtime, same as the uncompressed path.
+        auto chain = cooker::buildMipChain(pixels, width, height, true);
+        stbi_image_free(pixels);
+
+        std::vector<std::vector<uint8_t>> levels;
+        uint32_t levelWidth = width, levelHeight = height;
+        for (auto& level : chain) {
+            levels.push_back(cooker::compressLevel(level.data(), levelWidth, levelHeight, alpha));
+            levelWidth = std::max(levelWidth / 2, 1u);
+            levelHeight = std::max(levelHeight / 2, 1u);
+        }
+
+        VkFormat format = alpha ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+        VkExtent3D extent = {static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1};
+        if (!glfw::TextureFile::writeDDS(cooked.c_str(), format, extent, levels)) {
+            fprintf(stderr, "cooker: failed to write %s\n", cooked.c_str());
+            return false;
+        }
+        fprintf(stdout, "cooker: %s -> %s (%s, %zu levels)\n", source.c_str(), cooked.c_str(),
+                alpha ? "BC3" : "BC1", levels.size());
+        stats.cooked ++;
+        return true;
+    }
+
+    void cookFile(const std::filesystem::path& path, bool force, Stats& stats, glfw::ThreadPool& pool) {
+        std::string ext = lowerExtension(path);
+        bool ok = true;
+        if (ext == ".obj")
+            ok = cookMesh(path.string(), force, stats, pool);
+        else if (isImage(ext))
+            ok = cookTexture(path.string(), force, stats);
+        if (!ok)
+            stats.failed ++;
+    }
+}
+
+int main(int argc, char** argv) {
+    bool force = false;
+    std::vector<std::filesystem::path> inputs;
+    for (int i = 1; i < argc; i ++) {
+        if (std::strcmp(argv[i], "--force") == 0)
+            force = true;
+        else
+            inputs.emplace_back(argv[i]);
+    }
+    if (inputs.empty()) {
+        fprintf(stderr, "Usage: %s [--force] <file|directory>...\n", argv[0]);
+        return -1;
+    }
+
+    Stats stats;
+    glfw::ThreadPool pool;
+    for (auto& input : inputs) {
+        std::error_code error;
+        if (std::filesystem::is_directory(input, error)) {
+            for (auto& entry : std::filesystem::recursive_directory_iterator(input, error))
+                if (entry.is_regular_file())
+                    cookFile(entry.path(), force, stats, pool);
+        } else if (std::filesystem::is_regular_file(input, error)) {
+            cookFile(input, force, stats, pool);
+        } else {
+            fprintf(stderr, "cooker: %s does not exist\n", input.string().c_str());
+            stats.failed ++;
+        }
+    }
+
+    fprintf(stdout, "cooker: %d cooked, %d up to date, %d failed\n", stats.cooked, stats.skipped, stats.failed);
+    return stats.failed ? 1 : 0;
+}
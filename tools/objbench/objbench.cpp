@@ -0,0 +1,88 @@
+#include <MeshFile.h>
+#include <ThreadPool.h>
+#include <chrono>
+#include <cmath>
+
+/**
+ * OBJ import benchmark.
+ *
+ *   objbench [--runs N] [--threads N] <file.obj>...
+ *
+ * Imports every file with the serial tinyobj path and the parallel path of MeshFile, prints the best
+ * time of each over N runs (default 3) and checks that both produced the same mesh.
+ */
+
+namespace {
+    template<typename F>
+    double bestOf(int runs, F&& job) {
+        double best = std::numeric_limits<double>::max();
+        for (int i = 0; i < runs; i ++) {
+            auto start = std::chrono::steady_clock::now();
+            job();
+            auto end = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+        return best;
+    }
+
+    // Empty when the meshes match. Positions may differ in the last bit between the float parsers.
+    std::string compare(const glfw::MeshFile& serial, const glfw::MeshFile& parallel) {
+        if (serial.vertices.size() != parallel.vertices.size())
+            return "vertex count differs";
+        if (serial.indices != parallel.indices)
+            return "indices differ";
+        if (serial.matIDs != parallel.matIDs)
+            return "material ids differ";
+        if (serial.submeshes.size() != parallel.submeshes.size())
+            return "submesh count differs";
+        float maxError = 0.0f;
+        for (size_t i = 0; i < serial.vertices.size(); i ++) {
+            for (int c = 0; c < 3; c ++) {
+                float a = serial.vertices[i].pos[c], b = parallel.vertices[i].pos[c];
+                maxError = std::max(maxError, std::abs(a - b) / std::max(std::abs(a), 1.0f));
+            }
+        }
+        if (maxError > 1e-6f)
+            return "positions differ by " + std::to_string(maxError);
+        return "";
+    }
+}
+
+int main(int argc, char** argv) {
+    int runs = 3;
+    uint32_t threads = 0;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i ++) {
+        if (std::strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+            runs = std::max(1, std::atoi(argv[++ i]));
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = static_cast<uint32_t>(std::atoi(argv[++ i]));
+        else
+            inputs.emplace_back(argv[i]);
+    }
+    if (inputs.empty()) {
+        fprintf(stderr, "Usage: %s [--runs N] [--threads N] <file.obj>...\n", argv[0]);
+        return -1;
+    }
+
+    glfw::ThreadPool pool(threads);
+    fprintf(stdout, "objbench: %u worker threads, best of %d runs\n", pool.getThreadCount(), runs);
+    int failed = 0;
+    for (auto& input : inputs) {
+        glfw::MeshFile serial, parallel;
+        try {
+            double serialTime = bestOf(runs, [&]() { serial.importObj(input.c_str()); });
+            double parallelTime = bestOf(runs, [&]() { parallel.importObj(input.c_str(), pool); });
+            std::string mismatch = compare(serial, parallel);
+            fprintf(stdout, "%s: %zu vertices, %zu faces, serial %.1f ms, parallel %.1f ms (%.2fx)%s%s\n",
+                    input.c_str(), parallel.vertices.size(), parallel.matIDs.size(), serialTime, parallelTime,
+                    serialTime / parallelTime, mismatch.empty() ? "" : ", MISMATCH: ", mismatch.c_str());
+            if (!mismatch.empty())
+                failed ++;
+        } catch (std::exception& e) {
+            fprintf(stderr, "objbench: %s: %s\n", input.c_str(), e.what());
+            failed ++;
+        }
+    }
+    return failed ? 1 : 0;
+}